@@ -122,7 +122,7 @@ TCHAR *DownloadUpdateIfNotDownloaded(const char *url)
 		goto Error;
 
 	DWORD size;
-	void *s = httpResult->data.getData(&size);
+	void *s = httpResult->data.stealData(&size);
 	if (!s)
 		goto Error;
 
@@ -159,7 +159,7 @@ char *GetUpdateUrl(const TCHAR *version, VersionUpdateCheckType type)
 	HttpResult *res = HttpGet(AUTO_UPDATE_HOST, url, false /* https */);
 	if (!res || !res->IsValid())
 		return NULL;
-	char *s = (char *)res->data.getData(NULL);
+	char *s = (char *)res->data.stealData(NULL);
 	json = ParseJsonToDoc(s);
 	JsonEl *upgradeAvailable = GetMapElByName(json, "upgrade");
 	JsonElBool *upgradeAvailableBool = JsonElAsBool(upgradeAvailable);
@@ -0,0 +1,325 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+/* Runs the requests the updater makes (what SendIpUpdate(), GetUpdateUrl()
+and the typo exceptions send) through HttpGet() and HttpPost() and the
+POSIX transport (src/HttpPosix.cpp) against a stub server on localhost,
+once with the server keeping connections alive and once with it closing
+them after every response. Prints how long the requests took and how often
+a connection was reused.
+
+The stub server doesn't do ssl, the transport sends the https requests to
+it in plain http. -connect-delay makes it wait before it answers on a new
+connection, like an ssl handshake with a far away server would. That shows
+in the request times, the transport's own connect times only cover tcp.
+
+Builds on Linux, from this directory:
+  g++ -O2 -I. -I../src -o HttpBench HttpBench.cpp Win32Posix.cpp ../src/HttpPosix.cpp ../src/HttpConnPool.cpp ../src/Http.cpp ../src/GrowableBuf.cpp ../src/StrUtil.cpp -lpthread
+  ./HttpBench [-n <requests>] [-threads <count>] [-connect-delay <ms>]
+*/
+
+#include "stdafx.h"
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "Http.h"
+#include "HttpTransport.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+// biggest request the stub server reads
+#define MAX_REQUEST (64*1024)
+
+static bool			g_closeEachResponse;
+static DWORD		g_connectDelayMs;
+
+static uint64_t NowUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool SendAll(int fd, const char *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+		if (n <= 0)
+			return false;
+		data += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+// what the servers answer, close enough
+static const char *StubResponseBody(const char *method, const char *url)
+{
+	if (StrStartsWithI(url, "/nic/update"))
+		return "good 127.0.0.1";
+	if (StrStartsWithI(url, "/updatecheck/"))
+		return "{\"upgrade\": false}";
+	if (streq(method, "POST") && StrStartsWithI(url, "/v1/"))
+		return "{\"status\": \"success\", \"response\": {}}";
+	return NULL;
+}
+
+// <req> is the request line and headers. Returns the Content-Length, 0 if
+// there isn't one
+static long RequestBodySize(const char *req)
+{
+	const char *s = req;
+	while (NULL != (s = strchr(s, '\n'))) {
+		s++;
+		if (0 == strncasecmp(s, "Content-Length:", 15))
+			return atol(s + 15);
+	}
+	return 0;
+}
+
+static bool Respond(int fd, const char *req)
+{
+	char method[16];
+	char url[1024];
+	char headers[256];
+	if (2 != sscanf(req, "%15s %1023s", method, url))
+		return false;
+	const char *body = StubResponseBody(method, url);
+	const char *status = body ? "200 OK" : "404 Not Found";
+	if (!body)
+		body = "";
+	size_t bodyLen = strlen(body);
+	sprintf(headers, "HTTP/1.1 %s\r\nContent-Type: text/plain\r\nContent-Length: %u\r\n%s\r\n",
+		status, (unsigned)bodyLen, g_closeEachResponse ? "Connection: close\r\n" : "");
+	return SendAll(fd, headers, strlen(headers)) && SendAll(fd, body, bodyLen);
+}
+
+// answers requests on one connection until the client closes it
+static void *ServeConn(void *arg)
+{
+	int fd = (int)(intptr_t)arg;
+	char *buf = (char*)malloc(MAX_REQUEST + 1);
+	size_t len = 0;
+	if (g_connectDelayMs)
+		usleep(g_connectDelayMs * 1000);
+	while (buf) {
+		buf[len] = 0;
+		char *headersEnd = strstr(buf, "\r\n\r\n");
+		if (headersEnd) {
+			size_t reqLen = headersEnd + 4 - buf + RequestBodySize(buf);
+			if (len >= reqLen) {
+				if (!Respond(fd, buf) || g_closeEachResponse)
+					break;
+				memmove(buf, buf + reqLen, len - reqLen);
+				len -= reqLen;
+				continue;
+			}
+		}
+		if (len == MAX_REQUEST)
+			break;
+		ssize_t n = recv(fd, buf + len, MAX_REQUEST - len, 0);
+		if (n <= 0)
+			break;
+		len += (size_t)n;
+	}
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static void *AcceptConns(void *arg)
+{
+	int listenFd = (int)(intptr_t)arg;
+	for (;;) {
+		int fd = accept(listenFd, NULL, NULL);
+		if (-1 == fd) {
+			if (EINTR == errno)
+				continue;
+			break;
+		}
+		int noDelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+		pthread_t thread;
+		if (0 != pthread_create(&thread, NULL, ServeConn, (void*)(intptr_t)fd))
+			close(fd);
+		else
+			pthread_detach(thread);
+	}
+	return NULL;
+}
+
+// returns the port the server listens on, 0 if it couldn't be started
+static INTERNET_PORT StartStubServer()
+{
+	struct sockaddr_in addr;
+	socklen_t addrLen = sizeof(addr);
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (-1 == fd)
+		return 0;
+	memzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	if ((0 != bind(fd, (struct sockaddr*)&addr, sizeof(addr))) || (0 != listen(fd, 64)))
+		goto Error;
+	if (0 != getsockname(fd, (struct sockaddr*)&addr, &addrLen))
+		goto Error;
+	pthread_t thread;
+	if (0 != pthread_create(&thread, NULL, AcceptConns, (void*)(intptr_t)fd))
+		goto Error;
+	pthread_detach(thread);
+	return ntohs(addr.sin_port);
+Error:
+	close(fd);
+	return 0;
+}
+
+// the requests, shaped like the real ones
+static HttpResult *IpUpdate()
+{
+	return HttpGet("updates.opendns.com",
+		"/nic/update?token=6b1d3c9e2f0a4b8d9c7e5f3a1b2c4d6e&api_key=0123456789ABCDEF&v=2&hostname=home",
+		INTERNET_DEFAULT_HTTPS_PORT);
+}
+
+static HttpResult *UpgradeCheck()
+{
+	return HttpGet("opendnsupdate.appspot.com",
+		"/updatecheck/dynamicipwin?v=2.2.1&t=c&i=3ffe9397f38746bcb5d0d798c2a596b9&u=user",
+		INTERNET_DEFAULT_HTTP_PORT);
+}
+
+static HttpResult *TypoExceptionsAdd()
+{
+	return HttpPost("api.opendns.com", "/v1/",
+		"api_key=0123456789ABCDEF&method=typoexceptions_add&token=6b1d3c9e2f0a4b8d9c7e5f3a1b2c4d6e&network_id=123456&domains=exampel.com%2Cgoogel.com",
+		INTERNET_DEFAULT_HTTPS_PORT);
+}
+
+typedef struct {
+	const char *	name;
+	HttpResult *	(*send)();
+	int				count;
+	volatile int	errors;
+	uint64_t		totalUs;
+	// the slowest request of every thread
+	uint64_t		maxUs;
+	pthread_mutex_t	mutex;
+} Scenario;
+
+static void *RunScenarioThread(void *arg)
+{
+	Scenario *s = (Scenario*)arg;
+	uint64_t totalUs = 0, maxUs = 0;
+	int errors = 0;
+	for (int i=0; i < s->count; i++) {
+		uint64_t startUs = NowUs();
+		HttpResult *res = s->send();
+		uint64_t us = NowUs() - startUs;
+		totalUs += us;
+		if (us > maxUs)
+			maxUs = us;
+		if (!res || !res->IsValid())
+			errors++;
+		delete res;
+	}
+	pthread_mutex_lock(&s->mutex);
+	s->totalUs += totalUs;
+	if (maxUs > s->maxUs)
+		s->maxUs = maxUs;
+	s->errors += errors;
+	pthread_mutex_unlock(&s->mutex);
+	return NULL;
+}
+
+static void RunScenario(Scenario *s, int threadCount)
+{
+	pthread_t threads[64];
+	s->totalUs = s->maxUs = 0;
+	s->errors = 0;
+	pthread_mutex_init(&s->mutex, NULL);
+	uint64_t startUs = NowUs();
+	for (int i=0; i < threadCount; i++)
+		pthread_create(&threads[i], NULL, RunScenarioThread, s);
+	for (int i=0; i < threadCount; i++)
+		pthread_join(threads[i], NULL);
+	uint64_t wallUs = NowUs() - startUs;
+	pthread_mutex_destroy(&s->mutex);
+
+	int total = s->count * threadCount;
+	printf("  %-20s %6d requests  %8.1f us avg  %8.1f us max  %8.0f req/s  %d errors\n",
+		s->name, total, (double)s->totalUs / total, (double)s->maxUs,
+		total * 1000000.0 / (wallUs ? wallUs : 1), (int)s->errors);
+}
+
+static void RunAll(INTERNET_PORT port, int count, int threadCount)
+{
+	Scenario scenarios[] = {
+		{ "ip update", IpUpdate },
+		{ "upgrade check", UpgradeCheck },
+		{ "typo exceptions", TypoExceptionsAdd },
+	};
+	HttpTransport *transport = NewPosixHttpTransport("127.0.0.1", port);
+	HttpSetTransport(transport);
+	for (size_t i=0; i < dimof(scenarios); i++) {
+		scenarios[i].count = count / threadCount;
+		RunScenario(&scenarios[i], threadCount);
+	}
+
+	HttpConnPoolStats stats;
+	HttpGetPoolStats(&stats);
+	printf("  connections: %d opened, %d reused (%d%%), %d ms spent connecting, ~%d ms saved\n",
+		(int)stats.connsOpened, (int)stats.connsReused,
+		(int)(HttpConnPoolReuseRate(&stats) * 100), (int)stats.connectMs,
+		(int)HttpConnPoolMsSaved(&stats));
+	HttpSetTransport(NULL);
+	delete transport;
+}
+
+static void Usage()
+{
+	printf("usage: HttpBench [-n <requests>] [-threads <count>] [-connect-delay <ms>]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int count = 2000;
+	int threadCount = 1;
+	for (int i=1; i < argc; i++) {
+		if ((i + 1 < argc) && streq(argv[i], "-n"))
+			count = atoi(argv[++i]);
+		else if ((i + 1 < argc) && streq(argv[i], "-threads"))
+			threadCount = atoi(argv[++i]);
+		else if ((i + 1 < argc) && streq(argv[i], "-connect-delay"))
+			g_connectDelayMs = (DWORD)atoi(argv[++i]);
+		else
+			Usage();
+	}
+	if ((count < 1) || (threadCount < 1) || (threadCount > 64) || (count < threadCount))
+		Usage();
+
+	INTERNET_PORT port = StartStubServer();
+	if (0 == port) {
+		printf("couldn't start the stub server\n");
+		return 1;
+	}
+	printf("stub server on 127.0.0.1:%d, %d threads, %d ms connect delay\n",
+		(int)port, threadCount, (int)g_connectDelayMs);
+
+	g_closeEachResponse = false;
+	printf("server keeps connections alive:\n");
+	RunAll(port, count, threadCount);
+
+	g_closeEachResponse = true;
+	printf("server closes connections after every response:\n");
+	RunAll(port, count, threadCount);
+	return 0;
+}
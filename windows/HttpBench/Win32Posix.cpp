@@ -0,0 +1,203 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// What stdafx.h declares, implemented with POSIX
+
+#include "stdafx.h"
+
+#include <errno.h>
+#include <time.h>
+
+DWORD GetTickCount()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (DWORD)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+// <sLen> is -1 for 0-terminated <s>, which then includes the 0 in the count.
+// Returns the number of chars needed if <outSize> is 0, 0 if they don't fit
+int WideCharToMultiByte(UINT codePage, DWORD flags, const WCHAR *s, int sLen, char *out, int outSize, const char *defaultChar, BOOL *usedDefault)
+{
+	assert(CP_UTF8 == codePage);
+	if (-1 == sLen)
+		sLen = (int)wcslen(s) + 1;
+	int len = 0;
+	for (int i=0; i < sLen; i++) {
+		uint32_t c = (uint32_t)s[i];
+		char buf[4];
+		int n;
+		if (c < 0x80) {
+			buf[0] = (char)c;
+			n = 1;
+		} else if (c < 0x800) {
+			buf[0] = (char)(0xC0 | (c >> 6));
+			buf[1] = (char)(0x80 | (c & 0x3F));
+			n = 2;
+		} else if (c < 0x10000) {
+			buf[0] = (char)(0xE0 | (c >> 12));
+			buf[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+			buf[2] = (char)(0x80 | (c & 0x3F));
+			n = 3;
+		} else {
+			buf[0] = (char)(0xF0 | ((c >> 18) & 0x07));
+			buf[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+			buf[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+			buf[3] = (char)(0x80 | (c & 0x3F));
+			n = 4;
+		}
+		if (outSize > 0) {
+			if (len + n > outSize)
+				return 0;
+			memcpy(out + len, buf, n);
+		}
+		len += n;
+	}
+	return len;
+}
+
+// invalid utf8 becomes U+FFFD
+int MultiByteToWideChar(UINT codePage, DWORD flags, const char *s, int sLen, WCHAR *out, int outSize)
+{
+	assert(CP_UTF8 == codePage);
+	if (-1 == sLen)
+		sLen = (int)strlen(s) + 1;
+	const unsigned char *p = (const unsigned char*)s;
+	const unsigned char *end = p + sLen;
+	int len = 0;
+	while (p < end) {
+		uint32_t c = *p++;
+		int more = 0;
+		if (c >= 0xF0) {
+			c &= 0x07;
+			more = 3;
+		} else if (c >= 0xE0) {
+			c &= 0x0F;
+			more = 2;
+		} else if (c >= 0xC0) {
+			c &= 0x1F;
+			more = 1;
+		} else if (c >= 0x80) {
+			c = 0xFFFD;
+		}
+		for (; more > 0; more--) {
+			if ((p == end) || (0x80 != (*p & 0xC0))) {
+				c = 0xFFFD;
+				break;
+			}
+			c = (c << 6) | (*p++ & 0x3F);
+		}
+		if (outSize > 0) {
+			if (len >= outSize)
+				return 0;
+			out[len] = (WCHAR)c;
+		}
+		len++;
+	}
+	return len;
+}
+
+void InitializeCriticalSection(CRITICAL_SECTION *cs)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(cs, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+void DeleteCriticalSection(CRITICAL_SECTION *cs)
+{
+	pthread_mutex_destroy(cs);
+}
+
+void EnterCriticalSection(CRITICAL_SECTION *cs)
+{
+	pthread_mutex_lock(cs);
+}
+
+void LeaveCriticalSection(CRITICAL_SECTION *cs)
+{
+	pthread_mutex_unlock(cs);
+}
+
+typedef struct {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	LONG			count;
+	LONG			maxCount;
+} Semaphore;
+
+HANDLE CreateSemaphore(void *attrs, LONG initialCount, LONG maxCount, const TCHAR *name)
+{
+	assert(!attrs && !name);
+	Semaphore *sem = (Semaphore*)calloc(1, sizeof(Semaphore));
+	if (!sem)
+		return NULL;
+	pthread_condattr_t condAttr;
+	pthread_condattr_init(&condAttr);
+	pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sem->cond, &condAttr);
+	pthread_condattr_destroy(&condAttr);
+	pthread_mutex_init(&sem->mutex, NULL);
+	sem->count = initialCount;
+	sem->maxCount = maxCount;
+	return sem;
+}
+
+BOOL ReleaseSemaphore(HANDLE h, LONG count, LONG *prevCount)
+{
+	Semaphore *sem = (Semaphore*)h;
+	BOOL ok = FALSE;
+	pthread_mutex_lock(&sem->mutex);
+	if (prevCount)
+		*prevCount = sem->count;
+	if (count <= sem->maxCount - sem->count) {
+		sem->count += count;
+		pthread_cond_broadcast(&sem->cond);
+		ok = TRUE;
+	}
+	pthread_mutex_unlock(&sem->mutex);
+	return ok;
+}
+
+DWORD WaitForSingleObject(HANDLE h, DWORD timeoutMs)
+{
+	Semaphore *sem = (Semaphore*)h;
+	struct timespec until;
+	clock_gettime(CLOCK_MONOTONIC, &until);
+	until.tv_sec += timeoutMs / 1000;
+	until.tv_nsec += (long)(timeoutMs % 1000) * 1000000;
+	if (until.tv_nsec >= 1000000000) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000;
+	}
+
+	DWORD res = WAIT_OBJECT_0;
+	pthread_mutex_lock(&sem->mutex);
+	while (0 == sem->count) {
+		int err;
+		if (INFINITE == timeoutMs)
+			err = pthread_cond_wait(&sem->cond, &sem->mutex);
+		else
+			err = pthread_cond_timedwait(&sem->cond, &sem->mutex, &until);
+		if (ETIMEDOUT == err) {
+			res = WAIT_TIMEOUT;
+			break;
+		}
+	}
+	if (WAIT_OBJECT_0 == res)
+		sem->count--;
+	pthread_mutex_unlock(&sem->mutex);
+	return res;
+}
+
+BOOL CloseHandle(HANDLE h)
+{
+	Semaphore *sem = (Semaphore*)h;
+	pthread_cond_destroy(&sem->cond);
+	pthread_mutex_destroy(&sem->mutex);
+	free(sem);
+	return TRUE;
+}
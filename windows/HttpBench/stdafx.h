@@ -0,0 +1,86 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// The little of the Win32 api that the http code in src/ needs, on top of
+// POSIX, so that HttpBench can build it there. Only what the files listed
+// in HttpBench.cpp use.
+
+#pragma once
+
+#include <assert.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <wchar.h>
+#include <pthread.h>
+
+// sized like on Windows, the tick math relies on DWORD being 32 bits
+typedef uint32_t		DWORD;
+typedef int32_t			LONG;
+typedef unsigned int	UINT;
+typedef int				BOOL;
+typedef uint8_t			BYTE;
+typedef uint16_t		WORD;
+typedef uint64_t		ULONGLONG;
+typedef char			TCHAR;
+typedef wchar_t			WCHAR;
+typedef void *			HANDLE;
+typedef void *			HWND;
+typedef void *			HKEY;
+typedef void *			HBRUSH;
+typedef void *			PSID;
+typedef void *			LPVOID;
+typedef uint16_t		INTERNET_PORT;
+
+#define TRUE	1
+#define FALSE	0
+#define _T(x)	x
+#define TEXT(x)	x
+#define WINAPI
+#define MAX_PATH 260
+
+typedef struct {
+	LONG	left, top, right, bottom;
+} RECT;
+
+// only declared by the headers we include, never used
+class CString;
+class CDCHandle;
+class CWindow;
+
+#define INTERNET_DEFAULT_HTTP_PORT	80
+#define INTERNET_DEFAULT_HTTPS_PORT	443
+
+#define stricmp		strcasecmp
+#define _strnicmp	strncasecmp
+#define _wcsnicmp	wcsncasecmp
+#define _strdup		strdup
+#define StrCmp		strcmp
+#define StrCmpI		strcasecmp
+
+// only CP_UTF8 is supported
+#define CP_UTF8 65001
+int		WideCharToMultiByte(UINT codePage, DWORD flags, const WCHAR *s, int sLen, char *out, int outSize, const char *defaultChar, BOOL *usedDefault);
+int		MultiByteToWideChar(UINT codePage, DWORD flags, const char *s, int sLen, WCHAR *out, int outSize);
+
+DWORD	GetTickCount();
+
+typedef pthread_mutex_t CRITICAL_SECTION;
+void	InitializeCriticalSection(CRITICAL_SECTION *cs);
+void	DeleteCriticalSection(CRITICAL_SECTION *cs);
+void	EnterCriticalSection(CRITICAL_SECTION *cs);
+void	LeaveCriticalSection(CRITICAL_SECTION *cs);
+
+// semaphores are the only waitable objects
+#define INFINITE		0xFFFFFFFF
+#define WAIT_OBJECT_0	0
+#define WAIT_TIMEOUT	258
+HANDLE	CreateSemaphore(void *attrs, LONG initialCount, LONG maxCount, const TCHAR *name);
+BOOL	ReleaseSemaphore(HANDLE sem, LONG count, LONG *prevCount);
+DWORD	WaitForSingleObject(HANDLE sem, DWORD timeoutMs);
+BOOL	CloseHandle(HANDLE sem);
@@ -7,19 +7,26 @@
 
 #include "Errors.h"
 #include "CrashHandler.h"
-#include "DnsCheckThread.h"
+#include "DnsQuery.h"
+#include "EventLog.h"
+#include "HttpAsync.h"
+#include "HttpTransport.h"
 #include "JsonParser.h"
 #include "JsonApiResponses.h"
 #include "MiscUtil.h"
+#include "NetworkChange.h"
+#include "NetworkOwner.h"
 #include "Prefs.h"
 #include "SampleApiResponses.h"
 #include "SendIPUpdate.h"
+#include "ServiceLoop.h"
 #include "ServiceManager.h"
 #include "SimpleLog.h"
 #include "StrUtil.h"
 #include "UnitTests.h"
 
 extern int run_unit_tests();
+extern int run_benchmarks();
 
 /*
 Service controller. Command line arguments:
@@ -27,14 +34,16 @@ Service controller. Command line arguments:
   remove - removes the service
   debug - run in debug mode
   ut or unittests - run unittests
+  bench - run benchmarks
+  events - query the event log, see query_events()
 
 If run without arguments, starts the service.
 */
 
 static HANDLE g_serviceStopEvent;
 static SERVICE_STATUS_HANDLE g_serviceHandle;
-static ULONGLONG g_lastIpUpdateTimeInMs;
-static ULONGLONG g_lastSoftwareUpgradeTimeInMs;
+static NetworkOwner *g_networkOwner;
+static NetworkChangeNotifier *g_networkChange;
 
 static SERVICE_DESCRIPTION description = { 
 	_T("OpenDNS Dynamic IP Client. See http://www.opendns.com/support/service for details.")
@@ -46,8 +55,7 @@ bool g_paused = false;
 
 static bool g_debugMode = false;
 
-static const ULONGLONG THREE_HRS_IN_MS =  3*60*60*1000;
-static const ULONGLONG ONE_DAY_IN_MS   = 24*60*60*1000;
+#define ONE_SECOND_IN_MS 1000
 
 static void LaunchGuiWithParam(TCHAR *param)
 {
@@ -94,162 +102,31 @@ static void LaunchGuiWithParam(TCHAR *param)
 	CloseHandle(userToken);
 }
 
-static bool ShouldSendPeriodicUpdate()
-{
-	ULONGLONG currTimeInMs = GetTickCount();
-
-	// the time wraps-around every 49.7 days.
-	if (currTimeInMs < g_lastIpUpdateTimeInMs) {
-		// going backwards in time - it must be wrap around
-		g_lastIpUpdateTimeInMs = GetTickCount();
-		slog("Detected GetTickCount() wrap-around\n");
-	}
-
-	ULONGLONG nextUpdateTimeInMs = g_lastIpUpdateTimeInMs + THREE_HRS_IN_MS;
-	if (currTimeInMs > nextUpdateTimeInMs)
-		return true;
-	return false;
-}
-
-static IpUpdateResult g_prevIpUpdateResult = IpUpdateOk;
-
-static void HandleIPUpdateResponse(char *resp)
-{
-	if (!resp)
-		return;
-
-	if (IpUpdateOk != g_prevIpUpdateResult) {
-		// If previously wasn't ok, then siently ignore.
-		// We don't want to flood the user with too many
-		// messages
-		return;
-	}
-
-	g_prevIpUpdateResult = IpUpdateResultFromString(resp);
-	if (IpUpdateNotYours == g_prevIpUpdateResult) {
-		LaunchGuiWithParam(CMD_ARG_NOT_YOURS);
-		return;
-	}
-
-	if (IpUpdateBadAuth == g_prevIpUpdateResult) {
-		LaunchGuiWithParam(CMD_ARG_BAD_AUTH);
-		return;
-	}
-}
-
-static void LogIpUpdate(char *resp)
-{
-	slog("sent ip update for user '");
-	assert(g_pref_user_name);
-	if (g_pref_user_name)
-		slog(g_pref_user_name);
-	slog("', response: '");
-	if (resp)
-		slog(resp);
-	slog("' ");
-	slog(" url: ");
-	const char *urlTxt = GetIpUpdateUrl();
-	if (urlTxt)
-		slog(urlTxt);
-	free((void*)urlTxt);
-	slog(" host: ");
-	slog(GetIpUpdateHost());
-	slog("\n");
-}
-
-static void SendIPUpdateFromService()
-{
-	g_lastIpUpdateTimeInMs = GetTickCount();
-	if (g_paused)
-		return;
-
-	char *resp = SendIpUpdate();
-	LogIpUpdate(resp);
-	HandleIPUpdateResponse(resp);
-	free(resp);
-}
-
-static void SendPeriodicIPUpdate()
-{
-	if (ShouldSendPeriodicUpdate())
-		SendIPUpdateFromService();
-}
-
-static bool ShouldCheckForSoftwareUpgrade()
-{
-	ULONGLONG currTimeInMs = GetTickCount();
-
-	// the time wraps-around every 49.7 days.
-	if (currTimeInMs < g_lastSoftwareUpgradeTimeInMs) {
-		// going backwards in time - it must be wrap around
-		g_lastSoftwareUpgradeTimeInMs = GetTickCount();
-		slog("Detected GetTickCount() wrap-around\n");
-	}
-
-	ULONGLONG nextUpdateTimeInMs = g_lastSoftwareUpgradeTimeInMs + ONE_DAY_IN_MS;
-	if (currTimeInMs > nextUpdateTimeInMs)
-		return true;
-	return false;
-}
-
-static void CheckForSoftwareUpgrade(bool simulateUpgrade=false)
-{
-	g_lastSoftwareUpgradeTimeInMs = GetTickCount();
-	slog("CheckForSoftwareUpgrade()\n");
-
-	TCHAR *url2 = NULL;
-	const TCHAR *version = PROGRAM_VERSION;
-	if (simulateUpgrade)
-		version = PROGRAM_VERSION_SIMULATE_UPGRADE;
-	char *url = GetUpdateUrl(version, UpdateCheckVersionCheck);
-	if (!url)
-		return;
-	free(url);
-
-	// found an update - launch the UI asking it to check for an upgrade
-	// because a service can't show any UI
-
-	// TODO: make it less obnoxious if a user didn't choose to
-	// upgrade
-	slog("launching ui with /upgradecheck\n");
-	LaunchGuiWithParam(CMD_ARG_UPGRADE_CHECK);
-}
-
-static void PeriodicCheckForSoftwareUpgrade()
-{
-	if (ShouldCheckForSoftwareUpgrade())
-		CheckForSoftwareUpgrade();
-}
-
-class ServiceDnsEventsObserver : public DnsEventsObserver
+// ServiceLoop's view of the world
+class RealServiceEnv : public ServiceEnv
 {
-	IP4_ADDRESS m_prevIP;
 public:
-	ServiceDnsEventsObserver()
-	{
-		m_prevIP = IP_UNKNOWN;
+	MonotonicClock	m_clock;
+
+	RealServiceEnv() { MonotonicClockInit(&m_clock); }
+	virtual ULONGLONG NowMs() { return MonotonicClockMs(&m_clock); }
+	virtual IP4_ADDRESS GetMyIp() { return ::GetMyIp(); }
+	virtual bool Tick() { return g_networkOwner->Tick(); }
+	virtual bool IsOwner() { return g_networkOwner->IsOwner(); }
+	virtual bool BecameOwner() { return g_networkOwner->BecameOwner(); }
+	virtual bool HasSharedState() { return g_networkOwner->HasSharedState(); }
+	virtual bool TakeIpUpdateRequest() { return g_networkOwner->TakeIpUpdateRequest(); }
+	virtual void PublishIp(IP4_ADDRESS ip) { g_networkOwner->PublishIp(ip); }
+	virtual void PublishIpUpdateResult(const char *resp, DWORD latencyMs) {
+		g_networkOwner->PublishIpUpdateResult(resp, latencyMs);
 	}
-
-	virtual void MyIpChanged(IP4_ADDRESS myNewIP)
-	{
-		if (myNewIP == m_prevIP)
-			return;
-
-		bool wasPrevOk = RealIpAddress(m_prevIP);
-		m_prevIP = myNewIP;
-		if (RealIpAddress(myNewIP))
-			SendIPUpdateFromService();
-
-		// notify the user via launching UI if we're not using
-		// OpenDNS servers
-		if (myNewIP != IP_NOT_USING_OPENDNS)
-			return;
-
-		// if it was bad before, don't bother
-		if (!wasPrevOk)
-			return;
-		LaunchGuiWithParam(CMD_ARG_NOT_USING_UPENDNS);
+	virtual void PublishEvent(ServiceEventType type, const char *text) {
+		g_networkOwner->PublishEvent(type, 0, 0, text);
 	}
+	virtual void PublishNewVersion(const char *url) { g_networkOwner->PublishNewVersion(url); }
+	virtual bool GuiIsListening() { return g_networkOwner->HasEventConsumer(); }
+	virtual void LaunchGui(const TCHAR *param) { LaunchGuiWithParam((TCHAR*)param); }
+	virtual bool IsPaused() { return g_paused; }
 };
 
 #if 0
@@ -279,9 +156,153 @@ static CString LogFileName(const TCHAR *dir)
 	return fileName;
 }
 
+static CString EventLogFileName(const TCHAR *dir)
+{
+	CString fileName = dir;
+	fileName += "\\service-events.bin";
+	return fileName;
+}
+
 static void usage()
 {
 	fprintf(stdout, "usage: OpenDNSDynamicIpService.exe [install|remove]\n");
+	fprintf(stdout, "       OpenDNSDynamicIpService.exe events [-type ipupdate|ipchange] [-result <result>]\n");
+	fprintf(stdout, "           [-failed] [-ip <ip>] [-network <network>] [-hours <n>] [-count] [<file>...]\n");
+}
+
+static void FormatIp4(IP4_ADDRESS ip, char *buf)
+{
+	sprintf(buf, "%d.%d.%d.%d", (int)(ip >> 24), (int)((ip >> 16) & 0xff), (int)((ip >> 8) & 0xff), (int)(ip & 0xff));
+}
+
+static void FormatEventTime(ULONGLONG time, char *buf)
+{
+	FILETIME ft;
+	SYSTEMTIME st;
+	ft.dwLowDateTime = (DWORD)time;
+	ft.dwHighDateTime = (DWORD)(time >> 32);
+	FileTimeToSystemTime(&ft, &st);
+	sprintf(buf, "%04d-%02d-%02d %02d:%02d:%02d", st.wYear, st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
+}
+
+static void PrintEvent(void *ctx, const EventRecord *r)
+{
+	char timeBuf[32];
+	char ipBuf[16];
+	FormatEventTime(r->time, timeBuf);
+	FormatIp4(r->ip, ipBuf);
+	const char *resultName = (EventIpUpdate == r->type) ? EventResultName(r->result) : "";
+	fprintf(stdout, "%s %-8s %-15s %-12s %5ums %.*s %.*s\n", timeBuf,
+		EventTypeName(r->type), ipBuf, resultName, (unsigned)r->latencyMs,
+		(int)r->providerLen, EventRecordProvider(r), (int)r->networkLen, EventRecordNetwork(r));
+}
+
+static void PrintEventStats(const EventStats *stats)
+{
+	fprintf(stdout, "%d events\n", stats->count);
+	if (0 == stats->count)
+		return;
+	char firstBuf[32], lastBuf[32];
+	FormatEventTime(stats->firstTime, firstBuf);
+	FormatEventTime(stats->lastTime, lastBuf);
+	fprintf(stdout, "from %s to %s (UTC)\n", firstBuf, lastBuf);
+	int updates = 0;
+	for (int i = 0; i < EVENT_STATS_RESULTS; i++) {
+		if (0 == stats->countByResult[i])
+			continue;
+		updates += stats->countByResult[i];
+		const char *name = (EVENT_STATS_RESULTS - 1 == i) ? "noresponse/other" : EventResultName(i);
+		fprintf(stdout, "  %-16s %d\n", name, stats->countByResult[i]);
+	}
+	if (updates > 0)
+		fprintf(stdout, "ip update latency: avg %ums, max %ums\n",
+			(unsigned)(stats->latencyTotalMs / updates), (unsigned)stats->latencyMaxMs);
+}
+
+// <filter> might point to <arg> afterwards
+static bool ParseEventOption(const TCHAR *opt, const char *arg, EventFilter *filter)
+{
+	if (tstreq(opt, _T("-type")))
+		return EventTypeFromName(arg, &filter->type);
+	if (tstreq(opt, _T("-result")))
+		return EventResultFromName(arg, &filter->result);
+	if (tstreq(opt, _T("-ip"))) {
+		filter->ip = ParseIp4(arg);
+		return 0 != filter->ip;
+	}
+	if (tstreq(opt, _T("-hours"))) {
+		// FILETIME is in 100 nanosecond units
+		filter->since = EventTimeNow() - (ULONGLONG)atoi(arg) * 60 * 60 * 10000000;
+		return true;
+	}
+	if (tstreq(opt, _T("-network"))) {
+		filter->network = arg;
+		return true;
+	}
+	return false;
+}
+
+// "events [options] [<file>...]": prints events from the event log that
+// match all options and a summary. Reads service-events.bin in <commonDir>
+// if no file is given, archives (service-events.1.bin etc.) can be given
+// explicitly
+static int query_events(int argc, TCHAR **argv, const TCHAR *commonDir)
+{
+	EventFilter filter;
+	EventFilterInit(&filter);
+	EventStats stats;
+	memzero(&stats, sizeof(stats));
+	bool countOnly = false;
+	char *network = NULL;
+	EventVisitFunc visit;
+	int err = ErrNoError;
+
+	int i;
+	for (i = 0; i < argc; i++) {
+		const TCHAR *opt = argv[i];
+		if (tstreq(opt, _T("-count"))) {
+			countOnly = true;
+			continue;
+		}
+		if (tstreq(opt, _T("-failed"))) {
+			filter.failedOnly = true;
+			continue;
+		}
+		if ((_T('-') != opt[0]) || (i + 1 == argc))
+			break;
+		char *arg = TStrToStr(argv[++i]);
+		bool ok = arg && ParseEventOption(opt, arg, &filter);
+		if (filter.network == arg) {
+			free(network);
+			network = arg;
+		} else
+			free(arg);
+		if (!ok) {
+			usage();
+			err = 1;
+			goto Exit;
+		}
+	}
+
+	visit = countOnly ? NULL : PrintEvent;
+	if (i == argc) {
+		CString path = EventLogFileName(commonDir);
+		if (!EventLogQueryFile(path, &filter, &stats, visit, NULL)) {
+			fprintf(stderr, "couldn't read the event log\n");
+			err = 1;
+		}
+	}
+	for (; i < argc; i++) {
+		if (!EventLogQueryFile(argv[i], &filter, &stats, visit, NULL)) {
+			_ftprintf(stderr, _T("couldn't read %s\n"), argv[i]);
+			err = 1;
+		}
+	}
+	PrintEventStats(&stats);
+
+Exit:
+	free(network);
+	return err;
 }
 
 static void log(char *s)
@@ -354,9 +375,6 @@ Exit:
 	return err;
 }
 
-#define ONE_SECOND_IN_MS 1000
-#define ONE_MINUTE_IN_MS 60*1000
-
 static void StopIfQPressed()
 {
 	int keyPressed = _kbhit();
@@ -391,35 +409,85 @@ static void LogWhyCantSendIPUpdates()
 }
 
 #ifdef LOG_ALIVE
-#define ALIVE_PERIOD 10
+#define ALIVE_PERIOD_MS (10*60*1000)
+
+static void OnAliveTimer(void *ctx)
+{
+	slog("still alive\n");
+}
+
+static Timer g_aliveTimer;
 #endif
 
-static void RunUntilAskedToQuit(HANDLE stopHandle)
+static void LogHttpPoolStats()
 {
-	ServiceDnsEventsObserver dnsObserver;
-	DnsCheckThread *dnsCheckThread = new DnsCheckThread(&dnsObserver);
+	HttpConnPoolStats stats;
+	if (!HttpGetPoolStats(&stats))
+		return;
+	slogfmt("http connections: %d opened, %d reused (%d%%), ~%d ms of connecting saved\n",
+		(int)stats.connsOpened, (int)stats.connsReused,
+		(int)(HttpConnPoolReuseRate(&stats) * 100), (int)HttpConnPoolMsSaved(&stats));
+}
+
+static void WaitAndRunTimers(ServiceLoop *loop, HANDLE stopHandle)
+{
+	HANDLE handles[4];
+	DWORD handlesCount;
 	bool stop = false;
 	DWORD res;
-#ifdef LOG_ALIVE
-	int aliveCount = ALIVE_PERIOD;
-#endif
 	while (!stop && !g_forceStop) {
-		res = WaitForSingleObject(stopHandle, ONE_MINUTE_IN_MS);
-		if (WAIT_TIMEOUT != res)
+		// taken even when we're not the owner so that the event doesn't
+		// stay signalled
+		if (g_networkChange->TakeChange()) {
+			slog("network changed\n");
+			loop->NetworkChanged();
+		}
+		loop->RunTimers();
+		// the shared state can show up later, if we couldn't create it
+		handlesCount = 0;
+		handles[handlesCount++] = stopHandle;
+		if (g_networkOwner->OwnerChangedEvent())
+			handles[handlesCount++] = g_networkOwner->OwnerChangedEvent();
+		if (g_networkOwner->RequestEvent())
+			handles[handlesCount++] = g_networkOwner->RequestEvent();
+		if (g_networkChange->ChangedEvent())
+			handles[handlesCount++] = g_networkChange->ChangedEvent();
+		DWORD waitMs = loop->MsToNextTimer();
+		// so that StopIfQPressed() is responsive
+		if (g_debugMode && (waitMs > ONE_SECOND_IN_MS))
+			waitMs = ONE_SECOND_IN_MS;
+		res = WaitForMultipleObjects(handlesCount, handles, FALSE, waitMs);
+		if (WAIT_OBJECT_0 == res)
 			stop = true;
+		else if (WAIT_TIMEOUT != res)
+			loop->WokenUp();
 		if (g_debugMode)
 			StopIfQPressed();
-		SendPeriodicIPUpdate();
-		PeriodicCheckForSoftwareUpgrade();
+	}
+}
+
+static void RunUntilAskedToQuit(HANDLE stopHandle)
+{
+	g_networkOwner = new NetworkOwner(NetworkOwnerService);
+	g_networkChange = NewNetworkChangeNotifier();
+	RealServiceEnv env;
+	ServiceLoop loop(&env);
+	if (loop.Start(g_networkChange->IsWorking())) {
 #ifdef LOG_ALIVE
-		--aliveCount;
-		if (0 == aliveCount) {
-			aliveCount = ALIVE_PERIOD;
-			slog("still alive\n");
-		}
+		TimerInit(&g_aliveTimer, OnAliveTimer, NULL);
+		TimerWheelSchedule(loop.Timers(), &g_aliveTimer, env.NowMs() + ALIVE_PERIOD_MS, ALIVE_PERIOD_MS);
 #endif
+		WaitAndRunTimers(&loop, stopHandle);
+	} else {
+		slogl(SLogError, "RunUntilAskedToQuit(): ServiceLoop::Start() failed\n");
 	}
-	dnsCheckThread->Stop(true);
+	// let the ui take over right away
+	delete g_networkOwner;
+	g_networkOwner = NULL;
+	delete g_networkChange;
+	g_networkChange = NULL;
+	HttpAsyncShutdown(5*1000);
+	LogHttpPoolStats();
 }
 
 static void run_in_debug_mode()
@@ -449,6 +517,10 @@ static void WINAPI service_handler(unsigned long control)
 		slog("service_handler() control=SERVICE_CONTROL_STOP\n");
 		set_service_status(SERVICE_STOP_PENDING);
 		SetEvent(g_serviceStopEvent);
+		// the loop might be waiting for an ip update or an upgrade check,
+		// don't make it wait for the server to answer before it sees the
+		// stop event. RunUntilAskedToQuit() waits for the workers
+		HttpAsyncStop();
 	} else if (SERVICE_CONTROL_PAUSE == control) {
 		slog("service_handler() control=SERVICE_CONTROL_PAUSE\n");
 		g_paused = true;
@@ -463,19 +535,18 @@ static void WINAPI service_main(unsigned long /*argc*/, TCHAR ** /*argv*/)
 	slog("service_main()\n");
 	g_serviceHandle = RegisterServiceCtrlHandler(OPENDNS_UI_UPDATER_SERVICE_NAME, service_handler);
 	if (!g_serviceHandle) {
-		slog("service_main(): RegisterServiceCtrlHandler() failed\n");
+		slogl(SLogError, "service_main(): RegisterServiceCtrlHandler() failed\n");
 		return;
 	}
 
 	set_service_status(SERVICE_START_PENDING);
 	g_serviceStopEvent = CreateEvent(NULL, TRUE, FALSE, 0);
 	if (NULL == g_serviceStopEvent) {
-		slog("service_main(): CreateEvent() failed\n");
+		slogl(SLogError, "service_main(): CreateEvent() failed\n");
 		return;
 	}
 
 	set_service_status(SERVICE_RUNNING);
-	g_lastIpUpdateTimeInMs = GetTickCount();
 	RunUntilAskedToQuit(g_serviceStopEvent);
 	set_service_status(SERVICE_STOPPED);
 }
@@ -490,7 +561,7 @@ static int start_service()
 	slog("start_service()\n");
 	BOOL ok = StartServiceCtrlDispatcher(service_table);
 	if (!ok) {
-		slog("start_service(), StartServiceCtrlDispatcher() failed\n");
+		slogl(SLogError, "start_service(), StartServiceCtrlDispatcher() failed\n");
 		return ErrStartServiceCtrlDispatcherFail;
 	}
 
@@ -501,7 +572,7 @@ int _tmain(int argc, _TCHAR* argv[])
 {
 	int err = ErrNoError;
 
-	if (argc > 2) {
+	if ((argc > 2) && !tstreq(argv[1], _T("events"))) {
 		usage();
 		return 1;
 	}
@@ -545,6 +616,7 @@ int _tmain(int argc, _TCHAR* argv[])
 			goto Exit;
 		}
 
+		EventLogInit(EventLogFileName(commonDir));
 		err = start_service();
 	} else {
 		TCHAR* cmd = argv[1];
@@ -552,15 +624,22 @@ int _tmain(int argc, _TCHAR* argv[])
 			err = install_service();
 		else if (tstreq(cmd, _T("remove")))
 			err = remove_service();
-		else if (tstreq(cmd, _T("debug")))
+		else if (tstreq(cmd, _T("debug"))) {
+			EventLogInit(EventLogFileName(commonDir));
 			run_in_debug_mode();
+		}
 		else if (tstreq(cmd, _T("unittests")))
 			err = run_unit_tests();
 		else if (tstreq(cmd, _T("ut")))
 			err = run_unit_tests();
+		else if (tstreq(cmd, _T("bench")))
+			err = run_benchmarks();
+		else if (tstreq(cmd, _T("events")))
+			err = query_events(argc - 2, argv + 2, commonDir);
 	}
 
 Exit:
+	EventLogStop();
 	PreferencesFree();
 
 	slog("finished\n");
@@ -22,6 +22,7 @@
 #include <Winhttp.h>
 #include <shlwapi.h>
 #include <ShlObj.h>
+#include <iphlpapi.h>
 
 #if 0
 // I wish I knew why I have to define SECURITY_WIN32
@@ -39,7 +40,9 @@
 #include "pstdint.h"
 
 #pragma comment(lib, "dnsapi.lib")
+#pragma comment(lib, "iphlpapi.lib")
 #pragma comment(lib, "ole32.lib")
 #pragma comment(lib, "shlwapi.lib")
 #pragma comment(lib, "winhttp.lib")
+#pragma comment(lib, "ws2_32.lib")
 
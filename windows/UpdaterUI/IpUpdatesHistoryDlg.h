@@ -5,9 +5,19 @@
 
 // TODO: sorting by the columns
 
+// The list is virtual (LVS_OWNERDATA): it only asks for the items it shows
+// and we fetch them from the history a page at a time, so the dialog is
+// equally fast with any number of updates.
+#define IP_UPDATES_PAGE_SIZE 64
+
 class CIpUpdatesHistoryDlg : public CDialogImpl<CIpUpdatesHistoryDlg>
 {
-	IpUpdate *m_ipUpdates; // a reference, doesn't own this
+	IpUpdatesCursor		m_cursor;
+	bool				m_hasHistory;
+	// points into the history, see IpUpdatesStoreGet()
+	const IpUpdate *	m_page[IP_UPDATES_PAGE_SIZE];
+	int					m_pageStart;
+	int					m_pageLen;
 
 public:
 	enum { IDD = IDD_DIALOG_IP_UPDATES_HISTORY};
@@ -17,11 +27,15 @@ public:
 		COMMAND_ID_HANDLER(IDOK, OnButtonOk)
 		COMMAND_ID_HANDLER(IDCANCEL, OnButtonOk) // to make 'close window' button work
 		COMMAND_ID_HANDLER(IDC_BUTTON_COPY_TO_CLIPBOARD, OnButtonCopyToClipboard)
+		NOTIFY_HANDLER_EX(IDC_LIST_IP_UPDATES_HISTORY, LVN_GETDISPINFO, OnGetDispInfo)
+		NOTIFY_HANDLER_EX(IDC_LIST_IP_UPDATES_HISTORY, LVN_ODCACHEHINT, OnCacheHint)
 	END_MSG_MAP()
 
-	CIpUpdatesHistoryDlg(IpUpdate *ipUpdates)
+	CIpUpdatesHistoryDlg()
 	{
-		m_ipUpdates = ipUpdates;
+		m_hasHistory = false;
+		m_pageStart = 0;
+		m_pageLen = 0;
 	}
 
 	BOOL OnInitDialog(CWindow /* wndFocus */, LPARAM /* lInitParam */)
@@ -38,31 +52,74 @@ public:
 		static const int DATE_COLUMN_WIDTH = 150;
 		m_ipUpdatesList.SetColumnWidth(0, DATE_COLUMN_WIDTH);
 		m_ipUpdatesList.SetColumnWidth(1, TOTAL_WIDTH - DATE_COLUMN_WIDTH);
-		IpUpdate *curr = m_ipUpdates;
-		int i = 0;
-		while (curr && (i < IP_UPDATES_HISTORY_MAX)) {
-			TCHAR *ipAddr = StrToTStr(curr->ipAddress);
-			TCHAR *time = StrToTStr(curr->time);
-			if (time && ipAddr) {
-				m_ipUpdatesList.AddItem(i, 0, time);
-				if (curr->ok) {
-					m_ipUpdatesList.AddItem(i, 1, ipAddr);
-				} else {
-					TCHAR *s = TStrCat(_T("!"), ipAddr);
-					if (s) {
-						m_ipUpdatesList.AddItem(i, 1, s);
-						free(s);
-					}
-				}
-			}
-			free(ipAddr);
-			free(time);
-			curr = curr->next;
-			i++;
-		}
+		m_hasHistory = IpUpdatesHistoryCursor(&m_cursor);
+		if (m_hasHistory)
+			m_ipUpdatesList.SetItemCountEx(IpUpdatesCursorCount(&m_cursor), LVSICF_NOSCROLL);
 		return FALSE;
 	}
 
+	void FetchPage(int first)
+	{
+		m_pageStart = first;
+		m_pageLen = 0;
+		IpUpdatesCursorSeek(&m_cursor, first);
+		while (m_pageLen < IP_UPDATES_PAGE_SIZE) {
+			const IpUpdate *u = IpUpdatesCursorNext(&m_cursor);
+			if (!u)
+				break;
+			m_page[m_pageLen++] = u;
+		}
+	}
+
+	const IpUpdate *GetUpdate(int n)
+	{
+		if (!m_hasHistory)
+			return NULL;
+		if ((n < m_pageStart) || (n >= m_pageStart + m_pageLen))
+			FetchPage(n);
+		if (n - m_pageStart >= m_pageLen)
+			return NULL;
+		return m_page[n - m_pageStart];
+	}
+
+	// ip updates are ascii so there's no need for a real conversion
+	static void CopyAsciiToTStr(TCHAR *dst, int dstLen, const char *prefix, const char *s)
+	{
+		int i = 0;
+		for (; *prefix && (i < dstLen - 1); prefix++)
+			dst[i++] = (TCHAR)*prefix;
+		for (; *s && (i < dstLen - 1); s++)
+			dst[i++] = (TCHAR)*s;
+		dst[i] = 0;
+	}
+
+	LRESULT OnGetDispInfo(LPNMHDR pnmh)
+	{
+		LVITEM *item = &((NMLVDISPINFO*)pnmh)->item;
+		if (!(item->mask & LVIF_TEXT) || (item->cchTextMax <= 0))
+			return 0;
+		item->pszText[0] = 0;
+		// has been overwritten by newer updates
+		const IpUpdate *u = GetUpdate(item->iItem);
+		if (!u)
+			return 0;
+		if (0 == item->iSubItem)
+			CopyAsciiToTStr(item->pszText, item->cchTextMax, "", u->time);
+		else
+			CopyAsciiToTStr(item->pszText, item->cchTextMax, u->ok ? "" : "!", u->ipAddress);
+		return 0;
+	}
+
+	// the list tells us which items it's about to ask for
+	LRESULT OnCacheHint(LPNMHDR pnmh)
+	{
+		NMLVCACHEHINT *hint = (NMLVCACHEHINT*)pnmh;
+		bool cached = (hint->iFrom >= m_pageStart) && (hint->iTo < m_pageStart + m_pageLen);
+		if (m_hasHistory && !cached && (hint->iTo - hint->iFrom < IP_UPDATES_PAGE_SIZE))
+			FetchPage(hint->iFrom);
+		return 0;
+	}
+
 	LRESULT OnButtonOk(WORD /*wNotifyCode*/, WORD wID, HWND /*hWndCtl*/, BOOL& /*bHandled*/)
 	{
 		EndDialog(wID);
@@ -80,7 +137,7 @@ public:
 		if (!OpenClipboard())
 			return 0;
 
-		s = IpUpdatesAsText(m_ipUpdates, &sLen);
+		s = IpUpdatesAsText(&sLen);
 		if (!s)
 			goto Exit;
 
@@ -1,22 +1,13 @@
 #include "stdafx.h"
 
 #include "IpUpdatesLog.h"
+#include "IpUpdatesLogParser.h"
 #include "MiscUtil.h"
 #include "StrUtil.h"
 
-// When we reach that many updates, we'll trim the ip updates log
-#define IP_UPDATES_PURGE_LIMIT 1000
-
-// After we reach IP_UPDATES_PURGE_LIMIT, we'll only write out
-// IP_UPDATES_AFTER_PURGE_SIZE items, so that we don't have to purge every
-// time once we reach purge limit
-#define IP_UPDATES_SIZE_AFTER_PURGE 500
-
-// Linked list of ip updates. Newest are at the front.
-IpUpdate *				g_ipUpdates = NULL;
-
-static FILE *			gIpUpdatesLogFile;
+static IpUpdatesStore *	gIpUpdates;
 
+// the text log we used before IpUpdatesStore, imported once
 CString IpUpdatesLogFileName()
 {
 	CString fileName = AppDataDir();
@@ -24,7 +15,14 @@ CString IpUpdatesLogFileName()
 	return fileName;
 }
 
-static void str_append(char **dstInOut, char *s)
+CString IpUpdatesStoreFileName()
+{
+	CString fileName = AppDataDir();
+	fileName += _T("\\ipupdates.dat");
+	return fileName;
+}
+
+static void str_append(char **dstInOut, const char *s)
 {
 	char *dst = *dstInOut;
 	size_t len = strlen(s);
@@ -33,199 +31,83 @@ static void str_append(char **dstInOut, char *s)
 	*dstInOut = dst;
 }
 
-char *IpUpdatesAsText(IpUpdate *head, size_t *sizeOut)
+// The strings in IpUpdate have a fixed maximum size, so we can allocate
+// enough up front and build the text in a single pass
+char *IpUpdatesAsText(size_t *sizeOut)
 {
-	IpUpdate *curr = head;
-	char *s = NULL;
-	size_t sizeNeeded = 0;
-
-	while (curr) {
-		if (curr->ipAddress && curr->time) {
-			sizeNeeded += strlen(curr->ipAddress);
-			sizeNeeded += strlen(curr->time);
-			sizeNeeded += 3; // space + '\r\n'
-		}
-		curr = curr->next;
-	}
+	IpUpdatesCursor c;
+	if (!IpUpdatesHistoryCursor(&c))
+		return NULL;
 
-	s = (char*)malloc(sizeNeeded+1); // +1 for terminating zero
+	// space + '\r\n'
+	size_t maxLineSize = sizeof(((IpUpdate*)0)->ipAddress) + sizeof(((IpUpdate*)0)->time) + 3;
+	char *s = (char*)malloc(IpUpdatesCursorCount(&c) * maxLineSize + 1); // +1 for terminating zero
+	if (!s)
+		return NULL;
 
 	char *tmp = s;
-	curr = head;
-	while (curr) {
-		if (curr->ipAddress && curr->time) {
-			str_append(&tmp, curr->ipAddress);
-			str_append(&tmp, " ");
-			str_append(&tmp, curr->time);
-			str_append(&tmp, "\r\n");
-		}
-		curr = curr->next;
+	const IpUpdate *u;
+	while (NULL != (u = IpUpdatesCursorNext(&c))) {
+		str_append(&tmp, u->ipAddress);
+		str_append(&tmp, " ");
+		str_append(&tmp, u->time);
+		str_append(&tmp, "\r\n");
 	}
 	*tmp = 0;
 
-	*sizeOut = sizeNeeded + 1;
+	*sizeOut = tmp - s + 1;
 	return s;
 }
 
-static void FreeIpUpdate(IpUpdate *ipUpdate)
+bool IpUpdatesHistoryCursor(IpUpdatesCursor *c)
 {
-	assert(ipUpdate);
-	if (!ipUpdate)
-		return;
-	free(ipUpdate->ipAddress);
-	free(ipUpdate->time);
-	free(ipUpdate);
-}
-
-static void FreeIpUpdatesFromElement(IpUpdate *curr)
-{
-	while (curr) {
-		IpUpdate *next = curr->next;
-		FreeIpUpdate(curr);
-		curr = next;
-	}
-}
-
-static void InsertIpUpdate(const char *ipAddress, const char *time, bool ok)
-{
-	assert(ipAddress);
-	assert(time);
-	if (!ipAddress || !time)
-		return;
-	IpUpdate *ipUpdate = SA(IpUpdate);
-	if (!ipUpdate)
-		return;
-
-	ipUpdate->ipAddress = strdup(ipAddress);
-	ipUpdate->time = strdup(time);
-	ipUpdate->ok = ok;
-	if (!ipUpdate->ipAddress || !ipUpdate->time) {
-		FreeIpUpdate(ipUpdate);
-		return;
-	}
-
-	ipUpdate->next = g_ipUpdates;
-	g_ipUpdates = ipUpdate;
-}
-
-static inline bool is_newline_char(char c)
-{
-	return (c == '\r') || (c == '\n');
-}
-
-// at this point <*dataStartInOut> points at the beginning of the log file,
-// which consists of lines in format:
-// $ipaddr $time\r\n
-static bool ExtractIpAddrAndTime(char **dataStartInOut, uint64_t *dataSizeLeftInOut, char **ipAddrOut, char **timeOut, bool *okOut)
-{
-	char *curr = *dataStartInOut;
-	uint64_t dataSizeLeft = *dataSizeLeftInOut;
-	char *time = NULL;
-	char *ipAddr = curr;
-	bool ok = true;
-
-	if (0 == dataSizeLeft)
-		return false;
-
-	if (*curr == '!') {
-		ok = false;
-		--dataSizeLeft;
-		++ipAddr;
-		++curr;
-	}
-
-	// first space separates $ipaddr from $time
-	while ((dataSizeLeft > 0) && (*curr != ' ')) {
-		--dataSizeLeft;
-		++curr;
-	}
-
-	// didn't find the space => something's wrong
-	if (0 == dataSizeLeft)
+	if (!gIpUpdates)
 		return false;
-
-	assert(*curr == ' ');
-	// replace space with 0 to make ipAddr a null-terminated string
-	*curr = 0;
-	--dataSizeLeft;
-	++curr;
-
-	time = curr;
-
-	// find "\r\n' at the end
-	while ((dataSizeLeft > 0) && !is_newline_char(*curr)) {
-		--dataSizeLeft;
-		++curr;
-	}
-
-	// replace '\r\n' with 0, to make time a null-terminated string
-	while ((dataSizeLeft > 0) && is_newline_char(*curr)) {
-		*curr++ = 0;
-		--dataSizeLeft;
-	}
-
-	*ipAddrOut = ipAddr;
-	*timeOut = time;
-	*dataSizeLeftInOut = dataSizeLeft;
-	*dataStartInOut = curr;
-	*okOut = ok;
+	IpUpdatesCursorInit(c, gIpUpdates);
 	return true;
 }
 
-// load up to IP_UPDATES_HISTORY_MAX latest entries from ip updates log
-// When we finish g_ipUpdates is a list of ip updates with the most recent
-// at the beginning of the list
-static void ParseIpLogHistory(char *data, uint64_t dataSize)
+// The log has the oldest entries first, so they end up in the store in the
+// right order. Returns false if it stopped at a malformed line
+static bool ImportIpLogHistory(const char *data, uint64_t dataSize)
 {
-	char *ipAddr = NULL;
-	char *time = NULL;
-	bool updateOk;
-	while (dataSize != 0) {
-		bool ok = ExtractIpAddrAndTime(&data, &dataSize, &ipAddr, &time, &updateOk);
-		if (!ok) {
-			assert(0);
-			break;
-		}
-		InsertIpUpdate(ipAddr, time, updateOk);
+	const char *end = data + dataSize;
+	IpUpdateLine line;
+	while (IpUpdatesLogNextLine(&data, end, &line)) {
+		IpUpdatesStoreAppendN(gIpUpdates, line.ipAddress, line.ipAddressLen, line.time, line.timeLen, line.ok);
 	}
+	// only empty lines may be left
+	while ((data < end) && (('\r' == *data) || ('\n' == *data)))
+		data++;
+	return data == end;
 }
 
-static void LogIpUpdateEntry(FILE *log, const char *ipAddress, const char *time, bool ok)
-{
-	assert(log && ipAddress && time);
-	if (!log || !ipAddress || !time)
-		return;
-
-	size_t slen = strlen(ipAddress);
-	if (!ok) {
-		fwrite("!", 1, 1, log);
-	}
-	fwrite(ipAddress, slen, 1, log);
-	fwrite(" ", 1, 1, log);
-
-	slen = strlen(time);
-	fwrite(time, slen, 1, log);
-	fwrite("\r\n", 2, 1, log);
-	fflush(log);
-}
-
-static void LoadAndParseHistory(const TCHAR *logFileName)
+static void ImportTextLog()
 {
+	CString logFileName = IpUpdatesLogFileName();
 	uint64_t dataSize;
 	char *data = FileReadAll(logFileName, &dataSize);
 	if (!data)
 		return;
-	ParseIpLogHistory(data, dataSize);
+	bool complete = ImportIpLogHistory(data, dataSize);
 	free(data);
+	// the store exists now so we won't import again. Keep what we couldn't
+	// import rather than lose it
+	if (complete)
+		DeleteFile(logFileName);
+	else
+		MoveFileEx(logFileName, logFileName + _T(".bak"), MOVEFILE_REPLACE_EXISTING);
 }
 
 void LoadIpUpdatesHistory()
 {
-	assert(!gIpUpdatesLogFile);
+	assert(!gIpUpdates);
 
-	CString logFileName = IpUpdatesLogFileName();
-	LoadAndParseHistory(logFileName);
-	gIpUpdatesLogFile = _tfopen(logFileName, _T("ab"));
+	CString storeFileName = IpUpdatesStoreFileName();
+	bool isNew = !FileOrDirExists(storeFileName);
+	gIpUpdates = IpUpdatesStoreOpen(storeFileName, IP_UPDATES_STORE_CAPACITY);
+	if (gIpUpdates && isNew)
+		ImportTextLog();
 }
 
 static void LogIpUpdate(const char *ipAddress, bool ok)
@@ -236,9 +118,9 @@ static void LogIpUpdate(const char *ipAddress, bool ok)
 	_time64(&ltime);
 	today = _localtime64(&ltime);
 	strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M", today);
-	assert(gIpUpdatesLogFile);
-	LogIpUpdateEntry(gIpUpdatesLogFile, ipAddress, timeBuf, ok);
-	InsertIpUpdate(ipAddress, timeBuf, ok);
+	assert(gIpUpdates);
+	if (gIpUpdates)
+		IpUpdatesStoreAppend(gIpUpdates, ipAddress, timeBuf, ok);
 }
 
 void LogIpUpdateOk(const char *ipAddress)
@@ -251,73 +133,8 @@ void LogIpUpdateNotYours(const char *ipAddress)
 	LogIpUpdate(ipAddress, false);
 }
 
-static void CloseIpUpdatesLog()
-{
-	if (gIpUpdatesLogFile) {
-		fclose(gIpUpdatesLogFile);
-		gIpUpdatesLogFile = NULL;
-	}
-}
-
-// reverse g_ipUpdates and return size of the list
-size_t ReverseIpUpdateList()
-{
-	size_t size = 0;
-	IpUpdate *newHead = NULL;
-	IpUpdate *curr = g_ipUpdates;
-	while (curr) {
-		IpUpdate *next = curr->next;
-		curr->next = newHead;
-		newHead = curr;
-		curr = next;
-		size++;
-	}
-	g_ipUpdates = newHead;
-	return size;
-}
-
-static void WriteIpLogHistory(IpUpdate *head)
-{
-	CString logFileName = IpUpdatesLogFileName();
-	FILE *log = _tfopen(logFileName, _T("wb"));
-	IpUpdate *curr = head;
-	while (curr) {
-		LogIpUpdateEntry(log, curr->ipAddress, curr->time, curr->ok);
-		curr = curr->next;
-	}
-	fclose(log);
-}
-
-// if we have more than IP_UPDATES_HISTORY_MAX entries, over-write
-// the log with only the recent entries
-static void OverwriteLogIfReachedLimit()
-{
-	// in order to (possibly) write out log entries, we have to write from
-	// the end, so we need to reverse the list. We combine this with
-	// calculating the size because we need to know the size to decide
-	// if we need to overwrite the log
-	size_t size = ReverseIpUpdateList();
-	if (size < IP_UPDATES_PURGE_LIMIT)
-		return;
-
-	// skip the entries we don't want to write out
-	assert(size > IP_UPDATES_SIZE_AFTER_PURGE);
-	size_t toSkip = size - IP_UPDATES_SIZE_AFTER_PURGE;
-	IpUpdate *curr = g_ipUpdates;
-	while (curr && (toSkip != 0)) {
-		curr = curr->next;
-		toSkip--;
-	}
-
-	// write the rest to the new log
-	WriteIpLogHistory(curr);
-}
-
 void FreeIpUpdatesHistory()
 {
-	CloseIpUpdatesLog();
-	OverwriteLogIfReachedLimit();
-	FreeIpUpdatesFromElement(g_ipUpdates);
-	g_ipUpdates = NULL;
+	IpUpdatesStoreClose(gIpUpdates);
+	gIpUpdates = NULL;
 }
-
@@ -69,7 +69,7 @@ BOOL CMainFrame::PreTranslateMessage(MSG* pMsg)
 
 void CMainFrame::OnClose()
 {
-	BOOL sendingUpdates = GetPrefValBool(g_pref_send_updates);
+	BOOL sendingUpdates = GetPrefBool(PREF_send_updates);
 	if (CanSendIPUpdates() && sendingUpdates && !IsLeftAltAndCtrlPressed()) {
 		SwitchToHiddenState();
 		SetMsgHandled(TRUE);
@@ -137,7 +137,7 @@ void CMainFrame::OnSendUpdatesButtonClicked(UINT /*uNotifyCode*/, int /*nID*/, C
 {
 	CButton b = wndCtl;
 	BOOL checked = b.GetCheck();
-	SetPrefValBool(&g_pref_send_updates, checked);
+	SetPrefBool(PREF_send_updates, checked);
 	PreferencesSave();
 }
 
@@ -755,7 +755,7 @@ LRESULT CMainFrame::OnDownloadNetworks(UINT /*uMsg*/, WPARAM wParam, LPARAM lPar
 		goto Error;
 
 	DWORD dataSize;
-	jsonTxt = (char*)ctx->data.getData(&dataSize);
+	jsonTxt = (char*)ctx->data.stealData(&dataSize);
 	json = ParseJsonToDoc(jsonTxt);
 	if (!json)
 		goto Error;
@@ -922,7 +922,7 @@ int CMainFrame::OnCreate(LPCREATESTRUCT /* lpCreateStruct */)
 	m_buttonSendIpUpdates.SetFont(m_defaultGuiFont);
 	//m_buttonSendIpUpdates.SetFont(m_topBarFont);
 	m_buttonSendIpUpdates.SetDlgCtrlID(IDC_CHECK_SEND_UPDATES);
-	BOOL sendingUpdates = GetPrefValBool(g_pref_send_updates);
+	BOOL sendingUpdates = GetPrefBool(PREF_send_updates);
 	m_buttonSendIpUpdates.SetCheck(sendingUpdates);
 
 	m_editErrorMsg.Create(m_hWnd, r, _T(""), WS_CHILD | WS_VISIBLE | ES_MULTILINE);
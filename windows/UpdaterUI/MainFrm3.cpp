@@ -7,7 +7,6 @@
 #if MAIN_FRM == 3
 #include "MainFrm3.h"
 #include "IpUpdatesLog.h"
-#include "TypoExceptions.h"
 #include "IpUpdatesHistoryDlg.h"
 #include "PreferencesDlg.h"
 #include "wbem.h"
@@ -21,9 +20,9 @@
 // the code is there but we don't show at this moment
 #define SHOW_SYSTRAY_BALOON_FOR_ERRORS 0
 
-#define TEN_MINUTES_IN_MS 10*60*1000
-#define TYPO_EXCEPTION_CHECK_PERIOD TEN_MINUTES_IN_MS
-#define TYPO_EXCEPTION_CHECK_TIMER_ID 1
+// prefs toggled from the menu are saved once they stop changing
+#define PREFS_SAVE_TIMER_ID 2
+#define PREFS_SAVE_DELAY_MS 2*1000
 
 #define TXT_DIV_ACCOUNT _T("OpenDNS account")
 #define TXT_DIV_NETWORK_TO_UPDATE _T("Network to update")
@@ -118,7 +117,7 @@ BOOL CMainFrame::PreTranslateMessage(MSG* pMsg)
 
 void CMainFrame::OnClose()
 {
-	BOOL sendingUpdates = GetPrefValBool(g_pref_send_updates);
+	BOOL sendingUpdates = GetPrefBool(PREF_send_updates);
 	if (CanSendIPUpdates() && sendingUpdates && !IsLeftAltAndCtrlPressed() && !m_forceExitOnClose) {
 		ShowWindow(SW_MINIMIZE);
 		SetMsgHandled(TRUE);
@@ -127,9 +126,19 @@ void CMainFrame::OnClose()
 	}
 }
 
-void CMainFrame::OnTimer(UINT_PTR /*nIDEvent */)
+void CMainFrame::OnTimer(UINT_PTR nIDEvent)
 {
-	SubmitTypoExceptionsAsync();
+	if (PREFS_SAVE_TIMER_ID == nIDEvent) {
+		this->KillTimer(PREFS_SAVE_TIMER_ID);
+		PreferencesSave();
+	}
+}
+
+// Setting a timer that is already set restarts it, so a burst of
+// changes ends up in a single save
+void CMainFrame::SavePrefsLater()
+{
+	this->SetTimer(PREFS_SAVE_TIMER_ID, PREFS_SAVE_DELAY_MS);
 }
 
 LRESULT CMainFrame::OnLButtonDown(UINT /*nFlags*/, CPoint /*point*/)
@@ -368,7 +377,7 @@ BOOL CMainFrame::OnEraseBkgnd(CDCHandle dc)
 		// Draw last updated time (e.g. "5 minutes ago")
 		if (ShowLastUpdated()) {
 			y = m_txtUpdateRect.bottom + DIVIDER_Y_SPACING + 6;
-			BOOL sendUpdates = GetPrefValBool(g_pref_send_updates);
+			BOOL sendUpdates = GetPrefBool(PREF_send_updates);
 			if (sendUpdates) {
 				txt = LastUpdateTxt();
 				dc.TextOut(x, y, txt);
@@ -618,7 +627,7 @@ void CMainFrame::BuildStatusEditRtf(RtfTextInfo& ti)
 		ti.AddTxt(_T("Your IP address is taken by another user. "));
 		ti.AddLink(_T("Learn more."), LINK_LEARN_MORE_IP_TAKEN);
 
-		BOOL nagging_disabled = GetPrefValBool(g_pref_disable_nagging);
+		BOOL nagging_disabled = GetPrefBool(PREF_disable_nagging);
 		ti.AddParasIfNeeded();
 		if (nagging_disabled) {
 			ti.AddLink(_T("Start nagging me."), LINK_TOGGLE_NAGGING);
@@ -786,9 +795,9 @@ LRESULT CMainFrame::OnLinkStatusEdit(LPNMHDR pnmh)
 
 void CMainFrame::ToggleNagging()
 {
-	BOOL nagging_disabled = GetPrefValBool(g_pref_disable_nagging);
-	SetPrefValBool(&g_pref_disable_nagging, !nagging_disabled);
-	PreferencesSave();
+	BOOL nagging_disabled = GetPrefBool(PREF_disable_nagging);
+	SetPrefBool(PREF_disable_nagging, !nagging_disabled);
+	SavePrefsLater();
 	UpdateUpdateEdit(false /* doLayout */);
 	UpdateErrorEdit(true /* doLayout */);
 }
@@ -899,7 +908,7 @@ void CMainFrame::DoLayout()
 	else
 		m_editUpdateMsg.ShowWindow(SW_HIDE);
 
-	BOOL sendUpdates = GetPrefValBool(g_pref_send_updates);
+	BOOL sendUpdates = GetPrefBool(PREF_send_updates);
 	if (sendUpdates)
 		m_buttonUpdate.EnableWindow(TRUE);
 	else
@@ -1205,7 +1214,7 @@ void CMainFrame::OnIpUpdateResult(char *ipUpdateRes)
 	m_ipFromHttp = NULL;
 
 	// if it was a problem with our service, silently ignore it
-	if (IpUpdateNotAvailable == ipUpdateResult)
+	if ((IpUpdateNotAvailable == ipUpdateResult) || (IpUpdateUnknown == ipUpdateResult))
 		return;
 
 	// TODO: this might happen if a user made a network non-dynamic behind our back
@@ -1258,7 +1267,7 @@ void CMainFrame::OnPreferences(UINT /*uCode*/, int /*nID*/, HWND /*hWndCtl*/)
 	}
 	// if preferences (potentially) changed, save them and update UI to match
 	PreferencesSave();
-	BOOL hiddenMode = GetPrefValBool(g_pref_run_hidden);
+	BOOL hiddenMode = GetPrefBool(PREF_run_hidden);
 	UISetCheck(IDM_RUN_HIDDEN, hiddenMode);
 	UpdateUpdateEdit(false /* doLayout */);
 	UpdateErrorEdit(true /* doLayout */);
@@ -1266,9 +1275,9 @@ void CMainFrame::OnPreferences(UINT /*uCode*/, int /*nID*/, HWND /*hWndCtl*/)
 
 void CMainFrame::OnRunHidden(UINT /*uCode*/, int /*nID*/, HWND /*hWndCtl*/)
 {
-	BOOL hiddenMode = !GetPrefValBool(g_pref_run_hidden);
-	SetPrefValBool(&g_pref_run_hidden, hiddenMode);
-	PreferencesSave();
+	BOOL hiddenMode = !GetPrefBool(PREF_run_hidden);
+	SetPrefBool(PREF_run_hidden, hiddenMode);
+	SavePrefsLater();
 	// when enabling hidden mode, it acts as a command and hides the window
 	// when disabling hidden mode, it acts as an off button. It's a bit weird
 	if (hiddenMode)
@@ -1279,7 +1288,7 @@ void CMainFrame::OnRunHidden(UINT /*uCode*/, int /*nID*/, HWND /*hWndCtl*/)
 
 void CMainFrame::OnIpUpdatesHistory(UINT /*uCode*/, int /*nID*/, HWND /*hWndCtl*/)
 {
-	CIpUpdatesHistoryDlg dlg(g_ipUpdates);
+	CIpUpdatesHistoryDlg dlg;
 	dlg.DoModal();
 }
 
@@ -1320,7 +1329,7 @@ LRESULT CMainFrame::OnNotifyAboutError(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM
 	}
 #endif
 
-	BOOL nagging_disabled = GetPrefValBool(g_pref_disable_nagging);
+	BOOL nagging_disabled = GetPrefBool(PREF_disable_nagging);
 	if (!nagging_disabled) {
 		SwitchToVisibleState();
 	}
@@ -1374,9 +1383,14 @@ void CMainFrame::StartDownloadNetworks(char *token, int supressFlags)
 	INTERNET_PORT port = INTERNET_DEFAULT_HTTP_PORT;
 	if (IsApiHostHttps())
 		port = INTERNET_DEFAULT_HTTPS_PORT;
-	HttpResult *httpRes = HttpPost(apiHost, API_URL, paramsTxt, port);
+	// networks_get responses can be big so they're decoded as they're
+	// downloaded instead of being buffered and parsed into a document
+	NetworksGetParser *parser = NetworksGetParserNew();
+	HttpResult *httpRes = NULL;
+	if (parser)
+		httpRes = HttpPostStreamed(apiHost, API_URL, paramsTxt, port, NetworksGetParserFeedCallback, parser);
 	free((void*)paramsTxt);
-	OnDownloadNetworks(0, (WPARAM)httpRes, (LPARAM)supressFlags);
+	OnDownloadNetworks(httpRes, parser, supressFlags);
 }
 
 static BOOL IsBitSet(int flags, int bit)
@@ -1406,7 +1420,7 @@ NetworkInfo *MakeFirstNetworkDynamic(NetworkInfo *ni)
 		goto Error;
 
 	DWORD dataSize;
-	jsonTxt = (char *)httpRes->data.getData(&dataSize);
+	jsonTxt = (char *)httpRes->data.stealData(&dataSize);
 	if (!jsonTxt)
 		goto Error;
 
@@ -1426,33 +1440,27 @@ Error:
 	goto Exit;
 }
 
-LRESULT CMainFrame::OnDownloadNetworks(UINT /*uMsg*/, WPARAM wParam, LPARAM lParam)
+// <parser> has been fed the response to networks_get as it was downloaded
+void CMainFrame::OnDownloadNetworks(HttpResult *ctx, NetworksGetParser *parser, int supressFlags)
 {
 	NetworkInfo *ni = NULL;
-	char *jsonTxt = NULL;
-	JsonEl *json = NULL;
 	NetworkInfo *selectedNetwork = NULL;
-	int supressFlags = (int)lParam;
 	BOOL supressOneNetworkMsg = IsBitSet(supressFlags, SupressOneNetworkMsgFlag);
 	BOOL suppressNoDynamicIpMsg = IsBitSet(supressFlags, SuppressNoDynamicIpMsgFlag);
 	BOOL supressNoNetworks = IsBitSet(supressFlags, SupressNoNetworksMsgFlag);
 
-	HttpResult *ctx = (HttpResult*)wParam;
 	assert(ctx);
 	if (!ctx || !ctx->IsValid())
 		goto Error;
 
-	DWORD dataSize;
-	jsonTxt = (char*)ctx->data.getData(&dataSize);
-	json = ParseJsonToDoc(jsonTxt);
-	if (!json)
+	if (!NetworksGetParserFinish(parser))
 		goto Error;
-	WebApiStatus status = GetApiStatus(json);
+	WebApiStatus status = NetworksGetParserStatus(parser);
 
 	if (WebApiStatusSuccess != status) {
 		if (WebApiStatusFailure == status) {
 			long err;
-			bool ok = GetApiError(json, &err);
+			bool ok = NetworksGetParserError(parser, &err);
 			if (!ok)
 				goto Error;
 			if (ERR_NETWORK_DOESNT_EXIST == err)
@@ -1462,7 +1470,7 @@ LRESULT CMainFrame::OnDownloadNetworks(UINT /*uMsg*/, WPARAM wParam, LPARAM lPar
 			goto Error;
 		}
 	}
-	ni = ParseNetworksGetJson(json);
+	ni = NetworksGetParserStealNetworks(parser);
 	size_t networksCount = ListLengthGeneric(ni);
 	assert(0 != networksCount);
 	if (0 == networksCount)
@@ -1509,7 +1517,7 @@ NetworkSelected:
 
 Exit:
 	NetworkInfoFreeList(ni);
-	JsonElFree(json);
+	NetworksGetParserFree(parser);
 	delete ctx;
 	// prefs changed so save them
 	PreferencesSave();
@@ -1523,7 +1531,7 @@ Exit:
 	// it to standard cursor to ensure it's visible
 	HCURSOR curs = LoadCursor(NULL, IDC_ARROW);
 	SetCursor(curs);
-	return 0;
+	return;
 
 NoNetworkSelected:
 	//MessageBox(_T("You need to select a network for Dynamic IP Update."), MAIN_FRAME_TITLE);
@@ -1712,14 +1720,14 @@ int CMainFrame::OnCreate(LPCREATESTRUCT /* lpCreateStruct */)
 
 	m_updaterThread->ForceSendIpUpdate();
 	m_updaterThread->ForceSoftwareUpdateCheck();
-	OnTimer(0);
-	this->SetTimer(TYPO_EXCEPTION_CHECK_TIMER_ID, TYPO_EXCEPTION_CHECK_PERIOD);
 	return 0;
 }
 
 void CMainFrame::OnDestroy()
 {
-	this->KillTimer(TYPO_EXCEPTION_CHECK_TIMER_ID);
+	this->KillTimer(PREFS_SAVE_TIMER_ID);
+	// in case a save was pending
+	PreferencesSave();
 
 	// seen in crash report: apparently we get WM_DESTROY before
 	// m_updaterThread is created
@@ -1759,7 +1767,7 @@ void CMainFrame::SwitchToVisibleState()
 	m_notifyIcon.SetDefaultMenuItem(3, TRUE);
 	if (m_notifyIcon.IsHidden())
 		m_notifyIcon.Show();
-	BOOL hiddenMode = GetPrefValBool(g_pref_run_hidden);
+	BOOL hiddenMode = GetPrefBool(PREF_run_hidden);
 	UISetCheck(IDM_RUN_HIDDEN, hiddenMode);
 	UpdateUpdateEdit(false /* doLayout */);
 	UpdateErrorEdit(true /* doLayout */);
@@ -1772,7 +1780,7 @@ void CMainFrame::SwitchToHiddenState()
 	HMENU menu = LoadMenu(NULL, MAKEINTRESOURCE(IDR_MENU1));
 	m_notifyIcon.SetMenu(menu);
 	m_notifyIcon.SetDefaultMenuItem(3, TRUE);
-	BOOL hiddenMode = GetPrefValBool(g_pref_run_hidden);
+	BOOL hiddenMode = GetPrefBool(PREF_run_hidden);
 	if (hiddenMode && !m_notifyIcon.IsHidden())
 		m_notifyIcon.Hide();
 	UISetCheck(IDM_RUN_HIDDEN, hiddenMode);
@@ -348,7 +348,7 @@ public:
 	void OnSize(UINT nType, CSize /*size*/);
 
 	void StartDownloadNetworks(char *token, int supressFlags = 0);
-	LRESULT OnDownloadNetworks(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/);
+	void OnDownloadNetworks(HttpResult *ctx, NetworksGetParser *parser, int supressFlags);
 	NetworkInfo *SelectNetwork(NetworkInfo *ni);
 
 	bool GetLastIpUpdateTime();
@@ -358,6 +358,7 @@ public:
 	void SwitchToHiddenState();
 
 	void ToggleNagging();
+	void SavePrefsLater();
 
 	int OnCreate(LPCREATESTRUCT /* lpCreateStruct */);
 };
@@ -24,41 +24,41 @@ public:
 
 	~CPreferencesDlg() {}
 
-	void SetCheckValue(int ctrlId, char *prefName)
+	void SetCheckValue(int ctrlId, PrefId pref)
 	{
-		BOOL val = GetPrefValBool(prefName);
+		BOOL val = GetPrefBool(pref);
 		CButton b = GetDlgItem(ctrlId);
 		b.SetCheck(val);
 	}
 
-	void SetCheckValueInverted(int ctrlId, char *prefName)
+	void SetCheckValueInverted(int ctrlId, PrefId pref)
 	{
-		BOOL val = !GetPrefValBool(prefName);
+		BOOL val = !GetPrefBool(pref);
 		CButton b = GetDlgItem(ctrlId);
 		b.SetCheck(val);
 	}
 
-	void SetPrefFromCheckValue(int ctrlId, char **prefName)
+	void SetPrefFromCheckValue(int ctrlId, PrefId pref)
 	{
 		CButton b =  GetDlgItem(ctrlId);
 		BOOL checked = b.GetCheck();
-		SetPrefValBool(prefName, checked);
+		SetPrefBool(pref, checked);
 	}
 
-	void SetPrefFromCheckValueInverted(int ctrlId, char **prefName)
+	void SetPrefFromCheckValueInverted(int ctrlId, PrefId pref)
 	{
 		CButton b =  GetDlgItem(ctrlId);
 		BOOL checked = b.GetCheck();
-		SetPrefValBool(prefName, !checked);
+		SetPrefBool(pref, !checked);
 	}
 
 	BOOL OnInitDialog(CWindow /* wndFocus */, LPARAM /* lInitParam */)
 	{
 		CenterWindow(GetParent());
-		SetCheckValue(IDC_CHECK_SEND_DNS_OMATIC, g_pref_dns_o_matic);
-		SetCheckValue(IDC_CHECK_RUN_HIDDEN, g_pref_run_hidden);
-		SetCheckValue(IDC_CHECK_DONT_NOTIFY_ABOUT_ERRORS, g_pref_disable_nagging);
-		SetCheckValueInverted(IDC_CHECK_DISABLE_IP_UPDATES, g_pref_send_updates);
+		SetCheckValue(IDC_CHECK_SEND_DNS_OMATIC, PREF_dns_o_matic);
+		SetCheckValue(IDC_CHECK_RUN_HIDDEN, PREF_run_hidden);
+		SetCheckValue(IDC_CHECK_DONT_NOTIFY_ABOUT_ERRORS, PREF_disable_nagging);
+		SetCheckValueInverted(IDC_CHECK_DISABLE_IP_UPDATES, PREF_send_updates);
 		return FALSE;
 	}
 
@@ -80,10 +80,10 @@ public:
 
 	void UpdatePrefsValues()
 	{
-		SetPrefFromCheckValue(IDC_CHECK_SEND_DNS_OMATIC, &g_pref_dns_o_matic);
-		SetPrefFromCheckValue(IDC_CHECK_RUN_HIDDEN, &g_pref_run_hidden);
-		SetPrefFromCheckValue(IDC_CHECK_DONT_NOTIFY_ABOUT_ERRORS, &g_pref_disable_nagging);
-		SetPrefFromCheckValueInverted(IDC_CHECK_DISABLE_IP_UPDATES, &g_pref_send_updates);
+		SetPrefFromCheckValue(IDC_CHECK_SEND_DNS_OMATIC, PREF_dns_o_matic);
+		SetPrefFromCheckValue(IDC_CHECK_RUN_HIDDEN, PREF_run_hidden);
+		SetPrefFromCheckValue(IDC_CHECK_DONT_NOTIFY_ABOUT_ERRORS, PREF_disable_nagging);
+		SetPrefFromCheckValueInverted(IDC_CHECK_DISABLE_IP_UPDATES, PREF_send_updates);
 	}
 
 	LRESULT OnButtonOk(WORD /*wNotifyCode*/, WORD wID, HWND /*hWndCtl*/, BOOL& /*bHandled*/)
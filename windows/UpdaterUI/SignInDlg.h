@@ -162,7 +162,7 @@ public:
 			goto Error;
 		}
 		DWORD dataSize;
-		jsonTxt = (char*)httpResult->data.getData(&dataSize);
+		jsonTxt = (char*)httpResult->data.stealData(&dataSize);
 		json = ParseJsonToDoc(jsonTxt);
 		if (!json) {
 			if (jsonTxt) {
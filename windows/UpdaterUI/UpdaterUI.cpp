@@ -10,6 +10,7 @@
 #include "resource.h"
 
 #include "CrashHandler.h"
+#include "HttpAsync.h"
 #include "IpUpdatesLog.h"
 #include "MainFrm.h"
 
@@ -70,7 +71,7 @@ int Run(bool show)
 	if (wndMain.CreateEx(NULL, r) == NULL)
 		return 0;
 
-	if (GetPrefValBool(g_pref_run_hidden)) {
+	if (GetPrefBool(PREF_run_hidden)) {
 		show = false;
 	}
 
@@ -125,30 +126,31 @@ static char *g_imported_hostname;
 static void VerifyHostname(char *hostName)
 {
 	HttpResult *httpResult = NULL;
-	char *jsonTxt = NULL;
-	JsonEl *json = NULL;
 	NetworkInfo *ni = NULL;
 	NetworkInfo *dynamicNetwork = NULL;
+	NetworksGetParser *parser = NetworksGetParserNew();
+	if (!parser)
+		return;
 
 	CString params = ApiParamsNetworksGet(g_pref_token);
 	const char *paramsTxt = TStrToStr(params);
 	const char *apiHost = GetApiHost();
-	bool apiHostIsHttps = IsApiHostHttps();
-	httpResult = HttpPost(apiHost, API_URL, paramsTxt, apiHostIsHttps);		
+	INTERNET_PORT port = INTERNET_DEFAULT_HTTP_PORT;
+	if (IsApiHostHttps())
+		port = INTERNET_DEFAULT_HTTPS_PORT;
+	httpResult = HttpPostStreamed(apiHost, API_URL, paramsTxt, port, NetworksGetParserFeedCallback, parser);
 	free((void*)paramsTxt);
 	if (!httpResult ||  !httpResult->IsValid())
-		return;
+		goto Exit;
 
-	jsonTxt = (char*)httpResult->data.getData(NULL);
-	json = ParseJsonToDoc(jsonTxt);
-	if (!json)
+	if (!NetworksGetParserFinish(parser))
 		goto Exit;
 
-	WebApiStatus status = GetApiStatus(json);
+	WebApiStatus status = NetworksGetParserStatus(parser);
 	if (WebApiStatusSuccess != status)
 		goto Exit;
 
-	ni = ParseNetworksGetJson(json);
+	ni = NetworksGetParserStealNetworks(parser);
 	if (!ni)
 		goto Exit;
 	size_t networksCount = ListLengthGeneric(ni);
@@ -184,8 +186,7 @@ static void VerifyHostname(char *hostName)
 
 Exit:
 	NetworkInfoFreeList(ni);
-	JsonElFree(json);
-	free(jsonTxt);
+	NetworksGetParserFree(parser);
 	delete httpResult;
 	return;
 
@@ -226,7 +227,7 @@ static bool VerifyUserNamePassword(char *userName, char *pwd)
 	if (!httpResult || !httpResult->IsValid())
 		goto Error;
 
-	jsonTxt = (char*)httpResult->data.getData(NULL);
+	jsonTxt = (char*)httpResult->data.stealData(NULL);
 	json = ParseJsonToDoc(jsonTxt);
 	if (!json)
 		goto Error;
@@ -383,7 +384,7 @@ void SubmitAndDeleteCrashDump(const TCHAR *filePath)
 	DWORD dataSize = (DWORD)fileSize;
 	HttpResult *httpResult = HttpPostData(host, url, fileData, dataSize);
 	if (httpResult && httpResult->IsValid()) {
-		char *res = (char*)httpResult->data.getData(NULL);
+		char *res = (char*)httpResult->data.stealData(NULL);
 		slog("Sent crashdump. Response: ");
 		slognl(res);
 		free(res);
@@ -538,7 +539,7 @@ int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR cm
 	PreferencesLoad();
 
 	// just exit if we auto-started and we won't send updates
-	BOOL sendingUpdates = GetPrefValBool(g_pref_send_updates);
+	BOOL sendingUpdates = GetPrefBool(PREF_send_updates);
 	if (wasAutoStart && !sendingUpdates)
 			goto Exit;
 
@@ -566,6 +567,8 @@ int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR cm
 		showWindow = false;
 
 	nRet = Run(showWindow);
+	// don't hold up exiting for requests nobody will look at
+	HttpAsyncShutdown(2*1000);
 
 	PreferencesSave();
 Exit:
@@ -0,0 +1,263 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "AsyncLog.h"
+#include "MiscUtil.h"
+
+#define SLOTS_MASK			(ASYNC_LOG_SLOTS - 1)
+// longer messages are split and might be interleaved with other messages
+#define MAX_SLOTS_PER_MSG	32
+// the writer is woken up every time this many slots are filled
+#define WAKE_EVERY_SLOTS	(ASYNC_LOG_SLOTS / 4)
+#define BATCH_SIZE			(16*1024)
+
+// A slot at ring position <pos> is free when seq == pos and holds data
+// when seq == pos + 1. Loggers reserve positions by advancing writePos,
+// fill the slots and set seq. The reader frees a slot by setting seq to
+// the position it will be reused at, pos + ASYNC_LOG_SLOTS
+typedef struct {
+	volatile LONG	seq;
+	LONG			len;
+	char			data[ASYNC_LOG_SLOT_SIZE];
+} LogSlot;
+
+struct AsyncLog {
+	FILE *				f;
+	LogSlot *			slots;
+	volatile LONG		writePos;
+	// only accessed with drainCs held
+	LONG				readPos;
+	char *				batch;
+	DWORD				lastFlushMs;
+	LONG				droppedReported;
+	AsyncLogRotateFunc	rotateFunc;
+	void *				rotateCtx;
+
+	volatile LONG		flushIntervalMs;
+	volatile LONG		flushRequested;
+	volatile LONG		dropped;
+	volatile LONG		stop;
+
+	CRITICAL_SECTION	drainCs;
+	HANDLE				wakeEvent;
+	HANDLE				thread;
+	DWORD				threadId;
+};
+
+static bool ReserveSlots(AsyncLog *log, LONG n, LONG *posOut)
+{
+	for (;;) {
+		LONG pos = log->writePos;
+		// the reader frees slots in order, so if the last one is free,
+		// all of them are
+		LogSlot *last = &log->slots[(pos + n - 1) & SLOTS_MASK];
+		LONG dif = last->seq - (pos + n - 1);
+		if (dif < 0)
+			return false;
+		if ((0 == dif) && (pos == InterlockedCompareExchange(&log->writePos, pos + n, pos))) {
+			*posOut = pos;
+			return true;
+		}
+		// someone else took it, try the next position
+	}
+}
+
+static void WriteBatch(AsyncLog *log, size_t len)
+{
+	if ((len > 0) && log->f)
+		fwrite(log->batch, len, 1, log->f);
+}
+
+// Writes out slots that hold data, up to the first one that doesn't.
+// Must be called with drainCs held. Returns true if anything was written
+static bool DrainLocked(AsyncLog *log, bool flush)
+{
+	LONG startPos = log->readPos;
+	size_t batchLen = 0;
+	for (;;) {
+		LogSlot *slot = &log->slots[log->readPos & SLOTS_MASK];
+		if (slot->seq != log->readPos + 1)
+			break;
+		if (batchLen + slot->len > BATCH_SIZE) {
+			WriteBatch(log, batchLen);
+			batchLen = 0;
+		}
+		memcpy(log->batch + batchLen, slot->data, slot->len);
+		batchLen += slot->len;
+		InterlockedExchange(&slot->seq, log->readPos + ASYNC_LOG_SLOTS);
+		log->readPos++;
+	}
+	WriteBatch(log, batchLen);
+
+	LONG dropped = log->dropped;
+	if ((dropped != log->droppedReported) && log->f) {
+		fprintf(log->f, "[%d log messages dropped]\n", (int)(dropped - log->droppedReported));
+		log->droppedReported = dropped;
+	}
+	if (flush) {
+		if (log->f)
+			fflush(log->f);
+		log->lastFlushMs = GetTickCount();
+	}
+	return startPos != log->readPos;
+}
+
+static DWORD WINAPI WriterThread(LPVOID param)
+{
+	AsyncLog *log = (AsyncLog*)param;
+	for (;;) {
+		WaitForSingleObject(log->wakeEvent, (DWORD)log->flushIntervalMs);
+		bool stop = (0 != log->stop);
+		EnterCriticalSection(&log->drainCs);
+		bool flush = stop || (0 != InterlockedExchange(&log->flushRequested, 0));
+		if (GetTickCount() - log->lastFlushMs >= (DWORD)log->flushIntervalMs)
+			flush = true;
+		// a log that couldn't be opened is tried again before writing,
+		// so that messages aren't discarded once it can be
+		if (!log->f && log->rotateFunc)
+			log->f = log->rotateFunc(log->rotateCtx, NULL);
+		bool wrote = DrainLocked(log, flush);
+		if (wrote && log->f && log->rotateFunc)
+			log->f = log->rotateFunc(log->rotateCtx, log->f);
+		LeaveCriticalSection(&log->drainCs);
+		if (stop)
+			break;
+	}
+	return 0;
+}
+
+AsyncLog *AsyncLogNew(FILE *f, DWORD flushIntervalMs)
+{
+	AsyncLog *log = SAZ(AsyncLog);
+	if (!log)
+		return NULL;
+	log->f = f;
+	log->flushIntervalMs = (LONG)flushIntervalMs;
+	log->lastFlushMs = GetTickCount();
+	log->slots = (LogSlot*)malloc(sizeof(LogSlot) * ASYNC_LOG_SLOTS);
+	log->batch = (char*)malloc(BATCH_SIZE);
+	if (!log->slots || !log->batch)
+		goto Error;
+	for (LONG i = 0; i < ASYNC_LOG_SLOTS; i++)
+		log->slots[i].seq = i;
+	InitializeCriticalSection(&log->drainCs);
+	log->wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	if (!log->wakeEvent)
+		goto ErrorCs;
+	log->thread = CreateThread(NULL, 0, WriterThread, log, 0, &log->threadId);
+	if (!log->thread)
+		goto ErrorEvent;
+	return log;
+
+ErrorEvent:
+	CloseHandle(log->wakeEvent);
+ErrorCs:
+	DeleteCriticalSection(&log->drainCs);
+Error:
+	free(log->batch);
+	free(log->slots);
+	free(log);
+	return NULL;
+}
+
+void AsyncLogFree(AsyncLog *log)
+{
+	if (!log)
+		return;
+	InterlockedExchange(&log->stop, 1);
+	SetEvent(log->wakeEvent);
+	WaitForSingleObject(log->thread, INFINITE);
+	CloseHandle(log->thread);
+	CloseHandle(log->wakeEvent);
+	DeleteCriticalSection(&log->drainCs);
+	free(log->batch);
+	free(log->slots);
+	free(log);
+}
+
+static bool WriteChunk(AsyncLog *log, const char *s, size_t len)
+{
+	LONG n = (LONG)((len + ASYNC_LOG_SLOT_SIZE - 1) / ASYNC_LOG_SLOT_SIZE);
+	LONG pos;
+	DWORD startMs = 0;
+	while (!ReserveSlots(log, n, &pos)) {
+		// the ring is full, give the writer a chance to catch up
+		DWORD now = GetTickCount();
+		if (0 == startMs)
+			startMs = now;
+		else if (now - startMs >= ASYNC_LOG_FULL_WAIT_MS)
+			return false;
+		SetEvent(log->wakeEvent);
+		Sleep(1);
+	}
+
+	for (LONG i = 0; i < n; i++) {
+		LogSlot *slot = &log->slots[(pos + i) & SLOTS_MASK];
+		size_t slotLen = len;
+		if (slotLen > ASYNC_LOG_SLOT_SIZE)
+			slotLen = ASYNC_LOG_SLOT_SIZE;
+		memcpy(slot->data, s, slotLen);
+		slot->len = (LONG)slotLen;
+		s += slotLen;
+		len -= slotLen;
+		InterlockedExchange(&slot->seq, pos + i + 1);
+	}
+
+	// wake up the writer when crossing a WAKE_EVERY_SLOTS boundary so that
+	// it writes in big batches but well before the ring fills up
+	if (((DWORD)pos / WAKE_EVERY_SLOTS) != ((DWORD)(pos + n) / WAKE_EVERY_SLOTS))
+		SetEvent(log->wakeEvent);
+	return true;
+}
+
+void AsyncLogWrite(AsyncLog *log, const char *s, size_t len, bool flushNow)
+{
+	const size_t maxChunk = MAX_SLOTS_PER_MSG * ASYNC_LOG_SLOT_SIZE;
+	while (len > 0) {
+		size_t chunkLen = len;
+		if (chunkLen > maxChunk)
+			chunkLen = maxChunk;
+		if (!WriteChunk(log, s, chunkLen)) {
+			InterlockedIncrement(&log->dropped);
+			break;
+		}
+		s += chunkLen;
+		len -= chunkLen;
+	}
+	if (flushNow) {
+		InterlockedExchange(&log->flushRequested, 1);
+		SetEvent(log->wakeEvent);
+	}
+}
+
+void AsyncLogSetFlushInterval(AsyncLog *log, DWORD flushIntervalMs)
+{
+	InterlockedExchange(&log->flushIntervalMs, (LONG)flushIntervalMs);
+	SetEvent(log->wakeEvent);
+}
+
+void AsyncLogDrain(AsyncLog *log)
+{
+	// the writer might have crashed in the middle of DrainLocked()
+	if (GetCurrentThreadId() == log->threadId)
+		return;
+	EnterCriticalSection(&log->drainCs);
+	DrainLocked(log, true);
+	LeaveCriticalSection(&log->drainCs);
+}
+
+LONG AsyncLogDropped(AsyncLog *log)
+{
+	return log->dropped;
+}
+
+void AsyncLogSetRotateFunc(AsyncLog *log, AsyncLogRotateFunc func, void *ctx)
+{
+	EnterCriticalSection(&log->drainCs);
+	log->rotateFunc = func;
+	log->rotateCtx = ctx;
+	LeaveCriticalSection(&log->drainCs);
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef ASYNC_LOG_H__
+#define ASYNC_LOG_H__
+
+// Writes log messages to a file from a background thread. Loggers only
+// copy a message into a lock-free ring of fixed-size slots and return, the
+// writer thread drains the ring in batches with a single fwrite() and
+// fflush()es at most every flushIntervalMs (or right away when asked to).
+//
+// A message longer than a slot takes several consecutive slots, so it's
+// never interleaved with other messages. If the writer can't keep up
+// and the ring is full for more than ASYNC_LOG_FULL_WAIT_MS, the message
+// is dropped and counted.
+
+typedef struct AsyncLog AsyncLog;
+
+#define ASYNC_LOG_SLOTS					1024
+#define ASYNC_LOG_SLOT_SIZE				120
+#define ASYNC_LOG_FLUSH_INTERVAL_MS		1000
+#define ASYNC_LOG_FULL_WAIT_MS			100
+
+// <f> must stay open until AsyncLogFree(). It can be NULL if the log
+// couldn't be opened, messages are discarded until AsyncLogRotateFunc
+// opens it
+AsyncLog *	AsyncLogNew(FILE *f, DWORD flushIntervalMs);
+// writes out everything queued and stops the writer thread. Doesn't close
+// the file (which might have been replaced by AsyncLogRotateFunc)
+void		AsyncLogFree(AsyncLog *log);
+
+// <flushNow> wakes up the writer to write and fflush() right away
+void		AsyncLogWrite(AsyncLog *log, const char *s, size_t len, bool flushNow);
+void		AsyncLogSetFlushInterval(AsyncLog *log, DWORD flushIntervalMs);
+
+// Writes out everything queued so far and fflush()es, on the calling
+// thread. Meant for when the writer thread might not get a chance to, like
+// in a crash handler. Does nothing if called on the writer thread itself
+void		AsyncLogDrain(AsyncLog *log);
+
+// number of messages dropped because the ring was full
+LONG		AsyncLogDropped(AsyncLog *log);
+
+// Called on the writer thread after it writes a batch, e.g. to rotate the
+// log (see LogRotate.h). Returns the file to write to from now on, which
+// is <f> if nothing changed. If it returns NULL, messages are discarded
+// and it's called with NULL <f> again every time the writer wakes up,
+// before it writes
+typedef FILE *(*AsyncLogRotateFunc)(void *ctx, FILE *f);
+void		AsyncLogSetRotateFunc(AsyncLog *log, AsyncLogRotateFunc func, void *ctx);
+
+#endif
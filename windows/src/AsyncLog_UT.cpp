@@ -0,0 +1,173 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "AsyncLog.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+#include "UnitTests.h"
+
+#define THREADS_COUNT		4
+#define LINES_PER_THREAD	2000
+
+// returns the content of <f>, zero-terminated
+static char *ReadAll(FILE *f, size_t *lenOut)
+{
+	fflush(f);
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *s = (char*)malloc(len + 1);
+	if (!s)
+		return NULL;
+	*lenOut = fread(s, 1, len, f);
+	s[*lenOut] = 0;
+	return s;
+}
+
+static void async_log_order_ut()
+{
+	FILE *f = tmpfile();
+	if (!f)
+		return;
+	AsyncLog *log = AsyncLogNew(f, ASYNC_LOG_FLUSH_INTERVAL_MS);
+	utassert(NULL != log);
+	if (!log) {
+		fclose(f);
+		return;
+	}
+
+	// more lines than slots, so loggers have to wait for the writer
+	char buf[64];
+	for (int i=0; i < ASYNC_LOG_SLOTS * 3; i++) {
+		sprintf(buf, "line %d\n", i);
+		AsyncLogWrite(log, buf, strlen(buf), false);
+	}
+	// a message that takes more slots than one write can reserve
+	size_t bigLen = 10000;
+	char *big = (char*)malloc(bigLen);
+	for (size_t i=0; i < bigLen; i++)
+		big[i] = 'a' + (i % 26);
+	AsyncLogWrite(log, big, bigLen, true);
+	AsyncLogFree(log);
+
+	size_t len;
+	char *s = ReadAll(f, &len);
+	char *curr = s;
+	bool ok = true;
+	for (int i=0; ok && (i < ASYNC_LOG_SLOTS * 3); i++) {
+		sprintf(buf, "line %d\n", i);
+		ok = (0 == strncmp(curr, buf, strlen(buf)));
+		curr += strlen(buf);
+	}
+	utassert(ok);
+	utassert((size_t)(curr - s) + bigLen == len);
+	utassert(0 == memcmp(curr, big, bigLen));
+	free(s);
+	free(big);
+	fclose(f);
+}
+
+static void async_log_drain_ut()
+{
+	FILE *f = tmpfile();
+	if (!f)
+		return;
+	// never flushed by the writer on its own
+	AsyncLog *log = AsyncLogNew(f, INFINITE);
+	if (!log) {
+		fclose(f);
+		return;
+	}
+	const char *msg = "before crash\n";
+	AsyncLogWrite(log, msg, strlen(msg), false);
+	AsyncLogDrain(log);
+	size_t len;
+	char *s = ReadAll(f, &len);
+	utassert(streq(msg, s));
+	free(s);
+	AsyncLogFree(log);
+	fclose(f);
+}
+
+static AsyncLog *gThreadsLog;
+
+static DWORD WINAPI LoggerThread(LPVOID param)
+{
+	int threadNo = (int)(INT_PTR)param;
+	char buf[64];
+	for (int i=0; i < LINES_PER_THREAD; i++) {
+		sprintf(buf, "t%03d %05d\n", threadNo, i);
+		AsyncLogWrite(gThreadsLog, buf, strlen(buf), 0 == (i % 100));
+	}
+	return 0;
+}
+
+static void async_log_threads_ut()
+{
+	FILE *f = tmpfile();
+	if (!f)
+		return;
+	AsyncLog *log = AsyncLogNew(f, 10);
+	if (!log) {
+		fclose(f);
+		return;
+	}
+	gThreadsLog = log;
+	HANDLE threads[THREADS_COUNT];
+	int started = 0;
+	for (int i=0; i < THREADS_COUNT; i++) {
+		threads[i] = CreateThread(NULL, 0, LoggerThread, (LPVOID)(INT_PTR)i, 0, NULL);
+		if (threads[i])
+			started++;
+	}
+	for (int i=0; i < THREADS_COUNT; i++) {
+		if (threads[i]) {
+			WaitForSingleObject(threads[i], INFINITE);
+			CloseHandle(threads[i]);
+		}
+	}
+	utassert(0 == AsyncLogDropped(log));
+	AsyncLogFree(log);
+
+	// every line is intact, and lines of each thread are in order
+	size_t len;
+	char *s = ReadAll(f, &len);
+	int lines = 0;
+	bool ok = true;
+	int lastNo[THREADS_COUNT];
+	for (int i=0; i < dimof(lastNo); i++)
+		lastNo[i] = -1;
+	char *next = s;
+	char *line;
+	while (ok && (NULL != (line = StrSplitIter(&next, '\n')))) {
+		// after the last '\n'
+		if (strempty(line)) {
+			free(line);
+			continue;
+		}
+		int threadNo, no;
+		ok = (2 == sscanf(line, "t%d %d", &threadNo, &no)) && (10 == strlen(line));
+		ok = ok && (threadNo >= 0) && (threadNo < THREADS_COUNT);
+		if (ok)
+			ok = (no == lastNo[threadNo] + 1);
+		if (ok)
+			lastNo[threadNo] = no;
+		free(line);
+		lines++;
+	}
+	utassert(ok);
+	utassert(started * LINES_PER_THREAD == lines);
+	free(s);
+	fclose(f);
+}
+
+void async_log_ut_all()
+{
+	async_log_order_ut();
+	async_log_drain_ut();
+	async_log_threads_ut();
+}
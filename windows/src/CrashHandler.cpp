@@ -4,6 +4,7 @@
 
 #include "CrashHandler.h"
 #include "MiscUtil.h"
+#include "SimpleLog.h"
 #include "StrUtil.h"
 
 typedef BOOL WINAPI MiniDumpWriteProc(
@@ -115,6 +116,10 @@ static LONG WINAPI OpenDnsCrashHandler(EXCEPTION_POINTERS *exceptionInfo)
 
 	wasHere = true;
 
+	// the log is written by a background thread, make sure whatever was
+	// logged before the crash makes it to the file
+	SLogDrain();
+
 	// we either forgot to call InitDbgHelpDll() or it failed to obtain address of
 	// MiniDumpWriteDump(), so nothing we can do
 	if (NULL == g_minidDumpWriteProc)
@@ -0,0 +1,300 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "DnsClient.h"
+#include "DnsWire.h"
+#include "MiscUtil.h"
+#include "Sockets.h"
+#include "StrUtil.h"
+
+// over tcp the answer is prefixed with its length
+#define TCP_LEN_SIZE	2
+#define TCP_MAX			(0xffff + TCP_LEN_SIZE)
+
+typedef struct {
+	SOCKET	s;
+	WORD	id;
+	DWORD	startMs;
+} PendingQuery;
+
+static DnsServers	g_testServers;
+static bool			g_useTestServers;
+
+void DnsServersInit(DnsServers *servers)
+{
+	servers->count = 0;
+}
+
+bool DnsServersAdd(DnsServers *servers, const char *ip, WORD port)
+{
+	if (servers->count >= DNS_SERVERS_MAX)
+		return false;
+	DWORD addr = inet_addr(ip);
+	if ((INADDR_NONE == addr) || (INADDR_ANY == addr))
+		return false;
+	servers->addr[servers->count] = addr;
+	servers->port[servers->count] = port;
+	servers->count++;
+	return true;
+}
+
+bool DnsGetSystemServers(DnsServers *servers)
+{
+	DnsServersInit(servers);
+	ULONG size = 0;
+	if (ERROR_BUFFER_OVERFLOW != GetNetworkParams(NULL, &size))
+		return false;
+	FIXED_INFO *info = (FIXED_INFO*)malloc(size);
+	if (!info)
+		return false;
+	if (ERROR_SUCCESS == GetNetworkParams(info, &size)) {
+		for (IP_ADDR_STRING *a = &info->DnsServerList; a; a = a->Next)
+			DnsServersAdd(servers, a->IpAddress.String, DNS_PORT);
+	}
+	free(info);
+	return servers->count > 0;
+}
+
+bool DnsClientGetServers(DnsServers *serversOut)
+{
+	if (g_useTestServers) {
+		*serversOut = g_testServers;
+		return serversOut->count > 0;
+	}
+	return DnsGetSystemServers(serversOut);
+}
+
+void DnsClientSetServers(const DnsServers *servers)
+{
+	g_useTestServers = (NULL != servers);
+	if (servers)
+		g_testServers = *servers;
+}
+
+// Not crypto-strength, but together with the random source port the os
+// gives us it's plenty for telling our answers from stray packets
+static WORD NewQueryId()
+{
+	static DWORD state;
+	if (0 == state)
+		state = GetTickCount() ^ (GetCurrentProcessId() << 16);
+	state = state * 1103515245 + 12345;
+	return (WORD)(state >> 16);
+}
+
+static SOCKET Connect(const DnsServers *servers, int n, int type)
+{
+	SOCKET s = socket(AF_INET, type, 0);
+	if (INVALID_SOCKET == s)
+		return INVALID_SOCKET;
+	if (!SocketSetNonBlocking(s))
+		goto Error;
+	struct sockaddr_in addr;
+	memzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = servers->addr[n];
+	addr.sin_port = htons(servers->port[n]);
+	// a connected udp socket only gets packets from the server and learns
+	// about port unreachable
+	if ((0 != connect(s, (struct sockaddr*)&addr, sizeof(addr))) && !SocketInProgress(SocketLastError()))
+		goto Error;
+	return s;
+Error:
+	closesocket(s);
+	return INVALID_SOCKET;
+}
+
+static bool SendUdpQuery(PendingQuery *q, const char *name, const DnsServers *servers, int n)
+{
+	BYTE query[DNS_WIRE_UDP_MAX];
+	q->id = NewQueryId();
+	q->startMs = GetTickCount();
+	int len = DnsWireEncodeQuery(q->id, name, DNS_WIRE_RR_A, query, sizeof(query));
+	if (0 == len)
+		return false;
+	q->s = Connect(servers, n, SOCK_DGRAM);
+	if (INVALID_SOCKET == q->s)
+		return false;
+	if (len == send(q->s, (const char*)query, len, 0))
+		return true;
+	closesocket(q->s);
+	q->s = INVALID_SOCKET;
+	return false;
+}
+
+static DWORD MsLeft(DWORD startMs, DWORD timeoutMs)
+{
+	DWORD passedMs = GetTickCount() - startMs;
+	if (passedMs >= timeoutMs)
+		return 0;
+	return timeoutMs - passedMs;
+}
+
+// sends or receives all <len> bytes before the deadline
+static bool TcpTransfer(SOCKET s, BYTE *buf, int len, bool isSend, DWORD startMs, DWORD timeoutMs)
+{
+	while (len > 0) {
+		int n = isSend ? send(s, (const char*)buf, len, 0) : recv(s, (char*)buf, len, 0);
+		if (n > 0) {
+			buf += n;
+			len -= n;
+			continue;
+		}
+		if ((0 == n) || !SocketWouldBlock(SocketLastError()))
+			return false;
+		DWORD leftMs = MsLeft(startMs, timeoutMs);
+		if ((0 == leftMs) || !SocketWait(s, isSend, leftMs))
+			return false;
+	}
+	return true;
+}
+
+// asks server <n> again over tcp after it said the answer didn't fit in udp
+static DnsWireResult QueryTcp(const char *name, const DnsServers *servers, int n, DWORD startMs, DWORD timeoutMs, IP4_ADDRESS *ipOut)
+{
+	DnsWireResult res = DnsWireServerError;
+	BYTE *buf = NULL;
+	BYTE query[TCP_LEN_SIZE + DNS_WIRE_UDP_MAX];
+	BYTE respLen[TCP_LEN_SIZE];
+	DWORD leftMs;
+	int err = 0;
+	socklen_t errLen = sizeof(err);
+	WORD id = NewQueryId();
+	int len = DnsWireEncodeQuery(id, name, DNS_WIRE_RR_A, query + TCP_LEN_SIZE, DNS_WIRE_UDP_MAX);
+	if (0 == len)
+		return DnsWireServerError;
+	query[0] = (BYTE)(len >> 8);
+	query[1] = (BYTE)len;
+
+	SOCKET s = Connect(servers, n, SOCK_STREAM);
+	if (INVALID_SOCKET == s)
+		return DnsWireServerError;
+	leftMs = MsLeft(startMs, timeoutMs);
+	if ((0 == leftMs) || !SocketWait(s, true, leftMs))
+		goto Exit;
+	if ((0 != getsockopt(s, SOL_SOCKET, SO_ERROR, (char*)&err, &errLen)) || (0 != err))
+		goto Exit;
+	if (!TcpTransfer(s, query, TCP_LEN_SIZE + len, true, startMs, timeoutMs))
+		goto Exit;
+	if (!TcpTransfer(s, respLen, TCP_LEN_SIZE, false, startMs, timeoutMs))
+		goto Exit;
+	len = (respLen[0] << 8) | respLen[1];
+	buf = (BYTE*)malloc(len ? len : 1);
+	if (!buf || !TcpTransfer(s, buf, len, false, startMs, timeoutMs))
+		goto Exit;
+	res = DnsWireParseResponse(buf, len, id, name, ipOut);
+	// the server can't do better than that
+	if ((DnsWireTruncated == res) || (DnsWireMalformed == res))
+		res = DnsWireServerError;
+Exit:
+	free(buf);
+	closesocket(s);
+	return res;
+}
+
+int DnsClientResolveA(const char *name, const DnsServers *servers, const DnsClientOptions *opts, IP4_ADDRESS *ipOut)
+{
+	DnsClientOptions defaultOpts = { DNS_QUERY_TIMEOUT_MS, DNS_HEDGE_DELAY_MS };
+	if (!opts)
+		opts = &defaultOpts;
+	if (!SocketsInit())
+		return DNS_QUERY_ERROR;
+
+	PendingQuery queries[DNS_SERVERS_MAX];
+	int count = servers->count;
+	if (count > DNS_SERVERS_MAX)
+		count = DNS_SERVERS_MAX;
+	int started = 0;
+	int pending = 0;
+	DWORD lastStartMs = 0;
+	int result = DNS_QUERY_ERROR;
+	BYTE buf[DNS_WIRE_UDP_MAX];
+
+	for (;;) {
+		DWORD nowMs = GetTickCount();
+		// ask the next server if nobody is left to answer or the last one
+		// is taking too long
+		if ((started < count) && ((0 == pending) || (nowMs - lastStartMs >= opts->hedgeDelayMs))) {
+			PendingQuery *q = &queries[started];
+			if (SendUdpQuery(q, name, servers, started))
+				pending++;
+			else
+				q->s = INVALID_SOCKET;
+			started++;
+			lastStartMs = nowMs;
+			continue;
+		}
+		if (0 == pending)
+			break;
+
+		DWORD waitMs = opts->queryTimeoutMs;
+		if (started < count)
+			waitMs = opts->hedgeDelayMs - (nowMs - lastStartMs);
+		fd_set fds;
+		FD_ZERO(&fds);
+		int maxFd = 0;
+		for (int i=0; i < started; i++) {
+			PendingQuery *q = &queries[i];
+			if (INVALID_SOCKET == q->s)
+				continue;
+			DWORD leftMs = MsLeft(q->startMs, opts->queryTimeoutMs);
+			if (0 == leftMs) {
+				closesocket(q->s);
+				q->s = INVALID_SOCKET;
+				pending--;
+				continue;
+			}
+			if (leftMs < waitMs)
+				waitMs = leftMs;
+			FD_SET(q->s, &fds);
+			if ((int)q->s > maxFd)
+				maxFd = (int)q->s;
+		}
+		if (0 == pending)
+			continue;
+		struct timeval tv;
+		tv.tv_sec = waitMs / 1000;
+		tv.tv_usec = (waitMs % 1000) * 1000;
+		if (select(maxFd + 1, &fds, NULL, NULL, &tv) <= 0)
+			continue;
+
+		for (int i=0; i < started; i++) {
+			PendingQuery *q = &queries[i];
+			if ((INVALID_SOCKET == q->s) || !FD_ISSET(q->s, &fds))
+				continue;
+			int len = recv(q->s, (char*)buf, sizeof(buf), 0);
+			if ((len < 0) && SocketWouldBlock(SocketLastError()))
+				continue;
+			DnsWireResult res = DnsWireServerError;
+			if (len > 0)
+				res = DnsWireParseResponse(buf, len, q->id, name, ipOut);
+			if (DnsWireTruncated == res)
+				res = QueryTcp(name, servers, i, q->startMs, opts->queryTimeoutMs, ipOut);
+			// someone else's packet, keep waiting for ours
+			if (DnsWireMalformed == res)
+				continue;
+			if (DnsWireServerError == res) {
+				closesocket(q->s);
+				q->s = INVALID_SOCKET;
+				pending--;
+				continue;
+			}
+			if (DnsWireAddress == res)
+				result = DNS_QUERY_OK;
+			else if ((DnsWireNxDomain == res) || (DnsWireNoAddress == res))
+				result = DNS_QUERY_NO_A_RECORD;
+			else
+				result = DNS_QUERY_ERROR;
+			goto Exit;
+		}
+	}
+Exit:
+	for (int i=0; i < started; i++) {
+		if (INVALID_SOCKET != queries[i].s)
+			closesocket(queries[i].s);
+	}
+	return result;
+}
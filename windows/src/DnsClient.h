@@ -0,0 +1,61 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DNS_CLIENT_H__
+#define DNS_CLIENT_H__
+
+#include "DnsQuery.h"
+
+/* A small dns client for looking up A records, i.e. "myip.opendns.com".
+
+Queries go over non-blocking udp straight to the dns servers the computer
+is configured with, so that the lookup still tells whether we're using
+OpenDNS. A truncated udp answer is asked for again over tcp.
+
+Queries are hedged: we ask the first server and if it doesn't answer
+within hedgeDelayMs, we ask the next one too and so on. The first real
+answer (an address, NXDOMAIN or no records) wins. A server that fails
+(SERVFAIL, REFUSED, port unreachable) gets the next one asked right away.
+Each server gets queryTimeoutMs to answer.
+*/
+
+#define DNS_SERVERS_MAX			4
+#define DNS_PORT				53
+
+#define DNS_QUERY_TIMEOUT_MS	(3*1000)
+#define DNS_HEDGE_DELAY_MS		500
+
+typedef struct {
+	// in network byte order, as in sockaddr_in
+	DWORD	addr[DNS_SERVERS_MAX];
+	// in host byte order
+	WORD	port[DNS_SERVERS_MAX];
+	int		count;
+} DnsServers;
+
+typedef struct {
+	DWORD	queryTimeoutMs;
+	DWORD	hedgeDelayMs;
+} DnsClientOptions;
+
+void	DnsServersInit(DnsServers *servers);
+// <ip> is dotted. Returns false if it isn't valid or there's no more room
+bool	DnsServersAdd(DnsServers *servers, const char *ip, WORD port);
+// the DNS servers GetNetworkParams() reports for this machine
+bool	DnsGetSystemServers(DnsServers *servers);
+
+// Returns DNS_QUERY_OK, DNS_QUERY_NO_A_RECORD (NXDOMAIN or no A record
+// among the answers) or DNS_QUERY_ERROR (no answer, only failures or the
+// name exists but has no records at all), the same as the system's
+// DnsQuery(). <opts> can be NULL for the defaults
+int		DnsClientResolveA(const char *name, const DnsServers *servers, const DnsClientOptions *opts, IP4_ADDRESS *ipOut);
+
+// the servers dns_query() uses: those given to DnsClientSetServers() or
+// the system's
+bool	DnsClientGetServers(DnsServers *serversOut);
+// for tests, e.g. to point dns_query() at a local server. NULL restores
+// the system's servers
+void	DnsClientSetServers(const DnsServers *servers);
+
+#endif
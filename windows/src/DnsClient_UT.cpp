@@ -0,0 +1,339 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "DnsClient.h"
+#include "DnsWire.h"
+#include "MiscUtil.h"
+#include "Sockets.h"
+
+#include "UnitTests.h"
+
+#define TEST_NAME	"myip.opendns.com"
+#define TEST_IP		0x01020304
+
+static const BYTE gQuestion[] = {
+	4, 'm', 'y', 'i', 'p', 7, 'o', 'p', 'e', 'n', 'd', 'n', 's', 3, 'c', 'o', 'm', 0,
+	0, DNS_WIRE_RR_A, 0, DNS_WIRE_CLASS_IN
+};
+
+// "A, IN, ttl 60, 1.2.3.4" after the name
+static const BYTE gARecord[] = { 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 1, 2, 3, 4 };
+
+// header of a response to query 0x1234 with <answers> answers
+static int PutHeader(BYTE *buf, BYTE flags2, int answers)
+{
+	BYTE header[DNS_WIRE_HEADER_SIZE] = { 0x12, 0x34, 0x81, flags2, 0, 1, 0, (BYTE)answers, 0, 0, 0, 0 };
+	memcpy(buf, header, sizeof(header));
+	memcpy(buf + sizeof(header), gQuestion, sizeof(gQuestion));
+	return sizeof(header) + sizeof(gQuestion);
+}
+
+static int Put(BYTE *buf, int off, const BYTE *data, int len)
+{
+	memcpy(buf + off, data, len);
+	return off + len;
+}
+
+static void dns_wire_encode_ut()
+{
+	BYTE buf[DNS_WIRE_UDP_MAX];
+	int len = DnsWireEncodeQuery(0x1234, TEST_NAME, DNS_WIRE_RR_A, buf, sizeof(buf));
+	utassert(DNS_WIRE_HEADER_SIZE + sizeof(gQuestion) == len);
+	utassert((0x12 == buf[0]) && (0x34 == buf[1]) && (0x01 == buf[2]) && (1 == buf[5]));
+	utassert(0 == memcmp(buf + DNS_WIRE_HEADER_SIZE, gQuestion, sizeof(gQuestion)));
+	// the trailing dot doesn't change anything
+	len = DnsWireEncodeQuery(0x1234, TEST_NAME ".", DNS_WIRE_RR_A, buf, sizeof(buf));
+	utassert(DNS_WIRE_HEADER_SIZE + sizeof(gQuestion) == len);
+
+	utassert(0 == DnsWireEncodeQuery(1, "", DNS_WIRE_RR_A, buf, sizeof(buf)));
+	utassert(0 == DnsWireEncodeQuery(1, "a..com", DNS_WIRE_RR_A, buf, sizeof(buf)));
+	utassert(0 == DnsWireEncodeQuery(1, TEST_NAME, DNS_WIRE_RR_A, buf, 20));
+	char label[70];
+	memset(label, 'a', 64);
+	strcpy(label + 64, ".com");
+	utassert(0 == DnsWireEncodeQuery(1, label, DNS_WIRE_RR_A, buf, sizeof(buf)));
+}
+
+static void dns_wire_parse_ut()
+{
+	BYTE buf[DNS_WIRE_UDP_MAX];
+	IP4_ADDRESS ip = 0;
+	// the answer's name is a pointer to the question
+	const BYTE ptr[] = { 0xc0, DNS_WIRE_HEADER_SIZE };
+	int len = PutHeader(buf, 0x80, 1);
+	len = Put(buf, len, ptr, sizeof(ptr));
+	len = Put(buf, len, gARecord, sizeof(gARecord));
+	utassert(DnsWireAddress == DnsWireParseResponse(buf, len, 0x1234, TEST_NAME, &ip));
+	utassert(TEST_IP == ip);
+	utassert(DnsWireAddress == DnsWireParseResponse(buf, len, 0x1234, "MyIp.OpenDNS.com.", &ip));
+	// not ours
+	utassert(DnsWireMalformed == DnsWireParseResponse(buf, len, 0x1235, TEST_NAME, &ip));
+	utassert(DnsWireMalformed == DnsWireParseResponse(buf, len, 0x1234, "opendns.com", &ip));
+	utassert(DnsWireMalformed == DnsWireParseResponse(buf, len - 1, 0x1234, TEST_NAME, &ip));
+	buf[2] &= 0x7f;
+	utassert(DnsWireMalformed == DnsWireParseResponse(buf, len, 0x1234, TEST_NAME, &ip));
+
+	// "myip.opendns.com CNAME a.opendns.com", "a.opendns.com A 1.2.3.4"
+	const BYTE cname[] = { 0xc0, DNS_WIRE_HEADER_SIZE, 0, 5, 0, 1, 0, 0, 0, 60, 0, 4, 1, 'a', 0xc0, DNS_WIRE_HEADER_SIZE + 5 };
+	const BYTE cnameTarget[] = { 0xc0, DNS_WIRE_HEADER_SIZE + sizeof(gQuestion) + 12 };
+	len = PutHeader(buf, 0x80, 2);
+	len = Put(buf, len, cname, sizeof(cname));
+	len = Put(buf, len, cnameTarget, sizeof(cnameTarget));
+	len = Put(buf, len, gARecord, sizeof(gARecord));
+	ip = 0;
+	utassert(DnsWireAddress == DnsWireParseResponse(buf, len, 0x1234, TEST_NAME, &ip));
+	utassert(TEST_IP == ip);
+	// an A record for a name we didn't ask about doesn't count
+	len = PutHeader(buf, 0x80, 1);
+	len = Put(buf, len, cname + 12, 4);
+	len = Put(buf, len, gARecord, sizeof(gARecord));
+	utassert(DnsWireNoAddress == DnsWireParseResponse(buf, len, 0x1234, TEST_NAME, &ip));
+
+	len = PutHeader(buf, 0x83, 0);
+	utassert(DnsWireNxDomain == DnsWireParseResponse(buf, len, 0x1234, TEST_NAME, &ip));
+	len = PutHeader(buf, 0x80, 0);
+	utassert(DnsWireNoData == DnsWireParseResponse(buf, len, 0x1234, TEST_NAME, &ip));
+	len = PutHeader(buf, 0x82, 0);
+	utassert(DnsWireServerError == DnsWireParseResponse(buf, len, 0x1234, TEST_NAME, &ip));
+	len = PutHeader(buf, 0x80, 1);
+	buf[2] |= 0x02;
+	utassert(DnsWireTruncated == DnsWireParseResponse(buf, len, 0x1234, TEST_NAME, &ip));
+
+	// a pointer to itself
+	len = PutHeader(buf, 0x80, 1);
+	const BYTE loop[] = { 0xc0, (BYTE)len };
+	len = Put(buf, len, loop, sizeof(loop));
+	len = Put(buf, len, gARecord, sizeof(gARecord));
+	utassert(DnsWireMalformed == DnsWireParseResponse(buf, len, 0x1234, TEST_NAME, &ip));
+}
+
+enum StubMode {
+	StubAnswer,
+	StubNxDomain,
+	StubServFail,
+	StubSilent,
+	// truncated over udp, answers over tcp
+	StubTruncated
+};
+
+// a dns server on 127.0.0.1 that answers every query according to <mode>
+typedef struct {
+	SOCKET			udp;
+	SOCKET			tcp;
+	WORD			port;
+	StubMode		mode;
+	volatile LONG	stop;
+	HANDLE			thread;
+} StubServer;
+
+static int StubResponse(StubServer *srv, const BYTE *query, int queryLen, bool overTcp, BYTE *resp)
+{
+	if (queryLen < DNS_WIRE_HEADER_SIZE)
+		return 0;
+	memcpy(resp, query, queryLen);
+	// QR, RD and RA
+	resp[2] = 0x81;
+	resp[3] = 0x80;
+	int len = queryLen;
+	if (StubNxDomain == srv->mode)
+		resp[3] |= 3;
+	else if (StubServFail == srv->mode)
+		resp[3] |= 2;
+	else if ((StubTruncated == srv->mode) && !overTcp)
+		resp[2] |= 0x02;
+	else {
+		resp[7] = 1;
+		const BYTE ptr[] = { 0xc0, DNS_WIRE_HEADER_SIZE };
+		len = Put(resp, len, ptr, sizeof(ptr));
+		len = Put(resp, len, gARecord, sizeof(gARecord));
+	}
+	return len;
+}
+
+static void StubAnswerTcp(StubServer *srv)
+{
+	SOCKET s = accept(srv->tcp, NULL, NULL);
+	if (INVALID_SOCKET == s)
+		return;
+	BYTE query[DNS_WIRE_UDP_MAX + 2];
+	BYTE resp[DNS_WIRE_UDP_MAX + 2];
+	int len = 0;
+	// tiny queries, they come at once
+	if (SocketWait(s, false, 1000))
+		len = recv(s, (char*)query, sizeof(query), 0);
+	if (len > 2) {
+		int respLen = StubResponse(srv, query + 2, len - 2, true, resp + 2);
+		resp[0] = (BYTE)(respLen >> 8);
+		resp[1] = (BYTE)respLen;
+		send(s, (const char*)resp, respLen + 2, 0);
+	}
+	closesocket(s);
+}
+
+static DWORD WINAPI StubServerThread(LPVOID param)
+{
+	StubServer *srv = (StubServer*)param;
+	BYTE query[DNS_WIRE_UDP_MAX];
+	BYTE resp[DNS_WIRE_UDP_MAX];
+	while (!srv->stop) {
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(srv->udp, &fds);
+		FD_SET(srv->tcp, &fds);
+		struct timeval tv = { 0, 20*1000 };
+		SOCKET maxFd = (srv->udp > srv->tcp) ? srv->udp : srv->tcp;
+		if (select((int)maxFd + 1, &fds, NULL, NULL, &tv) <= 0)
+			continue;
+		if (FD_ISSET(srv->tcp, &fds))
+			StubAnswerTcp(srv);
+		if (!FD_ISSET(srv->udp, &fds))
+			continue;
+		struct sockaddr_in from;
+		socklen_t fromLen = sizeof(from);
+		int len = recvfrom(srv->udp, (char*)query, sizeof(query), 0, (struct sockaddr*)&from, &fromLen);
+		if ((len <= 0) || (StubSilent == srv->mode))
+			continue;
+		len = StubResponse(srv, query, len, false, resp);
+		sendto(srv->udp, (const char*)resp, len, 0, (struct sockaddr*)&from, fromLen);
+	}
+	return 0;
+}
+
+static bool StubServerStart(StubServer *srv, StubMode mode)
+{
+	memzero(srv, sizeof(*srv));
+	srv->mode = mode;
+	srv->udp = socket(AF_INET, SOCK_DGRAM, 0);
+	srv->tcp = socket(AF_INET, SOCK_STREAM, 0);
+	if ((INVALID_SOCKET == srv->udp) || (INVALID_SOCKET == srv->tcp))
+		return false;
+	struct sockaddr_in addr;
+	memzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	socklen_t addrLen = sizeof(addr);
+	if (0 != bind(srv->udp, (struct sockaddr*)&addr, sizeof(addr)))
+		return false;
+	if (0 != getsockname(srv->udp, (struct sockaddr*)&addr, &addrLen))
+		return false;
+	srv->port = ntohs(addr.sin_port);
+	// the same port for tcp, like a real server
+	if ((0 != bind(srv->tcp, (struct sockaddr*)&addr, sizeof(addr))) || (0 != listen(srv->tcp, 4)))
+		return false;
+	srv->thread = CreateThread(NULL, 0, StubServerThread, srv, 0, NULL);
+	return NULL != srv->thread;
+}
+
+static void StubServerStop(StubServer *srv)
+{
+	srv->stop = 1;
+	if (srv->thread) {
+		WaitForSingleObject(srv->thread, INFINITE);
+		CloseHandle(srv->thread);
+	}
+	if (INVALID_SOCKET != srv->udp)
+		closesocket(srv->udp);
+	if (INVALID_SOCKET != srv->tcp)
+		closesocket(srv->tcp);
+}
+
+static void AddStub(DnsServers *servers, StubServer *srv)
+{
+	DnsServersAdd(servers, "127.0.0.1", srv->port);
+}
+
+static void dns_client_ut()
+{
+	if (!SocketsInit())
+		return;
+	StubServer answer, nx, servFail, silent, truncated;
+	// all of them, so that they can all be stopped
+	bool ok = StubServerStart(&answer, StubAnswer);
+	ok = StubServerStart(&nx, StubNxDomain) && ok;
+	ok = StubServerStart(&servFail, StubServFail) && ok;
+	ok = StubServerStart(&silent, StubSilent) && ok;
+	ok = StubServerStart(&truncated, StubTruncated) && ok;
+	utassert(ok);
+	if (!ok)
+		goto Exit;
+
+	DnsServers servers;
+	DnsClientOptions opts;
+	IP4_ADDRESS ip;
+	int res;
+	DWORD startMs;
+	opts.queryTimeoutMs = 2000;
+	opts.hedgeDelayMs = 50;
+
+	DnsServersInit(&servers);
+	AddStub(&servers, &answer);
+	ip = 0;
+	res = DnsClientResolveA(TEST_NAME, &servers, &opts, &ip);
+	utassert((DNS_QUERY_OK == res) && (TEST_IP == ip));
+
+	DnsServersInit(&servers);
+	AddStub(&servers, &nx);
+	res = DnsClientResolveA(TEST_NAME, &servers, &opts, &ip);
+	utassert(DNS_QUERY_NO_A_RECORD == res);
+
+	DnsServersInit(&servers);
+	AddStub(&servers, &truncated);
+	ip = 0;
+	res = DnsClientResolveA(TEST_NAME, &servers, &opts, &ip);
+	utassert((DNS_QUERY_OK == res) && (TEST_IP == ip));
+
+	// the second server is asked after the hedge delay, long before the
+	// first one times out
+	DnsServersInit(&servers);
+	AddStub(&servers, &silent);
+	AddStub(&servers, &answer);
+	startMs = GetTickCount();
+	res = DnsClientResolveA(TEST_NAME, &servers, &opts, &ip);
+	utassert(DNS_QUERY_OK == res);
+	utassert(GetTickCount() - startMs < opts.queryTimeoutMs);
+
+	// a failing server gets the next one asked right away
+	DnsServersInit(&servers);
+	AddStub(&servers, &servFail);
+	AddStub(&servers, &nx);
+	opts.hedgeDelayMs = 5000;
+	startMs = GetTickCount();
+	res = DnsClientResolveA(TEST_NAME, &servers, &opts, &ip);
+	utassert(DNS_QUERY_NO_A_RECORD == res);
+	utassert(GetTickCount() - startMs < 1000);
+
+	// nobody answers: an error, not NXDOMAIN
+	DnsServersInit(&servers);
+	AddStub(&servers, &silent);
+	AddStub(&servers, &servFail);
+	opts.queryTimeoutMs = 200;
+	opts.hedgeDelayMs = 50;
+	res = DnsClientResolveA(TEST_NAME, &servers, &opts, &ip);
+	utassert(DNS_QUERY_ERROR == res);
+
+	// dns_query() can be pointed at the stub too
+	DnsServersInit(&servers);
+	AddStub(&servers, &answer);
+	DnsClientSetServers(&servers);
+	ip = 0;
+	res = dns_query(TEST_NAME, &ip);
+	utassert((DNS_QUERY_OK == res) && (TEST_IP == ip));
+	DnsClientSetServers(NULL);
+
+Exit:
+	StubServerStop(&answer);
+	StubServerStop(&nx);
+	StubServerStop(&servFail);
+	StubServerStop(&silent);
+	StubServerStop(&truncated);
+}
+
+void dns_client_ut_all()
+{
+	dns_wire_encode_ut();
+	dns_wire_parse_ut();
+	dns_client_ut();
+}
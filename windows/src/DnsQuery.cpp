@@ -4,10 +4,12 @@
 
 #include "stdafx.h"
 #include "dnsquery.h"
+#include "DnsClient.h"
 #include "MiscUtil.h"
 #include "StrUtil.h"
 
-int dns_query(const char *nameAscii, IP4_ADDRESS *ip4ut)
+// lets the system do the query, for when we don't know its dns servers
+static int dns_query_system(const char *nameAscii, IP4_ADDRESS *ip4ut)
 {
 	PDNS_RECORD records, cursor;
 	TCHAR *name = StrToTStr(nameAscii);
@@ -44,3 +46,23 @@ int dns_query(const char *nameAscii, IP4_ADDRESS *ip4ut)
 		return DNS_QUERY_NO_A_RECORD;
 	return DNS_QUERY_OK;
 }
+
+int dns_query(const char *nameAscii, IP4_ADDRESS *ip4ut)
+{
+	DnsServers servers;
+	if (DnsClientGetServers(&servers))
+		return DnsClientResolveA(nameAscii, &servers, NULL, ip4ut);
+	return dns_query_system(nameAscii, ip4ut);
+}
+
+IP4_ADDRESS GetMyIp()
+{
+	IP4_ADDRESS myIp;
+	int res = dns_query("myip.opendns.com", &myIp);
+	if (DNS_QUERY_OK == res)
+		return myIp;
+	if (DNS_QUERY_NO_A_RECORD == res)
+		return IP_NOT_USING_OPENDNS;
+	assert(DNS_QUERY_ERROR == res);
+	return IP_DNS_RESOLVE_ERROR;
+}
@@ -12,6 +12,35 @@ enum {
 	DNS_QUERY_ERROR
 };
 
+// Asks the dns servers of this computer directly (see DnsClient.h), or
+// lets the system do it if we can't tell which servers it uses
 int dns_query(const char *nameAscii, IP4_ADDRESS *ip4ut);
 
+// special values for IP4_ADDRESS
+enum {
+	// we haven't had a chance to dns resolve "myip.opends.com"
+	IP_UNKNOWN  = 0,
+	// we resolved "myip.opendns.com" but got NX record. That means
+	// we're not using OpenDNS dns server
+	IP_NOT_USING_OPENDNS = 1,
+	// we try to resolve "myip.opendns.com" but got generic dns error
+	// this usually indicates network connection problems
+	IP_DNS_RESOLVE_ERROR = 2
+};
+
+static inline bool RealIpAddress(IP4_ADDRESS ipAddr)
+{
+	if (ipAddr > IP_DNS_RESOLVE_ERROR)
+		return true;
+	return false;
+}
+
+// ips from dns are in network byte order, 1.2.3.4 is 0x04030201
+static inline IP4_ADDRESS Ip4NetworkToHostOrder(IP4_ADDRESS ip)
+{
+	return ((ip & 0xff) << 24) | ((ip & 0xff00) << 8) | ((ip >> 8) & 0xff00) | (ip >> 24);
+}
+
+IP4_ADDRESS GetMyIp();
+
 #endif
@@ -0,0 +1,190 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "DnsWire.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+#define FLAG_QR			0x8000
+#define FLAG_TC			0x0200
+#define FLAG_RD			0x0100
+#define RCODE_MASK		0x000f
+
+#define RCODE_NOERROR	0
+#define RCODE_NXDOMAIN	3
+
+#define LABEL_MAX		63
+#define LABEL_POINTER	0xc0
+
+// a name can't have more labels than that, so more pointers than that
+// means a loop
+#define MAX_LABELS		128
+
+static inline WORD Get16(const BYTE *p)
+{
+	return (WORD)((p[0] << 8) | p[1]);
+}
+
+static inline void Put16(BYTE *p, WORD v)
+{
+	p[0] = (BYTE)(v >> 8);
+	p[1] = (BYTE)v;
+}
+
+int DnsWireEncodeQuery(WORD id, const char *name, WORD type, BYTE *buf, int bufSize)
+{
+	size_t nameLen = strlen(name);
+	if ((nameLen > 0) && ('.' == name[nameLen - 1]))
+		nameLen--;
+	if ((0 == nameLen) || (nameLen > DNS_WIRE_NAME_MAX))
+		return 0;
+	// labels take as much as the dots between them plus the length of the
+	// first label and the terminating zero
+	int len = DNS_WIRE_HEADER_SIZE + (int)nameLen + 2 + 4;
+	if (len > bufSize)
+		return 0;
+
+	memzero(buf, DNS_WIRE_HEADER_SIZE);
+	Put16(buf, id);
+	Put16(buf + 2, FLAG_RD);
+	// one question
+	Put16(buf + 4, 1);
+
+	BYTE *out = buf + DNS_WIRE_HEADER_SIZE;
+	const char *label = name;
+	const char *end = name + nameLen;
+	while (label <= end) {
+		const char *dot = label;
+		while ((dot < end) && ('.' != *dot))
+			dot++;
+		size_t labelLen = dot - label;
+		if ((0 == labelLen) || (labelLen > LABEL_MAX))
+			return 0;
+		*out++ = (BYTE)labelLen;
+		memcpy(out, label, labelLen);
+		out += labelLen;
+		label = dot + 1;
+	}
+	*out++ = 0;
+	Put16(out, type);
+	Put16(out + 2, DNS_WIRE_CLASS_IN);
+	out += 4;
+	return (int)(out - buf);
+}
+
+// Decodes the possibly compressed name at <*offInOut> into <nameOut> in
+// text form, without the trailing dot, and advances <*offInOut> past it
+static bool ReadName(const BYTE *buf, int len, int *offInOut, char *nameOut)
+{
+	int off = *offInOut;
+	// where the name ends in the record, which is where the first pointer is
+	int next = -1;
+	int nameLen = 0;
+	for (int labels = 0; labels < MAX_LABELS; labels++) {
+		if (off >= len)
+			return false;
+		BYTE labelLen = buf[off];
+		if (LABEL_POINTER == (labelLen & LABEL_POINTER)) {
+			if (off + 2 > len)
+				return false;
+			if (-1 == next)
+				next = off + 2;
+			off = Get16(buf + off) & 0x3fff;
+			continue;
+		}
+		if (labelLen > LABEL_MAX)
+			return false;
+		off++;
+		if (0 == labelLen) {
+			nameOut[nameLen] = 0;
+			*offInOut = (-1 == next) ? off : next;
+			return true;
+		}
+		if (off + labelLen > len)
+			return false;
+		if (nameLen + (nameLen ? 1 : 0) + labelLen > DNS_WIRE_NAME_MAX)
+			return false;
+		if (nameLen)
+			nameOut[nameLen++] = '.';
+		memcpy(nameOut + nameLen, buf + off, labelLen);
+		nameLen += labelLen;
+		off += labelLen;
+	}
+	return false;
+}
+
+// dns names are case-insensitive and <name> can have the trailing dot
+static bool NameEq(const char *name, const char *wireName)
+{
+	size_t len = strlen(name);
+	if ((len > 0) && ('.' == name[len - 1]))
+		len--;
+	if (len != strlen(wireName))
+		return false;
+	return 0 == _strnicmp(name, wireName, len);
+}
+
+DnsWireResult DnsWireParseResponse(const BYTE *buf, int len, WORD id, const char *name, IP4_ADDRESS *ipOut)
+{
+	char rrName[DNS_WIRE_NAME_MAX + 1];
+	char target[DNS_WIRE_NAME_MAX + 1];
+
+	if (len < DNS_WIRE_HEADER_SIZE)
+		return DnsWireMalformed;
+	WORD flags = Get16(buf + 2);
+	if ((Get16(buf) != id) || !(flags & FLAG_QR))
+		return DnsWireMalformed;
+	if (1 != Get16(buf + 4))
+		return DnsWireMalformed;
+	int answers = Get16(buf + 6);
+
+	// the question must be ours
+	int off = DNS_WIRE_HEADER_SIZE;
+	if (!ReadName(buf, len, &off, rrName) || (off + 4 > len))
+		return DnsWireMalformed;
+	if (!NameEq(name, rrName) || (DNS_WIRE_RR_A != Get16(buf + off)))
+		return DnsWireMalformed;
+	off += 4;
+
+	if (flags & FLAG_TC)
+		return DnsWireTruncated;
+	WORD rcode = flags & RCODE_MASK;
+	if (RCODE_NXDOMAIN == rcode)
+		return DnsWireNxDomain;
+	if (RCODE_NOERROR != rcode)
+		return DnsWireServerError;
+	if (0 == answers)
+		return DnsWireNoData;
+
+	// the A record is for <name> or the CNAME it points to, which come in
+	// the order of the chain
+	const char *wanted = name;
+	for (int i=0; i < answers; i++) {
+		if (!ReadName(buf, len, &off, rrName) || (off + 10 > len))
+			return DnsWireMalformed;
+		WORD type = Get16(buf + off);
+		WORD klass = Get16(buf + off + 2);
+		WORD rdLen = Get16(buf + off + 8);
+		off += 10;
+		if (off + rdLen > len)
+			return DnsWireMalformed;
+		if ((DNS_WIRE_CLASS_IN == klass) && NameEq(wanted, rrName)) {
+			if ((DNS_WIRE_RR_A == type) && (4 == rdLen)) {
+				const BYTE *a = buf + off;
+				*ipOut = ((IP4_ADDRESS)a[0] << 24) | (a[1] << 16) | (a[2] << 8) | a[3];
+				return DnsWireAddress;
+			}
+			if (DNS_WIRE_RR_CNAME == type) {
+				int targetOff = off;
+				if (!ReadName(buf, len, &targetOff, target))
+					return DnsWireMalformed;
+				wanted = target;
+			}
+		}
+		off += rdLen;
+	}
+	return DnsWireNoAddress;
+}
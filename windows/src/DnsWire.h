@@ -0,0 +1,49 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef DNS_WIRE_H__
+#define DNS_WIRE_H__
+
+#include <windns.h>
+
+// Encoding of dns queries and decoding of responses in the wire format
+// (RFC 1035), only as much as is needed to look up an A record.
+
+#define DNS_WIRE_HEADER_SIZE	12
+// the most that can come over udp without EDNS0
+#define DNS_WIRE_UDP_MAX		512
+// longest name in text form, without the trailing dot
+#define DNS_WIRE_NAME_MAX		253
+
+#define DNS_WIRE_RR_A			1
+#define DNS_WIRE_RR_CNAME		5
+#define DNS_WIRE_CLASS_IN		1
+
+enum DnsWireResult {
+	// got an A record for the name, directly or through CNAMEs
+	DnsWireAddress,
+	// NXDOMAIN
+	DnsWireNxDomain,
+	// the name exists, but the server returned no records for it
+	DnsWireNoData,
+	// there are records, but no A record for the name
+	DnsWireNoAddress,
+	// the answer didn't fit in a udp packet, ask again over tcp
+	DnsWireTruncated,
+	// SERVFAIL, REFUSED etc.: another server might do better
+	DnsWireServerError,
+	// not a response to our query: garbage, a different id or question
+	DnsWireMalformed
+};
+
+// Returns the length of the query for <name> of type <type> with
+// recursion desired, 0 if <name> isn't valid or <bufSize> is too small
+int				DnsWireEncodeQuery(WORD id, const char *name, WORD type, BYTE *buf, int bufSize);
+
+// Checks that <buf> answers the query with <id> for the A record of
+// <name>. For DnsWireAddress, *<ipOut> is 1.2.3.4 as 0x01020304, like
+// GetMyIp() returns it
+DnsWireResult	DnsWireParseResponse(const BYTE *buf, int len, WORD id, const char *name, IP4_ADDRESS *ipOut);
+
+#endif
@@ -0,0 +1,312 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "EventLog.h"
+#include "LogRotate.h"
+#include "MiscUtil.h"
+#include "SendIPUpdate.h"
+#include "StrUtil.h"
+
+#define MAX_STR_LEN			255
+#define RECORD_ALIGN		8
+#define RECORD_MAX_SIZE		(sizeof(EventRecord) + 2 * MAX_STR_LEN + RECORD_ALIGN)
+
+static FILE *			gEventLogFile;
+static LogRotate *		gEventLogRotate;
+static bool				gEventLogStarted;
+static CRITICAL_SECTION	gEventLogCs;
+
+static const char *gEventTypeNames[] = {
+	NULL, "ipupdate", "ipchange"
+};
+
+// indexed by IpUpdateResult
+static const char *gEventResultNames[] = {
+	"ok", "notyours", "badauth", "notavailable", "nohost", "dnserr", "misc", "unknown"
+};
+
+#define NO_RESPONSE_NAME	"noresponse"
+
+static void WriteHeader(FILE *f)
+{
+	EventLogHeader h;
+	memzero(&h, sizeof(h));
+	memcpy(h.magic, EVENT_LOG_MAGIC, sizeof(h.magic));
+	h.version = EVENT_LOG_VERSION;
+	h.headerSize = sizeof(h);
+	fwrite(&h, sizeof(h), 1, f);
+	fflush(f);
+}
+
+bool EventLogInit(const TCHAR *logFileName)
+{
+	gEventLogFile = _tfopen(logFileName, _T("ab"));
+	if (!gEventLogFile)
+		return false;
+	InitializeCriticalSection(&gEventLogCs);
+	gEventLogStarted = true;
+	fseek(gEventLogFile, 0, SEEK_END);
+	if (0 == ftell(gEventLogFile))
+		WriteHeader(gEventLogFile);
+	// events are rare so we only care about the size
+	gEventLogRotate = LogRotateNew(logFileName, EVENT_LOG_MAX_SIZE, (DWORD)-1, EVENT_LOG_MAX_ARCHIVES);
+	return true;
+}
+
+void EventLogStop()
+{
+	if (!gEventLogStarted)
+		return;
+	if (gEventLogFile) {
+		fclose(gEventLogFile);
+		gEventLogFile = NULL;
+	}
+	LogRotateFree(gEventLogRotate);
+	gEventLogRotate = NULL;
+	DeleteCriticalSection(&gEventLogCs);
+	gEventLogStarted = false;
+}
+
+ULONGLONG EventTimeNow()
+{
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	ULARGE_INTEGER t;
+	t.LowPart = ft.dwLowDateTime;
+	t.HighPart = ft.dwHighDateTime;
+	return t.QuadPart;
+}
+
+size_t EventRecordBuild(char *buf, size_t bufSize, EventType type, ULONGLONG time, IP4_ADDRESS ip, const char *provider, const char *network, int result, DWORD latencyMs)
+{
+	size_t providerLen = provider ? strlen(provider) : 0;
+	if (providerLen > MAX_STR_LEN)
+		providerLen = MAX_STR_LEN;
+	size_t networkLen = network ? strlen(network) : 0;
+	if (networkLen > MAX_STR_LEN)
+		networkLen = MAX_STR_LEN;
+
+	size_t size = sizeof(EventRecord) + providerLen + networkLen;
+	size = (size + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+	if (size > bufSize)
+		return 0;
+
+	memzero(buf, size);
+	EventRecord *r = (EventRecord*)buf;
+	r->size = (WORD)size;
+	r->type = (BYTE)type;
+	r->providerLen = (BYTE)providerLen;
+	r->networkLen = (BYTE)networkLen;
+	r->result = (WORD)result;
+	r->time = time;
+	r->ip = ip;
+	r->latencyMs = latencyMs;
+	char *s = (char*)(r + 1);
+	if (provider)
+		memcpy(s, provider, providerLen);
+	if (network)
+		memcpy(s + providerLen, network, networkLen);
+	return size;
+}
+
+// must be called with the lock held
+static void SetEventLogFile(FILE *f)
+{
+	if (f && (f != gEventLogFile) && (0 == ftell(f)))
+		WriteHeader(f);
+	gEventLogFile = f;
+}
+
+void EventLogWrite(EventType type, IP4_ADDRESS ip, const char *provider, const char *network, int result, DWORD latencyMs)
+{
+	if (!gEventLogStarted)
+		return;
+
+	char buf[RECORD_MAX_SIZE];
+	size_t size = EventRecordBuild(buf, sizeof(buf), type, EventTimeNow(), ip, provider, network, result, latencyMs);
+	if (0 == size)
+		return;
+
+	EnterCriticalSection(&gEventLogCs);
+	// it couldn't be reopened after the last rotation
+	if (!gEventLogFile && gEventLogRotate)
+		SetEventLogFile(LogRotateIfNeeded(gEventLogRotate, NULL));
+	if (gEventLogFile) {
+		// a single fwrite() so that a reader never sees half a record
+		// followed by another one
+		fwrite(buf, size, 1, gEventLogFile);
+		fflush(gEventLogFile);
+		if (gEventLogRotate)
+			SetEventLogFile(LogRotateIfNeeded(gEventLogRotate, gEventLogFile));
+	}
+	LeaveCriticalSection(&gEventLogCs);
+}
+
+const char *EventTypeName(int type)
+{
+	if ((type > 0) && (type < dimof(gEventTypeNames)))
+		return gEventTypeNames[type];
+	return "unknown";
+}
+
+const char *EventResultName(int result)
+{
+	if ((result >= 0) && (result < dimof(gEventResultNames)))
+		return gEventResultNames[result];
+	if (EVENT_RESULT_NO_RESPONSE == result)
+		return NO_RESPONSE_NAME;
+	return "other";
+}
+
+bool EventTypeFromName(const char *name, int *typeOut)
+{
+	for (int i = 1; i < dimof(gEventTypeNames); i++) {
+		if (strieq(name, gEventTypeNames[i])) {
+			*typeOut = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool EventResultFromName(const char *name, int *resultOut)
+{
+	for (int i = 0; i < dimof(gEventResultNames); i++) {
+		if (strieq(name, gEventResultNames[i])) {
+			*resultOut = i;
+			return true;
+		}
+	}
+	if (strieq(name, NO_RESPONSE_NAME)) {
+		*resultOut = EVENT_RESULT_NO_RESPONSE;
+		return true;
+	}
+	return false;
+}
+
+size_t EventLogFirstRecord(const char *data, size_t len)
+{
+	if (len < sizeof(EventLogHeader))
+		return 0;
+	const EventLogHeader *h = (const EventLogHeader*)data;
+	if (0 != memcmp(h->magic, EVENT_LOG_MAGIC, sizeof(h->magic)))
+		return 0;
+	if ((h->headerSize < sizeof(EventLogHeader)) || (h->headerSize > len))
+		return 0;
+	return h->headerSize;
+}
+
+const EventRecord *EventLogNextRecord(const char *data, size_t len, size_t *pos)
+{
+	if ((*pos > len) || (len - *pos < sizeof(EventRecord)))
+		return NULL;
+	const EventRecord *r = (const EventRecord*)(data + *pos);
+	if ((r->size < sizeof(EventRecord)) || (r->size > len - *pos))
+		return NULL;
+	if (sizeof(EventRecord) + r->providerLen + r->networkLen > r->size)
+		return NULL;
+	*pos += r->size;
+	return r;
+}
+
+void EventFilterInit(EventFilter *filter)
+{
+	memzero(filter, sizeof(EventFilter));
+	filter->type = EVENT_ANY;
+	filter->result = EVENT_ANY;
+}
+
+bool EventMatches(const EventRecord *r, const EventFilter *filter)
+{
+	if ((EVENT_ANY != filter->type) && (r->type != filter->type))
+		return false;
+	// the result of an ip change is something else, see EventIpChanged
+	if ((EVENT_ANY != filter->result) && ((EventIpUpdate != r->type) || (r->result != filter->result)))
+		return false;
+	if (filter->failedOnly && ((EventIpUpdate != r->type) || (IpUpdateOk == r->result)))
+		return false;
+	if ((0 != filter->ip) && (r->ip != filter->ip))
+		return false;
+	if (r->time < filter->since)
+		return false;
+	if (filter->network) {
+		size_t len = strlen(filter->network);
+		if ((len != r->networkLen) || (0 != _strnicmp(filter->network, EventRecordNetwork(r), len)))
+			return false;
+	}
+	return true;
+}
+
+void EventStatsAdd(EventStats *stats, const EventRecord *r)
+{
+	if ((0 == stats->count) || (r->time < stats->firstTime))
+		stats->firstTime = r->time;
+	if (r->time > stats->lastTime)
+		stats->lastTime = r->time;
+	stats->count++;
+	if (EventIpUpdate != r->type)
+		return;
+	int bucket = r->result;
+	if (bucket > EVENT_STATS_RESULTS - 1)
+		bucket = EVENT_STATS_RESULTS - 1;
+	stats->countByResult[bucket]++;
+	stats->latencyTotalMs += r->latencyMs;
+	if (r->latencyMs > stats->latencyMaxMs)
+		stats->latencyMaxMs = r->latencyMs;
+}
+
+void EventLogQuery(const char *data, size_t len, const EventFilter *filter, EventStats *stats, EventVisitFunc visit, void *ctx)
+{
+	size_t pos = EventLogFirstRecord(data, len);
+	if (0 == pos)
+		return;
+	const EventRecord *r;
+	while (NULL != (r = EventLogNextRecord(data, len, &pos))) {
+		if (!EventMatches(r, filter))
+			continue;
+		EventStatsAdd(stats, r);
+		if (visit)
+			visit(ctx, r);
+	}
+}
+
+bool EventLogQueryFile(const TCHAR *path, const EventFilter *filter, EventStats *stats, EventVisitFunc visit, void *ctx)
+{
+	bool ok = false;
+	HANDLE mapping = NULL;
+	const char *data = NULL;
+	// the service might be writing to it or rotating it
+	HANDLE h = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (INVALID_HANDLE_VALUE == h)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(h, &size) || (0 != size.HighPart))
+		goto Exit;
+	// can't map an empty file
+	if (0 == size.LowPart) {
+		ok = true;
+		goto Exit;
+	}
+	mapping = CreateFileMapping(h, NULL, PAGE_READONLY, 0, size.LowPart, NULL);
+	if (!mapping)
+		goto Exit;
+	data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size.LowPart);
+	if (!data)
+		goto Exit;
+
+	EventLogQuery(data, size.LowPart, filter, stats, visit, ctx);
+	ok = true;
+
+Exit:
+	if (data)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle(mapping);
+	CloseHandle(h);
+	return ok;
+}
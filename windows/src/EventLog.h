@@ -0,0 +1,134 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef EVENT_LOG_H__
+#define EVENT_LOG_H__
+
+#include <windns.h>
+
+// A binary log of things worth finding later (ip updates and their results,
+// ip changes), written next to the free-form text log. Unlike the text log
+// it can be filtered and aggregated without parsing:
+// "OpenDNSDynamicIpService.exe events" (see EventLogQueryFile()).
+//
+// The file is an EventLogHeader followed by records. Every record starts
+// with its size so that readers can skip types they don't know about. The
+// strings follow the fixed part and the size is rounded up to 8 bytes, so
+// that records in a mapped file stay aligned.
+
+#define EVENT_LOG_MAGIC			"ODEV"
+#define EVENT_LOG_VERSION		1
+// the log is rotated when it gets bigger than that (see LogRotate.h)
+#define EVENT_LOG_MAX_SIZE		(4*1024*1024)
+#define EVENT_LOG_MAX_ARCHIVES	2
+
+enum EventType {
+	// <result> is IpUpdateResult or EVENT_RESULT_NO_RESPONSE
+	EventIpUpdate = 1,
+	// the ip returned by "myip.opendns.com" changed. <result> is 0 or, if
+	// there's no ip, IP_NOT_USING_OPENDNS or IP_DNS_RESOLVE_ERROR
+	EventIpChanged = 2
+};
+
+// the request failed without a response from the server
+#define EVENT_RESULT_NO_RESPONSE	0xff
+
+typedef struct {
+	char		magic[4];
+	WORD		version;
+	// readers skip that many bytes to get to the first record
+	WORD		headerSize;
+} EventLogHeader;
+
+typedef struct {
+	// of the whole record, including the strings and padding
+	WORD		size;
+	BYTE		type;
+	BYTE		providerLen;
+	BYTE		networkLen;
+	BYTE		reserved;
+	WORD		result;
+	// UTC, FILETIME units
+	ULONGLONG	time;
+	// in host byte order, 1.2.3.4 is 0x01020304. 0 if unknown
+	IP4_ADDRESS	ip;
+	DWORD		latencyMs;
+	// followed by providerLen chars of provider (the host that the request
+	// went to) and networkLen chars of network (the network's hostname),
+	// neither zero-terminated
+} EventRecord;
+
+bool		EventLogInit(const TCHAR *logFileName);
+void		EventLogStop();
+
+// <provider> and <network> can be NULL and are truncated to 255 chars
+void		EventLogWrite(EventType type, IP4_ADDRESS ip, const char *provider, const char *network, int result, DWORD latencyMs);
+
+ULONGLONG	EventTimeNow();
+
+// short names used by the query tool, e.g. "ipupdate", "notyours"
+const char *EventTypeName(int type);
+const char *EventResultName(int result);
+bool		EventTypeFromName(const char *name, int *typeOut);
+bool		EventResultFromName(const char *name, int *resultOut);
+
+// Serializes a record into <buf>. Returns its size or 0 if it doesn't fit
+size_t		EventRecordBuild(char *buf, size_t bufSize, EventType type, ULONGLONG time, IP4_ADDRESS ip, const char *provider, const char *network, int result, DWORD latencyMs);
+
+static inline const char *EventRecordProvider(const EventRecord *r)
+{
+	return (const char*)(r + 1);
+}
+
+static inline const char *EventRecordNetwork(const EventRecord *r)
+{
+	return (const char*)(r + 1) + r->providerLen;
+}
+
+// Returns the offset of the first record in <data>, 0 if it isn't an event log
+size_t		EventLogFirstRecord(const char *data, size_t len);
+// Returns the record at *<pos> and advances *<pos> past it. Returns NULL at
+// the end of data or if the rest is truncated (e.g. we're reading while
+// the service writes)
+const EventRecord *EventLogNextRecord(const char *data, size_t len, size_t *pos);
+
+#define EVENT_ANY	-1
+
+typedef struct {
+	int			type;		// EventType or EVENT_ANY
+	int			result;		// or EVENT_ANY, only ip updates match it
+	bool		failedOnly;	// only results other than IpUpdateOk
+	IP4_ADDRESS	ip;			// 0 for any
+	ULONGLONG	since;		// FILETIME, 0 for any
+	const char *network;	// NULL for any
+} EventFilter;
+
+void		EventFilterInit(EventFilter *filter);
+bool		EventMatches(const EventRecord *r, const EventFilter *filter);
+
+// results above that are counted in the last bucket
+#define EVENT_STATS_RESULTS	9
+
+typedef struct {
+	int			count;
+	// only ip updates are counted by result
+	int			countByResult[EVENT_STATS_RESULTS];
+	ULONGLONG	latencyTotalMs;
+	DWORD		latencyMaxMs;
+	ULONGLONG	firstTime;
+	ULONGLONG	lastTime;
+} EventStats;
+
+void		EventStatsAdd(EventStats *stats, const EventRecord *r);
+
+// called for every matching record, for printing
+typedef void (*EventVisitFunc)(void *ctx, const EventRecord *r);
+
+// Maps the file into memory and adds matching records to <stats>. <visit>
+// can be NULL. Returns false if the file couldn't be read
+bool		EventLogQueryFile(const TCHAR *path, const EventFilter *filter, EventStats *stats, EventVisitFunc visit, void *ctx);
+// the part of EventLogQueryFile() that doesn't touch the file system
+void		EventLogQuery(const char *data, size_t len, const EventFilter *filter, EventStats *stats, EventVisitFunc visit, void *ctx);
+
+#endif
@@ -0,0 +1,199 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "EventLog.h"
+#include "MiscUtil.h"
+#include "SendIPUpdate.h"
+#include "StrUtil.h"
+
+#include "UnitTests.h"
+
+#define BENCH_RECORDS	(1000*1000)
+
+static const char *gNetworks[] = { "home", "office", "lab" };
+
+// Builds an event log in memory: a header followed by <count> ip updates
+// with results cycling through IpUpdateOk..IpUpdateMiscErr
+static char *BuildLog(int count, size_t *lenOut)
+{
+	size_t cap = sizeof(EventLogHeader) + count * 64;
+	char *data = (char*)malloc(cap);
+	if (!data)
+		return NULL;
+	EventLogHeader *h = (EventLogHeader*)data;
+	memzero(h, sizeof(*h));
+	memcpy(h->magic, EVENT_LOG_MAGIC, sizeof(h->magic));
+	h->version = EVENT_LOG_VERSION;
+	h->headerSize = sizeof(*h);
+	size_t len = sizeof(*h);
+	for (int i=0; i < count; i++) {
+		int result = i % (IpUpdateMiscErr + 1);
+		const char *network = gNetworks[i % dimof(gNetworks)];
+		len += EventRecordBuild(data + len, cap - len, EventIpUpdate, 1000 + i,
+			0x01020300 + (i % 256), "updates.opendns.com", network, result, i % 500);
+	}
+	*lenOut = len;
+	return data;
+}
+
+static void event_log_record_ut()
+{
+	char buf[1024];
+	size_t size = EventRecordBuild(buf, sizeof(buf), EventIpUpdate, 123, 0x01020304, "updates.opendns.com", "home", IpUpdateNotYours, 250);
+	utassert(0 == (size % 8));
+	utassert(size >= sizeof(EventRecord) + strlen("updates.opendns.com") + strlen("home"));
+	const EventRecord *r = (const EventRecord*)buf;
+	utassert(size == r->size);
+	utassert(EventIpUpdate == r->type);
+	utassert(IpUpdateNotYours == r->result);
+	utassert(123 == r->time);
+	utassert(0x01020304 == r->ip);
+	utassert(250 == r->latencyMs);
+	utassert(0 == strncmp("updates.opendns.com", EventRecordProvider(r), r->providerLen));
+	utassert(0 == strncmp("home", EventRecordNetwork(r), r->networkLen));
+
+	// strings are truncated
+	char longStr[300];
+	memset(longStr, 'a', sizeof(longStr) - 1);
+	longStr[sizeof(longStr) - 1] = 0;
+	size = EventRecordBuild(buf, sizeof(buf), EventIpChanged, 0, 0, longStr, NULL, 0, 0);
+	utassert((size > 0) && (255 == r->providerLen) && (0 == r->networkLen));
+	// doesn't fit
+	utassert(0 == EventRecordBuild(buf, sizeof(EventRecord), EventIpUpdate, 0, 0, "a", NULL, 0, 0));
+}
+
+static void event_log_parse_ut()
+{
+	size_t len;
+	char *data = BuildLog(10, &len);
+	if (!data)
+		return;
+
+	size_t pos = EventLogFirstRecord(data, len);
+	utassert(sizeof(EventLogHeader) == pos);
+	int count = 0;
+	while (EventLogNextRecord(data, len, &pos))
+		count++;
+	utassert(10 == count);
+	utassert(len == pos);
+
+	// the last record is being written
+	pos = EventLogFirstRecord(data, len - 3);
+	count = 0;
+	while (EventLogNextRecord(data, len - 3, &pos))
+		count++;
+	utassert(9 == count);
+
+	utassert(0 == EventLogFirstRecord(data, 4));
+	data[0] = 'X';
+	utassert(0 == EventLogFirstRecord(data, len));
+	free(data);
+}
+
+static void event_log_query_ut()
+{
+	size_t len;
+	char *data = BuildLog(70, &len);
+	if (!data)
+		return;
+
+	EventFilter filter;
+	EventFilterInit(&filter);
+	EventStats stats;
+	memzero(&stats, sizeof(stats));
+	EventLogQuery(data, len, &filter, &stats, NULL, NULL);
+	utassert(70 == stats.count);
+	utassert(10 == stats.countByResult[IpUpdateOk]);
+	utassert(10 == stats.countByResult[IpUpdateMiscErr]);
+	utassert(1000 == stats.firstTime);
+	utassert(1069 == stats.lastTime);
+	utassert(69 == stats.latencyMaxMs);
+
+	filter.failedOnly = true;
+	memzero(&stats, sizeof(stats));
+	EventLogQuery(data, len, &filter, &stats, NULL, NULL);
+	utassert(60 == stats.count);
+	utassert(0 == stats.countByResult[IpUpdateOk]);
+
+	EventFilterInit(&filter);
+	filter.result = IpUpdateNotYours;
+	filter.network = "HOME";
+	memzero(&stats, sizeof(stats));
+	EventLogQuery(data, len, &filter, &stats, NULL, NULL);
+	// i % 7 == 1 and i % 3 == 0
+	utassert(3 == stats.count);
+
+	EventFilterInit(&filter);
+	filter.ip = 0x01020305;
+	filter.since = 1060;
+	memzero(&stats, sizeof(stats));
+	EventLogQuery(data, len, &filter, &stats, NULL, NULL);
+	utassert(0 == stats.count);
+	filter.since = 1000;
+	EventLogQuery(data, len, &filter, &stats, NULL, NULL);
+	utassert(1 == stats.count);
+
+	EventFilterInit(&filter);
+	filter.type = EventIpChanged;
+	memzero(&stats, sizeof(stats));
+	EventLogQuery(data, len, &filter, &stats, NULL, NULL);
+	utassert(0 == stats.count);
+	free(data);
+
+	// an ip change's result isn't an IpUpdateResult
+	char buf[256];
+	size_t size = EventRecordBuild(buf, sizeof(buf), EventIpChanged, 1000, 0x01020304, NULL, NULL, 0, 0);
+	utassert(size > 0);
+	const EventRecord *r = (const EventRecord*)buf;
+	EventFilterInit(&filter);
+	bool matches = EventMatches(r, &filter);
+	utassert(matches);
+	filter.result = IpUpdateOk;
+	matches = EventMatches(r, &filter);
+	utassert(!matches);
+}
+
+static void event_log_names_ut()
+{
+	int v;
+	utassert(EventTypeFromName("ipupdate", &v) && (EventIpUpdate == v));
+	utassert(EventTypeFromName("IpChange", &v) && (EventIpChanged == v));
+	utassert(!EventTypeFromName("foo", &v));
+	for (int i = IpUpdateOk; i <= IpUpdateUnknown; i++) {
+		utassert(EventResultFromName(EventResultName(i), &v) && (i == v));
+	}
+	utassert(EventResultFromName("noresponse", &v) && (EVENT_RESULT_NO_RESPONSE == v));
+	utassert(!EventResultFromName("other", &v));
+	utassert(streq("unknown", EventTypeName(0)));
+}
+
+void event_log_ut_all()
+{
+	event_log_record_ut();
+	event_log_parse_ut();
+	event_log_query_ut();
+	event_log_names_ut();
+}
+
+void event_log_bench_all()
+{
+	size_t len;
+	char *data = BuildLog(BENCH_RECORDS, &len);
+	if (!data)
+		return;
+
+	EventFilter filter;
+	EventFilterInit(&filter);
+	filter.failedOnly = true;
+	filter.network = "office";
+	EventStats stats;
+	memzero(&stats, sizeof(stats));
+	double start = benchTimeMs();
+	EventLogQuery(data, len, &filter, &stats, NULL, NULL);
+	benchReport("EventLogQuery() failed updates of one network", BENCH_RECORDS, benchTimeMs() - start);
+	utassert(stats.count > 0);
+	free(data);
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+#include "GrowableBuf.h"
+
+bool GrowableBuf::reserve(size_t size)
+{
+	// +1 for 0 termination
+	size_t needed = m_size + size + 1;
+	if (needed <= m_cap)
+		return true;
+	// doubling keeps the number of reallocations (and copies of data)
+	// logarithmic in the final size
+	size_t newCap = m_cap * 2;
+	if (newCap < MIN_CAP)
+		newCap = MIN_CAP;
+	if (newCap < needed)
+		newCap = needed;
+	char *newData = (char*)realloc(m_data, newCap);
+	if (!newData)
+		return false;
+	m_data = newData;
+	m_cap = newCap;
+	return true;
+}
+
+bool GrowableBuf::append(const void *data, size_t size)
+{
+	if (!reserve(size))
+		return false;
+	memcpy(m_data + m_size, data, size);
+	commit(size);
+	return true;
+}
+
+void *GrowableBuf::stealData(DWORD *sizeOut)
+{
+	char *res = m_data;
+	if (sizeOut)
+		*sizeOut = (DWORD)m_size;
+	if (0 == m_size) {
+		freeAll();
+		return NULL;
+	}
+	m_data = NULL;
+	m_size = 0;
+	m_cap = 0;
+	return (void*)res;
+}
+
+void GrowableBuf::freeAll()
+{
+	free(m_data);
+	m_data = NULL;
+	m_size = 0;
+	m_cap = 0;
+}
@@ -0,0 +1,75 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef GROWABLE_BUF_H__
+#define GROWABLE_BUF_H__
+
+// A contiguous buffer that grows geometrically as data is appended to it.
+// The data is always followed by a 0 byte so it can be used as a string
+// and stealData() hands it out without copying.
+class GrowableBuf {
+private:
+	char *	m_data;
+	// size of the data, not including terminating 0
+	size_t	m_size;
+	// size of m_data, including space for terminating 0
+	size_t	m_cap;
+
+public:
+	enum {
+		MIN_CAP = 256
+	};
+
+	GrowableBuf() {
+		m_data = NULL;
+		m_size = 0;
+		m_cap = 0;
+	}
+
+	~GrowableBuf() {
+		freeAll();
+	}
+
+	// make sure there's space for at least <size> more bytes, so that
+	// they can be appended without reallocating
+	bool reserve(size_t size);
+	bool append(const void *data, size_t size);
+
+	// for reading directly into the buffer: reserve() space, write to
+	// appendPtr() and commit() how much was written
+	char *appendPtr() {
+		return m_data + m_size;
+	}
+
+	void commit(size_t size) {
+		assert(m_size + size < m_cap);
+		m_size += size;
+		m_data[m_size] = 0;
+	}
+
+	// drops data past <size>
+	void truncate(size_t size) {
+		assert(size <= m_size);
+		if (size < m_size) {
+			m_size = size;
+			m_data[m_size] = 0;
+		}
+	}
+
+	size_t size() {
+		return m_size;
+	}
+
+	// the buffer keeps ownership of the data
+	const char *data() {
+		return m_data;
+	}
+
+	// returns 0-terminated data (NULL if empty) and gives up ownership
+	// of it, caller needs to free() the result. The buffer is empty after
+	void *stealData(DWORD *sizeOut);
+	void freeAll();
+};
+
+#endif
@@ -0,0 +1,159 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "GrowableBuf.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+#include "UnitTests.h"
+
+static void growable_buf_ut()
+{
+	GrowableBuf buf;
+	DWORD size = 1;
+	utassert(0 == buf.size());
+	utassert(NULL == buf.stealData(&size));
+	utassert(0 == size);
+
+	// grow past a few reallocations
+	char chunk[100];
+	for (int i=0; i < 100; i++) {
+		memset(chunk, 'a' + (i % 26), sizeof(chunk));
+		bool appended = buf.append(chunk, sizeof(chunk));
+		utassert(appended);
+	}
+	utassert(100 * sizeof(chunk) == buf.size());
+	const char *d = buf.data();
+	bool ok = true;
+	for (int i=0; i < 100 * (int)sizeof(chunk); i++) {
+		if (d[i] != 'a' + ((i / (int)sizeof(chunk)) % 26))
+			ok = false;
+	}
+	utassert(ok);
+	// always 0-terminated
+	utassert(0 == d[buf.size()]);
+
+	char *s = (char*)buf.stealData(&size);
+	utassert(s == d);
+	utassert(100 * sizeof(chunk) == size);
+	utassert(0 == buf.size());
+	free(s);
+
+	// writing directly into reserved space
+	bool reserved = buf.reserve(5);
+	utassert(reserved);
+	memcpy(buf.appendPtr(), "hello", 5);
+	buf.commit(3);
+	utassert(streq("hel", buf.data()));
+	buf.freeAll();
+	utassert(0 == buf.size());
+}
+
+void growable_buf_ut_all()
+{
+	growable_buf_ut();
+}
+
+#define HTTP_CHUNK_SIZE 1024
+
+// what reading the response used to cost: a malloc()ed node for every
+// chunk and a final copy of all of them into one block
+typedef struct ChunkNode {
+	struct ChunkNode *	next;
+	DWORD				size;
+	char				data[HTTP_CHUNK_SIZE];
+} ChunkNode;
+
+static char *ReadAsLinkedChunks(const char *body, size_t bodySize)
+{
+	ChunkNode *head = NULL;
+	size_t left = bodySize;
+	const char *src = body;
+	while (left > 0) {
+		char tmp[HTTP_CHUNK_SIZE];
+		DWORD n = (DWORD)(left < HTTP_CHUNK_SIZE ? left : HTTP_CHUNK_SIZE);
+		memcpy(tmp, src, n);
+		ChunkNode *node = SA(ChunkNode);
+		memcpy(node->data, tmp, n);
+		node->size = n;
+		node->next = head;
+		head = node;
+		src += n;
+		left -= n;
+	}
+	char *res = (char*)malloc(bodySize + 1);
+	char *end = res + bodySize;
+	*end = 0;
+	while (head) {
+		ChunkNode *next = head->next;
+		end -= head->size;
+		memcpy(end, head->data, head->size);
+		free(head);
+		head = next;
+	}
+	return res;
+}
+
+// simulates HttpReadAllData() reading <body> in chunks the size of
+// network reads
+static char *ReadAsGrowableBuf(const char *body, size_t bodySize, bool presize)
+{
+	GrowableBuf buf;
+	if (presize)
+		buf.reserve(bodySize);
+	size_t left = bodySize;
+	const char *src = body;
+	while (left > 0) {
+		DWORD n = (DWORD)(left < HTTP_CHUNK_SIZE ? left : HTTP_CHUNK_SIZE);
+		buf.reserve(n);
+		memcpy(buf.appendPtr(), src, n);
+		buf.commit(n);
+		src += n;
+		left -= n;
+	}
+	return (char*)buf.stealData(NULL);
+}
+
+static void growable_buf_bench()
+{
+	static const size_t bodySizes[] = { 1024, 64*1024, 1024*1024, 10*1024*1024 };
+	for (int i=0; i < dimof(bodySizes); i++) {
+		size_t size = bodySizes[i];
+		char *body = (char*)malloc(size);
+		if (!body)
+			return;
+		memset(body, 'x', size);
+		int iterations = (int)((256*1024*1024) / size);
+		if (iterations > 10000)
+			iterations = 10000;
+		fprintf(stderr, "\nhttp body of %d bytes", (int)size);
+
+		double start = benchTimeMs();
+		for (int j=0; j < iterations; j++)
+			free(ReadAsLinkedChunks(body, size));
+		benchReport("  linked chunks", iterations, benchTimeMs() - start);
+
+		start = benchTimeMs();
+		for (int j=0; j < iterations; j++)
+			free(ReadAsGrowableBuf(body, size, false));
+		benchReport("  growable", iterations, benchTimeMs() - start);
+
+		start = benchTimeMs();
+		for (int j=0; j < iterations; j++)
+			free(ReadAsGrowableBuf(body, size, true));
+		benchReport("  growable, pre-sized", iterations, benchTimeMs() - start);
+
+		char *s = ReadAsGrowableBuf(body, size, false);
+		utassert(s && (0 == memcmp(s, body, size)) && (0 == s[size]));
+		free(s);
+		free(body);
+	}
+}
+
+void growable_buf_bench_all()
+{
+	growable_buf_bench();
+}
@@ -5,199 +5,85 @@
 #include "stdafx.h"
 
 #include "Http.h"
+#include "HttpTransport.h"
 #include "MiscUtil.h"
 #include "StrUtil.h"
-#include "WTLThread.h"
 
-#define CONTENT_TYPE_URL_ENCODED_W L"Content-Type: application/x-www-form-urlencoded\r\n"
+// NULL means DefaultHttpTransport()
+static HttpTransport *g_transport;
 
-static void ShowLastError(HttpResult *res)
+HttpTransport *HttpGetTransport()
 {
-	DWORD error = GetLastError();
-	char *err = LastErrorAsStr(error);
-	free(err);
-	if (0 == error)
-		error = (DWORD)-1;
-	res->error = error;
+	if (g_transport)
+		return g_transport;
+	return DefaultHttpTransport();
 }
 
-static bool CreateAndStartThread(LPTHREAD_START_ROUTINE proc, LPVOID procArg)
+HttpTransport *HttpSetTransport(HttpTransport *transport)
 {
-	DWORD dwCreationFlags = 0;
-	DWORD dwStackSize = 64*1024;
-#ifdef _ATL_MIN_CRT
-	DWORD threadId = 0;
-	HANDLE hThread = ::CreateThread(NULL, dwStackSize, proc, procArg,
-		dwCreationFlags, &threadId);
-	if (NULL == hThread)
-		return false;
-#else
-	unsigned threadId;
-	uintptr_t hThread = _beginthreadex(NULL, dwStackSize,
-		(unsigned (__stdcall*)(void*)) proc, procArg,
-		dwCreationFlags, (unsigned*) &threadId);
-	if (-1 == hThread)
-		return false;
-#endif
-	return true;
+	HttpTransport *prev = g_transport;
+	g_transport = transport;
+	return prev;
 }
 
-static bool SetupSessionAndRequest(const WCHAR *host, const WCHAR *url, INTERNET_PORT port, 
-	const WCHAR *method, HINTERNET *hSession, HINTERNET *hConnect, HINTERNET *hRequest)
+bool HttpGetPoolStats(HttpConnPoolStats *stats)
 {
-	*hSession = WinHttpOpen(L"OpenDNS Updater Client",  
-					WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
-					WINHTTP_NO_PROXY_NAME, 
-					WINHTTP_NO_PROXY_BYPASS, 0 );
-	if (!*hSession)
-		goto Error;
-
-	*hConnect = WinHttpConnect(*hSession, host, port, 0);
-	if (!*hConnect)
-		goto Error;
-
-	DWORD flags = 0;
-	if (INTERNET_DEFAULT_HTTPS_PORT == port)
-		flags = WINHTTP_FLAG_SECURE;
-
-	*hRequest = WinHttpOpenRequest(*hConnect, method, url,
-					NULL, WINHTTP_NO_REFERER, 
-					WINHTTP_DEFAULT_ACCEPT_TYPES, 
-					flags);
-
-	if (!*hRequest)
-		goto Error;
-
-	return true;
-Error:
-	return false;
+	return HttpGetTransport()->GetPoolStats(stats);
 }
 
-static void CloseAllHandles(HINTERNET *hRequest, HINTERNET *hConnect, HINTERNET *hSession)
+void HttpRequestInit(HttpRequest *req, const char *method, const char *host, const char *url, INTERNET_PORT port)
 {
-	if (*hRequest)
-		WinHttpCloseHandle(*hRequest);
-	if (*hConnect)
-		WinHttpCloseHandle(*hConnect);
-	if (*hSession)
-		WinHttpCloseHandle(*hSession);
+	memzero(req, sizeof(HttpRequest));
+	req->method = method;
+	req->host = host;
+	req->url = url;
+	req->port = port;
 }
 
-static bool HttpReadAllData(HINTERNET hRequest, MemSegment& data)
-{
-	BOOL		ok;
-	DWORD		dwDownloaded = 0;
-	DWORD		dwAvailable = 0;
-	char 		buf[1024];
-	DWORD		bufSize = dimof(buf);
-
-	do  {
-		dwAvailable = 0;
-		ok = WinHttpQueryDataAvailable(hRequest, &dwAvailable);
-		if (!ok)
-			goto Error;
-
-		ok = WinHttpReadData(hRequest, (LPVOID)buf, bufSize, &dwDownloaded);
-		if (!ok)
-			goto Error;
-
-		if (dwDownloaded > 0)
-			data.add(buf, dwDownloaded);
-
-	} while (dwDownloaded > 0);
-	return true;
-Error:
-	return false;
-}
-
-HttpResult* HttpGet(const WCHAR *host, const WCHAR *url, INTERNET_PORT port)
+static HttpResult *HttpSend(const HttpRequest *req)
 {
-	BOOL		ok;
-	HINTERNET	hSession = NULL, hConnect = NULL, hRequest = NULL;
-
 	HttpResult *res = new HttpResult();
 	if (!res)
 		return NULL;
-
-	ok = SetupSessionAndRequest(host, url, port, L"GET", &hSession, &hConnect, &hRequest);
-	if (!ok)
-		goto Error;
-
-	ok = WinHttpSendRequest(hRequest,
-				WINHTTP_NO_ADDITIONAL_HEADERS, 0,
-				WINHTTP_NO_REQUEST_DATA, 0, 
-				0, 0);
-
-	if (!ok)
-		goto Error;
-
-	ok = WinHttpReceiveResponse(hRequest, NULL);
-	if (!ok)
-		goto Error;
-
-	ok = HttpReadAllData(hRequest, res->data);
-	if (!ok)
-		goto Error;
-
-Exit:
-	CloseAllHandles(&hRequest, &hConnect, &hSession);
+	HttpGetTransport()->Send(req, res);
 	return res;
-
-Error:
-	ShowLastError(res);
-	goto Exit;
 }
 
-HttpResult* HttpGetWithBasicAuth(const WCHAR *host, const WCHAR *url, const WCHAR *userName, const WCHAR *pwd, INTERNET_PORT port)
+HttpResult* HttpGet(const char *host, const char *url, INTERNET_PORT port)
 {
-	BOOL		ok;
-	HINTERNET	hSession = NULL, hConnect = NULL, hRequest = NULL;
-
-	HttpResult *res = new HttpResult();
-	if (!res)
-		return NULL;
-
-	ok = SetupSessionAndRequest(host, url, port, L"GET", &hSession, &hConnect, &hRequest);
-	if (!ok)
-		goto Error;
-	
-
-	ok = WinHttpSetCredentials(hRequest, WINHTTP_AUTH_TARGET_SERVER, WINHTTP_AUTH_SCHEME_BASIC, userName, pwd, NULL);
-	if (!ok)
-		goto Error;
-
-	ok = WinHttpSendRequest(hRequest,
-				WINHTTP_NO_ADDITIONAL_HEADERS, 0,
-				WINHTTP_NO_REQUEST_DATA, 0, 
-				0, 0);
-
-	if (!ok)
-		goto Error;
-
-	ok = WinHttpReceiveResponse(hRequest, NULL);
-	if (!ok)
-		goto Error;
-
-	ok = HttpReadAllData(hRequest, res->data);
-	if (!ok)
-		goto Error;
+	HttpRequest req;
+	HttpRequestInit(&req, "GET", host, url, port);
+	return HttpSend(&req);
+}
 
-Exit:
-	CloseAllHandles(&hRequest, &hConnect, &hSession);
+HttpResult* HttpGet(const WCHAR *host, const WCHAR *url, INTERNET_PORT port)
+{
+	char *host2 = WstrToUtf8(host);
+	char *url2 = WstrToUtf8(url);
+	HttpResult *res = NULL;
+	if (host2 && url2)
+		res = HttpGet(host2, url2, port);
+	free(host2);
+	free(url2);
 	return res;
-
-Error:
-	ShowLastError(res);
-	goto Exit;
 }
 
 // TODO: should report non-200 results as NULL?
 HttpResult* HttpGetWithBasicAuth(const char *host, const char *url, const char *userName, const char *pwd,  INTERNET_PORT port)
 {
-	WCHAR *host2 = StrToWstrSimple(host);
-	WCHAR *url2 = StrToWstrSimple(url);
-	WCHAR *userName2 = StrToWstrSimple(userName);
-	WCHAR *pwd2 = StrToWstrSimple(pwd);
+	HttpRequest req;
+	HttpRequestInit(&req, "GET", host, url, port);
+	req.userName = userName;
+	req.pwd = pwd;
+	return HttpSend(&req);
+}
+
+HttpResult* HttpGetWithBasicAuth(const WCHAR *host, const WCHAR *url, const WCHAR *userName, const WCHAR *pwd, INTERNET_PORT port)
+{
+	char *host2 = WstrToUtf8(host);
+	char *url2 = WstrToUtf8(url);
+	char *userName2 = WstrToUtf8(userName);
+	char *pwd2 = WstrToUtf8(pwd);
 	HttpResult *res = NULL;
 	if (host2 && url2 && userName2 && pwd2)
 		res = HttpGetWithBasicAuth(host2, url2, userName2, pwd2, port);
@@ -208,36 +94,36 @@ HttpResult* HttpGetWithBasicAuth(const char *host, const char *url, const char *
 	return res;
 }
 
-HttpResult* HttpGet(const WCHAR *url)
+HttpResult* HttpGet(const char *url)
 {
 	INTERNET_PORT port = INTERNET_DEFAULT_HTTP_PORT;
-	if (WStrStartsWithI(url, L"https://")) {
+	if (StrStartsWithI(url, "https://")) {
 		port = INTERNET_DEFAULT_HTTPS_PORT;
 		url += 8; // skip https://
-	} else if (WStrStartsWithI(url, L"http://")) {
+	} else if (StrStartsWithI(url, "http://")) {
 		url += 7; // skip http://
 	} else {
 		// url must start with http:// or https://
 		return NULL;
 	}
 
-	const WCHAR *urlPart = WStrFindChar(url, L'/');
+	const char *urlPart = StrFindChar(url, '/');
 	if (!urlPart)
 		return NULL;
-	int hostLen = urlPart - url;
+	size_t hostLen = urlPart - url;
 	if (0 == hostLen)
 		return NULL;
-	WCHAR* host = WStrDupN(url, hostLen);
+	char *host = strdupn(url, hostLen);
 	if (!host)
 		return NULL;
-	HttpResult *res = HttpGet((const WCHAR*)host, urlPart, port);
+	HttpResult *res = HttpGet(host, urlPart, port);
 	free(host);
 	return res;
 }
 
-HttpResult* HttpGet(const char *url)
+HttpResult* HttpGet(const WCHAR *url)
 {
-	WCHAR *url2 = StrToWstrSimple(url);
+	char *url2 = WstrToUtf8(url);
 	HttpResult *res = NULL;
 	if (url2)
 		res = HttpGet(url2);
@@ -245,67 +131,15 @@ HttpResult* HttpGet(const char *url)
 	return res;
 }
 
-HttpResult* HttpGet(const char *host, const char *url,  INTERNET_PORT port)
+HttpResult* HttpPost(const char *host, const char *url, const char *params, INTERNET_PORT port)
 {
-	WCHAR *host2 = StrToWstrSimple(host);
-	WCHAR *url2 = StrToWstrSimple(url);
-	HttpResult *res = NULL;
-	if (host2 && url2)
-		res = HttpGet(host2, url2, port);
-	free(host2);
-	free(url2);
-	return res;
+	return HttpPostStreamed(host, url, params, port, NULL, NULL);
 }
 
 HttpResult* HttpPost(const WCHAR *host, const WCHAR *url, const char *params,  INTERNET_PORT port)
 {
-	BOOL		ok;
-	HINTERNET	hSession = NULL, hConnect = NULL, hRequest = NULL;
-
-	HttpResult *res = new HttpResult();
-	if (!res)
-		return NULL;
-
-	ok = SetupSessionAndRequest(host, url, port, L"POST", &hSession, &hConnect, &hRequest);
-	if (!ok)
-		goto Error;
-
-	const WCHAR *headers = CONTENT_TYPE_URL_ENCODED_W;
-	DWORD headersLen = wcslen(headers);
-	DWORD flags = WINHTTP_ADDREQ_FLAG_ADD | WINHTTP_ADDREQ_FLAG_REPLACE;
-	ok = WinHttpAddRequestHeaders(hRequest, headers, headersLen, flags);
-	if (!ok)
-		goto Error;
-
-	DWORD paramsLen = strlen(params);
-	ok = WinHttpSendRequest(hRequest,
-				WINHTTP_NO_ADDITIONAL_HEADERS, 0,
-				(LPVOID)params, paramsLen, 
-				paramsLen, 0);
-	if (!ok)
-		goto Error;
-
-	ok = WinHttpReceiveResponse(hRequest, NULL);
-	if (!ok)
-		goto Error;
-
-	ok = HttpReadAllData(hRequest, res->data);
-	if (!ok)
-		goto Error;
-
-Exit:
-	CloseAllHandles(&hRequest, &hConnect, &hSession);
-	return res;
-
-Error:
-	ShowLastError(res);
-	goto Exit;
-}
-
-HttpResult* HttpPost(const char *host, const char *url, const char *params, INTERNET_PORT port)
-{
-	WCHAR *host2 = StrToWstrSimple(host);
-	WCHAR *url2 = StrToWstrSimple(url);
+	char *host2 = WstrToUtf8(host);
+	char *url2 = WstrToUtf8(url);
 	HttpResult *res = NULL;
 	if (host2 && url2)
 		res = HttpPost(host2, url2, params, port);
@@ -314,50 +148,35 @@ HttpResult* HttpPost(const char *host, const char *url, const char *params, INTE
 	return res;
 }
 
-HttpResult* HttpPostData(const WCHAR *host, const WCHAR *url, void *data, DWORD dataSize, INTERNET_PORT port)
+// Like HttpPost() but the response is handed to <dataCb> chunk by chunk
+// as it arrives, so it can be processed without buffering all of it.
+// HttpResult::data is empty.
+HttpResult* HttpPostStreamed(const char *host, const char *url, const char *params, INTERNET_PORT port, HttpDataCallback dataCb, void *dataCbCtx)
 {
-#if 0
-	inet = _wininet.InternetOpenA(CLIENTNAME "/" UT_VERSION_ID, INTERNET_OPEN_TYPE_PRECONFIG, NULL, NULL, 0 );
-	if (inet == NULL) { err = "InternetOpen failed"; goto error1; }
-
-	conn = _wininet.InternetConnectA(inet, CRASHREPORTHOST, INTERNET_DEFAULT_HTTP_PORT, "", "", INTERNET_SERVICE_HTTP, 0, 0);
-#endif
-	BOOL		ok;
-	HINTERNET	hSession = NULL, hConnect = NULL, hRequest = NULL;
-
-	HttpResult *res = new HttpResult();
-	if (!res)
-		return NULL;
-
-	ok = SetupSessionAndRequest(host, url, port, L"POST", &hSession, &hConnect, &hRequest);
-	if (!ok)
-		goto Error;
-
-	ok = WinHttpSendRequest(hRequest, L"Content-type: application/binary", (DWORD)-1, data, dataSize, dataSize, NULL);
-	if (!ok)
-		goto Error;
-
-	ok = WinHttpReceiveResponse(hRequest, NULL);
-	if (!ok)
-		goto Error;
-
-	ok = HttpReadAllData(hRequest, res->data);
-	if (!ok)
-		goto Error;
-
-Exit:
-	CloseAllHandles(&hRequest, &hConnect, &hSession);
-	return res;
-
-Error:
-	ShowLastError(res);
-	goto Exit;
+	HttpRequest req;
+	HttpRequestInit(&req, "POST", host, url, port);
+	req.headers = CONTENT_TYPE_URL_ENCODED;
+	req.body = params;
+	req.bodySize = (DWORD)strlen(params);
+	req.dataCb = dataCb;
+	req.dataCbCtx = dataCbCtx;
+	return HttpSend(&req);
 }
 
 HttpResult* HttpPostData(const char *host, const char *url, void *data, DWORD dataSize,  INTERNET_PORT port)
 {
-	WCHAR *host2 = StrToWstrSimple(host);
-	WCHAR *url2 = StrToWstrSimple(url);
+	HttpRequest req;
+	HttpRequestInit(&req, "POST", host, url, port);
+	req.headers = CONTENT_TYPE_BINARY;
+	req.body = data;
+	req.bodySize = dataSize;
+	return HttpSend(&req);
+}
+
+HttpResult* HttpPostData(const WCHAR *host, const WCHAR *url, void *data, DWORD dataSize, INTERNET_PORT port)
+{
+	char *host2 = WstrToUtf8(host);
+	char *url2 = WstrToUtf8(url);
 	HttpResult *res = NULL;
 	if (host2 && url2)
 		res = HttpPostData(host2, url2, data, dataSize, port);
@@ -365,47 +184,3 @@ HttpResult* HttpPostData(const char *host, const char *url, void *data, DWORD da
 	free(url2);
 	return res;
 }
-
-class HttpPostThreadData
-{
-public:
-	char *m_host;
-	char *m_url;
-	char *m_params;
-	bool m_https;
-	HWND m_hwndToNotify;
-	UINT m_msg;
-
-	~HttpPostThreadData() {
-		free(m_host);
-		free(m_url);
-		free(m_params);
-	}
-};
-
-static DWORD WINAPI HttpPostThread(LPVOID arg)
-{
-	HttpPostThreadData *data = (HttpPostThreadData*)arg;
-	INTERNET_PORT port = INTERNET_DEFAULT_HTTP_PORT;
-	if (data->m_https)
-		port = INTERNET_DEFAULT_HTTPS_PORT;
-	HttpResult *result = HttpPost(data->m_host, data->m_url, data->m_params, port);
-	PostMessage(data->m_hwndToNotify, data->m_msg, (WPARAM)result, 0);
-	delete data;
-	return 0;
-}
-
-bool HttpPostAsync(const char *host, const char *url, const char *params, bool https, HWND hwndToNotify, UINT msg)
-{
-	HttpPostThreadData *data = new HttpPostThreadData();
-	if (!data)
-		return false;
-	data->m_host = strdup(host);
-	data->m_url = strdup(url);
-	data->m_params = strdup(params);
-	data->m_https = https;
-	data->m_hwndToNotify = hwndToNotify;
-	data->m_msg = msg;
-	return CreateAndStartThread(HttpPostThread, (LPVOID)data);
-}
-
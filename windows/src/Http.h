@@ -5,13 +5,13 @@
 #ifndef HTTP_H__
 #define HTTP_H__
 
-#include "MemSegment.h"
+#include "GrowableBuf.h"
 
 class HttpResult {
 public:
 	/* 0 if no error */
 	DWORD		  	error;
-	MemSegment		data;
+	GrowableBuf		data;
 
 	HttpResult() {
 		error = 0;
@@ -26,6 +26,13 @@ public:
 	}
 };
 
+// called with consecutive chunks of the response as they are read.
+// Returning false aborts the request
+typedef bool (*HttpDataCallback)(void *ctx, const void *data, DWORD dataSize);
+// called before the data with the size from Content-Length, if the server
+// sent one and it isn't unreasonably big
+typedef void (*HttpSizeCallback)(void *ctx, DWORD size);
+
 HttpResult* HttpGet(const WCHAR *url);
 HttpResult* HttpGet(const char *url);
 
@@ -37,8 +44,10 @@ HttpResult* HttpGetWithBasicAuth(const char *host, const char *url, const char *
 
 HttpResult* HttpPost(const char *host, const char *url, const char *params, INTERNET_PORT port = INTERNET_DEFAULT_HTTP_PORT);
 HttpResult* HttpPost(const WCHAR *host, const WCHAR *url, const char *params, INTERNET_PORT port = INTERNET_DEFAULT_HTTP_PORT);
+HttpResult* HttpPostStreamed(const char *host, const char *url, const char *params, INTERNET_PORT port, HttpDataCallback dataCb, void *dataCbCtx);
 HttpResult* HttpPostData(const char *host, const char *url, void *data, DWORD dataSize, INTERNET_PORT port = INTERNET_DEFAULT_HTTP_PORT);
 HttpResult* HttpPostData(const WCHAR *host, const WCHAR *url, void *data, DWORD dataSize, INTERNET_PORT port = INTERNET_DEFAULT_HTTP_PORT);
+// runs on the HttpAsync worker pool, see HttpAsync.cpp
 bool HttpPostAsync(const char *host, const char *url, const char *params, bool https, HWND hwndToNotify, UINT msg);
 
 #endif
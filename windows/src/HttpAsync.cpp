@@ -0,0 +1,537 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "HttpAsync.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+#ifndef _ATL_MIN_CRT
+#include <process.h>
+#endif
+
+typedef struct HttpAsyncJob {
+	struct HttpAsyncJob *	next;
+	DWORD					id;
+	// strings and body are copies owned by the job
+	HttpRequest				req;
+	HttpDataCallback		userDataCb;
+	HttpSizeCallback		userSizeCb;
+	void *					userDataCbCtx;
+	DWORD					queuedMs;
+	DWORD					timeoutMs;
+	volatile bool			cancelled;
+	bool					timedOut;
+	HttpResult *			res;
+	HttpAsyncCallback		cb;
+	void *					cbCtx;
+} HttpAsyncJob;
+
+// 0 - not initialized, 1 - being initialized, 2 - initialized
+static volatile LONG	g_initState;
+static bool				g_stopping;
+static DWORD			g_nextId;
+// jobs waiting for a worker, oldest first
+static HttpAsyncJob *	g_queueFirst;
+static HttpAsyncJob *	g_queueLast;
+static int				g_queuedCount;
+// jobs being run by workers
+static HttpAsyncJob *	g_running;
+static int				g_workerCount;
+static int				g_idleWorkerCount;
+
+static CRITICAL_SECTION	g_cs;
+// released once for every queued job and for every worker on shutdown
+static HANDLE			g_jobsSem;
+// set by HttpAsyncStop(), so that HttpAsyncSendWait() doesn't wait for
+// requests that can't be aborted
+static HANDLE			g_stopEvent;
+// thread handles of the workers started so far, closed by
+// HttpAsyncShutdown() once they're done
+static HANDLE			g_workers[HTTP_ASYNC_MAX_WORKERS];
+static int				g_workerHandleCount;
+#define LOCK() EnterCriticalSection(&g_cs)
+#define UNLOCK() LeaveCriticalSection(&g_cs)
+
+static void EnsureInitialized()
+{
+	if (2 == g_initState)
+		return;
+	if (0 == InterlockedCompareExchange(&g_initState, 1, 0)) {
+		InitializeCriticalSection(&g_cs);
+		g_jobsSem = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+		g_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		g_initState = 2;
+		return;
+	}
+	while (2 != g_initState)
+		Sleep(0);
+}
+
+static void JobFree(HttpAsyncJob *job)
+{
+	free((void*)job->req.method);
+	free((void*)job->req.host);
+	free((void*)job->req.url);
+	free((void*)job->req.headers);
+	free((void*)job->req.body);
+	free((void*)job->req.userName);
+	free((void*)job->req.pwd);
+	delete job->res;
+	free(job);
+}
+
+static HttpAsyncJob *JobNew(const HttpRequest *req)
+{
+	HttpAsyncJob *job = SAZ(HttpAsyncJob);
+	if (!job)
+		return NULL;
+	job->req = *req;
+	job->req.method = StrDupSafe(req->method);
+	job->req.host = StrDupSafe(req->host);
+	job->req.url = StrDupSafe(req->url);
+	job->req.headers = StrDupSafe(req->headers);
+	job->req.userName = StrDupSafe(req->userName);
+	job->req.pwd = StrDupSafe(req->pwd);
+	job->req.body = NULL;
+	if (req->body)
+		job->req.body = memdup(req->body, req->bodySize);
+	job->res = new HttpResult();
+	if (!job->req.method || !job->req.host || !job->req.url || !job->res)
+		goto Error;
+	if ((req->headers && !job->req.headers) || (req->body && !job->req.body))
+		goto Error;
+	if ((req->userName && !job->req.userName) || (req->pwd && !job->req.pwd))
+		goto Error;
+	return job;
+Error:
+	JobFree(job);
+	return NULL;
+}
+
+// hands the result over to the callback and frees the job
+static void JobComplete(HttpAsyncJob *job)
+{
+	HttpResult *res = job->res;
+	job->res = NULL;
+	job->cb(job->cbCtx, res);
+	JobFree(job);
+}
+
+static void JobCancel(HttpAsyncJob *job)
+{
+	job->res->data.freeAll();
+	job->res->error = HTTP_ERR_CANCELLED;
+	JobComplete(job);
+}
+
+static bool JobTimedOut(HttpAsyncJob *job)
+{
+	return HttpConnPoolNowMs() - job->queuedMs >= job->timeoutMs;
+}
+
+// sits between the transport and the caller's callback, so that cancelled
+// and timed out requests can be aborted while the data is coming in
+static bool JobDataCb(void *ctx, const void *data, DWORD dataSize)
+{
+	HttpAsyncJob *job = (HttpAsyncJob*)ctx;
+	if (job->cancelled)
+		return false;
+	if (JobTimedOut(job)) {
+		job->timedOut = true;
+		return false;
+	}
+	if (job->userDataCb)
+		return job->userDataCb(job->userDataCbCtx, data, dataSize);
+	return job->res->data.append(data, dataSize);
+}
+
+// the transport knows how big the response is going to be
+static void JobSizeCb(void *ctx, DWORD size)
+{
+	HttpAsyncJob *job = (HttpAsyncJob*)ctx;
+	if (job->userSizeCb)
+		job->userSizeCb(job->userDataCbCtx, size);
+	else if (!job->userDataCb)
+		job->res->data.reserve(size);
+}
+
+static void JobRun(HttpAsyncJob *job)
+{
+	if (job->cancelled)
+		return;
+	if (JobTimedOut(job)) {
+		job->res->error = HTTP_ERR_TIMED_OUT;
+		return;
+	}
+
+	job->userDataCb = job->req.dataCb;
+	job->userSizeCb = job->req.sizeCb;
+	job->userDataCbCtx = job->req.dataCbCtx;
+	job->req.dataCb = JobDataCb;
+	job->req.sizeCb = JobSizeCb;
+	job->req.dataCbCtx = job;
+	// the transport's own timeouts don't go past what's left
+	DWORD elapsed = HttpConnPoolNowMs() - job->queuedMs;
+	DWORD left = job->timeoutMs - elapsed;
+	if ((0 == job->req.timeoutMs) || (job->req.timeoutMs > left))
+		job->req.timeoutMs = left;
+
+	HttpGetTransport()->Send(&job->req, job->res);
+
+	if (job->timedOut || (job->res->error && JobTimedOut(job))) {
+		job->res->data.freeAll();
+		job->res->error = HTTP_ERR_TIMED_OUT;
+	}
+}
+
+static void RemoveRunning(HttpAsyncJob *job)
+{
+	HttpAsyncJob **curr = &g_running;
+	while (*curr != job)
+		curr = &(*curr)->next;
+	*curr = job->next;
+	job->next = NULL;
+}
+
+// must be called with the lock held. Returns NULL if there's nothing to do
+static HttpAsyncJob *PopJob()
+{
+	HttpAsyncJob *job = g_queueFirst;
+	if (!job)
+		return NULL;
+	g_queueFirst = job->next;
+	if (!g_queueFirst)
+		g_queueLast = NULL;
+	g_queuedCount--;
+	job->next = g_running;
+	g_running = job;
+	return job;
+}
+
+static DWORD WINAPI WorkerThread(LPVOID arg)
+{
+	for (;;) {
+		LOCK();
+		g_idleWorkerCount++;
+		UNLOCK();
+		WaitForSingleObject(g_jobsSem, INFINITE);
+		LOCK();
+		g_idleWorkerCount--;
+		HttpAsyncJob *job = PopJob();
+		bool stop = g_stopping;
+		UNLOCK();
+
+		if (job) {
+			JobRun(job);
+			LOCK();
+			RemoveRunning(job);
+			UNLOCK();
+			if (job->cancelled)
+				JobCancel(job);
+			else
+				JobComplete(job);
+		} else if (stop) {
+			break;
+		}
+	}
+
+	LOCK();
+	g_workerCount--;
+	UNLOCK();
+	return 0;
+}
+
+// must be called with the lock held
+static void StartWorkerIfNeeded()
+{
+	if ((g_queuedCount <= g_idleWorkerCount) || (g_workerCount >= HTTP_ASYNC_MAX_WORKERS))
+		return;
+	DWORD stackSize = 64*1024;
+#ifdef _ATL_MIN_CRT
+	DWORD threadId = 0;
+	HANDLE hThread = ::CreateThread(NULL, stackSize, WorkerThread, NULL, 0, &threadId);
+#else
+	unsigned threadId;
+	HANDLE hThread = (HANDLE)_beginthreadex(NULL, stackSize,
+		(unsigned (__stdcall*)(void*))WorkerThread, NULL, 0, &threadId);
+	if ((HANDLE)-1 == hThread)
+		hThread = NULL;
+#endif
+	if (!hThread)
+		return;
+	// workers only exit on shutdown, so there's never more than
+	// HTTP_ASYNC_MAX_WORKERS of them
+	g_workers[g_workerHandleCount++] = hThread;
+	g_workerCount++;
+}
+
+DWORD HttpAsyncSend(const HttpRequest *req, DWORD timeoutMs, HttpAsyncCallback cb, void *cbCtx)
+{
+	EnsureInitialized();
+	HttpAsyncJob *job = JobNew(req);
+	if (!job)
+		return 0;
+	job->cb = cb;
+	job->cbCtx = cbCtx;
+	job->timeoutMs = timeoutMs;
+	job->queuedMs = HttpConnPoolNowMs();
+
+	LOCK();
+	if (g_stopping) {
+		UNLOCK();
+		JobFree(job);
+		return 0;
+	}
+	if (0 == ++g_nextId)
+		++g_nextId;
+	job->id = g_nextId;
+	if (g_queueLast)
+		g_queueLast->next = job;
+	else
+		g_queueFirst = job;
+	g_queueLast = job;
+	g_queuedCount++;
+	StartWorkerIfNeeded();
+	if (0 == g_workerCount) {
+		// no worker and couldn't start one
+		g_queueFirst = g_queueLast = NULL;
+		g_queuedCount = 0;
+		UNLOCK();
+		JobFree(job);
+		return 0;
+	}
+	DWORD id = job->id;
+	ReleaseSemaphore(g_jobsSem, 1, NULL);
+	UNLOCK();
+	return id;
+}
+
+DWORD HttpAsyncPost(const char *host, const char *url, const char *params, INTERNET_PORT port, DWORD timeoutMs, HttpAsyncCallback cb, void *cbCtx)
+{
+	HttpRequest req;
+	HttpRequestInit(&req, "POST", host, url, port);
+	req.headers = CONTENT_TYPE_URL_ENCODED;
+	req.body = params;
+	req.bodySize = (DWORD)strlen(params);
+	return HttpAsyncSend(&req, timeoutMs, cb, cbCtx);
+}
+
+#define WAITER_PENDING	0
+#define WAITER_DONE		1
+// the waiter gave up, the callback frees the result
+#define WAITER_GONE		2
+
+// shared by the waiter and the callback, the last one to let go frees it
+typedef struct {
+	volatile LONG	refCount;
+	volatile LONG	state;
+	HANDLE			done;
+	HttpResult *	res;
+} WaitCtx;
+
+static void WaitCtxRelease(WaitCtx *wait)
+{
+	if (0 != InterlockedDecrement(&wait->refCount))
+		return;
+	CloseHandle(wait->done);
+	free(wait);
+}
+
+static void WaitDone(void *ctx, HttpResult *res)
+{
+	WaitCtx *wait = (WaitCtx*)ctx;
+	wait->res = res;
+	if (WAITER_PENDING == InterlockedCompareExchange(&wait->state, WAITER_DONE, WAITER_PENDING))
+		SetEvent(wait->done);
+	else
+		delete res;
+	WaitCtxRelease(wait);
+}
+
+static HttpResult *NewErrorResult(DWORD error)
+{
+	HttpResult *res = new HttpResult();
+	if (res)
+		res->error = error;
+	return res;
+}
+
+HttpResult *HttpAsyncSendWait(const HttpRequest *req, DWORD timeoutMs)
+{
+	HttpResult *res = NULL;
+	EnsureInitialized();
+	WaitCtx *wait = SAZ(WaitCtx);
+	if (!wait)
+		return NULL;
+	wait->refCount = 2;
+	wait->state = WAITER_PENDING;
+	wait->done = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!wait->done) {
+		free(wait);
+		return NULL;
+	}
+	DWORD id = HttpAsyncSend(req, timeoutMs, WaitDone, wait);
+	if (0 == id) {
+		// the callback won't be called
+		CloseHandle(wait->done);
+		free(wait);
+		return NULL;
+	}
+
+	HANDLE handles[2] = { wait->done, g_stopEvent };
+	DWORD waitMs = timeoutMs + HTTP_ASYNC_WAIT_GRACE_MS;
+	if (waitMs < timeoutMs)
+		waitMs = INFINITE - 1;
+	DWORD waitRes = WaitForMultipleObjects(dimof(handles), handles, FALSE, waitMs);
+	if (WAIT_OBJECT_0 == waitRes)
+		goto Done;
+
+	// the transport is stuck past the timeout, or we're stopping. The job
+	// finishes on its own when the transport lets go of it
+	if (WAITER_PENDING == InterlockedCompareExchange(&wait->state, WAITER_GONE, WAITER_PENDING)) {
+		HttpAsyncCancel(id);
+		res = NewErrorResult((WAIT_TIMEOUT == waitRes) ? HTTP_ERR_TIMED_OUT : HTTP_ERR_CANCELLED);
+		WaitCtxRelease(wait);
+		return res;
+	}
+	// the callback got there first
+	WaitForSingleObject(wait->done, INFINITE);
+Done:
+	res = wait->res;
+	WaitCtxRelease(wait);
+	return res;
+}
+
+HttpResult *HttpAsyncGetWait(const char *host, const char *url, INTERNET_PORT port, DWORD timeoutMs)
+{
+	HttpRequest req;
+	HttpRequestInit(&req, "GET", host, url, port);
+	return HttpAsyncSendWait(&req, timeoutMs);
+}
+
+HttpResult *HttpAsyncPostWait(const char *host, const char *url, const char *params, INTERNET_PORT port, DWORD timeoutMs)
+{
+	HttpRequest req;
+	HttpRequestInit(&req, "POST", host, url, port);
+	req.headers = CONTENT_TYPE_URL_ENCODED;
+	req.body = params;
+	req.bodySize = (DWORD)strlen(params);
+	return HttpAsyncSendWait(&req, timeoutMs);
+}
+
+bool HttpAsyncCancel(DWORD id)
+{
+	HttpAsyncJob *job;
+	HttpAsyncJob *prev = NULL;
+
+	EnsureInitialized();
+	LOCK();
+	for (job = g_running; job; job = job->next) {
+		if (job->id == id) {
+			job->cancelled = true;
+			UNLOCK();
+			return true;
+		}
+	}
+
+	for (job = g_queueFirst; job; job = job->next) {
+		if (job->id == id)
+			break;
+		prev = job;
+	}
+	if (!job) {
+		UNLOCK();
+		return false;
+	}
+	if (prev)
+		prev->next = job->next;
+	else
+		g_queueFirst = job->next;
+	if (g_queueLast == job)
+		g_queueLast = prev;
+	g_queuedCount--;
+	UNLOCK();
+
+	JobCancel(job);
+	return true;
+}
+
+void HttpAsyncStop()
+{
+	EnsureInitialized();
+	LOCK();
+	if (g_stopping) {
+		UNLOCK();
+		return;
+	}
+	g_stopping = true;
+	SetEvent(g_stopEvent);
+	HttpAsyncJob *queued = g_queueFirst;
+	g_queueFirst = g_queueLast = NULL;
+	g_queuedCount = 0;
+	for (HttpAsyncJob *job = g_running; job; job = job->next)
+		job->cancelled = true;
+	int workerCount = g_workerCount;
+	if (workerCount > 0)
+		ReleaseSemaphore(g_jobsSem, workerCount, NULL);
+	UNLOCK();
+
+	while (queued) {
+		HttpAsyncJob *next = queued->next;
+		JobCancel(queued);
+		queued = next;
+	}
+}
+
+void HttpAsyncShutdown(DWORD waitMs)
+{
+	HANDLE workers[HTTP_ASYNC_MAX_WORKERS];
+
+	HttpAsyncStop();
+	LOCK();
+	int count = g_workerHandleCount;
+	memcpy(workers, g_workers, count * sizeof(HANDLE));
+	g_workerHandleCount = 0;
+	UNLOCK();
+
+	if (count > 0)
+		WaitForMultipleObjects(count, workers, TRUE, waitMs);
+	// workers that are still running don't need their handle
+	for (int i=0; i < count; i++)
+		CloseHandle(workers[i]);
+}
+
+typedef struct {
+	HWND	hwnd;
+	UINT	msg;
+} NotifyWindowCtx;
+
+static void NotifyWindow(void *ctx, HttpResult *res)
+{
+	NotifyWindowCtx *notify = (NotifyWindowCtx*)ctx;
+	if (!PostMessage(notify->hwnd, notify->msg, (WPARAM)res, 0))
+		delete res;
+	free(notify);
+}
+
+// posts <msg> to <hwndToNotify> with the HttpResult as WPARAM when the
+// request completes. The window must delete it
+bool HttpPostAsync(const char *host, const char *url, const char *params, bool https, HWND hwndToNotify, UINT msg)
+{
+	NotifyWindowCtx *notify = SA(NotifyWindowCtx);
+	if (!notify)
+		return false;
+	notify->hwnd = hwndToNotify;
+	notify->msg = msg;
+	INTERNET_PORT port = INTERNET_DEFAULT_HTTP_PORT;
+	if (https)
+		port = INTERNET_DEFAULT_HTTPS_PORT;
+	if (0 == HttpAsyncPost(host, url, params, port, HTTP_ASYNC_DEFAULT_TIMEOUT_MS, NotifyWindow, notify)) {
+		free(notify);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,62 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef HTTP_ASYNC_H__
+#define HTTP_ASYNC_H__
+
+#include "HttpTransport.h"
+
+// Runs http requests on a small pool of worker threads, shared by everyone
+// in the process. Requests wait in a queue when all workers are busy.
+// Workers are started as needed, up to HTTP_ASYNC_MAX_WORKERS.
+
+#define HTTP_ASYNC_MAX_WORKERS			4
+#define HTTP_ASYNC_DEFAULT_TIMEOUT_MS	(60*1000)
+// how much longer than its timeout HttpAsyncSendWait() waits for a request
+// before giving up on it, for transports that don't keep to the timeout
+#define HTTP_ASYNC_WAIT_GRACE_MS		(2*1000)
+
+// HttpResult::error values for requests that didn't complete
+#define HTTP_ERR_CANCELLED	((DWORD)-10)
+#define HTTP_ERR_TIMED_OUT	((DWORD)-11)
+
+// Called exactly once per request, on a worker thread (or the thread that
+// calls HttpAsyncStop() for requests that never started). Takes
+// ownership of <res>, which is never NULL
+typedef void (*HttpAsyncCallback)(void *ctx, HttpResult *res);
+
+// Queues a copy of <req>. If the request doesn't complete within
+// <timeoutMs> of being queued, it's aborted with HTTP_ERR_TIMED_OUT.
+// Returns an id for HttpAsyncCancel(), 0 if the request couldn't be queued
+// (in which case <cb> isn't called)
+DWORD	HttpAsyncSend(const HttpRequest *req, DWORD timeoutMs, HttpAsyncCallback cb, void *cbCtx);
+DWORD	HttpAsyncPost(const char *host, const char *url, const char *params, INTERNET_PORT port, DWORD timeoutMs, HttpAsyncCallback cb, void *cbCtx);
+
+// Queue the request and wait for it. For background threads that can block
+// but want the whole request bounded by <timeoutMs> and aborted by
+// HttpAsyncStop(), which a plain HttpGet() isn't. If the transport takes
+// more than HTTP_ASYNC_WAIT_GRACE_MS longer than that, the request is
+// cancelled and HTTP_ERR_TIMED_OUT returned without waiting for it. After
+// HttpAsyncStop() it returns HTTP_ERR_CANCELLED right away. Returns NULL if
+// the request couldn't be queued
+HttpResult *HttpAsyncSendWait(const HttpRequest *req, DWORD timeoutMs);
+HttpResult *HttpAsyncGetWait(const char *host, const char *url, INTERNET_PORT port, DWORD timeoutMs);
+HttpResult *HttpAsyncPostWait(const char *host, const char *url, const char *params, INTERNET_PORT port, DWORD timeoutMs);
+
+// The request completes with HTTP_ERR_CANCELLED: right away if it was
+// still queued, otherwise as soon as the transport returns or delivers
+// more data. Returns false if the request already completed
+bool	HttpAsyncCancel(DWORD id);
+
+// Cancels all requests and wakes up everyone waiting in
+// HttpAsyncSendWait(). Requests can't be queued afterwards. Doesn't wait for
+// anything, so it can be called e.g. from a service control handler, and
+// more than once
+void	HttpAsyncStop();
+
+// HttpAsyncStop(), then waits up to <waitMs> for the workers to finish.
+// Called once, when the process is done with http
+void	HttpAsyncShutdown(DWORD waitMs);
+
+#endif
@@ -0,0 +1,242 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "HttpAsync.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+#include "UnitTests.h"
+
+// Answers with the url. Urls starting with "/slow" trickle a byte every
+// millisecond until g_slowDone is set, giving the data callback a chance
+// to abort the request. "/stuck" blocks until g_slowDone is set, like a
+// transport that doesn't keep to its timeout. "/sized" sends SIZED_LEN
+// bytes with their size upfront and fails if the result had to grow while
+// they came in.
+
+#define SIZED_LEN	4000
+class FakeTransport : public HttpTransport {
+public:
+	virtual void Send(const HttpRequest *req, HttpResult *res);
+};
+
+static volatile bool g_slowDone;
+
+void FakeTransport::Send(const HttpRequest *req, HttpResult *res)
+{
+	if (StrStartsWithI(req->url, "/stuck")) {
+		while (!g_slowDone)
+			Sleep(1);
+	}
+	if (StrStartsWithI(req->url, "/slow")) {
+		while (!g_slowDone) {
+			if (!req->dataCb(req->dataCbCtx, ".", 1)) {
+				res->error = (DWORD)-1;
+				return;
+			}
+			Sleep(1);
+		}
+	}
+	if (StrStartsWithI(req->url, "/sized")) {
+		char chunk[1000];
+		memset(chunk, 'x', sizeof(chunk));
+		if (req->sizeCb)
+			req->sizeCb(req->dataCbCtx, SIZED_LEN);
+		const char *buf = res->data.data();
+		for (int i=0; i < SIZED_LEN / (int)sizeof(chunk); i++)
+			req->dataCb(req->dataCbCtx, chunk, sizeof(chunk));
+		if (res->data.data() != buf)
+			res->error = (DWORD)-2;
+		return;
+	}
+	if (req->dataCb)
+		req->dataCb(req->dataCbCtx, req->url, (DWORD)strlen(req->url));
+	else
+		res->data.append(req->url, strlen(req->url));
+}
+
+typedef struct {
+	volatile bool	done;
+	HttpResult *	res;
+} AsyncResult;
+
+static void OnResult(void *ctx, HttpResult *res)
+{
+	AsyncResult *r = (AsyncResult*)ctx;
+	r->res = res;
+	r->done = true;
+}
+
+static bool WaitDone(AsyncResult *results, int count)
+{
+	for (int ms=0; ms < 5000; ms++) {
+		int done = 0;
+		for (int i=0; i < count; i++) {
+			if (results[i].done)
+				done++;
+		}
+		if (done == count)
+			return true;
+		Sleep(1);
+	}
+	return false;
+}
+
+static DWORD AsyncGet(const char *url, DWORD timeoutMs, AsyncResult *r)
+{
+	HttpRequest req;
+	HttpRequestInit(&req, "GET", "api.opendns.com", url, INTERNET_DEFAULT_HTTPS_PORT);
+	return HttpAsyncSend(&req, timeoutMs, OnResult, r);
+}
+
+static void FreeResults(AsyncResult *results, int count)
+{
+	for (int i=0; i < count; i++)
+		delete results[i].res;
+}
+
+// more requests than there are workers, so some wait in the queue
+static void http_async_complete_ut()
+{
+	AsyncResult results[HTTP_ASYNC_MAX_WORKERS * 3];
+	char url[32];
+	int count = dimof(results);
+
+	memzero(results, sizeof(results));
+	for (int i=0; i < count; i++) {
+		sprintf(url, "/req/%d", i);
+		DWORD id = AsyncGet(url, HTTP_ASYNC_DEFAULT_TIMEOUT_MS, &results[i]);
+		utassert(0 != id);
+	}
+	bool done = WaitDone(results, count);
+	utassert(done);
+	for (int i=0; done && (i < count); i++) {
+		sprintf(url, "/req/%d", i);
+		utassert(0 == results[i].res->error);
+		utassert(streq(url, results[i].res->data.data()));
+	}
+	FreeResults(results, count);
+}
+
+static void http_async_cancel_ut()
+{
+	AsyncResult slow[HTTP_ASYNC_MAX_WORKERS];
+	AsyncResult queued[2];
+	DWORD slowIds[HTTP_ASYNC_MAX_WORKERS];
+	DWORD queuedIds[2];
+	bool ok;
+
+	memzero(slow, sizeof(slow));
+	memzero(queued, sizeof(queued));
+	g_slowDone = false;
+	for (int i=0; i < HTTP_ASYNC_MAX_WORKERS; i++)
+		slowIds[i] = AsyncGet("/slow", HTTP_ASYNC_DEFAULT_TIMEOUT_MS, &slow[i]);
+	for (int i=0; i < 2; i++)
+		queuedIds[i] = AsyncGet("/queued", HTTP_ASYNC_DEFAULT_TIMEOUT_MS, &queued[i]);
+
+	// still in the queue, so the callback is called right away
+	ok = HttpAsyncCancel(queuedIds[0]);
+	utassert(ok);
+	utassert(queued[0].done);
+	utassert(queued[0].res && (HTTP_ERR_CANCELLED == queued[0].res->error));
+
+	// aborted while receiving
+	ok = HttpAsyncCancel(slowIds[0]);
+	utassert(ok);
+	ok = WaitDone(&slow[0], 1);
+	utassert(ok);
+	utassert(slow[0].res && (HTTP_ERR_CANCELLED == slow[0].res->error));
+	utassert(slow[0].res && (0 == slow[0].res->data.size()));
+
+	g_slowDone = true;
+	ok = WaitDone(slow, HTTP_ASYNC_MAX_WORKERS);
+	utassert(ok);
+	ok = WaitDone(&queued[1], 1);
+	utassert(ok);
+	utassert(queued[1].res && (0 == queued[1].res->error));
+
+	// already completed
+	ok = HttpAsyncCancel(slowIds[1]);
+	utassert(!ok);
+	ok = HttpAsyncCancel(queuedIds[0]);
+	utassert(!ok);
+
+	FreeResults(slow, HTTP_ASYNC_MAX_WORKERS);
+	FreeResults(queued, 2);
+}
+
+static void http_async_timeout_ut()
+{
+	AsyncResult r;
+	memzero(&r, sizeof(r));
+	g_slowDone = false;
+	DWORD id = AsyncGet("/slow", 50, &r);
+	utassert(0 != id);
+	bool done = WaitDone(&r, 1);
+	g_slowDone = true;
+	utassert(done);
+	utassert(r.res && (HTTP_ERR_TIMED_OUT == r.res->error));
+	delete r.res;
+}
+
+// the result is sized from Content-Length, like without HttpAsync
+static void http_async_presize_ut()
+{
+	AsyncResult r;
+	memzero(&r, sizeof(r));
+	DWORD id = AsyncGet("/sized", HTTP_ASYNC_DEFAULT_TIMEOUT_MS, &r);
+	utassert(0 != id);
+	bool done = WaitDone(&r, 1);
+	utassert(done);
+	utassert(r.res && (0 == r.res->error));
+	utassert(r.res && (SIZED_LEN == r.res->data.size()));
+	delete r.res;
+}
+
+static void http_async_wait_ut()
+{
+	HttpResult *res = HttpAsyncGetWait("api.opendns.com", "/wait", INTERNET_DEFAULT_HTTPS_PORT, HTTP_ASYNC_DEFAULT_TIMEOUT_MS);
+	utassert(res && (0 == res->error));
+	utassert(res && streq("/wait", res->data.data()));
+	delete res;
+
+	g_slowDone = false;
+	res = HttpAsyncGetWait("api.opendns.com", "/slow", INTERNET_DEFAULT_HTTPS_PORT, 50);
+	g_slowDone = true;
+	utassert(res && (HTTP_ERR_TIMED_OUT == res->error));
+	delete res;
+}
+
+// a transport that doesn't return is given up on a little after the timeout
+static void http_async_wait_stuck_ut()
+{
+	g_slowDone = false;
+	DWORD startMs = GetTickCount();
+	HttpResult *res = HttpAsyncGetWait("api.opendns.com", "/stuck", INTERNET_DEFAULT_HTTPS_PORT, 50);
+	DWORD waitedMs = GetTickCount() - startMs;
+	utassert(res && (HTTP_ERR_TIMED_OUT == res->error));
+	utassert(waitedMs < 50 + HTTP_ASYNC_WAIT_GRACE_MS + 1000);
+	delete res;
+
+	// the worker completes it once the transport returns, for nobody
+	g_slowDone = true;
+	res = HttpAsyncGetWait("api.opendns.com", "/after", INTERNET_DEFAULT_HTTPS_PORT, HTTP_ASYNC_DEFAULT_TIMEOUT_MS);
+	utassert(res && streq("/after", res->data.data()));
+	delete res;
+}
+
+void http_async_ut_all()
+{
+	FakeTransport transport;
+	HttpTransport *prev = HttpSetTransport(&transport);
+	http_async_complete_ut();
+	http_async_cancel_ut();
+	http_async_timeout_ut();
+	http_async_presize_ut();
+	http_async_wait_ut();
+	http_async_wait_stuck_ut();
+	HttpSetTransport(prev);
+}
@@ -0,0 +1,253 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "HttpConnPool.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+typedef struct {
+	void *	conn;
+	DWORD	lastUsedMs;
+} IdleConn;
+
+typedef struct HostConns {
+	struct HostConns *	next;
+	char *				host;
+	INTERNET_PORT		port;
+	int					inUse;
+	int					idleCount;
+	// most recently used last
+	IdleConn *			idle;
+	// counts free slots
+	HANDLE				slots;
+} HostConns;
+
+struct HttpConnPool {
+	int					maxConnsPerHost;
+	DWORD				idleTimeoutMs;
+	HttpConnCloseFunc	closeFunc;
+	HostConns *			hosts;
+	HttpConnPoolStats	stats;
+	CRITICAL_SECTION	cs;
+};
+
+#define LOCK(pool) EnterCriticalSection(&(pool)->cs)
+#define UNLOCK(pool) LeaveCriticalSection(&(pool)->cs)
+
+DWORD HttpConnPoolNowMs()
+{
+	return GetTickCount();
+}
+
+HttpConnPool *HttpConnPoolNew(int maxConnsPerHost, DWORD idleTimeoutMs, HttpConnCloseFunc closeFunc)
+{
+	HttpConnPool *pool = SAZ(HttpConnPool);
+	if (!pool)
+		return NULL;
+	pool->maxConnsPerHost = maxConnsPerHost;
+	pool->idleTimeoutMs = idleTimeoutMs;
+	pool->closeFunc = closeFunc;
+	InitializeCriticalSection(&pool->cs);
+	return pool;
+}
+
+void HttpConnPoolFree(HttpConnPool *pool)
+{
+	if (!pool)
+		return;
+	HostConns *hc = pool->hosts;
+	while (hc) {
+		HostConns *next = hc->next;
+		assert(0 == hc->inUse);
+		for (int i=0; i < hc->idleCount; i++)
+			pool->closeFunc(hc->idle[i].conn);
+		CloseHandle(hc->slots);
+		free(hc->idle);
+		free(hc->host);
+		free(hc);
+		hc = next;
+	}
+	DeleteCriticalSection(&pool->cs);
+	free(pool);
+}
+
+// must be called with the lock held
+static HostConns *FindOrCreateHost(HttpConnPool *pool, const char *host, INTERNET_PORT port)
+{
+	HostConns *hc;
+	for (hc = pool->hosts; hc; hc = hc->next) {
+		if ((hc->port == port) && strieq(hc->host, host))
+			return hc;
+	}
+
+	hc = SAZ(HostConns);
+	if (!hc)
+		return NULL;
+	hc->host = strdup(host);
+	hc->port = port;
+	hc->idle = (IdleConn*)malloc(sizeof(IdleConn) * pool->maxConnsPerHost);
+	hc->slots = CreateSemaphore(NULL, pool->maxConnsPerHost, pool->maxConnsPerHost, NULL);
+	if (!hc->slots)
+		goto Error;
+	if (!hc->host || !hc->idle)
+		goto Error;
+	hc->next = pool->hosts;
+	pool->hosts = hc;
+	return hc;
+Error:
+	if (hc->slots)
+		CloseHandle(hc->slots);
+	free(hc->idle);
+	free(hc->host);
+	free(hc);
+	return NULL;
+}
+
+// Must be called with the lock held. Takes the expired connections out of
+// the pool and returns them in a malloc()ed array, for CloseEvicted() to
+// close after the lock is released, so that a slow close doesn't hold up
+// other threads. Returns NULL if there are none
+static void **EvictIdleLocked(HttpConnPool *pool, DWORD nowMs, int *countOut)
+{
+	void **evicted = NULL;
+	int count = 0;
+	for (HostConns *hc = pool->hosts; hc; hc = hc->next) {
+		// the oldest are first
+		int expired = 0;
+		while ((expired < hc->idleCount) && (nowMs - hc->idle[expired].lastUsedMs >= pool->idleTimeoutMs))
+			expired++;
+		if (0 == expired)
+			continue;
+		void **tmp = (void**)realloc(evicted, (count + expired) * sizeof(void*));
+		if (!tmp)
+			break;
+		evicted = tmp;
+		for (int i=0; i < expired; i++)
+			evicted[count++] = hc->idle[i].conn;
+		hc->idleCount -= expired;
+		memmove(hc->idle, hc->idle + expired, hc->idleCount * sizeof(IdleConn));
+		pool->stats.connsEvicted += expired;
+	}
+	*countOut = count;
+	return evicted;
+}
+
+static void CloseEvicted(HttpConnPool *pool, void **evicted, int count)
+{
+	for (int i=0; i < count; i++)
+		pool->closeFunc(evicted[i]);
+	free(evicted);
+}
+
+void HttpConnPoolEvictIdle(HttpConnPool *pool, DWORD nowMs)
+{
+	int evictedCount;
+	LOCK(pool);
+	void **evicted = EvictIdleLocked(pool, nowMs, &evictedCount);
+	UNLOCK(pool);
+	CloseEvicted(pool, evicted, evictedCount);
+}
+
+static bool WaitForSlot(HttpConnPool *pool, HostConns *hc, DWORD timeoutMs)
+{
+	// the semaphore is only waited on with the lock released, so that
+	// HttpConnPoolRelease() can get to it
+	UNLOCK(pool);
+	DWORD res = WaitForSingleObject(hc->slots, timeoutMs);
+	LOCK(pool);
+	return WAIT_OBJECT_0 == res;
+}
+
+bool HttpConnPoolAcquire(HttpConnPool *pool, const char *host, INTERNET_PORT port, DWORD timeoutMs, HttpConnSlot *slot)
+{
+	DWORD nowMs = HttpConnPoolNowMs();
+	bool ok = false;
+	int evictedCount;
+
+	memzero(slot, sizeof(HttpConnSlot));
+	LOCK(pool);
+	void **evicted = EvictIdleLocked(pool, nowMs, &evictedCount);
+	HostConns *hc = FindOrCreateHost(pool, host, port);
+	if (!hc)
+		goto Exit;
+	if (!WaitForSlot(pool, hc, timeoutMs))
+		goto Exit;
+	hc->inUse++;
+	ok = true;
+
+	if (hc->idleCount > 0) {
+		hc->idleCount--;
+		slot->conn = hc->idle[hc->idleCount].conn;
+		slot->reused = true;
+	}
+Exit:
+	UNLOCK(pool);
+	CloseEvicted(pool, evicted, evictedCount);
+	return ok;
+}
+
+void HttpConnPoolRelease(HttpConnPool *pool, const char *host, INTERNET_PORT port, HttpConnSlot *slot, bool keepAlive)
+{
+	DWORD nowMs = HttpConnPoolNowMs();
+	void *toClose = NULL;
+
+	LOCK(pool);
+	HostConns *hc = FindOrCreateHost(pool, host, port);
+	assert(hc && (hc->inUse > 0));
+	hc->inUse--;
+
+	if (slot->conn) {
+		// there are at most maxConnsPerHost in use, so there is always
+		// room in <idle> for this one
+		if (keepAlive && (hc->idleCount < pool->maxConnsPerHost)) {
+			hc->idle[hc->idleCount].conn = slot->conn;
+			hc->idle[hc->idleCount].lastUsedMs = nowMs;
+			hc->idleCount++;
+		} else {
+			toClose = slot->conn;
+		}
+	}
+	ReleaseSemaphore(hc->slots, 1, NULL);
+	UNLOCK(pool);
+
+	if (toClose)
+		pool->closeFunc(toClose);
+	memzero(slot, sizeof(HttpConnSlot));
+}
+
+void HttpConnPoolCountRequest(HttpConnPool *pool, bool reused, DWORD connectMs)
+{
+	LOCK(pool);
+	if (reused) {
+		pool->stats.connsReused++;
+	} else {
+		pool->stats.connsOpened++;
+		pool->stats.connectMs += connectMs;
+	}
+	UNLOCK(pool);
+}
+
+void HttpConnPoolGetStats(HttpConnPool *pool, HttpConnPoolStats *stats)
+{
+	LOCK(pool);
+	*stats = pool->stats;
+	UNLOCK(pool);
+}
+
+double HttpConnPoolReuseRate(const HttpConnPoolStats *stats)
+{
+	uint64_t total = stats->connsOpened + stats->connsReused;
+	if (0 == total)
+		return 0;
+	return (double)stats->connsReused / (double)total;
+}
+
+uint64_t HttpConnPoolMsSaved(const HttpConnPoolStats *stats)
+{
+	if (0 == stats->connsOpened)
+		return 0;
+	return stats->connsReused * stats->connectMs / stats->connsOpened;
+}
@@ -0,0 +1,75 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef HTTP_CONN_POOL_H__
+#define HTTP_CONN_POOL_H__
+
+#include "Http.h"
+
+// A per-host pool of connections, shared by http transports. Connections
+// are opaque to the pool, the transport opens them and gives a function to
+// close them. At most maxConnsPerHost slots for a given host:port are in
+// use at any time, which is what limits how many requests we make to one
+// server at once, and idle connections are closed after idleTimeoutMs.
+// WinHTTP keeps the tcp (and ssl) connections alive under its session on
+// its own, so its transport only uses the slots and never gives the pool a
+// connection to keep.
+// The transport tells the pool whether each request it made had to open a
+// connection (see HttpConnPoolCountRequest()), which is what the stats are
+// made of.
+
+typedef struct HttpConnPool HttpConnPool;
+
+typedef void (*HttpConnCloseFunc)(void *conn);
+
+typedef struct {
+	// connection to use, NULL if the caller must open a new one and
+	// store it here
+	void *	conn;
+	bool	reused;
+} HttpConnSlot;
+
+typedef struct {
+	// requests that opened a new connection and requests that went over
+	// one that was already open
+	uint64_t	connsOpened;
+	uint64_t	connsReused;
+	// closed because they were idle for too long
+	uint64_t	connsEvicted;
+	// time spent opening the connections (including the ssl handshake)
+	uint64_t	connectMs;
+} HttpConnPoolStats;
+
+#define HTTP_POOL_MAX_CONNS_PER_HOST	4
+#define HTTP_POOL_IDLE_TIMEOUT_MS		(30*1000)
+
+HttpConnPool *	HttpConnPoolNew(int maxConnsPerHost, DWORD idleTimeoutMs, HttpConnCloseFunc closeFunc);
+// closes all idle connections. There must be no connections in use
+void			HttpConnPoolFree(HttpConnPool *pool);
+
+// waits up to <timeoutMs> for a free slot for <host>:<port>. Returns false
+// on timeout. Otherwise <slot>->conn is the most recently used idle
+// connection or NULL
+bool			HttpConnPoolAcquire(HttpConnPool *pool, const char *host, INTERNET_PORT port, DWORD timeoutMs, HttpConnSlot *slot);
+// must be called for every successful HttpConnPoolAcquire(). If <keepAlive>
+// is false, or the pool already has too many idle connections, <slot>->conn
+// is closed
+void			HttpConnPoolRelease(HttpConnPool *pool, const char *host, INTERNET_PORT port, HttpConnSlot *slot, bool keepAlive);
+// called once for every request that got as far as the server. <connectMs>
+// is how long opening the connection took if it wasn't <reused>
+void			HttpConnPoolCountRequest(HttpConnPool *pool, bool reused, DWORD connectMs);
+
+// closes connections idle since before <nowMs> - idleTimeoutMs. Done
+// automatically by HttpConnPoolAcquire()
+void			HttpConnPoolEvictIdle(HttpConnPool *pool, DWORD nowMs);
+DWORD			HttpConnPoolNowMs();
+
+void			HttpConnPoolGetStats(HttpConnPool *pool, HttpConnPoolStats *stats);
+// fraction of requests that reused a connection, 0..1
+double			HttpConnPoolReuseRate(const HttpConnPoolStats *stats);
+// roughly how much time reusing connections saved: every reused one would
+// have taken as long to open as the ones we did open, on average
+uint64_t		HttpConnPoolMsSaved(const HttpConnPoolStats *stats);
+
+#endif
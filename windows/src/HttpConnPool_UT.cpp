@@ -0,0 +1,202 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "HttpConnPool.h"
+#include "MiscUtil.h"
+
+#include "UnitTests.h"
+
+#define MAX_FAKE_CONNS 16
+
+// connections are indexes into g_closed, plus 1 so they're never NULL
+static int g_closed[MAX_FAKE_CONNS];
+static int g_nextConn;
+
+static void *FakeConnOpen()
+{
+	return (void*)(intptr_t)(++g_nextConn);
+}
+
+static void FakeConnClose(void *conn)
+{
+	g_closed[(intptr_t)conn - 1]++;
+}
+
+static int ClosedCount()
+{
+	int n = 0;
+	for (int i=0; i < MAX_FAKE_CONNS; i++)
+		n += g_closed[i];
+	return n;
+}
+
+static void http_conn_pool_reuse_ut()
+{
+	HttpConnPoolStats stats;
+	HttpConnSlot s1, s2, s3, s4;
+	bool ok;
+
+	memzero(g_closed, sizeof(g_closed));
+	g_nextConn = 0;
+	HttpConnPool *pool = HttpConnPoolNew(2, 1000, FakeConnClose);
+
+	ok = HttpConnPoolAcquire(pool, "api.opendns.com", 443, 0, &s1);
+	utassert(ok);
+	utassert(NULL == s1.conn && !s1.reused);
+	s1.conn = FakeConnOpen();
+	HttpConnPoolCountRequest(pool, false, 30);
+	HttpConnPoolRelease(pool, "api.opendns.com", 443, &s1, true);
+	utassert(0 == ClosedCount());
+
+	// the idle connection is handed out again, host is case-insensitive
+	ok = HttpConnPoolAcquire(pool, "API.opendns.com", 443, 0, &s1);
+	utassert(ok);
+	utassert((void*)1 == s1.conn && s1.reused);
+	HttpConnPoolCountRequest(pool, true, 0);
+
+	// different port is a different host
+	ok = HttpConnPoolAcquire(pool, "api.opendns.com", 80, 0, &s2);
+	utassert(ok);
+	utassert(NULL == s2.conn);
+	s2.conn = FakeConnOpen();
+	HttpConnPoolCountRequest(pool, false, 10);
+
+	// at most 2 connections in use per host
+	ok = HttpConnPoolAcquire(pool, "api.opendns.com", 443, 0, &s3);
+	utassert(ok);
+	utassert(NULL == s3.conn);
+	s3.conn = FakeConnOpen();
+	HttpConnPoolCountRequest(pool, false, 20);
+	ok = HttpConnPoolAcquire(pool, "api.opendns.com", 443, 0, &s4);
+	utassert(!ok);
+
+	// not kept alive, so it's closed and frees up a slot
+	HttpConnPoolRelease(pool, "api.opendns.com", 443, &s1, false);
+	utassert(1 == g_closed[0]);
+	ok = HttpConnPoolAcquire(pool, "api.opendns.com", 443, 0, &s4);
+	utassert(ok);
+	utassert(NULL == s4.conn);
+	// failed to open a connection, so it's not counted
+	HttpConnPoolRelease(pool, "api.opendns.com", 443, &s4, true);
+	HttpConnPoolRelease(pool, "api.opendns.com", 443, &s3, true);
+	HttpConnPoolRelease(pool, "api.opendns.com", 80, &s2, true);
+	utassert(1 == ClosedCount());
+
+	HttpConnPoolGetStats(pool, &stats);
+	utassert(3 == stats.connsOpened);
+	utassert(1 == stats.connsReused);
+	utassert(0 == stats.connsEvicted);
+	utassert(60 == stats.connectMs);
+	utassert(0.25 == HttpConnPoolReuseRate(&stats));
+	utassert(20 == HttpConnPoolMsSaved(&stats));
+
+	HttpConnPoolFree(pool);
+	utassert(3 == ClosedCount());
+}
+
+static void http_conn_pool_evict_ut()
+{
+	HttpConnPoolStats stats;
+	HttpConnSlot s1, s2;
+	bool ok;
+
+	memzero(g_closed, sizeof(g_closed));
+	g_nextConn = 0;
+	HttpConnPool *pool = HttpConnPoolNew(4, 1000, FakeConnClose);
+
+	ok = HttpConnPoolAcquire(pool, "updates.opendns.com", 443, 0, &s1);
+	utassert(ok);
+	ok = HttpConnPoolAcquire(pool, "updates.opendns.com", 443, 0, &s2);
+	utassert(ok);
+	s1.conn = FakeConnOpen();
+	s2.conn = FakeConnOpen();
+	HttpConnPoolRelease(pool, "updates.opendns.com", 443, &s1, true);
+	HttpConnPoolRelease(pool, "updates.opendns.com", 443, &s2, true);
+
+	DWORD now = HttpConnPoolNowMs();
+	HttpConnPoolEvictIdle(pool, now + 500);
+	utassert(0 == ClosedCount());
+	HttpConnPoolEvictIdle(pool, now + 5000);
+	utassert(1 == g_closed[0] && 1 == g_closed[1]);
+
+	HttpConnPoolGetStats(pool, &stats);
+	utassert(2 == stats.connsEvicted);
+
+	// nothing left to reuse
+	ok = HttpConnPoolAcquire(pool, "updates.opendns.com", 443, 0, &s1);
+	utassert(ok);
+	utassert(NULL == s1.conn);
+	HttpConnPoolRelease(pool, "updates.opendns.com", 443, &s1, true);
+
+	HttpConnPoolFree(pool);
+	utassert(2 == ClosedCount());
+}
+
+static HttpConnPool *g_lockedPool;
+static int g_closedWhileLocked;
+
+static DWORD WINAPI GetStatsThread(LPVOID /* param */)
+{
+	HttpConnPoolStats stats;
+	HttpConnPoolGetStats(g_lockedPool, &stats);
+	return 0;
+}
+
+// another thread must be able to use the pool while we close
+static void CheckUnlockedConnClose(void *conn)
+{
+	HANDLE thread = CreateThread(NULL, 0, GetStatsThread, NULL, 0, NULL);
+	if (WAIT_OBJECT_0 != WaitForSingleObject(thread, 5000))
+		g_closedWhileLocked++;
+	CloseHandle(thread);
+	FakeConnClose(conn);
+}
+
+// idle connections are closed with the lock released
+static void http_conn_pool_evict_unlocked_ut()
+{
+	HttpConnSlot s1;
+	bool ok;
+
+	memzero(g_closed, sizeof(g_closed));
+	g_nextConn = 0;
+	g_closedWhileLocked = 0;
+	HttpConnPool *pool = HttpConnPoolNew(2, 1000, CheckUnlockedConnClose);
+	g_lockedPool = pool;
+
+	ok = HttpConnPoolAcquire(pool, "updates.opendns.com", 443, 0, &s1);
+	utassert(ok);
+	s1.conn = FakeConnOpen();
+	HttpConnPoolRelease(pool, "updates.opendns.com", 443, &s1, true);
+	HttpConnPoolEvictIdle(pool, HttpConnPoolNowMs() + 5000);
+	utassert(1 == ClosedCount());
+	utassert(0 == g_closedWhileLocked);
+
+	HttpConnPoolFree(pool);
+	g_lockedPool = NULL;
+}
+
+static void http_conn_pool_reuse_rate_ut()
+{
+	HttpConnPoolStats stats;
+	memzero(&stats, sizeof(stats));
+	utassert(0 == HttpConnPoolReuseRate(&stats));
+	utassert(0 == HttpConnPoolMsSaved(&stats));
+
+	stats.connsOpened = 2;
+	stats.connsReused = 8;
+	stats.connectMs = 300;
+	utassert(0.8 == HttpConnPoolReuseRate(&stats));
+	utassert(1200 == HttpConnPoolMsSaved(&stats));
+}
+
+void http_conn_pool_ut_all()
+{
+	http_conn_pool_reuse_ut();
+	http_conn_pool_evict_ut();
+	http_conn_pool_evict_unlocked_ut();
+	http_conn_pool_reuse_rate_ut();
+}
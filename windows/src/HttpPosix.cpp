@@ -0,0 +1,530 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// http transport over POSIX non-blocking sockets. Speaks plain HTTP/1.1
+// and keeps connections alive in an HttpConnPool. Has no ssl, so https
+// requests only work when redirected to a plain http server with
+// NewPosixHttpTransport(connectHost, ...), which is what it's for: running
+// our requests against a local stub server, see HttpBench. Not part of the
+// Windows projects.
+
+#include "stdafx.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "HttpConnPool.h"
+#include "HttpTransport.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+// for the whole request, unless HttpRequest::timeoutMs is given
+#define HTTP_TIMEOUT_MS (30*1000)
+
+// don't trust Content-Length more than that when pre-sizing the buffer
+#define MAX_PRESIZE (16*1024*1024)
+
+// longest status or header line accepted
+#define MAX_LINE (16*1024)
+
+// errors that are not errno values
+#define HTTP_ERR_HTTPS_NOT_SUPPORTED	((DWORD)-2)
+#define HTTP_ERR_BAD_RESPONSE			((DWORD)-3)
+#define HTTP_ERR_TIMEOUT				((DWORD)-4)
+#define HTTP_ERR_ABORTED				((DWORD)-5)
+#define HTTP_ERR_CLOSED					((DWORD)-6)
+
+class PosixHttpTransport : public HttpTransport {
+private:
+	char *			m_connectHost;
+	INTERNET_PORT	m_connectPort;
+	HttpConnPool *	m_pool;
+
+public:
+	PosixHttpTransport(const char *connectHost, INTERNET_PORT connectPort);
+	virtual ~PosixHttpTransport();
+
+	virtual void Send(const HttpRequest *req, HttpResult *res);
+	virtual bool GetPoolStats(HttpConnPoolStats *stats);
+};
+
+static DWORD LastErrno()
+{
+	if (0 == errno)
+		return (DWORD)-1;
+	return (DWORD)errno;
+}
+
+// ms left until <endMs>, 0 if it passed
+static DWORD MsLeft(DWORD endMs)
+{
+	int left = (int)(endMs - HttpConnPoolNowMs());
+	return (left > 0) ? (DWORD)left : 0;
+}
+
+// returns 0 when <fd> is ready for <events> or an error. Every wait gets
+// what's left until <endMs>, so the whole request keeps to its timeout
+static DWORD WaitFor(int fd, short events, DWORD endMs)
+{
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = 0;
+	for (;;) {
+		DWORD left = MsLeft(endMs);
+		if (0 == left)
+			return HTTP_ERR_TIMEOUT;
+		int n = poll(&pfd, 1, (int)left);
+		if (n > 0)
+			return 0;
+		if ((n < 0) && (EINTR != errno))
+			return LastErrno();
+	}
+}
+
+static DWORD Connect(const char *host, INTERNET_PORT port, DWORD endMs, int *fdOut)
+{
+	struct addrinfo hints;
+	struct addrinfo *addrs = NULL;
+	char portStr[16];
+	DWORD err = (DWORD)-1;
+
+	memzero(&hints, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	sprintf(portStr, "%d", (int)port);
+	if (0 != getaddrinfo(host, portStr, &hints, &addrs))
+		return (DWORD)-1;
+
+	for (struct addrinfo *ai = addrs; ai; ai = ai->ai_next) {
+		int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (-1 == fd) {
+			err = LastErrno();
+			continue;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+		// requests are written in one go, don't hold back the end of them
+		int noDelay = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+		err = 0;
+		if (0 != connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+			if (EINPROGRESS != errno)
+				err = LastErrno();
+			else
+				err = WaitFor(fd, POLLOUT, endMs);
+			if (0 == err) {
+				int sockErr = 0;
+				socklen_t len = sizeof(sockErr);
+				getsockopt(fd, SOL_SOCKET, SO_ERROR, &sockErr, &len);
+				err = (DWORD)sockErr;
+			}
+		}
+		if (0 == err) {
+			*fdOut = fd;
+			break;
+		}
+		close(fd);
+	}
+	freeaddrinfo(addrs);
+	return err;
+}
+
+static DWORD SendAll(int fd, const char *data, size_t size, DWORD endMs)
+{
+	while (size > 0) {
+		ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+		if (n > 0) {
+			data += n;
+			size -= (size_t)n;
+			continue;
+		}
+		if ((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))
+			return LastErrno();
+		DWORD err = WaitFor(fd, POLLOUT, endMs);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static char *Base64Encode(const char *s, size_t len)
+{
+	static const char *chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	char *res = (char*)malloc(((len + 2) / 3) * 4 + 1);
+	if (!res)
+		return NULL;
+	char *out = res;
+	const unsigned char *in = (const unsigned char*)s;
+	for (size_t i=0; i < len; i += 3) {
+		unsigned int n = in[i] << 16;
+		if (i + 1 < len)
+			n |= in[i + 1] << 8;
+		if (i + 2 < len)
+			n |= in[i + 2];
+		*out++ = chars[(n >> 18) & 63];
+		*out++ = chars[(n >> 12) & 63];
+		*out++ = (i + 1 < len) ? chars[(n >> 6) & 63] : '=';
+		*out++ = (i + 2 < len) ? chars[n & 63] : '=';
+	}
+	*out = 0;
+	return res;
+}
+
+static bool AppendStr(GrowableBuf& buf, const char *s)
+{
+	return buf.append(s, strlen(s));
+}
+
+static bool BuildRequest(const HttpRequest *req, GrowableBuf& out)
+{
+	char num[16];
+	bool ok = AppendStr(out, req->method) && AppendStr(out, " ") &&
+		AppendStr(out, req->url) && AppendStr(out, " HTTP/1.1\r\nHost: ") &&
+		AppendStr(out, req->host) && AppendStr(out, "\r\nUser-Agent: OpenDNS Updater Client\r\n");
+	if (ok && req->userName) {
+		const char *pwd = req->pwd ? req->pwd : "";
+		size_t credentialsLen = strlen(req->userName) + 1 + strlen(pwd);
+		char *credentials = (char*)malloc(credentialsLen + 1);
+		if (!credentials)
+			return false;
+		sprintf(credentials, "%s:%s", req->userName, pwd);
+		char *encoded = Base64Encode(credentials, credentialsLen);
+		free(credentials);
+		if (!encoded)
+			return false;
+		ok = AppendStr(out, "Authorization: Basic ") && AppendStr(out, encoded) && AppendStr(out, "\r\n");
+		free(encoded);
+	}
+	if (ok && req->headers)
+		ok = AppendStr(out, req->headers);
+	if (ok && req->body) {
+		sprintf(num, "%u", (unsigned)req->bodySize);
+		ok = AppendStr(out, "Content-Length: ") && AppendStr(out, num) && AppendStr(out, "\r\n");
+	}
+	ok = ok && AppendStr(out, "\r\n");
+	if (ok && req->body)
+		ok = out.append(req->body, req->bodySize);
+	return ok;
+}
+
+static DWORD GiveData(const HttpRequest *req, HttpResult *res, const char *data, size_t size)
+{
+	if (0 == size)
+		return 0;
+	if (req->dataCb) {
+		if (!req->dataCb(req->dataCbCtx, data, (DWORD)size))
+			return HTTP_ERR_ABORTED;
+		return 0;
+	}
+	if (!res->data.append(data, size))
+		return (DWORD)ENOMEM;
+	return 0;
+}
+
+// buffered reading from a connection
+typedef struct {
+	int		fd;
+	DWORD	endMs;
+	char	buf[4096];
+	size_t	pos;
+	size_t	len;
+} Reader;
+
+static DWORD ReaderFill(Reader *r)
+{
+	for (;;) {
+		ssize_t n = recv(r->fd, r->buf, sizeof(r->buf), 0);
+		if (n > 0) {
+			r->pos = 0;
+			r->len = (size_t)n;
+			return 0;
+		}
+		if (0 == n)
+			return HTTP_ERR_CLOSED;
+		if ((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))
+			return LastErrno();
+		DWORD err = WaitFor(r->fd, POLLIN, r->endMs);
+		if (err)
+			return err;
+	}
+}
+
+// reads a line, without the terminating "\r\n"
+static DWORD ReadLine(Reader *r, GrowableBuf& line)
+{
+	line.freeAll();
+	for (;;) {
+		if (r->pos == r->len) {
+			DWORD err = ReaderFill(r);
+			if (err)
+				return err;
+		}
+		char *start = r->buf + r->pos;
+		char *end = (char*)memchr(start, '\n', r->len - r->pos);
+		size_t n = end ? (end - start) : (r->len - r->pos);
+		if (line.size() + n > MAX_LINE)
+			return HTTP_ERR_BAD_RESPONSE;
+		if (!line.append(start, n))
+			return (DWORD)ENOMEM;
+		if (!end) {
+			r->pos = r->len;
+			continue;
+		}
+		r->pos += n + 1;
+		if ((line.size() > 0) && ('\r' == line.data()[line.size() - 1]))
+			line.truncate(line.size() - 1);
+		return 0;
+	}
+}
+
+// passes on <size> bytes of body, or everything until the server closes
+// the connection if <toEof> is true
+static DWORD ReadBody(Reader *r, size_t size, bool toEof, const HttpRequest *req, HttpResult *res)
+{
+	while (toEof || (size > 0)) {
+		if (r->pos == r->len) {
+			DWORD err = ReaderFill(r);
+			if (toEof && (HTTP_ERR_CLOSED == err))
+				return 0;
+			if (err)
+				return err;
+		}
+		size_t n = r->len - r->pos;
+		if (!toEof && (n > size))
+			n = size;
+		DWORD err = GiveData(req, res, r->buf + r->pos, n);
+		if (err)
+			return err;
+		r->pos += n;
+		if (!toEof)
+			size -= n;
+	}
+	return 0;
+}
+
+static DWORD ReadChunkedBody(Reader *r, const HttpRequest *req, HttpResult *res)
+{
+	GrowableBuf line;
+	for (;;) {
+		DWORD err = ReadLine(r, line);
+		if (err)
+			return err;
+		const char *sizeStr = line.data() ? line.data() : "";
+		char *end;
+		unsigned long size = strtoul(sizeStr, &end, 16);
+		if (end == sizeStr)
+			return HTTP_ERR_BAD_RESPONSE;
+		if (0 == size)
+			break;
+		err = ReadBody(r, size, false, req, res);
+		if (!err)
+			err = ReadLine(r, line);
+		if (err)
+			return err;
+	}
+	// skip trailers
+	do {
+		DWORD err = ReadLine(r, line);
+		if (err)
+			return err;
+	} while (line.size() > 0);
+	return 0;
+}
+
+static const char *HeaderValue(const char *line, const char *name)
+{
+	size_t nameLen = strlen(name);
+	if ((0 != strncasecmp(line, name, nameLen)) || (':' != line[nameLen]))
+		return NULL;
+	line += nameLen + 1;
+	while ((' ' == *line) || ('\t' == *line))
+		line++;
+	return line;
+}
+
+// The body is passed on as it arrives, headers are dropped. Sets
+// <gotResponse> once the status line was read and <keepAlive> if the
+// connection can be used for another request
+static DWORD ReadResponse(Reader *r, const HttpRequest *req, HttpResult *res, bool *gotResponse, bool *keepAlive)
+{
+	GrowableBuf	line;
+	long		contentLength = -1;
+	bool		chunked = false;
+	DWORD		err;
+
+	*gotResponse = false;
+	*keepAlive = false;
+
+	err = ReadLine(r, line);
+	if (err)
+		return err;
+	if ((line.size() < 12) || !StrStartsWithI(line.data(), "HTTP/1."))
+		return HTTP_ERR_BAD_RESPONSE;
+	*gotResponse = true;
+	bool http11 = ('1' == line.data()[7]);
+	int status = atoi(line.data() + 9);
+	bool canKeepAlive = http11;
+
+	for (;;) {
+		err = ReadLine(r, line);
+		if (err)
+			return err;
+		if (0 == line.size())
+			break;
+		const char *val;
+		if (NULL != (val = HeaderValue(line.data(), "Content-Length"))) {
+			contentLength = atol(val);
+		} else if (NULL != (val = HeaderValue(line.data(), "Transfer-Encoding"))) {
+			chunked = strieq(val, "chunked");
+		} else if (NULL != (val = HeaderValue(line.data(), "Connection"))) {
+			if (strieq(val, "close"))
+				canKeepAlive = false;
+			else if (strieq(val, "keep-alive"))
+				canKeepAlive = true;
+		}
+	}
+
+	if ((204 == status) || (304 == status) || ((status >= 100) && (status < 200))) {
+		*keepAlive = canKeepAlive;
+		return 0;
+	}
+	if (chunked) {
+		err = ReadChunkedBody(r, req, res);
+		*keepAlive = canKeepAlive;
+	} else if (contentLength >= 0) {
+		if (!req->dataCb && (contentLength <= MAX_PRESIZE))
+			res->data.reserve(contentLength);
+		if (req->sizeCb && (contentLength <= MAX_PRESIZE))
+			req->sizeCb(req->dataCbCtx, (DWORD)contentLength);
+		err = ReadBody(r, contentLength, false, req, res);
+		*keepAlive = canKeepAlive;
+	} else {
+		err = ReadBody(r, 0, true, req, res);
+	}
+	// a server that sends more than it said leaves the connection in an
+	// unknown state
+	if (r->pos != r->len)
+		*keepAlive = false;
+	return err;
+}
+
+// connections are stored in the pool as fd + 1, so that they're never NULL
+static void *ConnFromFd(int fd)
+{
+	return (void*)(intptr_t)(fd + 1);
+}
+
+static int FdFromConn(void *conn)
+{
+	return (int)(intptr_t)conn - 1;
+}
+
+static void CloseConn(void *conn)
+{
+	close(FdFromConn(conn));
+}
+
+PosixHttpTransport::PosixHttpTransport(const char *connectHost, INTERNET_PORT connectPort)
+{
+	m_connectHost = connectHost ? strdup(connectHost) : NULL;
+	m_connectPort = connectPort;
+	m_pool = HttpConnPoolNew(HTTP_POOL_MAX_CONNS_PER_HOST, HTTP_POOL_IDLE_TIMEOUT_MS, CloseConn);
+}
+
+PosixHttpTransport::~PosixHttpTransport()
+{
+	HttpConnPoolFree(m_pool);
+	free(m_connectHost);
+}
+
+bool PosixHttpTransport::GetPoolStats(HttpConnPoolStats *stats)
+{
+	HttpConnPoolGetStats(m_pool, stats);
+	return true;
+}
+
+void PosixHttpTransport::Send(const HttpRequest *req, HttpResult *res)
+{
+	const char *	host = req->host;
+	INTERNET_PORT	port = req->port;
+	HttpConnSlot	slot;
+	GrowableBuf		request;
+	bool			gotResponse = false;
+	bool			keepAlive = false;
+	DWORD			timeoutMs = req->timeoutMs ? req->timeoutMs : HTTP_TIMEOUT_MS;
+	DWORD			endMs = HttpConnPoolNowMs() + timeoutMs;
+	DWORD			connectMs = 0;
+	DWORD			err;
+
+	if (m_connectHost) {
+		host = m_connectHost;
+		port = m_connectPort;
+	} else if (INTERNET_DEFAULT_HTTPS_PORT == port) {
+		res->error = HTTP_ERR_HTTPS_NOT_SUPPORTED;
+		return;
+	}
+
+	if (!BuildRequest(req, request)) {
+		res->error = (DWORD)ENOMEM;
+		return;
+	}
+
+	if (!HttpConnPoolAcquire(m_pool, host, port, timeoutMs, &slot)) {
+		res->error = HTTP_ERR_TIMEOUT;
+		return;
+	}
+
+	for (;;) {
+		err = 0;
+		if (!slot.conn) {
+			int fd = -1;
+			DWORD startMs = HttpConnPoolNowMs();
+			err = Connect(host, port, endMs, &fd);
+			connectMs = HttpConnPoolNowMs() - startMs;
+			if (0 == err)
+				slot.conn = ConnFromFd(fd);
+		}
+		if (0 == err)
+			err = SendAll(FdFromConn(slot.conn), request.data(), request.size(), endMs);
+		if (0 == err) {
+			Reader r;
+			r.fd = FdFromConn(slot.conn);
+			r.endMs = endMs;
+			r.pos = r.len = 0;
+			err = ReadResponse(&r, req, res, &gotResponse, &keepAlive);
+		}
+		// the server might have closed a kept-alive connection while it
+		// was idle, in which case the request is sent again on a new one
+		if (err && slot.reused && !gotResponse && (HTTP_ERR_TIMEOUT != err)) {
+			CloseConn(slot.conn);
+			slot.conn = NULL;
+			slot.reused = false;
+			continue;
+		}
+		break;
+	}
+
+	if (gotResponse)
+		HttpConnPoolCountRequest(m_pool, slot.reused, connectMs);
+	HttpConnPoolRelease(m_pool, host, port, &slot, (0 == err) && keepAlive);
+	res->error = err;
+}
+
+HttpTransport *NewPosixHttpTransport(const char *connectHost, INTERNET_PORT connectPort)
+{
+	return new PosixHttpTransport(connectHost, connectPort);
+}
+
+static PosixHttpTransport g_defaultTransport(NULL, 0);
+
+HttpTransport *DefaultHttpTransport()
+{
+	return &g_defaultTransport;
+}
@@ -0,0 +1,71 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef HTTP_TRANSPORT_H__
+#define HTTP_TRANSPORT_H__
+
+#include "Http.h"
+#include "HttpConnPool.h"
+
+// Everything needed to make a single http request. Strings are utf8.
+typedef struct {
+	const char *		method;
+	const char *		host;
+	const char *		url;
+	// https is used for INTERNET_DEFAULT_HTTPS_PORT
+	INTERNET_PORT		port;
+	// NULL or additional headers, each terminated with "\r\n"
+	const char *		headers;
+	const void *		body;
+	DWORD				bodySize;
+	// for basic authentication, NULL if not needed
+	const char *		userName;
+	const char *		pwd;
+	// if not NULL, the response is given to it as it's read instead
+	// of being collected in HttpResult::data
+	HttpDataCallback	dataCb;
+	// optional, only used together with dataCb
+	HttpSizeCallback	sizeCb;
+	void *				dataCbCtx;
+	// 0 for the transport's defaults. Otherwise bounds the whole request,
+	// from waiting for a connection to reading the last of the response
+	DWORD				timeoutMs;
+} HttpRequest;
+
+// for HttpRequest::headers
+#define CONTENT_TYPE_URL_ENCODED "Content-Type: application/x-www-form-urlencoded\r\n"
+#define CONTENT_TYPE_BINARY "Content-Type: application/binary\r\n"
+
+void HttpRequestInit(HttpRequest *req, const char *method, const char *host, const char *url, INTERNET_PORT port);
+
+// HttpGet(), HttpPost() etc. build an HttpRequest and hand it to the
+// current transport: WinHTTP, unless a test sets another one.
+class HttpTransport {
+public:
+	virtual ~HttpTransport() {}
+	// sets HttpResult::error if the request failed
+	virtual void Send(const HttpRequest *req, HttpResult *res) = 0;
+	// returns false if the transport doesn't know which requests reused
+	// a connection
+	virtual bool GetPoolStats(HttpConnPoolStats *stats) { return false; }
+};
+
+HttpTransport *NewWinHttpTransport();
+// Plain http over POSIX sockets (HttpPosix.cpp, not built on Windows). If
+// <connectHost> isn't NULL, all requests go to <connectHost>:<connectPort>
+// instead of to their host, https ones included
+HttpTransport *NewPosixHttpTransport(const char *connectHost, INTERNET_PORT connectPort);
+
+// the WinHTTP one, or the POSIX one where there's no WinHTTP
+HttpTransport *DefaultHttpTransport();
+
+HttpTransport *HttpGetTransport();
+// NULL restores the default transport. Should be done before any requests
+// are made. Returns the previous transport set with HttpSetTransport()
+HttpTransport *HttpSetTransport(HttpTransport *transport);
+
+// connection reuse counters of the current transport
+bool HttpGetPoolStats(HttpConnPoolStats *stats);
+
+#endif
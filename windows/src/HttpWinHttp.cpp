@@ -0,0 +1,400 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "HttpConnPool.h"
+#include "HttpTransport.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+// don't trust Content-Length more than that when pre-sizing the buffer
+#define MAX_PRESIZE (16*1024*1024)
+
+// how long to wait for one of HTTP_POOL_MAX_CONNS_PER_HOST to free up
+#define POOL_WAIT_TIMEOUT_MS (60*1000)
+
+// Vista and later, not in older SDKs
+#ifndef WINHTTP_OPTION_RECEIVE_RESPONSE_TIMEOUT
+#define WINHTTP_OPTION_RECEIVE_RESPONSE_TIMEOUT 7
+#endif
+
+// A single WinHTTP session is kept for the life of the transport, so that
+// WinHTTP can keep the tcp (and ssl) connections under it alive. It does
+// that on its own, a connect handle is cheap and doesn't open anything, so
+// each request gets a new one. The pool only gives out its slots, so that
+// we don't make more than HTTP_POOL_MAX_CONNS_PER_HOST requests to one
+// server at once. Whether a request opened a connection is learnt from
+// WinHTTP's status callbacks.
+class WinHttpTransport : public HttpTransport {
+private:
+	HINTERNET		m_session;
+	HttpConnPool *	m_pool;
+	// false if we couldn't set the status callback, then we can't tell
+	// which requests opened a connection
+	bool			m_countConns;
+
+	HINTERNET GetSession();
+
+public:
+	WinHttpTransport();
+	virtual ~WinHttpTransport();
+
+	virtual void Send(const HttpRequest *req, HttpResult *res);
+	virtual bool GetPoolStats(HttpConnPoolStats *stats);
+};
+
+static void ShowLastError(HttpResult *res)
+{
+	DWORD error = GetLastError();
+	char *err = LastErrorAsStr(error);
+	free(err);
+	if (0 == error)
+		error = (DWORD)-1;
+	res->error = error;
+}
+
+// never called, WinHTTP keeps the connections
+static void CloseConn(void *conn)
+{
+	assert(0);
+}
+
+// what the status callbacks saw of a single request
+typedef struct {
+	bool	connecting;
+	bool	opened;
+	DWORD	connectStartMs;
+	DWORD	connectMs;
+} ConnTiming;
+
+// WinHTTP only connects (and does the ssl handshake) when it has no idle
+// connection to the server. Once it starts sending, that's done
+static void CALLBACK StatusCallback(HINTERNET hInternet, DWORD_PTR context, DWORD status, LPVOID info, DWORD infoLen)
+{
+	ConnTiming *timing = (ConnTiming*)context;
+	if (!timing)
+		return;
+	if (WINHTTP_CALLBACK_STATUS_CONNECTING_TO_SERVER == status) {
+		timing->connecting = true;
+		timing->opened = true;
+		timing->connectStartMs = GetTickCount();
+	} else if ((WINHTTP_CALLBACK_STATUS_SENDING_REQUEST == status) && timing->connecting) {
+		timing->connecting = false;
+		timing->connectMs += GetTickCount() - timing->connectStartMs;
+	}
+}
+
+WinHttpTransport::WinHttpTransport()
+{
+	m_session = NULL;
+	m_countConns = false;
+	m_pool = HttpConnPoolNew(HTTP_POOL_MAX_CONNS_PER_HOST, HTTP_POOL_IDLE_TIMEOUT_MS, CloseConn);
+}
+
+WinHttpTransport::~WinHttpTransport()
+{
+	HttpConnPoolFree(m_pool);
+	if (m_session)
+		WinHttpCloseHandle(m_session);
+}
+
+// created on first use, as the default transport is a global object
+HINTERNET WinHttpTransport::GetSession()
+{
+	if (m_session)
+		return m_session;
+
+	HINTERNET session = WinHttpOpen(L"OpenDNS Updater Client",  
+					WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+					WINHTTP_NO_PROXY_NAME, 
+					WINHTTP_NO_PROXY_BYPASS, 0 );
+	if (!session)
+		return NULL;
+
+	DWORD maxConns = HTTP_POOL_MAX_CONNS_PER_HOST;
+	WinHttpSetOption(session, WINHTTP_OPTION_MAX_CONNS_PER_SERVER, &maxConns, sizeof(maxConns));
+	WinHttpSetOption(session, WINHTTP_OPTION_MAX_CONNS_PER_1_0_SERVER, &maxConns, sizeof(maxConns));
+	// inherited by the connect and request handles. Called on the thread
+	// making the request, as the session is synchronous
+	WINHTTP_STATUS_CALLBACK prevCb = WinHttpSetStatusCallback(session, StatusCallback,
+		WINHTTP_CALLBACK_FLAG_CONNECT_TO_SERVER | WINHTTP_CALLBACK_FLAG_SEND_REQUEST, 0);
+	bool countConns = (WINHTTP_INVALID_STATUS_CALLBACK != prevCb);
+
+	// another thread might have beaten us to it
+	if (NULL != InterlockedCompareExchangePointer((PVOID*)&m_session, session, NULL))
+		WinHttpCloseHandle(session);
+	else
+		m_countConns = countConns;
+	return m_session;
+}
+
+bool WinHttpTransport::GetPoolStats(HttpConnPoolStats *stats)
+{
+	HttpConnPoolGetStats(m_pool, stats);
+	return m_countConns;
+}
+
+// WinHTTP's timeouts are per step: resolving, connecting, sending and every
+// wait for data each get the whole timeout, so with all of them set to
+// HttpRequest::timeoutMs a request could take several times that. Instead
+// the steps share what's left of it
+typedef struct {
+	bool	set;
+	DWORD	endMs;
+} Deadline;
+
+static void DeadlineInit(Deadline *d, DWORD timeoutMs)
+{
+	d->set = (0 != timeoutMs);
+	d->endMs = GetTickCount() + timeoutMs;
+}
+
+// ms left until <d>, INFINITE if there's no deadline. Sets
+// ERROR_WINHTTP_TIMEOUT and returns 0 if it passed
+static DWORD DeadlineMsLeft(const Deadline *d)
+{
+	if (!d->set)
+		return INFINITE;
+	int left = (int)(d->endMs - GetTickCount());
+	if (left > 0)
+		return (DWORD)left;
+	SetLastError(ERROR_WINHTTP_TIMEOUT);
+	return 0;
+}
+
+// resolving, connecting and sending happen one after another in
+// WinHttpSendRequest(), each gets a third of what's left
+static bool SetSendTimeouts(HINTERNET hRequest, const Deadline *d)
+{
+	if (!d->set)
+		return true;
+	DWORD left = DeadlineMsLeft(d);
+	if (0 == left)
+		return false;
+	int step = (int)(left / 3);
+	if (0 == step)
+		step = 1;
+	return !!WinHttpSetTimeouts(hRequest, step, step, step, (int)left);
+}
+
+// before every wait for the server, which gets what's left
+static bool SetReceiveTimeout(HINTERNET hRequest, const Deadline *d)
+{
+	if (!d->set)
+		return true;
+	DWORD left = DeadlineMsLeft(d);
+	if (0 == left)
+		return false;
+	// Vista and later wait for the response headers with a timeout of
+	// their own, XP doesn't know it
+	WinHttpSetOption(hRequest, WINHTTP_OPTION_RECEIVE_RESPONSE_TIMEOUT, &left, sizeof(left));
+	return !!WinHttpSetOption(hRequest, WINHTTP_OPTION_RECEIVE_TIMEOUT, &left, sizeof(left));
+}
+
+// Content-Length, 0 if the server didn't send it or we don't believe it
+static DWORD PresizeLength(HINTERNET hRequest)
+{
+	DWORD		contentLength = 0;
+	DWORD		headerSize = sizeof(contentLength);
+
+	BOOL ok = WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_CONTENT_LENGTH | WINHTTP_QUERY_FLAG_NUMBER,
+				WINHTTP_HEADER_NAME_BY_INDEX, &contentLength, &headerSize, WINHTTP_NO_HEADER_INDEX);
+	if (!ok || (contentLength > MAX_PRESIZE))
+		return 0;
+	return contentLength;
+}
+
+static bool HttpReadAllData(HINTERNET hRequest, const Deadline *d, HttpDataCallback dataCb, HttpSizeCallback sizeCb, void *dataCbCtx)
+{
+	BOOL		ok;
+	DWORD		dwDownloaded = 0;
+	DWORD		dwAvailable = 0;
+	char 		buf[1024];
+	DWORD		bufSize = dimof(buf);
+
+	DWORD contentLength = PresizeLength(hRequest);
+	if (sizeCb && (contentLength > 0))
+		sizeCb(dataCbCtx, contentLength);
+
+	do  {
+		if (!SetReceiveTimeout(hRequest, d))
+			goto Error;
+		dwAvailable = 0;
+		ok = WinHttpQueryDataAvailable(hRequest, &dwAvailable);
+		if (!ok)
+			goto Error;
+
+		ok = WinHttpReadData(hRequest, (LPVOID)buf, bufSize, &dwDownloaded);
+		if (!ok)
+			goto Error;
+
+		if (dwDownloaded > 0) {
+			ok = dataCb(dataCbCtx, buf, dwDownloaded);
+			if (!ok)
+				goto Error;
+		}
+
+	} while (dwDownloaded > 0);
+	return true;
+Error:
+	return false;
+}
+
+// reads directly into <data>, sized upfront from Content-Length if the
+// server sent it
+static bool HttpReadAllData(HINTERNET hRequest, const Deadline *d, GrowableBuf& data)
+{
+	BOOL		ok;
+	DWORD		dwDownloaded = 0;
+	DWORD		dwAvailable = 0;
+
+	DWORD contentLength = PresizeLength(hRequest);
+	if (contentLength > 0)
+		data.reserve(contentLength);
+
+	do  {
+		if (!SetReceiveTimeout(hRequest, d))
+			goto Error;
+		dwAvailable = 0;
+		ok = WinHttpQueryDataAvailable(hRequest, &dwAvailable);
+		if (!ok)
+			goto Error;
+		if (0 == dwAvailable)
+			dwAvailable = 1024;
+
+		if (!data.reserve(dwAvailable))
+			goto Error;
+		ok = WinHttpReadData(hRequest, (LPVOID)data.appendPtr(), dwAvailable, &dwDownloaded);
+		if (!ok)
+			goto Error;
+
+		data.commit(dwDownloaded);
+	} while (dwDownloaded > 0);
+	return true;
+Error:
+	return false;
+}
+
+void WinHttpTransport::Send(const HttpRequest *req, HttpResult *res)
+{
+	BOOL			ok;
+	HINTERNET		hSession = GetSession();
+	HINTERNET		hConnect = NULL;
+	HINTERNET		hRequest = NULL;
+	HttpConnSlot	slot;
+	ConnTiming		timing;
+	bool			haveSlot = false;
+	Deadline		deadline;
+	DWORD			poolWaitMs = POOL_WAIT_TIMEOUT_MS;
+	DWORD			reqFlags = 0;
+	WCHAR *			method = StrToWstrSimple(req->method);
+	WCHAR *			host = StrToWstrSimple(req->host);
+	WCHAR *			url = StrToWstrSimple(req->url);
+	WCHAR *			headers = NULL;
+	WCHAR *			userName = NULL;
+	WCHAR *			pwd = NULL;
+
+	DeadlineInit(&deadline, req->timeoutMs);
+	if (!hSession || !method || !host || !url)
+		goto Error;
+
+	if (deadline.set && (req->timeoutMs < poolWaitMs))
+		poolWaitMs = req->timeoutMs;
+	if (!HttpConnPoolAcquire(m_pool, req->host, req->port, poolWaitMs, &slot)) {
+		SetLastError(ERROR_WINHTTP_TIMEOUT);
+		goto Error;
+	}
+	haveSlot = true;
+
+	hConnect = WinHttpConnect(hSession, host, req->port, 0);
+	if (!hConnect)
+		goto Error;
+
+	if (INTERNET_DEFAULT_HTTPS_PORT == req->port)
+		reqFlags = WINHTTP_FLAG_SECURE;
+
+	hRequest = WinHttpOpenRequest(hConnect, method, url,
+					NULL, WINHTTP_NO_REFERER, 
+					WINHTTP_DEFAULT_ACCEPT_TYPES, 
+					reqFlags);
+	if (!hRequest)
+		goto Error;
+
+	if (req->headers) {
+		headers = StrToWstrSimple(req->headers);
+		if (!headers)
+			goto Error;
+		DWORD flags = WINHTTP_ADDREQ_FLAG_ADD | WINHTTP_ADDREQ_FLAG_REPLACE;
+		ok = WinHttpAddRequestHeaders(hRequest, headers, wcslen(headers), flags);
+		if (!ok)
+			goto Error;
+	}
+
+	if (req->userName) {
+		userName = StrToWstrSimple(req->userName);
+		pwd = StrToWstrSimple(req->pwd);
+		if (!userName || !pwd)
+			goto Error;
+		ok = WinHttpSetCredentials(hRequest, WINHTTP_AUTH_TARGET_SERVER, WINHTTP_AUTH_SCHEME_BASIC, userName, pwd, NULL);
+		if (!ok)
+			goto Error;
+	}
+
+	if (!SetSendTimeouts(hRequest, &deadline))
+		goto Error;
+	memzero(&timing, sizeof(timing));
+	ok = WinHttpSendRequest(hRequest,
+				WINHTTP_NO_ADDITIONAL_HEADERS, 0,
+				(LPVOID)req->body, req->bodySize, 
+				req->bodySize, (DWORD_PTR)&timing);
+	if (!ok)
+		goto Error;
+	if (m_countConns)
+		HttpConnPoolCountRequest(m_pool, !timing.opened, timing.connectMs);
+
+	if (!SetReceiveTimeout(hRequest, &deadline))
+		goto Error;
+	ok = WinHttpReceiveResponse(hRequest, NULL);
+	if (!ok)
+		goto Error;
+
+	if (req->dataCb)
+		ok = HttpReadAllData(hRequest, &deadline, req->dataCb, req->sizeCb, req->dataCbCtx);
+	else
+		ok = HttpReadAllData(hRequest, &deadline, res->data);
+	if (!ok)
+		goto Error;
+
+Exit:
+	if (hRequest)
+		WinHttpCloseHandle(hRequest);
+	if (hConnect)
+		WinHttpCloseHandle(hConnect);
+	if (haveSlot)
+		HttpConnPoolRelease(m_pool, req->host, req->port, &slot, false);
+	free(method);
+	free(host);
+	free(url);
+	free(headers);
+	free(userName);
+	free(pwd);
+	return;
+
+Error:
+	ShowLastError(res);
+	goto Exit;
+}
+
+HttpTransport *NewWinHttpTransport()
+{
+	return new WinHttpTransport();
+}
+
+static WinHttpTransport g_defaultTransport;
+
+HttpTransport *DefaultHttpTransport()
+{
+	return &g_defaultTransport;
+}
@@ -0,0 +1,123 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include <emmintrin.h>
+#include <intrin.h>
+
+#include "IpUpdatesLogParser.h"
+
+#define SIMD_WIDTH 16
+
+enum {
+	SIMD_UNKNOWN,
+	SIMD_SSE2,
+	SIMD_NONE
+};
+
+static int gSimd = SIMD_UNKNOWN;
+
+static bool UseSse2()
+{
+	if (SIMD_UNKNOWN == gSimd) {
+		if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+			gSimd = SIMD_SSE2;
+		else
+			gSimd = SIMD_NONE;
+	}
+	return SIMD_SSE2 == gSimd;
+}
+
+void IpUpdatesLogParserForceScalar(bool forceScalar)
+{
+	gSimd = forceScalar ? SIMD_NONE : SIMD_UNKNOWN;
+}
+
+static inline bool IsNewline(char c)
+{
+	return ('\r' == c) || ('\n' == c);
+}
+
+static inline const char *FirstSetBit(const char *s, int mask)
+{
+	unsigned long idx;
+	_BitScanForward(&idx, (unsigned long)mask);
+	return s + idx;
+}
+
+const char *FindSpaceOrNewline(const char *s, const char *end)
+{
+	if (UseSse2()) {
+		const __m128i space = _mm_set1_epi8(' ');
+		const __m128i cr = _mm_set1_epi8('\r');
+		const __m128i lf = _mm_set1_epi8('\n');
+		for (; end - s >= SIMD_WIDTH; s += SIMD_WIDTH) {
+			__m128i v = _mm_loadu_si128((const __m128i*)s);
+			__m128i eq = _mm_or_si128(_mm_cmpeq_epi8(v, space),
+				_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+			int mask = _mm_movemask_epi8(eq);
+			if (mask)
+				return FirstSetBit(s, mask);
+		}
+	}
+	// what's left after the last whole 16 bytes, or everything without SSE2
+	for (; s < end; s++) {
+		if ((' ' == *s) || IsNewline(*s))
+			return s;
+	}
+	return end;
+}
+
+const char *FindNewline(const char *s, const char *end)
+{
+	if (UseSse2()) {
+		const __m128i cr = _mm_set1_epi8('\r');
+		const __m128i lf = _mm_set1_epi8('\n');
+		for (; end - s >= SIMD_WIDTH; s += SIMD_WIDTH) {
+			__m128i v = _mm_loadu_si128((const __m128i*)s);
+			int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+			if (mask)
+				return FirstSetBit(s, mask);
+		}
+	}
+	for (; s < end; s++) {
+		if (IsNewline(*s))
+			return s;
+	}
+	return end;
+}
+
+bool IpUpdatesLogNextLine(const char **currInOut, const char *end, IpUpdateLine *lineOut)
+{
+	const char *curr = *currInOut;
+	// skip empty lines
+	while ((curr < end) && IsNewline(*curr))
+		curr++;
+	if (curr == end)
+		return false;
+
+	lineOut->ok = true;
+	if ('!' == *curr) {
+		lineOut->ok = false;
+		curr++;
+	}
+
+	// first space separates $ipaddr from $time, which has spaces too
+	const char *sep = FindSpaceOrNewline(curr, end);
+	if ((sep == end) || (' ' != *sep))
+		return false;
+	lineOut->ipAddress = curr;
+	lineOut->ipAddressLen = sep - curr;
+
+	curr = sep + 1;
+	const char *eol = FindNewline(curr, end);
+	lineOut->time = curr;
+	lineOut->timeLen = eol - curr;
+
+	while ((eol < end) && IsNewline(*eol))
+		eol++;
+	*currInOut = eol;
+	return true;
+}
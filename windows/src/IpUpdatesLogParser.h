@@ -0,0 +1,34 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IP_UPDATES_LOG_PARSER_H__
+#define IP_UPDATES_LOG_PARSER_H__
+
+// Parser for the text log of ip updates, which has lines in format:
+// [!]$ipaddr $time\r\n
+// ('!' means the server returned !yours). Fields point into the parsed
+// data, which isn't modified. Separators are searched for 16 bytes at a
+// time with SSE2 if the cpu has it.
+
+typedef struct {
+	const char *	ipAddress;
+	size_t			ipAddressLen;
+	const char *	time;
+	size_t			timeLen;
+	// true if update was successful, false if server returned !yours
+	bool			ok;
+} IpUpdateLine;
+
+// Parses the line at *<currInOut> and advances it to the next line. Returns
+// false at the end of data or if the line is malformed
+bool IpUpdatesLogNextLine(const char **currInOut, const char *end, IpUpdateLine *lineOut);
+
+// exposed for tests. Return <end> if there's no such char
+const char *FindSpaceOrNewline(const char *s, const char *end);
+const char *FindNewline(const char *s, const char *end);
+
+// for tests and benchmarks, so that we can compare with SSE2
+void IpUpdatesLogParserForceScalar(bool forceScalar);
+
+#endif
@@ -0,0 +1,202 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "IpUpdatesLogParser.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+#include "UnitTests.h"
+
+#define BENCH_LINES	1000000
+
+static bool LineEq(const IpUpdateLine *l, const char *ipAddress, const char *time, bool ok)
+{
+	if ((strlen(ipAddress) != l->ipAddressLen) || (0 != memcmp(ipAddress, l->ipAddress, l->ipAddressLen)))
+		return false;
+	if ((strlen(time) != l->timeLen) || (0 != memcmp(time, l->time, l->timeLen)))
+		return false;
+	return ok == l->ok;
+}
+
+static void ip_updates_log_parser_lines_ut()
+{
+	const char *data = "1.2.3.4 2009-11-23 14:05\r\n!208.67.222.222 2009-11-23 14:06\n\r\n10.0.0.1 2009-11-24 01:00";
+	const char *end = data + strlen(data);
+	const char *curr = data;
+	IpUpdateLine line;
+	bool ok;
+
+	// utassert() evaluates its argument twice
+	ok = IpUpdatesLogNextLine(&curr, end, &line);
+	utassert(ok && LineEq(&line, "1.2.3.4", "2009-11-23 14:05", true));
+	ok = IpUpdatesLogNextLine(&curr, end, &line);
+	utassert(ok && LineEq(&line, "208.67.222.222", "2009-11-23 14:06", false));
+	// no newline after the last line
+	ok = IpUpdatesLogNextLine(&curr, end, &line);
+	utassert(ok && LineEq(&line, "10.0.0.1", "2009-11-24 01:00", true));
+	utassert(curr == end);
+	ok = IpUpdatesLogNextLine(&curr, end, &line);
+	utassert(!ok);
+
+	// there's no space before the end of line
+	data = "1.2.3.4\r\n2009-11-23 14:05\r\n";
+	curr = data;
+	ok = IpUpdatesLogNextLine(&curr, data + strlen(data), &line);
+	utassert(!ok);
+	curr = data;
+	ok = IpUpdatesLogNextLine(&curr, data + 7, &line);
+	utassert(!ok);
+}
+
+// SSE2 and scalar code must find the same chars, including those in the
+// bytes after the last whole 16 and those past the end, which aren't looked at
+static void ip_updates_log_parser_find_ut()
+{
+	const char *s = "0123456789abcdefghijklmnopqrstuvwxyz 0123456789\n";
+	size_t len = strlen(s);
+	for (int scalar = 0; scalar < 2; scalar++) {
+		IpUpdatesLogParserForceScalar(0 != scalar);
+		utassert(s + 36 == FindSpaceOrNewline(s, s + len));
+		utassert(s + 36 == FindSpaceOrNewline(s + 20, s + len));
+		utassert(s + 35 == FindSpaceOrNewline(s, s + 35));
+		utassert(s + 47 == FindNewline(s, s + len));
+		utassert(s + 47 == FindNewline(s + 1, s + len));
+		utassert(s + 46 == FindNewline(s, s + 46));
+		utassert(s + 5 == FindNewline(s + 5, s + 5));
+	}
+	IpUpdatesLogParserForceScalar(false);
+}
+
+// The parser we had before IpUpdatesLogParser, which modifies the data to
+// zero-terminate the strings
+static bool ExtractIpAddrAndTimeLegacy(char **dataStartInOut, uint64_t *dataSizeLeftInOut, char **ipAddrOut, char **timeOut, bool *okOut)
+{
+	char *curr = *dataStartInOut;
+	uint64_t dataSizeLeft = *dataSizeLeftInOut;
+	char *ipAddr = curr;
+	bool ok = true;
+
+	if (0 == dataSizeLeft)
+		return false;
+	if (*curr == '!') {
+		ok = false;
+		--dataSizeLeft;
+		++ipAddr;
+		++curr;
+	}
+	while ((dataSizeLeft > 0) && (*curr != ' ')) {
+		--dataSizeLeft;
+		++curr;
+	}
+	if (0 == dataSizeLeft)
+		return false;
+	*curr = 0;
+	--dataSizeLeft;
+	++curr;
+	char *time = curr;
+	while ((dataSizeLeft > 0) && (*curr != '\r') && (*curr != '\n')) {
+		--dataSizeLeft;
+		++curr;
+	}
+	while ((dataSizeLeft > 0) && ((*curr == '\r') || (*curr == '\n'))) {
+		*curr++ = 0;
+		--dataSizeLeft;
+	}
+	*ipAddrOut = ipAddr;
+	*timeOut = time;
+	*dataSizeLeftInOut = dataSizeLeft;
+	*dataStartInOut = curr;
+	*okOut = ok;
+	return true;
+}
+
+static char *BuildLog(int lines, size_t *lenOut)
+{
+	// "!255.255.255.255 2009-11-23 14:05\r\n"
+	char *data = (char*)malloc(lines * 36 + 1);
+	if (!data)
+		return NULL;
+	char *tmp = data;
+	for (int i=0; i < lines; i++) {
+		tmp += sprintf(tmp, "%s%d.%d.%d.%d 2009-11-%02d %02d:%02d\r\n", (i % 16) ? "" : "!",
+			208, 67, (i >> 8) & 0xff, i & 0xff, 1 + (i % 28), (i / 60) % 24, i % 60);
+	}
+	*lenOut = tmp - data;
+	return data;
+}
+
+static int ParseAll(const char *data, size_t len)
+{
+	const char *curr = data;
+	const char *end = data + len;
+	IpUpdateLine line;
+	int count = 0;
+	while (IpUpdatesLogNextLine(&curr, end, &line))
+		count++;
+	return count;
+}
+
+void ip_updates_log_parser_ut_all()
+{
+	ip_updates_log_parser_lines_ut();
+	ip_updates_log_parser_find_ut();
+}
+
+void ip_updates_log_parser_bench_all()
+{
+	size_t len;
+	char *data = BuildLog(BENCH_LINES, &len);
+	if (!data)
+		return;
+	// the legacy parser modifies the data, so it gets a copy
+	char *copy = (char*)malloc(len);
+	if (!copy) {
+		free(data);
+		return;
+	}
+	memcpy(copy, data, len);
+
+	char *curr = copy;
+	uint64_t left = len;
+	char *ipAddr, *time;
+	bool ok;
+	int count = 0;
+	double start = benchTimeMs();
+	while (ExtractIpAddrAndTimeLegacy(&curr, &left, &ipAddr, &time, &ok))
+		count++;
+	benchReport("ExtractIpAddrAndTime() (legacy)", BENCH_LINES, benchTimeMs() - start);
+	utassert(BENCH_LINES == count);
+
+	// the legacy log also made a copy of both strings for every line
+	memcpy(copy, data, len);
+	curr = copy;
+	left = len;
+	count = 0;
+	start = benchTimeMs();
+	while (ExtractIpAddrAndTimeLegacy(&curr, &left, &ipAddr, &time, &ok)) {
+		ipAddr = strdup(ipAddr);
+		time = strdup(time);
+		free(ipAddr);
+		free(time);
+		count++;
+	}
+	benchReport("ExtractIpAddrAndTime() + strdup() (legacy)", BENCH_LINES, benchTimeMs() - start);
+	utassert(BENCH_LINES == count);
+	free(copy);
+
+	IpUpdatesLogParserForceScalar(true);
+	start = benchTimeMs();
+	count = ParseAll(data, len);
+	benchReport("IpUpdatesLogNextLine() scalar", BENCH_LINES, benchTimeMs() - start);
+	utassert(BENCH_LINES == count);
+
+	IpUpdatesLogParserForceScalar(false);
+	start = benchTimeMs();
+	count = ParseAll(data, len);
+	benchReport("IpUpdatesLogNextLine()", BENCH_LINES, benchTimeMs() - start);
+	utassert(BENCH_LINES == count);
+	free(data);
+}
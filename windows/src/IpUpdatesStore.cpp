@@ -0,0 +1,173 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "IpUpdatesStore.h"
+#include "MiscUtil.h"
+
+#define STORE_MAGIC		"ODIU"
+#define STORE_VERSION	1
+
+typedef struct {
+	char	magic[4];
+	WORD	version;
+	WORD	recordSize;
+	DWORD	capacity;
+	// number of updates ever appended. The newest is at (count - 1) % capacity
+	DWORD	count;
+} StoreHeader;
+
+struct IpUpdatesStore {
+	HANDLE			file;
+	HANDLE			mapping;
+	StoreHeader *	header;
+	IpUpdate *		records;
+};
+
+static bool HeaderValid(const StoreHeader *h, ULONGLONG fileSize)
+{
+	if (0 != memcmp(h->magic, STORE_MAGIC, sizeof(h->magic)))
+		return false;
+	if ((STORE_VERSION != h->version) || (sizeof(IpUpdate) != h->recordSize))
+		return false;
+	if (0 == h->capacity)
+		return false;
+	return fileSize >= sizeof(StoreHeader) + (ULONGLONG)h->capacity * sizeof(IpUpdate);
+}
+
+IpUpdatesStore *IpUpdatesStoreOpen(const TCHAR *path, DWORD capacity)
+{
+	StoreHeader		h;
+	DWORD			read;
+	LARGE_INTEGER	fileSize;
+	DWORD			size;
+	bool			valid = false;
+
+	IpUpdatesStore *s = SAZ(IpUpdatesStore);
+	if (!s)
+		return NULL;
+	s->file = CreateFile(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == s->file)
+		goto Error;
+
+	// the header tells how big the store is
+	if (GetFileSizeEx(s->file, &fileSize) && ReadFile(s->file, &h, sizeof(h), &read, NULL) && (sizeof(h) == read))
+		valid = HeaderValid(&h, fileSize.QuadPart);
+	if (valid)
+		capacity = h.capacity;
+	size = sizeof(StoreHeader) + capacity * sizeof(IpUpdate);
+
+	// grows the file to <size> if it's smaller
+	s->mapping = CreateFileMapping(s->file, NULL, PAGE_READWRITE, 0, size, NULL);
+	if (!s->mapping)
+		goto Error;
+	s->header = (StoreHeader*)MapViewOfFile(s->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!s->header)
+		goto Error;
+	s->records = (IpUpdate*)(s->header + 1);
+
+	if (!valid) {
+		memzero(s->header, size);
+		memcpy(s->header->magic, STORE_MAGIC, sizeof(s->header->magic));
+		s->header->version = STORE_VERSION;
+		s->header->recordSize = sizeof(IpUpdate);
+		s->header->capacity = capacity;
+	}
+	return s;
+
+Error:
+	IpUpdatesStoreClose(s);
+	return NULL;
+}
+
+void IpUpdatesStoreClose(IpUpdatesStore *s)
+{
+	if (!s)
+		return;
+	if (s->header)
+		UnmapViewOfFile(s->header);
+	if (s->mapping)
+		CloseHandle(s->mapping);
+	if (s->file && (INVALID_HANDLE_VALUE != s->file))
+		CloseHandle(s->file);
+	free(s);
+}
+
+static void CopyTruncated(char *dst, size_t dstSize, const char *src, size_t len)
+{
+	if (len > dstSize - 1)
+		len = dstSize - 1;
+	if (len > 0)
+		memcpy(dst, src, len);
+	dst[len] = 0;
+}
+
+void IpUpdatesStoreAppend(IpUpdatesStore *s, const char *ipAddress, const char *time, bool ok)
+{
+	size_t ipAddressLen = ipAddress ? strlen(ipAddress) : 0;
+	size_t timeLen = time ? strlen(time) : 0;
+	IpUpdatesStoreAppendN(s, ipAddress, ipAddressLen, time, timeLen, ok);
+}
+
+void IpUpdatesStoreAppendN(IpUpdatesStore *s, const char *ipAddress, size_t ipAddressLen, const char *time, size_t timeLen, bool ok)
+{
+	StoreHeader *h = s->header;
+	IpUpdate *u = &s->records[h->count % h->capacity];
+	memzero(u, sizeof(IpUpdate));
+	CopyTruncated(u->ipAddress, sizeof(u->ipAddress), ipAddress, ipAddressLen);
+	CopyTruncated(u->time, sizeof(u->time), time, timeLen);
+	u->ok = ok;
+	// only now the record becomes visible, so if we crash before that,
+	// the store is still consistent
+	h->count++;
+}
+
+int IpUpdatesStoreCount(IpUpdatesStore *s)
+{
+	if (s->header->count < s->header->capacity)
+		return (int)s->header->count;
+	return (int)s->header->capacity;
+}
+
+const IpUpdate *IpUpdatesStoreGet(IpUpdatesStore *s, int n)
+{
+	if ((n < 0) || (n >= IpUpdatesStoreCount(s)))
+		return NULL;
+	StoreHeader *h = s->header;
+	return &s->records[(h->count - 1 - n) % h->capacity];
+}
+
+void IpUpdatesCursorInit(IpUpdatesCursor *c, IpUpdatesStore *s)
+{
+	c->store = s;
+	c->count = s->header->count;
+	c->pos = 0;
+}
+
+int IpUpdatesCursorCount(const IpUpdatesCursor *c)
+{
+	DWORD capacity = c->store->header->capacity;
+	if (c->count < capacity)
+		return (int)c->count;
+	return (int)capacity;
+}
+
+void IpUpdatesCursorSeek(IpUpdatesCursor *c, int pos)
+{
+	c->pos = pos;
+}
+
+const IpUpdate *IpUpdatesCursorNext(IpUpdatesCursor *c)
+{
+	if ((c->pos < 0) || (c->pos >= IpUpdatesCursorCount(c)))
+		return NULL;
+	StoreHeader *h = c->store->header;
+	// number of the update among all updates ever appended
+	DWORD n = c->count - 1 - c->pos;
+	if (h->count - n > h->capacity)
+		return NULL;
+	c->pos++;
+	return &c->store->records[n % h->capacity];
+}
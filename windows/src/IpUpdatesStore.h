@@ -0,0 +1,61 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef IP_UPDATES_STORE_H__
+#define IP_UPDATES_STORE_H__
+
+// History of ip updates in a file of fixed-size records that is mapped
+// into memory and used as a ring: once it's full, the newest update
+// overwrites the oldest one. Appending is O(1), opening doesn't parse
+// anything and records are read in place.
+//
+// The file is a header (which has the capacity, so the file describes
+// itself) followed by <capacity> records.
+
+#define IP_UPDATES_STORE_CAPACITY	1024
+
+typedef struct {
+	// "2009-11-23 14:05", zero-terminated
+	char	time[20];
+	// zero-terminated
+	char	ipAddress[16];
+	// true if update was successful, false if server returned !yours
+	BYTE	ok;
+	BYTE	reserved[3];
+} IpUpdate;
+
+typedef struct IpUpdatesStore IpUpdatesStore;
+
+// Creates the file if it doesn't exist. If it isn't a valid store, its
+// content is discarded. <capacity> is only used for new stores
+IpUpdatesStore *IpUpdatesStoreOpen(const TCHAR *path, DWORD capacity);
+void			IpUpdatesStoreClose(IpUpdatesStore *s);
+
+// <ipAddress> and <time> are truncated to fit
+void			IpUpdatesStoreAppend(IpUpdatesStore *s, const char *ipAddress, const char *time, bool ok);
+// same as IpUpdatesStoreAppend() for strings that aren't zero-terminated
+void			IpUpdatesStoreAppendN(IpUpdatesStore *s, const char *ipAddress, size_t ipAddressLen, const char *time, size_t timeLen, bool ok);
+int				IpUpdatesStoreCount(IpUpdatesStore *s);
+// <n> == 0 is the most recent update. Points into the mapped file so it's
+// only valid until the update is overwritten or the store is closed
+const IpUpdate *IpUpdatesStoreGet(IpUpdatesStore *s, int n);
+
+// Iterates over updates starting with the most recent one. Positions are
+// relative to the most recent update when the cursor was created, so that
+// updates appended while e.g. a dialog shows the history don't shift them
+typedef struct {
+	IpUpdatesStore *	store;
+	DWORD				count;
+	int					pos;
+} IpUpdatesCursor;
+
+void			IpUpdatesCursorInit(IpUpdatesCursor *c, IpUpdatesStore *s);
+// the number of updates there were when the cursor was created
+int				IpUpdatesCursorCount(const IpUpdatesCursor *c);
+void			IpUpdatesCursorSeek(IpUpdatesCursor *c, int pos);
+// Returns NULL after the last update or if the update at the current
+// position has been overwritten since the cursor was created
+const IpUpdate *IpUpdatesCursorNext(IpUpdatesCursor *c);
+
+#endif
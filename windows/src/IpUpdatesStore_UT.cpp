@@ -0,0 +1,133 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "IpUpdatesStore.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+#include "UnitTests.h"
+
+#define TEST_CAPACITY	4
+
+static const TCHAR *TestStorePath()
+{
+	static TCHAR path[MAX_PATH];
+	if (!path[0]) {
+		TCHAR dir[MAX_PATH];
+		GetTempPath(dimof(dir), dir);
+		GetTempFileName(dir, _T("ipu"), 0, path);
+	}
+	return path;
+}
+
+static void ip_updates_store_ring_ut()
+{
+	const TCHAR *path = TestStorePath();
+	DeleteFile(path);
+	IpUpdatesStore *s = IpUpdatesStoreOpen(path, TEST_CAPACITY);
+	utassert(NULL != s);
+	if (!s)
+		return;
+	utassert(0 == IpUpdatesStoreCount(s));
+	utassert(NULL == IpUpdatesStoreGet(s, 0));
+
+	char ip[16];
+	for (int i=0; i < 6; i++) {
+		sprintf(ip, "10.0.0.%d", i);
+		IpUpdatesStoreAppend(s, ip, "2009-11-23 14:05", 0 != (i % 2));
+	}
+	// only the last TEST_CAPACITY are left, the newest first
+	utassert(TEST_CAPACITY == IpUpdatesStoreCount(s));
+	const IpUpdate *u = IpUpdatesStoreGet(s, 0);
+	utassert(u && streq("10.0.0.5", u->ipAddress) && u->ok);
+	u = IpUpdatesStoreGet(s, TEST_CAPACITY - 1);
+	utassert(u && streq("10.0.0.2", u->ipAddress) && !u->ok);
+	utassert(u && streq("2009-11-23 14:05", u->time));
+	utassert(NULL == IpUpdatesStoreGet(s, TEST_CAPACITY));
+
+	// too long to fit
+	IpUpdatesStoreAppend(s, "1234567890.1234567890", "2009-11-23 14:05:00 and more", true);
+	u = IpUpdatesStoreGet(s, 0);
+	utassert(u && (sizeof(u->ipAddress) - 1 == strlen(u->ipAddress)));
+	utassert(u && (sizeof(u->time) - 1 == strlen(u->time)));
+	IpUpdatesStoreClose(s);
+
+	// the history survives re-opening and the capacity comes from the file
+	s = IpUpdatesStoreOpen(path, TEST_CAPACITY * 2);
+	utassert(NULL != s);
+	if (!s)
+		return;
+	utassert(TEST_CAPACITY == IpUpdatesStoreCount(s));
+	u = IpUpdatesStoreGet(s, 1);
+	utassert(u && streq("10.0.0.5", u->ipAddress));
+	IpUpdatesStoreClose(s);
+	DeleteFile(path);
+}
+
+static void ip_updates_store_invalid_ut()
+{
+	const TCHAR *path = TestStorePath();
+	FILE *f = _tfopen(path, _T("wb"));
+	if (!f)
+		return;
+	fputs("1.2.3.4 2009-11-23 14:05\r\n", f);
+	fclose(f);
+	IpUpdatesStore *s = IpUpdatesStoreOpen(path, TEST_CAPACITY);
+	utassert(NULL != s);
+	if (!s)
+		return;
+	utassert(0 == IpUpdatesStoreCount(s));
+	IpUpdatesStoreAppend(s, "1.2.3.4", "2009-11-23 14:05", true);
+	utassert(1 == IpUpdatesStoreCount(s));
+	IpUpdatesStoreClose(s);
+	DeleteFile(path);
+}
+
+static void ip_updates_store_cursor_ut()
+{
+	const TCHAR *path = TestStorePath();
+	DeleteFile(path);
+	IpUpdatesStore *s = IpUpdatesStoreOpen(path, TEST_CAPACITY);
+	if (!s)
+		return;
+	char ip[16];
+	for (int i=0; i < 3; i++) {
+		sprintf(ip, "10.0.0.%d", i);
+		IpUpdatesStoreAppend(s, ip, "2009-11-23 14:05", true);
+	}
+
+	IpUpdatesCursor c;
+	IpUpdatesCursorInit(&c, s);
+	utassert(3 == IpUpdatesCursorCount(&c));
+	const IpUpdate *u = IpUpdatesCursorNext(&c);
+	utassert(u && streq("10.0.0.2", u->ipAddress));
+	IpUpdatesCursorSeek(&c, 2);
+	u = IpUpdatesCursorNext(&c);
+	utassert(u && streq("10.0.0.0", u->ipAddress));
+	utassert(NULL == IpUpdatesCursorNext(&c));
+
+	// appending doesn't shift the positions of the cursor
+	IpUpdatesStoreAppend(s, "10.0.0.3", "2009-11-23 14:05", true);
+	IpUpdatesCursorSeek(&c, 0);
+	u = IpUpdatesCursorNext(&c);
+	utassert(u && streq("10.0.0.2", u->ipAddress));
+	utassert(3 == IpUpdatesCursorCount(&c));
+	// but "10.0.0.0" is gone once the ring wraps around
+	IpUpdatesStoreAppend(s, "10.0.0.4", "2009-11-23 14:05", true);
+	IpUpdatesCursorSeek(&c, 1);
+	u = IpUpdatesCursorNext(&c);
+	utassert(u && streq("10.0.0.1", u->ipAddress));
+	utassert(NULL == IpUpdatesCursorNext(&c));
+	IpUpdatesStoreClose(s);
+	DeleteFile(path);
+}
+
+void ip_updates_store_ut_all()
+{
+	ip_updates_store_ring_ut();
+	ip_updates_store_invalid_ut();
+	ip_updates_store_cursor_ut();
+}
@@ -10,40 +10,50 @@
 #include "MiscUtil.h"
 #include "StrUtil.h"
 
+// true if <s> of length <len> (not necessarily zero-terminated) is <lit>
+static bool StrEqLen(const char *s, size_t len, const char *lit)
+{
+	return (len == strlen(lit)) && (0 == memcmp(s, lit, len));
+}
+
+static WebApiStatus ApiStatusFromStr(const char *s, size_t len)
+{
+	if (StrEqLen(s, len, "success"))
+		return WebApiStatusSuccess;
+	if (StrEqLen(s, len, "failure"))
+		return WebApiStatusFailure;
+	return WebApiStatusUnknown;
+}
+
 WebApiStatus GetApiStatus(JsonEl *json)
 {
-	JsonEl *statusEl = GetMapElByName(json, "status");
+	JsonEl *statusEl = GetMapElByKey(json, "status");
 	if (!statusEl)
 		return WebApiStatusUnknown;
 	JsonElString *elString = JsonElAsString(statusEl);
 	if (!elString)
 		return WebApiStatusUnknown;
 	char *s = elString->stringVal;
-	if (streq("success", s))
-		return WebApiStatusSuccess;
-	if (streq("failure", s))
-		return WebApiStatusFailure;
-	return WebApiStatusUnknown;
+	return ApiStatusFromStr(s, strlen(s));
 }
 
 // returns the string value of "token" element or NULL if there was
 // an error ("token" element doesn't exist, is not a string)
 char *GetApiResponseToken(JsonEl *json)
 {
-	// TODO: should get response.token but *.token works for us too
-	JsonEl *el = GetMapElByName(json, "token");
+	JsonEl *el = GetElByPath(json, "response/token");
 	return JsonElAsStringVal(el);
 }
 
 bool GetApiError(JsonEl *json, long *errOut)
 {
-	JsonEl *el = GetMapElByName(json, "error");
+	JsonEl *el = GetMapElByKey(json, "error");
 	return JsonElAsIntegerVal(el, errOut);
 }
 
 char *GetApiErrorMessage(JsonEl *json)
 {
-	JsonEl *el = GetMapElByName(json, "error_message");
+	JsonEl *el = GetMapElByKey(json, "error_message");
 	return JsonElAsStringVal(el);
 }
 
@@ -112,7 +122,7 @@ static NetworkInfo* NetworkInfoFromJson(JsonElMapData *json)
 
 NetworkInfo *ParseNetworksGetJson(JsonEl *json)
 {
-	JsonEl *el = GetMapElByName(json, "response");
+	JsonEl *el = GetMapElByKey(json, "response");
 	if (!el)
 		return NULL;
 	JsonElMap *networksMap = JsonElAsMap(el);
@@ -137,6 +147,345 @@ Error:
 	return NULL;
 }
 
+// NetworksGetParser decodes networks_get response directly from yajl
+// callbacks, without building a JsonEl document. The structure is:
+// {"status":"success","response":{"<networkId>":{"dynamic":true,
+//  "label":"home","ip_address":"1.2.3.4"}, ...}}
+// or {"status":"failure","error":4008,"error_message":"..."}
+
+// nesting levels of maps we care about
+#define NGP_LEVEL_TOP		1
+#define NGP_LEVEL_NETWORKS	2 // value of "response"
+#define NGP_LEVEL_NETWORK	3
+
+typedef enum {
+	NgpKeyOther,
+	// at NGP_LEVEL_TOP
+	NgpKeyStatus,
+	NgpKeyError,
+	NgpKeyResponse,
+	// at NGP_LEVEL_NETWORK
+	NgpKeyDynamic,
+	NgpKeyLabel,
+	NgpKeyIpAddress
+} NgpKey;
+
+struct NetworksGetParser {
+	yajl_handle		yajl_handle;
+	// how many maps/arrays deep we are
+	int				level;
+	// if not 0, we're inside a value we don't care about that
+	// started at this level
+	int				skipLevel;
+	// key of the next value at the current level
+	NgpKey			key;
+	bool			failed;
+	WebApiStatus	status;
+	bool			hasError;
+	long			error;
+	// key of the network (i.e. its id) whose map comes next
+	char *			networkId;
+	// network being parsed
+	NetworkInfo *	curr;
+	// networks parsed so far, in document order
+	NetworkInfo *	first;
+	NetworkInfo *	last;
+};
+
+#define CONTINUE_PARSE 1
+#define CANCEL_PARSE 0
+
+// yajl strings are not zero-terminated
+static char *ngp_strdupn(const unsigned char *s, size_t len)
+{
+	char *res = (char*)malloc(len + 1);
+	if (!res)
+		return NULL;
+	memcpy(res, s, len);
+	res[len] = 0;
+	return res;
+}
+
+static int ngp_fail(NetworksGetParser *p)
+{
+	p->failed = true;
+	return CANCEL_PARSE;
+}
+
+// a value that is not a string, bool or a container where we expect one
+static int ngp_other_value(NetworksGetParser *p)
+{
+	if (p->skipLevel)
+		return CONTINUE_PARSE;
+	if (NGP_LEVEL_NETWORKS == p->level)
+		return ngp_fail(p); // network must be a map
+	if ((NGP_LEVEL_NETWORK == p->level) && (NgpKeyDynamic == p->key))
+		return ngp_fail(p);
+	return CONTINUE_PARSE;
+}
+
+static int ngp_null(void *ctx)
+{
+	NetworksGetParser *p = (NetworksGetParser*)ctx;
+	// "label" is null for networks without one
+	if (!p->skipLevel && (NGP_LEVEL_NETWORK == p->level) && (NgpKeyLabel == p->key))
+		return CONTINUE_PARSE;
+	return ngp_other_value(p);
+}
+
+static int ngp_boolean(void *ctx, int boolVal)
+{
+	NetworksGetParser *p = (NetworksGetParser*)ctx;
+	if (!p->skipLevel && (NGP_LEVEL_NETWORK == p->level) && (NgpKeyDynamic == p->key)) {
+		p->curr->isDynamic = boolVal;
+		return CONTINUE_PARSE;
+	}
+	return ngp_other_value(p);
+}
+
+static int ngp_integer(void *ctx, long integerVal)
+{
+	NetworksGetParser *p = (NetworksGetParser*)ctx;
+	if (!p->skipLevel && (NGP_LEVEL_TOP == p->level) && (NgpKeyError == p->key)) {
+		p->hasError = true;
+		p->error = integerVal;
+		return CONTINUE_PARSE;
+	}
+	return ngp_other_value(p);
+}
+
+static int ngp_double(void *ctx, double /* doubleVal */)
+{
+	return ngp_other_value((NetworksGetParser*)ctx);
+}
+
+static int ngp_string(void *ctx, const unsigned char *stringVal, unsigned int stringLen)
+{
+	NetworksGetParser *p = (NetworksGetParser*)ctx;
+	if (p->skipLevel)
+		return CONTINUE_PARSE;
+	if (NGP_LEVEL_TOP == p->level) {
+		if (NgpKeyStatus == p->key)
+			p->status = ApiStatusFromStr((const char*)stringVal, stringLen);
+		return CONTINUE_PARSE;
+	}
+	if (NGP_LEVEL_NETWORK == p->level) {
+		char **dst = NULL;
+		if (NgpKeyLabel == p->key)
+			dst = &p->curr->label;
+		else if (NgpKeyIpAddress == p->key)
+			dst = &p->curr->ipAddress;
+		if (!dst)
+			return ngp_other_value(p);
+		free(*dst);
+		*dst = ngp_strdupn(stringVal, stringLen);
+		if (!*dst)
+			return ngp_fail(p);
+		return CONTINUE_PARSE;
+	}
+	return ngp_other_value(p);
+}
+
+static int ngp_map_key(void *ctx, const unsigned char *key, unsigned int keyLen)
+{
+	NetworksGetParser *p = (NetworksGetParser*)ctx;
+	if (p->skipLevel)
+		return CONTINUE_PARSE;
+	const char *k = (const char*)key;
+	p->key = NgpKeyOther;
+	if (NGP_LEVEL_TOP == p->level) {
+		if (StrEqLen(k, keyLen, "status"))
+			p->key = NgpKeyStatus;
+		else if (StrEqLen(k, keyLen, "error"))
+			p->key = NgpKeyError;
+		else if (StrEqLen(k, keyLen, "response"))
+			p->key = NgpKeyResponse;
+	} else if (NGP_LEVEL_NETWORKS == p->level) {
+		free(p->networkId);
+		p->networkId = ngp_strdupn(key, keyLen);
+		if (!p->networkId)
+			return ngp_fail(p);
+	} else if (NGP_LEVEL_NETWORK == p->level) {
+		if (StrEqLen(k, keyLen, "dynamic"))
+			p->key = NgpKeyDynamic;
+		else if (StrEqLen(k, keyLen, "label"))
+			p->key = NgpKeyLabel;
+		else if (StrEqLen(k, keyLen, "ip_address"))
+			p->key = NgpKeyIpAddress;
+	}
+	return CONTINUE_PARSE;
+}
+
+static int ngp_start_container(NetworksGetParser *p, bool isMap)
+{
+	++p->level;
+	if (p->skipLevel)
+		return CONTINUE_PARSE;
+	int level = p->level;
+	if (NGP_LEVEL_TOP == level) {
+		if (!isMap)
+			return ngp_fail(p);
+	} else if (NGP_LEVEL_NETWORKS == level) {
+		// only care about "response" map
+		if (!isMap || (NgpKeyResponse != p->key))
+			p->skipLevel = level;
+	} else if (NGP_LEVEL_NETWORK == level) {
+		if (!isMap || !p->networkId)
+			return ngp_fail(p);
+		p->curr = SAZ(NetworkInfo);
+		if (!p->curr)
+			return ngp_fail(p);
+		p->curr->networkId = p->networkId;
+		p->networkId = NULL;
+	} else {
+		// "dynamic" can't be a map or an array, other values we ignore
+		if ((NGP_LEVEL_NETWORK == level - 1) && (NgpKeyDynamic == p->key))
+			return ngp_fail(p);
+		p->skipLevel = level;
+	}
+	p->key = NgpKeyOther;
+	return CONTINUE_PARSE;
+}
+
+static int ngp_end_container(NetworksGetParser *p)
+{
+	int level = p->level--;
+	if (p->skipLevel) {
+		if (level == p->skipLevel)
+			p->skipLevel = 0;
+		return CONTINUE_PARSE;
+	}
+	if (NGP_LEVEL_NETWORK == level) {
+		NetworkInfo *ni = p->curr;
+		p->curr = NULL;
+		if (!ni->ipAddress) {
+			NetworkInfoFree(ni);
+			return ngp_fail(p);
+		}
+		if (p->last)
+			p->last->next = ni;
+		else
+			p->first = ni;
+		p->last = ni;
+	}
+	p->key = NgpKeyOther;
+	return CONTINUE_PARSE;
+}
+
+static int ngp_start_map(void *ctx)
+{
+	return ngp_start_container((NetworksGetParser*)ctx, true);
+}
+
+static int ngp_end_map(void *ctx)
+{
+	return ngp_end_container((NetworksGetParser*)ctx);
+}
+
+static int ngp_start_array(void *ctx)
+{
+	return ngp_start_container((NetworksGetParser*)ctx, false);
+}
+
+static int ngp_end_array(void *ctx)
+{
+	return ngp_end_container((NetworksGetParser*)ctx);
+}
+
+static const yajl_callbacks ngp_yajl_callbacks = {
+	ngp_null,
+	ngp_boolean,
+	ngp_integer,
+	ngp_double,
+	NULL, // yajl_number
+	ngp_string,
+	ngp_start_map,
+	ngp_map_key,
+	ngp_end_map,
+	ngp_start_array,
+	ngp_end_array
+};
+
+NetworksGetParser *NetworksGetParserNew()
+{
+	NetworksGetParser *p = SAZ(NetworksGetParser);
+	if (!p)
+		return NULL;
+	p->status = WebApiStatusUnknown;
+	p->yajl_handle = yajl_alloc(&ngp_yajl_callbacks, NULL, (void*)p);
+	if (!p->yajl_handle) {
+		free(p);
+		return NULL;
+	}
+	return p;
+}
+
+void NetworksGetParserFree(NetworksGetParser *p)
+{
+	if (!p)
+		return;
+	yajl_free(p->yajl_handle);
+	free(p->networkId);
+	NetworkInfoFree(p->curr);
+	NetworkInfoFreeList(p->first);
+	free(p);
+}
+
+// Feed the next chunk of the response. Chunks can be split anywhere.
+// Returns false if the data is not a valid networks_get response, in
+// which case there's no point in feeding more
+bool NetworksGetParserFeed(NetworksGetParser *p, const void *data, size_t len)
+{
+	if (p->failed)
+		return false;
+	yajl_status status = yajl_parse(p->yajl_handle, (const unsigned char*)data, (unsigned int)len);
+	if ((yajl_status_ok != status) && (yajl_status_insufficient_data != status))
+		p->failed = true;
+	return !p->failed;
+}
+
+// Call after all the data has been fed. Returns false if the response
+// wasn't a complete and valid networks_get response
+bool NetworksGetParserFinish(NetworksGetParser *p)
+{
+	if (p->failed)
+		return false;
+	yajl_status status = yajl_parse_complete(p->yajl_handle);
+	if ((yajl_status_ok != status) || (0 != p->level))
+		p->failed = true;
+	return !p->failed;
+}
+
+// matches HttpDataCallback so that the response can be decoded as
+// it's downloaded. <ctx> is NetworksGetParser
+bool NetworksGetParserFeedCallback(void *ctx, const void *data, DWORD dataSize)
+{
+	return NetworksGetParserFeed((NetworksGetParser*)ctx, data, dataSize);
+}
+
+WebApiStatus NetworksGetParserStatus(NetworksGetParser *p)
+{
+	return p->status;
+}
+
+bool NetworksGetParserError(NetworksGetParser *p, long *errOut)
+{
+	if (!p->hasError)
+		return false;
+	*errOut = p->error;
+	return true;
+}
+
+// networks parsed so far. Caller owns the result and must free it
+// with NetworkInfoFreeList()
+NetworkInfo *NetworksGetParserStealNetworks(NetworksGetParser *p)
+{
+	NetworkInfo *res = p->first;
+	p->first = NULL;
+	p->last = NULL;
+	return res;
+}
+
 size_t DynamicNetworksCount(NetworkInfo *head, bool onlyLabeled)
 {
 	size_t count = 0;
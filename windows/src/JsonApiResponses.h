@@ -42,4 +42,17 @@ void NetworkInfoFreeList(NetworkInfo *head);
 size_t DynamicNetworksCount(NetworkInfo *head, bool onlyLabeled=false);
 NetworkInfo *FindDynamicWithLabel(NetworkInfo *head, char *label);
 NetworkInfo *FindFirstDynamic(NetworkInfo *head);
+
+// streaming decoder of networks_get responses, an alternative to
+// ParseJsonToDoc() + ParseNetworksGetJson() that doesn't build a document
+typedef struct NetworksGetParser NetworksGetParser;
+
+NetworksGetParser *NetworksGetParserNew();
+void NetworksGetParserFree(NetworksGetParser *p);
+bool NetworksGetParserFeed(NetworksGetParser *p, const void *data, size_t len);
+bool NetworksGetParserFeedCallback(void *ctx, const void *data, DWORD dataSize);
+bool NetworksGetParserFinish(NetworksGetParser *p);
+WebApiStatus NetworksGetParserStatus(NetworksGetParser *p);
+bool NetworksGetParserError(NetworksGetParser *p, long *errOut);
+NetworkInfo *NetworksGetParserStealNetworks(NetworksGetParser *p);
 #endif
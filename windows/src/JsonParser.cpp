@@ -6,9 +6,20 @@
 
 #include "JsonParser.h"
 
+#include "MemArena.h"
 #include "MiscUtil.h"
 #include "StrUtil.h"
 
+// maps with fewer entries are searched linearly, building an index
+// wouldn't pay off
+#define MAP_INDEX_MIN_ENTRIES 8
+
+// open addressing hash table, <size> is a power of 2
+struct JsonElMapIndex {
+	size_t			size;
+	JsonElMapData *	slots[1]; // <size> entries
+};
+
 typedef struct MapArrayNestingChain {
 	JsonEl *	el; /* either map or array */
 	struct MapArrayNestingChain *prev;
@@ -18,70 +29,115 @@ typedef struct {
 	yajl_handle 			yajl_handle;
 	MapArrayNestingChain *	nestingChain;
 	JsonEl *				firstEl;
+	// if not NULL, all elements are allocated from here and must not
+	// be freed with JsonElFree()
+	MemArena *				arena;
 } JsonParserCtx;
 
-static JsonEl *NewBool(int boolVal)
+static void *jp_alloc(JsonParserCtx *ctx, size_t size)
+{
+	if (ctx->arena)
+		return ctx->arena->alloc(size);
+	return malloc(size);
+}
+
+// yajl gives us exact length of the string so unlike strdupn() we don't
+// need to strlen() the (possibly very long) rest of the document
+static char *jp_strdupn(JsonParserCtx *ctx, const unsigned char *s, size_t len)
 {
-	JsonElBool *el = SA(JsonElBool);
+	if (ctx->arena)
+		return ctx->arena->strdupn((const char*)s, len);
+	char *res = (char*)malloc(len + 1);
+	if (!res)
+		return NULL;
+	memcpy(res, s, len);
+	res[len] = 0;
+	return res;
+}
+
+// JA == Json Alloc, like SA() but allocates from the arena if we have one
+#define JA(ctx, struct_name) (struct_name*)jp_alloc(ctx, sizeof(struct_name))
+
+static JsonEl *NewBool(JsonParserCtx *ctx, int boolVal)
+{
+	JsonElBool *el = JA(ctx, JsonElBool);
+	if (!el)
+		return NULL;
 	el->type = JsonTypeBool;
 	el->boolVal = boolVal;
 	return (JsonEl*)el;
 }
 
-static JsonEl *NewInteger(long integerVal)
+static JsonEl *NewInteger(JsonParserCtx *ctx, long integerVal)
 {
-	JsonElInteger *el = SA(JsonElInteger);
+	JsonElInteger *el = JA(ctx, JsonElInteger);
+	if (!el)
+		return NULL;
 	el->type = JsonTypeInteger;
 	el->intVal = integerVal;
 	return (JsonEl*)el;
 }
 
-static JsonEl *NewDouble(double doubleVal)
+static JsonEl *NewDouble(JsonParserCtx *ctx, double doubleVal)
 {
-	JsonElDouble *el = SA(JsonElDouble);
+	JsonElDouble *el = JA(ctx, JsonElDouble);
+	if (!el)
+		return NULL;
 	el->type = JsonTypeDouble;
 	el->doubleVal = doubleVal;
 	return (JsonEl*)el;
 }
 
-static JsonEl *NewString(const unsigned char *s, size_t len)
+static JsonEl *NewString(JsonParserCtx *ctx, const unsigned char *s, size_t len)
 {
-	JsonElString *el = SA(JsonElString);
+	JsonElString *el = JA(ctx, JsonElString);
+	if (!el)
+		return NULL;
 	el->type = JsonTypeString;
-	el->stringVal = strdupn((const char*)s, len);
+	el->stringVal = jp_strdupn(ctx, s, len);
 	return (JsonEl*)el;
 }
 
-static JsonEl *NewArray()
+static JsonEl *NewArray(JsonParserCtx *ctx)
 {
-	JsonElArray *el = SA(JsonElArray);
+	JsonElArray *el = JA(ctx, JsonElArray);
+	if (!el)
+		return NULL;
 	el->type = JsonTypeArray;
 	el->firstVal = NULL;
 	return (JsonEl*)el;
 }
 
-static JsonEl *NewMap()
+static JsonEl *NewMap(JsonParserCtx *ctx)
 {
-	JsonElMap *el = SA(JsonElMap);
+	JsonElMap *el = JA(ctx, JsonElMap);
+	if (!el)
+		return NULL;
 	el->type = JsonTypeMap;
 	el->firstVal = NULL;
+	el->index = NULL;
+	el->arena = ctx->arena;
 	return (JsonEl*)el;
 }
 
-static JsonElArrayData *NewArrayData(JsonEl *el)
+static JsonElArrayData *NewArrayData(JsonParserCtx *ctx, JsonEl *el)
 {
-	JsonElArrayData *arrayData = SA(JsonElArrayData);
+	JsonElArrayData *arrayData = JA(ctx, JsonElArrayData);
+	if (!arrayData)
+		return NULL;
 	arrayData->val = el;
 	arrayData->next = NULL;
 	return arrayData;
 }
 
-static JsonElMapData *NewMapData(const unsigned char *key, size_t keyLen)
+static JsonElMapData *NewMapData(JsonParserCtx *ctx, const unsigned char *key, size_t keyLen)
 {
-	JsonElMapData *mapData = SA(JsonElMapData);
+	JsonElMapData *mapData = JA(ctx, JsonElMapData);
+	if (!mapData)
+		return NULL;
 	mapData->next = NULL;
 	mapData->val = NULL;
-	mapData->key = strdupn((const char*)key, keyLen);
+	mapData->key = jp_strdupn(ctx, key, keyLen);
 	return mapData;
 }
 
@@ -136,6 +192,8 @@ void JsonElFree(JsonEl *el)
 		{
 			JsonElMap *map = (JsonElMap*)el;
 			JsonElMapDataFree(map->firstVal);
+			assert(!map->arena);
+			free(map->index);
 			break;
 		}
 	}
@@ -267,6 +325,8 @@ static JsonEl *GetMapElByNameFromArray(JsonElArray *arr, const char *name)
 
 // recursively find map element with a given <name>
 // returns NULL if not found
+// Note: this searches the whole document. If you know where the element
+// is, GetMapElByKey() and GetElByPath() are faster and more precise
 JsonEl *GetMapElByName(JsonEl *json, const char *name)
 {
 	JsonElMap *map = JsonElAsMap(json);
@@ -280,14 +340,158 @@ JsonEl *GetMapElByName(JsonEl *json, const char *name)
 	return NULL;
 }
 
+// FNV-1a
+static inline uint32_t HashKey(const char *key, size_t keyLen)
+{
+	uint32_t h = 2166136261U;
+	for (size_t i=0; i < keyLen; i++) {
+		h ^= (unsigned char)key[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static inline bool KeyEq(const char *s, const char *key, size_t keyLen)
+{
+	return (0 == strncmp(s, key, keyLen)) && (0 == s[keyLen]);
+}
+
+static JsonElMapIndex *BuildMapIndex(JsonElMap *map)
+{
+	size_t count = ListLengthGeneric(map->firstVal);
+	if (count < MAP_INDEX_MIN_ENTRIES)
+		return NULL;
+
+	// keep load factor at most 0.5
+	size_t size = MAP_INDEX_MIN_ENTRIES;
+	while (size < count * 2)
+		size *= 2;
+	size_t memSize = sizeof(JsonElMapIndex) + (size - 1) * sizeof(JsonElMapData*);
+	JsonElMapIndex *index;
+	if (map->arena)
+		index = (JsonElMapIndex*)map->arena->alloc(memSize);
+	else
+		index = (JsonElMapIndex*)malloc(memSize);
+	if (!index)
+		return NULL;
+	index->size = size;
+	memzero(index->slots, size * sizeof(JsonElMapData*));
+
+	size_t mask = size - 1;
+	JsonElMapData *mapData = map->firstVal;
+	while (mapData) {
+		char *key = mapData->key;
+		size_t slot = HashKey(key, strlen(key)) & mask;
+		while (index->slots[slot]) {
+			// on duplicate keys the first one wins, like in linear search
+			if (streq(key, index->slots[slot]->key))
+				break;
+			slot = (slot + 1) & mask;
+		}
+		if (!index->slots[slot])
+			index->slots[slot] = mapData;
+		mapData = mapData->next;
+	}
+	return index;
+}
+
+// find an entry with a given key only among direct children of the <map>
+static JsonEl *MapGetByKeyN(JsonElMap *map, const char *key, size_t keyLen)
+{
+	if (!map->index)
+		map->index = BuildMapIndex(map);
+
+	JsonElMapIndex *index = map->index;
+	if (index) {
+		size_t mask = index->size - 1;
+		size_t slot = HashKey(key, keyLen) & mask;
+		JsonElMapData *mapData = index->slots[slot];
+		while (mapData) {
+			if (KeyEq(mapData->key, key, keyLen))
+				return mapData->val;
+			slot = (slot + 1) & mask;
+			mapData = index->slots[slot];
+		}
+		return NULL;
+	}
+
+	JsonElMapData *mapData = map->firstVal;
+	while (mapData) {
+		if (KeyEq(mapData->key, key, keyLen))
+			return mapData->val;
+		mapData = mapData->next;
+	}
+	return NULL;
+}
+
+static JsonEl *ArrayGetByIndexStr(JsonElArray *arr, const char *s, size_t len)
+{
+	if (0 == len)
+		return NULL;
+	size_t n = 0;
+	for (size_t i=0; i < len; i++) {
+		if ((s[i] < '0') || (s[i] > '9'))
+			return NULL;
+		n = n * 10 + (s[i] - '0');
+	}
+	JsonElArrayData *arrData = arr->firstVal;
+	while (arrData && (n > 0)) {
+		arrData = arrData->next;
+		--n;
+	}
+	if (!arrData)
+		return NULL;
+	return arrData->val;
+}
+
+// find a value of <key> in <json>, which must be a map. Unlike
+// GetMapElByName() doesn't look into nested maps and arrays.
+// Returns NULL if not found.
+JsonEl *GetMapElByKey(JsonEl *json, const char *key)
+{
+	JsonElMap *map = JsonElAsMap(json);
+	if (!map || !key)
+		return NULL;
+	return MapGetByKeyN(map, key, strlen(key));
+}
+
+// find an element by its '/' separated path from <json> e.g.
+// "response/network_id". Path components of arrays are indexes
+// e.g. "response/0/label". Returns NULL if not found.
+JsonEl *GetElByPath(JsonEl *json, const char *path)
+{
+	if (!path)
+		return NULL;
+	JsonEl *curr = json;
+	const char *s = path;
+	for (;;) {
+		if (!curr)
+			return NULL;
+		const char *end = StrFindChar(s, '/');
+		size_t len = end ? (size_t)(end - s) : strlen(s);
+		JsonElMap *map = JsonElAsMap(curr);
+		JsonElArray *arr = JsonElAsArray(curr);
+		if (map)
+			curr = MapGetByKeyN(map, s, len);
+		else if (arr)
+			curr = ArrayGetByIndexStr(arr, s, len);
+		else
+			return NULL;
+		if (!end)
+			return curr;
+		s = end + 1;
+	}
+}
+
 #define CONTINUE_PARSE 1
 #define CANCEL_PARSE 0
 
-static void jp_init(JsonParserCtx *ctx)
+static void jp_init(JsonParserCtx *ctx, MemArena *arena)
 {
 	ctx->yajl_handle = 0;
 	ctx->nestingChain = NULL;
 	ctx->firstEl = NULL;
+	ctx->arena = arena;
 }
 
 static JsonEl *jp_steal_result(JsonParserCtx *ctx)
@@ -297,7 +501,7 @@ static JsonEl *jp_steal_result(JsonParserCtx *ctx)
 	return result;
 }
 
-static int jp_add_element(JsonParserCtx *ctx, JsonEl *el)
+static int jp_link_element(JsonParserCtx *ctx, JsonEl *el)
 {
 	assert(ctx->nestingChain);
 	if (!ctx->nestingChain)
@@ -306,7 +510,9 @@ static int jp_add_element(JsonParserCtx *ctx, JsonEl *el)
 	JsonEl *nestingEl = ctx->nestingChain->el;
 	if (JsonTypeArray == nestingEl->type) {
 		JsonElArray *elArr = (JsonElArray*)nestingEl;
-		JsonElArrayData *newData = NewArrayData(el);
+		JsonElArrayData *newData = NewArrayData(ctx, el);
+		if (!newData)
+			return CANCEL_PARSE;
 		/* Put in front. Elements will be in reverse order when we're done. */
 		newData->next = elArr->firstVal;
 		elArr->firstVal = newData;
@@ -329,9 +535,28 @@ static int jp_add_element(JsonParserCtx *ctx, JsonEl *el)
 	return CONTINUE_PARSE;
 }
 
+// If it fails, <el> is freed (unless it's from the arena) and the caller
+// must not use it
+static int jp_add_element(JsonParserCtx *ctx, JsonEl *el)
+{
+	if (!el)
+		return CANCEL_PARSE;
+	if (jp_link_element(ctx, el))
+		return CONTINUE_PARSE;
+	if (!ctx->arena)
+		JsonElFree(el);
+	return CANCEL_PARSE;
+}
+
 static int jp_nesting_chain_head_push(JsonParserCtx *ctx, JsonEl *el)
 {
 	MapArrayNestingChain *newHead = SA(MapArrayNestingChain);
+	if (!newHead) {
+		// the first element isn't owned by anything yet
+		if (!ctx->firstEl && !ctx->arena)
+			JsonElFree(el);
+		return CANCEL_PARSE;
+	}
 	newHead->el = el;
 	newHead->prev = ctx->nestingChain;
 	if (!ctx->firstEl) {
@@ -388,7 +613,10 @@ static void jp_destroy(JsonParserCtx *ctx)
 		jp_nesting_chain_head_pop(ctx);
 	}
 
-	JsonElFree(ctx->firstEl);
+	// with an arena, the partially built document is freed together
+	// with the arena
+	if (!ctx->arena)
+		JsonElFree(ctx->firstEl);
 	if (ctx->yajl_handle) {
 		yajl_free(ctx->yajl_handle);
 	}
@@ -404,21 +632,21 @@ static int yp_yajl_boolean(void *o, int boolVal)
 {
 	JsonParserCtx *ctx = static_cast<JsonParserCtx*>(o);
 	assert(ctx->nestingChain);
-	JsonEl *el = NewBool(boolVal);
+	JsonEl *el = NewBool(ctx, boolVal);
 	return jp_add_element(ctx, el);
 }
 
 static int yp_yajl_integer(void *o, long integerVal)
 {
 	JsonParserCtx *ctx = static_cast<JsonParserCtx*>(o);
-	JsonEl *el = NewInteger(integerVal);
+	JsonEl *el = NewInteger(ctx, integerVal);
 	return jp_add_element(ctx, el);
 }
 
 static int yp_yajl_double(void *o, double doubleVal)
 {
 	JsonParserCtx *ctx = static_cast<JsonParserCtx*>(o);
-	JsonEl *el = NewDouble(doubleVal);
+	JsonEl *el = NewDouble(ctx, doubleVal);
 	return jp_add_element(ctx, el);
 }
 
@@ -429,16 +657,19 @@ static int yp_yajl_double(void *o, double doubleVal)
 static int yp_yajl_string(void *o, const unsigned char * stringVal, unsigned int stringLen)
 {
 	JsonParserCtx *ctx = static_cast<JsonParserCtx*>(o);
-	JsonEl *el = NewString(stringVal, stringLen);
+	JsonEl *el = NewString(ctx, stringVal, stringLen);
 	return jp_add_element(ctx, el);
 }
 
 static int yp_yajl_start_map(void *o)
 {
 	JsonParserCtx *ctx = static_cast<JsonParserCtx*>(o);
-	JsonEl *map = NewMap();
-	if (ctx->nestingChain)
-		jp_add_element(ctx, map);
+	JsonEl *map = NewMap(ctx);
+	if (!map)
+		return CANCEL_PARSE;
+	// if it fails, <map> is already freed
+	if (ctx->nestingChain && !jp_add_element(ctx, map))
+		return CANCEL_PARSE;
 	return jp_nesting_chain_head_push(ctx, map);
 }
 
@@ -449,7 +680,9 @@ static int yp_yajl_map_key(void *o, const unsigned char * key, unsigned int keyL
 	if (!head)
 		return CANCEL_PARSE;
 	JsonElMap *map = (JsonElMap*)head->el;
-	JsonElMapData *mapData = NewMapData(key, keyLen);
+	JsonElMapData *mapData = NewMapData(ctx, key, keyLen);
+	if (!mapData)
+		return CANCEL_PARSE;
 	mapData->next = map->firstVal;
 	map->firstVal = mapData;
 	return CONTINUE_PARSE;
@@ -465,9 +698,12 @@ static int yp_yajl_end_map(void *o)
 static int yp_yajl_start_array(void *o)
 {
 	JsonParserCtx *ctx = static_cast<JsonParserCtx*>(o);
-	JsonEl *arr = NewArray();
-	if (ctx->nestingChain)
-		jp_add_element(ctx, arr);
+	JsonEl *arr = NewArray(ctx);
+	if (!arr)
+		return CANCEL_PARSE;
+	// if it fails, <arr> is already freed
+	if (ctx->nestingChain && !jp_add_element(ctx, arr))
+		return CANCEL_PARSE;
 	return jp_nesting_chain_head_push(ctx, arr);
 }
 
@@ -500,7 +736,9 @@ static yajl_status jp_parse(JsonParserCtx *ctx, const unsigned char *s, unsigned
 	return status;
 }
 
-JsonEl *ParseJsonToDoc(const char *s)
+// If <arena> is given, the whole document is allocated from it. Such document
+// must not be freed with JsonElFree(), it goes away when the arena is freed.
+JsonEl *ParseJsonToDoc(const char *s, MemArena *arena)
 {
 	JsonEl *result = NULL;
 	JsonParserCtx parserCtx;
@@ -508,7 +746,7 @@ JsonEl *ParseJsonToDoc(const char *s)
 	if (!s)
 		return NULL;
 
-	jp_init(&parserCtx);
+	jp_init(&parserCtx, arena);
 
 	yajl_status status = jp_parse(&parserCtx, (const unsigned char*)s, strlen(s));
 	if (yajl_status_ok != status)
@@ -7,6 +7,8 @@
 
 #include "yajl_parse.h"
 
+class MemArena;
+
 template <typename T>
 T* ReverseListGeneric(T *head)
 {
@@ -74,9 +76,17 @@ typedef struct JsonElMapData {
 	JsonEl *	val;
 } JsonElMapData;
 
+typedef struct JsonElMapIndex JsonElMapIndex;
+
 typedef struct {
 	JsonElType		type;
 	JsonElMapData	*firstVal;
+	// hash table of firstVal entries by key. Built lazily on first
+	// GetMapElByKey() (only for maps big enough to benefit from it)
+	JsonElMapIndex	*index;
+	// arena this map was allocated from (NULL if malloc()ed). The index
+	// is allocated from the same place
+	MemArena *		arena;
 } JsonElMap;
 
 // Note: make 'next' be first in the struct for perf
@@ -99,7 +109,9 @@ JsonElInteger *JsonElAsInteger(JsonEl *el);
 bool JsonElAsIntegerVal(JsonEl *el, long *val);
 JsonElBool *JsonElAsBool(JsonEl *el);
 
-JsonEl *ParseJsonToDoc(const char *s);
+JsonEl *ParseJsonToDoc(const char *s, MemArena *arena=NULL);
 JsonEl *GetMapElByName(JsonEl *json, const char *name);
+JsonEl *GetMapElByKey(JsonEl *json, const char *key);
+JsonEl *GetElByPath(JsonEl *json, const char *path);
 
 #endif
@@ -8,6 +8,7 @@
 #include "MiscUtil.h"
 #include "JsonParser.h"
 #include "JsonApiResponses.h"
+#include "MemArena.h"
 #include "SampleApiResponses.h"
 
 #include "UnitTests.h"
@@ -250,6 +251,179 @@ static void multiple_networks_ut()
 	JsonElFree(json);
 }
 
+static void check_networks_equal(NetworkInfo *ni1, NetworkInfo *ni2)
+{
+	while (ni1 && ni2) {
+		check_network_info(ni2, ni1->networkId, ni1->ipAddress, ni1->label, ni1->isDynamic);
+		ni1 = ni1->next;
+		ni2 = ni2->next;
+	}
+	utassert(!ni1 && !ni2);
+}
+
+static void arena_multiple_networks_ut()
+{
+	MemArena arena(64);
+	JsonEl *json = ParseJsonToDoc(MULTIPLE_NETWORKS, &arena);
+	utassert(json);
+	if (!json) return;
+	// a tiny first block forces the document to span several blocks
+	utassert(arena.blocksCount() > 1);
+	JsonEl *json2 = ParseJsonToDoc(MULTIPLE_NETWORKS);
+	NetworkInfo *ni = ParseNetworksGetJson(json);
+	NetworkInfo *ni2 = ParseNetworksGetJson(json2);
+	utassert(5 == ListLengthGeneric(ni));
+	check_networks_equal(ni, ni2);
+	NetworkInfoFreeList(ni);
+	NetworkInfoFreeList(ni2);
+	JsonElFree(json2);
+	arena.freeAll();
+	utassert(0 == arena.blocksCount());
+
+	// invalid json must not leave anything behind that the caller has
+	// to free other than the arena
+	json = ParseJsonToDoc("{\"status\":\"success\",\"response\":{\"668261\":{", &arena);
+	utassert(!json);
+}
+
+#define NESTED_KEYS "{\"a\":{\"status\":\"nested\",\"arr\":[1,{\"x\":\"y\"}]},\"status\":\"top\"}"
+
+static void get_by_key_and_path_ut()
+{
+	JsonEl *json = ParseJsonToDoc(NESTED_KEYS);
+	utassert(json);
+	if (!json) return;
+	// recursive search finds keys that only exist in nested maps,
+	// direct lookup doesn't
+	utassert(streq("y", JsonElAsStringVal(GetMapElByName(json, "x"))));
+	utassert(NULL == GetMapElByKey(json, "x"));
+	utassert(streq("top", JsonElAsStringVal(GetMapElByKey(json, "status"))));
+	utassert(streq("nested", JsonElAsStringVal(GetElByPath(json, "a/status"))));
+	utassert(streq("y", JsonElAsStringVal(GetElByPath(json, "a/arr/1/x"))));
+	long n;
+	utassert(JsonElAsIntegerVal(GetElByPath(json, "a/arr/0"), &n) && (1 == n));
+	utassert(NULL == GetElByPath(json, "a/arr/2"));
+	utassert(NULL == GetElByPath(json, "a/arr/x"));
+	utassert(NULL == GetElByPath(json, "a/status/x"));
+	utassert(NULL == GetElByPath(json, "a/sta"));
+	JsonElFree(json);
+
+	json = ParseJsonToDoc(AUTH_OK);
+	utassert(json);
+	if (!json) return;
+	utassert(NULL == GetMapElByKey(json, "token"));
+	utassert(streq("DCE15D01E430D8C96D3920FB8F64185C", JsonElAsStringVal(GetElByPath(json, "response/token"))));
+	JsonElFree(json);
+}
+
+// big enough maps get a hash index, check that lookups through it
+// find every key, return the first of duplicate keys and don't find
+// prefixes of keys
+static void map_index_ut()
+{
+	static const int count = 100;
+	char buf[32];
+	char jsonTxt[2048];
+	char *tmp = jsonTxt;
+	tmp += sprintf(tmp, "{");
+	for (int i=0; i < count; i++)
+		tmp += sprintf(tmp, "\"k%d\":%d,", i, i);
+	sprintf(tmp, "\"k0\":-1}");
+
+	MemArena arena;
+	JsonEl *jsons[2];
+	jsons[0] = ParseJsonToDoc(jsonTxt);
+	jsons[1] = ParseJsonToDoc(jsonTxt, &arena);
+	for (int j=0; j < dimof(jsons); j++) {
+		JsonEl *json = jsons[j];
+		utassert(json);
+		if (!json) return;
+		for (int i=0; i < count; i++) {
+			long n = -2;
+			sprintf(buf, "k%d", i);
+			utassert(JsonElAsIntegerVal(GetMapElByKey(json, buf), &n));
+			utassert(n == i);
+		}
+		utassert(JsonElAsMap(json)->index);
+		utassert(NULL == GetMapElByKey(json, "k"));
+		utassert(NULL == GetMapElByKey(json, "k1000"));
+	}
+	JsonElFree(jsons[0]);
+}
+
+// feed <s> to NetworksGetParser in chunks of <chunkSize> bytes
+static NetworksGetParser *ParseNetworksGetStreamed(const char *s, size_t chunkSize)
+{
+	NetworksGetParser *p = NetworksGetParserNew();
+	size_t left = strlen(s);
+	while (left > 0) {
+		size_t len = chunkSize;
+		if (len > left)
+			len = left;
+		if (!NetworksGetParserFeed(p, s, len))
+			break;
+		s += len;
+		left -= len;
+	}
+	return p;
+}
+
+static void networks_get_parser_ut()
+{
+	JsonEl *json = ParseJsonToDoc(MULTIPLE_NETWORKS);
+	NetworkInfo *expected = ParseNetworksGetJson(json);
+	utassert(5 == ListLengthGeneric(expected));
+	// chunk boundaries in the middle of keys and strings must not matter
+	static const size_t chunkSizes[] = { 1, 7, 1024 };
+	for (int i=0; i < dimof(chunkSizes); i++) {
+		NetworksGetParser *p = ParseNetworksGetStreamed(MULTIPLE_NETWORKS, chunkSizes[i]);
+		utassert(NetworksGetParserFinish(p));
+		utassert(WebApiStatusSuccess == NetworksGetParserStatus(p));
+		long err;
+		utassert(!NetworksGetParserError(p, &err));
+		NetworkInfo *ni = NetworksGetParserStealNetworks(p);
+		check_networks_equal(expected, ni);
+		NetworkInfoFreeList(ni);
+		NetworksGetParserFree(p);
+	}
+	NetworkInfoFreeList(expected);
+	JsonElFree(json);
+
+	NetworksGetParser *p = ParseNetworksGetStreamed(BAD_PWD, 3);
+	utassert(NetworksGetParserFinish(p));
+	utassert(WebApiStatusFailure == NetworksGetParserStatus(p));
+	long err;
+	utassert(NetworksGetParserError(p, &err));
+	utassert(ERR_BAD_USERNAME_PWD == err);
+	utassert(NULL == NetworksGetParserStealNetworks(p));
+	NetworksGetParserFree(p);
+
+	// unknown values, including nested ones, are skipped
+	p = ParseNetworksGetStreamed("{\"x\":{\"response\":{\"1\":{}}},\"status\":\"success\",\"response\":{\"12\":{\"label\":null,\"extra\":[1,{\"dynamic\":1}],\"ip_address\":\"1.2.3.4\",\"dynamic\":true}}}", 5);
+	utassert(NetworksGetParserFinish(p));
+	NetworkInfo *ni = NetworksGetParserStealNetworks(p);
+	utassert(1 == ListLengthGeneric(ni));
+	if (ni)
+		check_network_info(ni, "12", "1.2.3.4", NULL, TRUE);
+	NetworkInfoFreeList(ni);
+	NetworksGetParserFree(p);
+
+	// truncated response
+	p = ParseNetworksGetStreamed("{\"status\":\"success\",\"response\":{\"668261\":{", 1024);
+	utassert(!NetworksGetParserFinish(p));
+	NetworksGetParserFree(p);
+
+	// network without ip address
+	p = ParseNetworksGetStreamed("{\"status\":\"success\",\"response\":{\"1\":{\"dynamic\":true}}}", 1024);
+	utassert(!NetworksGetParserFinish(p));
+	NetworksGetParserFree(p);
+
+	// "dynamic" must be a bool
+	p = ParseNetworksGetStreamed("{\"status\":\"success\",\"response\":{\"1\":{\"dynamic\":[],\"ip_address\":\"1.2.3.4\"}}}", 1024);
+	utassert(!NetworksGetParserFinish(p));
+	NetworksGetParserFree(p);
+}
+
 void json_parser_ut_all()
 {
 	ReverseListGeneric_ut();
@@ -259,6 +433,99 @@ void json_parser_ut_all()
 	one_network_not_dynamic_ut();
 	one_network_dynamic_ut();
 	multiple_networks_ut();
+	arena_multiple_networks_ut();
+	get_by_key_and_path_ut();
+	map_index_ut();
+	networks_get_parser_ut();
 	// TODO: a negative test for networks parsing
 }
 
+// generate networks_get response with <count> networks, in the same
+// format as MULTIPLE_NETWORKS. Caller needs to free() the result
+static char *GenNetworksGetJson(int count)
+{
+	static const char *start = "{\"status\":\"success\",\"response\":{";
+	static const char *end = "}}";
+	// more than enough for one network
+	static const size_t maxNetworkLen = 128;
+	char *s = (char*)malloc(strlen(start) + count * maxNetworkLen + strlen(end) + 1);
+	if (!s)
+		return NULL;
+	char *tmp = s;
+	tmp += sprintf(tmp, "%s", start);
+	for (int i=0; i < count; i++) {
+		if (i > 0)
+			*tmp++ = ',';
+		bool dynamic = (0 == i % 3);
+		if (dynamic)
+			tmp += sprintf(tmp, "\"%d\":{\"dynamic\":true,\"label\":\"net-%d\",\"ip_address\":\"67.215.%d.%d\"}", 600000 + i, i, (i / 256) % 256, i % 256);
+		else
+			tmp += sprintf(tmp, "\"%d\":{\"dynamic\":false,\"label\":null,\"ip_address\":\"67.215.%d.%d\"}", 600000 + i, (i / 256) % 256, i % 256);
+	}
+	sprintf(tmp, "%s", end);
+	return s;
+}
+
+static void parse_networks_get_bench(const char *json, MemArena *arena, int iterations, const char *name)
+{
+	double start = benchTimeMs();
+	for (int i=0; i < iterations; i++) {
+		JsonEl *doc = ParseJsonToDoc(json, arena);
+		utassert(doc);
+		NetworkInfo *ni = ParseNetworksGetJson(doc);
+		utassert(ni);
+		NetworkInfoFreeList(ni);
+		if (arena)
+			arena->freeAll();
+		else
+			JsonElFree(doc);
+	}
+	benchReport(name, iterations, benchTimeMs() - start);
+}
+
+// same as parse_networks_get_bench() but with NetworksGetParser, fed
+// in chunks of the same size as HttpReadAllData() reads
+static void parse_networks_get_streamed_bench(const char *json, int iterations, const char *name)
+{
+	double start = benchTimeMs();
+	for (int i=0; i < iterations; i++) {
+		NetworksGetParser *p = ParseNetworksGetStreamed(json, 1024);
+		utassert(NetworksGetParserFinish(p));
+		NetworkInfo *ni = NetworksGetParserStealNetworks(p);
+		utassert(ni);
+		NetworkInfoFreeList(ni);
+		NetworksGetParserFree(p);
+	}
+	benchReport(name, iterations, benchTimeMs() - start);
+}
+
+static void json_alloc_bench()
+{
+	static const int networkCounts[] = { 10, 1000, 10000 };
+	for (int i=0; i < dimof(networkCounts); i++) {
+		int count = networkCounts[i];
+		char *json = GenNetworksGetJson(count);
+		utassert(json);
+		if (!json)
+			return;
+		int iterations = 100000 / count;
+		fprintf(stderr, "\nnetworks_get with %d networks, %d bytes", count, (int)strlen(json));
+		parse_networks_get_bench(json, NULL, iterations, "  malloc");
+		MemArena arena;
+		parse_networks_get_bench(json, &arena, iterations, "  arena");
+		parse_networks_get_streamed_bench(json, iterations, "  streamed");
+		// the streamed parser doesn't need the document at all, so that's
+		// how much less memory it needs at the peak
+		MemArena docArena;
+		JsonEl *doc = ParseJsonToDoc(json, &docArena);
+		utassert(doc);
+		fprintf(stderr, "\n  document size: %d bytes", (int)docArena.totalSize());
+		free(json);
+	}
+}
+
+void json_parser_bench_all()
+{
+	json_alloc_bench();
+}
+
@@ -0,0 +1,203 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include <io.h>
+#include <winioctl.h>
+
+#include "LogRotate.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+struct LogRotate {
+	TCHAR *		path;
+	long		maxSize;
+	DWORD		maxAgeMinutes;
+	int			maxArchives;
+	// when the current log file was started
+	ULONGLONG	startMinutes;
+	// the size the log had when it last failed to rotate, it's next
+	// rotated when it has grown by maxSize past that
+	long		failedSize;
+};
+
+static ULONGLONG FileTimeToMinutes(const FILETIME *ft)
+{
+	ULARGE_INTEGER t;
+	t.LowPart = ft->dwLowDateTime;
+	t.HighPart = ft->dwHighDateTime;
+	// FILETIME is in 100 nanosecond units
+	return t.QuadPart / (10 * 1000 * 1000 * 60);
+}
+
+static ULONGLONG NowMinutes()
+{
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	return FileTimeToMinutes(&now);
+}
+
+LogRotate *LogRotateNew(const TCHAR *path, long maxSize, DWORD maxAgeMinutes, int maxArchives)
+{
+	LogRotate *r = SAZ(LogRotate);
+	if (!r)
+		return NULL;
+	r->path = tstrdup(path);
+	if (!r->path) {
+		free(r);
+		return NULL;
+	}
+	r->maxSize = maxSize;
+	r->maxAgeMinutes = maxAgeMinutes;
+	r->maxArchives = maxArchives;
+
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (GetFileAttributesEx(path, GetFileExInfoStandard, &data))
+		r->startMinutes = FileTimeToMinutes(&data.ftCreationTime);
+	else
+		r->startMinutes = NowMinutes();
+	return r;
+}
+
+void LogRotateFree(LogRotate *r)
+{
+	if (!r)
+		return;
+	free(r->path);
+	free(r);
+}
+
+bool LogRotateNeeded(long size, long maxSize, ULONGLONG startMinutes, ULONGLONG nowMinutes, DWORD maxAgeMinutes)
+{
+	// don't leave empty archives behind
+	if (0 == size)
+		return false;
+	if (size >= maxSize)
+		return true;
+	// the clock might have been set back
+	if (nowMinutes < startMinutes)
+		return false;
+	return (nowMinutes - startMinutes) >= maxAgeMinutes;
+}
+
+TCHAR *LogRotateArchiveName(const TCHAR *path, int n)
+{
+	TCHAR num[16];
+	_itot_s(n, num, dimof(num), 10);
+
+	// the extension is after the last '.' in the last path component
+	const TCHAR *ext = NULL;
+	for (const TCHAR *s = path; *s; s++) {
+		if (_T('.') == *s)
+			ext = s;
+		else if ((_T('\\') == *s) || (_T('/') == *s))
+			ext = NULL;
+	}
+	if (!ext)
+		return TStrCat(path, _T("."), num);
+
+	size_t baseLen = ext - path;
+	TCHAR *base = (TCHAR*)malloc((baseLen + 1) * sizeof(TCHAR));
+	if (!base)
+		return NULL;
+	memcpy(base, path, baseLen * sizeof(TCHAR));
+	base[baseLen] = 0;
+	TCHAR *res = TStrCat(base, _T("."), num, ext);
+	free(base);
+	return res;
+}
+
+// Best effort, fails on file systems that don't support compression
+static void CompressFile(const TCHAR *path)
+{
+	HANDLE h = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if (INVALID_HANDLE_VALUE == h)
+		return;
+	USHORT format = COMPRESSION_FORMAT_DEFAULT;
+	DWORD returned;
+	DeviceIoControl(h, FSCTL_SET_COMPRESSION, &format, sizeof(format), NULL, 0, &returned, NULL);
+	CloseHandle(h);
+}
+
+static void ShiftArchives(LogRotate *r)
+{
+	TCHAR *oldest = LogRotateArchiveName(r->path, r->maxArchives);
+	if (oldest)
+		DeleteFile(oldest);
+	free(oldest);
+	for (int n = r->maxArchives; n > 1; n--) {
+		TCHAR *src = LogRotateArchiveName(r->path, n - 1);
+		TCHAR *dst = LogRotateArchiveName(r->path, n);
+		if (src && dst)
+			MoveFileEx(src, dst, MOVEFILE_REPLACE_EXISTING);
+		free(src);
+		free(dst);
+	}
+}
+
+// opens the log for writing at its end, like a FILE we were given
+static FILE *OpenLog(LogRotate *r, const TCHAR *mode)
+{
+	FILE *f = _tfopen(r->path, mode);
+	if (f)
+		fseek(f, 0, SEEK_END);
+	return f;
+}
+
+FILE *LogRotateIfNeeded(LogRotate *r, FILE *f)
+{
+	ULONGLONG now = NowMinutes();
+	if (!f) {
+		f = OpenLog(r, _T("ab"));
+		// a new log if it was rotated before it couldn't be reopened
+		if (f && (0 == ftell(f))) {
+			r->startMinutes = now;
+			r->failedSize = 0;
+		}
+		return f;
+	}
+	long size = ftell(f);
+	if (!LogRotateNeeded(size - r->failedSize, r->maxSize, r->startMinutes, now, r->maxAgeMinutes))
+		return f;
+
+	fclose(f);
+	if (r->maxArchives > 0) {
+		// the archives are only shifted once the log has been renamed,
+		// otherwise every failed try would lose the oldest one
+		TCHAR *tmp = LogRotateArchiveName(r->path, 0);
+		bool moved = tmp && MoveFileEx(r->path, tmp, MOVEFILE_REPLACE_EXISTING);
+		if (moved) {
+			ShiftArchives(r);
+			TCHAR *first = LogRotateArchiveName(r->path, 1);
+			if (first && MoveFileEx(tmp, first, MOVEFILE_REPLACE_EXISTING))
+				CompressFile(first);
+			free(first);
+		}
+		free(tmp);
+		if (!moved) {
+			// e.g. someone has it open without FILE_SHARE_DELETE. We keep
+			// what's in it and try again when it has grown by maxSize or
+			// after maxAgeMinutes, instead of after every write
+			r->failedSize = size;
+			r->startMinutes = now;
+			return OpenLog(r, _T("ab"));
+		}
+	}
+	// without archives the log is truncated
+	f = OpenLog(r, _T("wb"));
+	if (!f)
+		return NULL;
+	r->failedSize = 0;
+
+	// a file created with the name of a just renamed file gets its creation
+	// time ("file system tunneling"), so we need to set it ourselves
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	HANDLE h = (HANDLE)_get_osfhandle(_fileno(f));
+	if (INVALID_HANDLE_VALUE != h)
+		SetFileTime(h, &ft, NULL, NULL);
+	r->startMinutes = now;
+	return f;
+}
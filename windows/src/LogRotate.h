@@ -0,0 +1,41 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef LOG_ROTATE_H__
+#define LOG_ROTATE_H__
+
+// Keeps a log file from growing forever. When it gets bigger than maxSize
+// or older than maxAgeMinutes, it becomes the first archive, e.g.
+// service-log.txt is renamed to service-log.1.txt, previous service-log.1.txt
+// to service-log.2.txt and so on, up to maxArchives. The log is renamed to
+// service-log.0.txt first, the archives are only shifted if that works.
+// Archives are
+// compressed by the file system (NTFS compression) where it's supported.
+//
+// Meant to be called from the log writer thread, see AsyncLogSetRotateFunc()
+
+#define LOG_ROTATE_MAX_SIZE			(1024*1024)
+#define LOG_ROTATE_MAX_AGE_MINUTES	(7*24*60)
+#define LOG_ROTATE_MAX_ARCHIVES		5
+
+typedef struct LogRotate LogRotate;
+
+LogRotate *	LogRotateNew(const TCHAR *path, long maxSize, DWORD maxAgeMinutes, int maxArchives);
+void		LogRotateFree(LogRotate *r);
+
+// <nowMinutes> and <startMinutes> are minutes since some fixed point in time
+bool		LogRotateNeeded(long size, long maxSize, ULONGLONG startMinutes, ULONGLONG nowMinutes, DWORD maxAgeMinutes);
+
+// Rotates if <f>, which is open for appending to the log, is too big or
+// too old. Returns the file to write to from now on, which is <f> if
+// there was no need to rotate. If the log can't be renamed, it's reopened
+// for appending and rotating is tried again later. Returns NULL if the
+// log can't be reopened, then it should be called again with NULL <f> to
+// try again
+FILE *		LogRotateIfNeeded(LogRotate *r, FILE *f);
+
+// the name of <n>th archive of <path>, "c:\\foo\\log.txt" => "c:\\foo\\log.<n>.txt"
+TCHAR *		LogRotateArchiveName(const TCHAR *path, int n);
+
+#endif
@@ -0,0 +1,180 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "LogRotate.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+#include "UnitTests.h"
+
+static void log_rotate_needed_ut()
+{
+	const long maxSize = 1000;
+	const DWORD maxAge = 60;
+	utassert(!LogRotateNeeded(0, maxSize, 100, 100, maxAge));
+	// an empty log is never rotated, however old
+	utassert(!LogRotateNeeded(0, maxSize, 100, 1000, maxAge));
+	utassert(!LogRotateNeeded(999, maxSize, 100, 100, maxAge));
+	utassert(LogRotateNeeded(1000, maxSize, 100, 100, maxAge));
+	utassert(LogRotateNeeded(5000, maxSize, 100, 100, maxAge));
+	utassert(!LogRotateNeeded(10, maxSize, 100, 159, maxAge));
+	utassert(LogRotateNeeded(10, maxSize, 100, 160, maxAge));
+	// clock set back
+	utassert(!LogRotateNeeded(10, maxSize, 100, 50, maxAge));
+}
+
+static void log_rotate_archive_name_ut()
+{
+	static const TCHAR *tests[] = {
+		_T("c:\\foo\\service-log.txt"), _T("c:\\foo\\service-log.1.txt"),
+		_T("c:\\foo.bar\\log"), _T("c:\\foo.bar\\log.1"),
+		_T("log.a.txt"), _T("log.a.1.txt"),
+		_T("c:/foo.bar/log"), _T("c:/foo.bar/log.1"),
+		_T("log"), _T("log.1"),
+	};
+	for (int i=0; i < dimof(tests); i += 2) {
+		TCHAR *name = LogRotateArchiveName(tests[i], 1);
+		utassert(name && tstreq(tests[i+1], name));
+		free(name);
+	}
+	TCHAR *name = LogRotateArchiveName(_T("log.txt"), 12);
+	utassert(name && tstreq(_T("log.12.txt"), name));
+	free(name);
+}
+
+static const TCHAR *TestLogPath()
+{
+	static TCHAR path[MAX_PATH];
+	if (!path[0]) {
+		TCHAR dir[MAX_PATH];
+		GetTempPath(dimof(dir), dir);
+		GetTempFileName(dir, _T("lrt"), 0, path);
+	}
+	return path;
+}
+
+static void WriteBytes(FILE *f, int count)
+{
+	for (int i=0; i < count; i++)
+		fputc('x', f);
+}
+
+static bool FileCanBeOpened(const TCHAR *path)
+{
+	FILE *f = _tfopen(path, _T("rb"));
+	if (!f)
+		return false;
+	fclose(f);
+	return true;
+}
+
+static long FileSize(const TCHAR *path)
+{
+	FILE *f = _tfopen(path, _T("rb"));
+	if (!f)
+		return -1;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fclose(f);
+	return size;
+}
+
+// a log that can't be renamed keeps what's in it, the archives stay as
+// they are, and renaming isn't tried again after every write
+static void log_rotate_rename_failed_ut()
+{
+	const TCHAR *path = TestLogPath();
+	TCHAR *renamed = LogRotateArchiveName(path, 0);
+	TCHAR *archive1 = LogRotateArchiveName(path, 1);
+	TCHAR *archive2 = LogRotateArchiveName(path, 2);
+	LogRotate *r = NULL;
+	FILE *f = NULL;
+	utassert(renamed && archive1 && archive2);
+	if (!renamed || !archive1 || !archive2)
+		goto Exit;
+	DeleteFile(path);
+	DeleteFile(archive2);
+	f = _tfopen(archive1, _T("wb"));
+	if (f) {
+		WriteBytes(f, 10);
+		fclose(f);
+	}
+	// the log can't replace a directory
+	CreateDirectory(renamed, NULL);
+	r = LogRotateNew(path, 100, (DWORD)-1, 2);
+	f = _tfopen(path, _T("ab"));
+	utassert(r && f);
+	if (!r || !f)
+		goto Exit;
+
+	WriteBytes(f, 150);
+	f = LogRotateIfNeeded(r, f);
+	utassert(f && (150 == ftell(f)));
+	RemoveDirectory(renamed);
+	utassert(10 == FileSize(archive1));
+	utassert(!FileCanBeOpened(archive2));
+
+	WriteBytes(f, 50);
+	f = LogRotateIfNeeded(r, f);
+	utassert(f && (200 == ftell(f)));
+	utassert(10 == FileSize(archive1));
+
+	// grown by maxSize since it failed
+	WriteBytes(f, 100);
+	f = LogRotateIfNeeded(r, f);
+	utassert(f && (0 == ftell(f)));
+	utassert(300 == FileSize(archive1));
+	utassert(10 == FileSize(archive2));
+	utassert(!FileCanBeOpened(renamed));
+Exit:
+	if (f)
+		fclose(f);
+	LogRotateFree(r);
+	if (renamed) {
+		RemoveDirectory(renamed);
+		DeleteFile(renamed);
+	}
+	if (archive1)
+		DeleteFile(archive1);
+	if (archive2)
+		DeleteFile(archive2);
+	DeleteFile(path);
+	free(renamed);
+	free(archive1);
+	free(archive2);
+}
+
+// a log that couldn't be reopened is opened again when asked for without
+// one
+static void log_rotate_reopen_ut()
+{
+	const TCHAR *path = TestLogPath();
+	DeleteFile(path);
+	LogRotate *r = LogRotateNew(path, 100, (DWORD)-1, 1);
+	utassert(NULL != r);
+	if (!r)
+		return;
+	FILE *f = LogRotateIfNeeded(r, NULL);
+	utassert(NULL != f);
+	if (f) {
+		WriteBytes(f, 10);
+		fclose(f);
+	}
+	f = LogRotateIfNeeded(r, NULL);
+	utassert(f && (10 == ftell(f)));
+	if (f)
+		fclose(f);
+	LogRotateFree(r);
+	DeleteFile(path);
+}
+
+void log_rotate_ut_all()
+{
+	log_rotate_needed_ut();
+	log_rotate_archive_name_ut();
+	log_rotate_rename_failed_ut();
+	log_rotate_reopen_ut();
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+#include "MemArena.h"
+
+// all allocations are aligned to that
+#define ARENA_ALIGN 8
+
+static inline size_t AlignUp(size_t n)
+{
+	return (n + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1);
+}
+
+MemArena::Block *MemArena::newBlock(size_t minSize)
+{
+	size_t size = m_nextBlockSize;
+	if (size < minSize)
+		size = minSize;
+	Block *b = (Block*)malloc(AlignUp(sizeof(Block)) + size);
+	if (!b)
+		return NULL;
+	b->size = size;
+	b->used = 0;
+	b->next = m_blocks;
+	m_blocks = b;
+
+	// grow geometrically so that big documents only need a few blocks
+	if (m_nextBlockSize < MAX_BLOCK_SIZE)
+		m_nextBlockSize *= 2;
+	return b;
+}
+
+void *MemArena::alloc(size_t size)
+{
+	size = AlignUp(size);
+	Block *b = m_blocks;
+	if (!b || (b->size - b->used < size)) {
+		b = newBlock(size);
+		if (!b)
+			return NULL;
+	}
+	char *res = (char*)b + AlignUp(sizeof(Block)) + b->used;
+	b->used += size;
+	return (void*)res;
+}
+
+char *MemArena::strdupn(const char *s, size_t len)
+{
+	char *res = (char*)alloc(len + 1);
+	if (!res)
+		return NULL;
+	memcpy(res, s, len);
+	res[len] = 0;
+	return res;
+}
+
+void MemArena::freeAll()
+{
+	Block *curr = m_blocks;
+	while (curr) {
+		Block *next = curr->next;
+		free(curr);
+		curr = next;
+	}
+	m_blocks = NULL;
+}
+
+size_t MemArena::blocksCount()
+{
+	size_t count = 0;
+	for (Block *curr = m_blocks; curr; curr = curr->next)
+		++count;
+	return count;
+}
+
+// total size of memory allocated from the OS, not including block headers
+size_t MemArena::totalSize()
+{
+	size_t size = 0;
+	for (Block *curr = m_blocks; curr; curr = curr->next)
+		size += curr->size;
+	return size;
+}
@@ -0,0 +1,55 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef MEM_ARENA_H__
+#define MEM_ARENA_H__
+
+// A bump allocator. Memory is carved out of a few big blocks and can't be
+// freed piece by piece - everything is freed at once with freeAll() (or when
+// the arena is deleted). Good for data that dies together, like a parsed
+// json document.
+class MemArena {
+private:
+	struct Block {
+		// make 'next' the first field for perf
+		struct Block *	next;
+		size_t			size;
+		size_t			used;
+		// data follows
+	};
+
+	// newest block first. We only allocate from the newest one
+	Block *	m_blocks;
+	size_t	m_nextBlockSize;
+
+	Block *newBlock(size_t minSize);
+
+public:
+	enum {
+		DEFAULT_BLOCK_SIZE = 16*1024,
+		MAX_BLOCK_SIZE = 1024*1024
+	};
+
+	MemArena(size_t firstBlockSize = DEFAULT_BLOCK_SIZE) {
+		m_blocks = NULL;
+		m_nextBlockSize = firstBlockSize;
+		if (0 == m_nextBlockSize)
+			m_nextBlockSize = DEFAULT_BLOCK_SIZE;
+	}
+
+	~MemArena() {
+		freeAll();
+	}
+
+	// returns NULL if out of memory. Memory is not zeroed
+	void *alloc(size_t size);
+	// like strdupn() but 's' doesn't have to be zero-terminated
+	char *strdupn(const char *s, size_t len);
+	void freeAll();
+
+	size_t blocksCount();
+	size_t totalSize();
+};
+
+#endif
@@ -118,6 +118,30 @@ BOOL FileWriteAll(const TCHAR *filePath, const char *data, uint64_t dataLen)
     return f_ok;
 }
 
+// Writes to a temporary file next to <filePath> and renames it over
+// <filePath>, so that a crash or a full disk leaves either the old or
+// the new content, never a truncated file
+BOOL FileWriteAllAtomic(const TCHAR *filePath, const char *data, uint64_t dataLen)
+{
+	CString tmpPath(filePath);
+	tmpPath += _T(".tmp");
+	HANDLE h = CreateFile(tmpPath, GENERIC_WRITE, 0, NULL,
+			CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (h == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	DWORD size;
+	BOOL f_ok = WriteFile(h, data, (DWORD)dataLen, &size, NULL) && ((DWORD)dataLen == size);
+	if (f_ok)
+		f_ok = FlushFileBuffers(h);
+	CloseHandle(h);
+	if (f_ok)
+		f_ok = MoveFileEx(tmpPath, filePath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+	if (!f_ok)
+		DeleteFile(tmpPath);
+	return f_ok;
+}
+
 #define APP_DATA_SUBDIR _T("OpenDNS Updater")
 CString AppDataDir()
 {
@@ -511,6 +535,12 @@ const char *GetIpUpdateDnsOMaticHost()
 // the same URL format is used for dns-o-matic (updates.dnsomatic.com) and
 // updates.opendns.com server. dns-o-matic server ignores v=2 argument but
 const char *GetIpUpdateUrl(BOOL addApiKey)
+{
+	return GetIpUpdateUrlForHostname(addApiKey, g_pref_hostname);
+}
+
+// <hostname> can also be a comma-separated list of hostnames
+const char *GetIpUpdateUrlForHostname(BOOL addApiKey, const char *hostname)
 {
 	CString url = "/nic/update?token=";
 	assert(g_pref_token);
@@ -521,11 +551,11 @@ const char *GetIpUpdateUrl(BOOL addApiKey)
 	}
 	url += "&v=2";
 	url += "&hostname=";
-	if (g_pref_hostname) {
-		char *hostnameEncoded = StrUrlEncode(g_pref_hostname);
-		url += hostnameEncoded;
+	if (hostname) {
+		char *hostnameEncoded = StrUrlEncode(hostname);
+		if (hostnameEncoded)
+			url += hostnameEncoded;
 		free(hostnameEncoded);
-		
 	}
 	const char *urlTxt = (const char*)TStrToStr(url);
 	return urlTxt;
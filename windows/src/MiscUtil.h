@@ -44,6 +44,8 @@ extern UINT g_errorNotifMsg;
 
 // SA == Struct Alloc
 #define SA(struct_name) (struct_name*)malloc(sizeof(struct_name))
+// SAZ == Struct Alloc Zeroed
+#define SAZ(struct_name) (struct_name*)calloc(1, sizeof(struct_name))
 
 // mark unused variables to reduce compiler warnings
 #define UNUSED_VAR( x )  (x) = (x)
@@ -86,6 +88,7 @@ bool FileOrDirExists(const TCHAR *fileName);
 
 char *FileReadAll(const TCHAR *filePath, uint64_t *fileSizeOut=NULL);
 BOOL FileWriteAll(const TCHAR *filePath, const char *buf, uint64_t bufLen);
+BOOL FileWriteAllAtomic(const TCHAR *filePath, const char *buf, uint64_t bufLen);
 CString AppDataDir();
 CString SettingsFileName();
 CString SettingsFileNameInDir(const TCHAR *dir);
@@ -116,6 +119,7 @@ const char *GetApiHost();
 const char *GetIpUpdateHost();
 const char *GetIpUpdateDnsOMaticHost();
 const char *GetIpUpdateUrl(BOOL addApiKey);
+const char *GetIpUpdateUrlForHostname(BOOL addApiKey, const char *hostname);
 bool IsApiHostHttps();
 const TCHAR *GetDashboardUrl();
 bool CanSendIPUpdates();
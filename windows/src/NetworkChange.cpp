@@ -0,0 +1,54 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "NetworkChange.h"
+
+void IpCheckScheduleInit(IpCheckSchedule *s, bool haveNotifier)
+{
+	s->lastCheckMs = 0;
+	s->intervalMs = IP_CHECK_MIN_INTERVAL_MS;
+	s->maxIntervalMs = haveNotifier ? IP_CHECK_MAX_INTERVAL_MS : IP_CHECK_MIN_INTERVAL_MS;
+	s->checkNow = true;
+}
+
+void IpCheckScheduleNetworkChanged(IpCheckSchedule *s)
+{
+	s->intervalMs = IP_CHECK_MIN_INTERVAL_MS;
+	s->checkNow = true;
+}
+
+void IpCheckScheduleForce(IpCheckSchedule *s)
+{
+	s->checkNow = true;
+}
+
+bool IpCheckScheduleDue(const IpCheckSchedule *s, DWORD nowMs)
+{
+	if (s->checkNow)
+		return true;
+	// unsigned math handles GetTickCount() wrap-around
+	return nowMs - s->lastCheckMs >= s->intervalMs;
+}
+
+DWORD IpCheckScheduleMsLeft(const IpCheckSchedule *s, DWORD nowMs)
+{
+	if (IpCheckScheduleDue(s, nowMs))
+		return 0;
+	return s->intervalMs - (nowMs - s->lastCheckMs);
+}
+
+void IpCheckScheduleChecked(IpCheckSchedule *s, DWORD nowMs, bool ipChanged)
+{
+	s->lastCheckMs = nowMs;
+	s->checkNow = false;
+	if (ipChanged) {
+		s->intervalMs = IP_CHECK_MIN_INTERVAL_MS;
+		return;
+	}
+	s->intervalMs *= 2;
+	if (s->intervalMs > s->maxIntervalMs)
+		s->intervalMs = s->maxIntervalMs;
+}
@@ -0,0 +1,74 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef NETWORK_CHANGE_H__
+#define NETWORK_CHANGE_H__
+
+/* Tells when an interface goes up or down, an address is added or removed
+or the default route changes, so that we check our ip right away instead
+of on the next poll. Backends:
+ - NotifyAddrChange() and NotifyRouteChange() on Windows
+ - FakeNetworkChangeNotifier for tests
+A backend that fails to start never reports a change and we're left with
+polling at the fastest rate, like before we had notifications.
+*/
+
+class NetworkChangeNotifier {
+public:
+	virtual ~NetworkChangeNotifier() {}
+	// Returns true if the network changed since the last call. Several
+	// changes in a row (e.g. a new address and a new default route after
+	// connecting) are reported once. Doesn't block
+	virtual bool TakeChange() = 0;
+	// false if the backend failed to start
+	virtual bool IsWorking() = 0;
+	// Signalled when the network changes, so that it can be waited for
+	// together with other handles. Stays signalled until TakeChange().
+	// NULL if the backend can't be waited on, then TakeChange() must be
+	// called periodically
+	virtual HANDLE ChangedEvent() { return NULL; }
+};
+
+// the one for this platform
+NetworkChangeNotifier *NewNetworkChangeNotifier();
+
+// changes only when told to
+class FakeNetworkChangeNotifier : public NetworkChangeNotifier {
+public:
+	FakeNetworkChangeNotifier(bool working=true) : m_changes(0), m_working(working) {}
+	virtual bool TakeChange() { return 0 != InterlockedExchange(&m_changes, 0); }
+	virtual bool IsWorking() { return m_working; }
+	void Change() { InterlockedIncrement(&m_changes); }
+private:
+	volatile LONG	m_changes;
+	bool			m_working;
+};
+
+/* When to check the ip. Right after the network changed we check at the
+fastest rate and every check that finds the same ip doubles the interval,
+up to IP_CHECK_MAX_INTERVAL_MS. We never stop polling because the public
+ip can change behind a router without anything changing locally. Without
+a working notifier we stay at the fastest rate. */
+
+#define IP_CHECK_MIN_INTERVAL_MS	(60*1000)
+#define IP_CHECK_MAX_INTERVAL_MS	(8*60*1000)
+
+typedef struct {
+	DWORD	lastCheckMs;
+	DWORD	intervalMs;
+	DWORD	maxIntervalMs;
+	bool	checkNow;
+} IpCheckSchedule;
+
+void	IpCheckScheduleInit(IpCheckSchedule *s, bool haveNotifier);
+// check right away and go back to the fastest rate
+void	IpCheckScheduleNetworkChanged(IpCheckSchedule *s);
+// check right away without changing the rate, e.g. when asked by the user
+void	IpCheckScheduleForce(IpCheckSchedule *s);
+bool	IpCheckScheduleDue(const IpCheckSchedule *s, DWORD nowMs);
+// ms until the next check is due, 0 if it's due now
+DWORD	IpCheckScheduleMsLeft(const IpCheckSchedule *s, DWORD nowMs);
+void	IpCheckScheduleChecked(IpCheckSchedule *s, DWORD nowMs, bool ipChanged);
+
+#endif
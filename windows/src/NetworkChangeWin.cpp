@@ -0,0 +1,116 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "MiscUtil.h"
+#include "NetworkChange.h"
+#include "SimpleLog.h"
+
+// how long to wait for cancelled requests to complete before giving up
+// on freeing their memory
+#define CANCEL_WAIT_MS 1000
+
+typedef BOOL (WINAPI *CancelIPChangeNotifyProc)(LPOVERLAPPED notifyOverlapped);
+
+typedef struct {
+	OVERLAPPED	addr;
+	OVERLAPPED	route;
+} ChangeRequests;
+
+// Both requests signal the same manual-reset event. When it's signalled we
+// re-arm the ones that completed.
+class WinNetworkChangeNotifier : public NetworkChangeNotifier {
+private:
+	HANDLE				m_event;
+	// CancelIPChangeNotify() is only in Vista and later. On XP the requests
+	// stay pending after we're deleted, so they and the event are leaked
+	// rather than completed into freed memory
+	ChangeRequests *	m_reqs;
+	bool				m_working;
+
+	bool Arm(OVERLAPPED *o, bool route);
+
+public:
+	WinNetworkChangeNotifier();
+	virtual ~WinNetworkChangeNotifier();
+	virtual bool TakeChange();
+	virtual bool IsWorking() { return m_working; }
+	virtual HANDLE ChangedEvent() { return m_working ? m_event : NULL; }
+};
+
+static CancelIPChangeNotifyProc GetCancelProc()
+{
+	HMODULE dll = GetModuleHandle(_T("iphlpapi.dll"));
+	if (!dll)
+		return NULL;
+	return (CancelIPChangeNotifyProc)GetProcAddress(dll, "CancelIPChangeNotify");
+}
+
+WinNetworkChangeNotifier::WinNetworkChangeNotifier()
+{
+	m_working = false;
+	m_reqs = SAZ(ChangeRequests);
+	m_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!m_reqs || !m_event)
+		goto Error;
+	if (!Arm(&m_reqs->addr, false) || !Arm(&m_reqs->route, true))
+		goto Error;
+	m_working = true;
+	return;
+Error:
+	slog("WinNetworkChangeNotifier: failed to start, polling for ip changes\n");
+}
+
+WinNetworkChangeNotifier::~WinNetworkChangeNotifier()
+{
+	CancelIPChangeNotifyProc cancel = GetCancelProc();
+	if (!cancel || !m_reqs)
+		return;
+	cancel(&m_reqs->addr);
+	cancel(&m_reqs->route);
+	DWORD startMs = GetTickCount();
+	while (!HasOverlappedIoCompleted(&m_reqs->addr) || !HasOverlappedIoCompleted(&m_reqs->route)) {
+		if (GetTickCount() - startMs > CANCEL_WAIT_MS)
+			return;
+		Sleep(10);
+	}
+	free(m_reqs);
+	if (m_event)
+		CloseHandle(m_event);
+}
+
+bool WinNetworkChangeNotifier::Arm(OVERLAPPED *o, bool route)
+{
+	memzero(o, sizeof(*o));
+	o->hEvent = m_event;
+	// we don't need the handle, it's only for waiting on it without an
+	// OVERLAPPED and mustn't be closed
+	HANDLE h;
+	DWORD err = route ? NotifyRouteChange(&h, o) : NotifyAddrChange(&h, o);
+	if (ERROR_IO_PENDING == err)
+		return true;
+	slogfmt("WinNetworkChangeNotifier: Notify%sChange() failed with %d\n", route ? "Route" : "Addr", (int)err);
+	return false;
+}
+
+bool WinNetworkChangeNotifier::TakeChange()
+{
+	if (!m_working)
+		return false;
+	if (WAIT_OBJECT_0 != WaitForSingleObject(m_event, 0))
+		return false;
+	// a request that completes after this signals the event again
+	ResetEvent(m_event);
+	if (HasOverlappedIoCompleted(&m_reqs->addr))
+		m_working = Arm(&m_reqs->addr, false);
+	if (m_working && HasOverlappedIoCompleted(&m_reqs->route))
+		m_working = Arm(&m_reqs->route, true);
+	return true;
+}
+
+NetworkChangeNotifier *NewNetworkChangeNotifier()
+{
+	return new WinNetworkChangeNotifier();
+}
@@ -0,0 +1,91 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "NetworkChange.h"
+
+#include "UnitTests.h"
+
+static void network_change_fake_ut()
+{
+	FakeNetworkChangeNotifier n;
+	utassert(n.IsWorking());
+	utassert(NULL == n.ChangedEvent());
+	bool changed = n.TakeChange();
+	utassert(!changed);
+	// changes in a row are reported once
+	n.Change();
+	n.Change();
+	changed = n.TakeChange();
+	utassert(changed);
+	changed = n.TakeChange();
+	utassert(!changed);
+}
+
+static void ip_check_schedule_backoff_ut()
+{
+	IpCheckSchedule s;
+	IpCheckScheduleInit(&s, true);
+	DWORD now = 1000;
+	// we check right away after starting
+	utassert(IpCheckScheduleDue(&s, now));
+	IpCheckScheduleChecked(&s, now, true);
+	utassert(!IpCheckScheduleDue(&s, now + IP_CHECK_MIN_INTERVAL_MS - 1));
+	utassert(IpCheckScheduleDue(&s, now + IP_CHECK_MIN_INTERVAL_MS));
+	utassert(IP_CHECK_MIN_INTERVAL_MS - 10 == IpCheckScheduleMsLeft(&s, now + 10));
+	utassert(0 == IpCheckScheduleMsLeft(&s, now + IP_CHECK_MIN_INTERVAL_MS + 10));
+
+	// nothing changes, so we check less and less often
+	DWORD expected = IP_CHECK_MIN_INTERVAL_MS;
+	for (int i=0; i < 8; i++) {
+		now += expected;
+		utassert(IpCheckScheduleDue(&s, now));
+		IpCheckScheduleChecked(&s, now, false);
+		expected *= 2;
+		if (expected > IP_CHECK_MAX_INTERVAL_MS)
+			expected = IP_CHECK_MAX_INTERVAL_MS;
+		utassert(expected == s.intervalMs);
+		utassert(!IpCheckScheduleDue(&s, now + expected - 1));
+	}
+	utassert(IP_CHECK_MAX_INTERVAL_MS == s.intervalMs);
+
+	// a network change means checking now and at the fastest rate again
+	IpCheckScheduleNetworkChanged(&s);
+	utassert(IpCheckScheduleDue(&s, now + 1));
+	IpCheckScheduleChecked(&s, now + 1, false);
+	utassert(2 * IP_CHECK_MIN_INTERVAL_MS == s.intervalMs);
+
+	// forcing a check doesn't change the rate
+	IpCheckScheduleForce(&s);
+	utassert(IpCheckScheduleDue(&s, now + 2));
+	utassert(2 * IP_CHECK_MIN_INTERVAL_MS == s.intervalMs);
+
+	// a check that finds a new ip goes back to the fastest rate
+	IpCheckScheduleChecked(&s, now + 2, true);
+	utassert(IP_CHECK_MIN_INTERVAL_MS == s.intervalMs);
+
+	// GetTickCount() wraps around
+	IpCheckScheduleChecked(&s, (DWORD)-1000, true);
+	utassert(!IpCheckScheduleDue(&s, 1000));
+	utassert(IpCheckScheduleDue(&s, IP_CHECK_MIN_INTERVAL_MS));
+}
+
+// without notifications polling is all we have, so it doesn't back off
+static void ip_check_schedule_no_notifier_ut()
+{
+	IpCheckSchedule s;
+	IpCheckScheduleInit(&s, false);
+	IpCheckScheduleChecked(&s, 0, false);
+	IpCheckScheduleChecked(&s, IP_CHECK_MIN_INTERVAL_MS, false);
+	utassert(IP_CHECK_MIN_INTERVAL_MS == s.intervalMs);
+	utassert(IpCheckScheduleDue(&s, 2 * IP_CHECK_MIN_INTERVAL_MS));
+}
+
+void network_change_ut_all()
+{
+	network_change_fake_ut();
+	ip_check_schedule_backoff_ut();
+	ip_check_schedule_no_notifier_ut();
+}
@@ -0,0 +1,351 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include <sddl.h>
+
+#include "NetworkOwner.h"
+#include "MiscUtil.h"
+#include "SimpleLog.h"
+
+// The service runs as LocalSystem and creates the shared memory, the ui
+// runs as a regular user and must be able to open it. Logged in users get
+// read, write and synchronize (GENERIC_READ | GENERIC_WRITE | SYNCHRONIZE)
+// and nothing else, so they can't change the dacl or the owner
+#define SHARED_STATE_SDDL "D:(A;;GA;;;SY)(A;;0xc0100000;;;IU)(A;;0xc0100000;;;AU)"
+
+bool NetworkOwnerLeaseTick(NetworkOwnerLease *lease, DWORD myPid, NetworkOwnerKind myKind, DWORD nowMs)
+{
+	bool mine = (lease->ownerPid == myPid);
+	// GetTickCount() wraps around every 49.7 days so compare the difference
+	bool expired = (0 == lease->ownerPid) || ((LONG)(nowMs - lease->leaseExpiresMs) >= 0);
+	// there's only one service, if it sees someone else's lease, it's
+	// either the ui or a previous, dead instance of the service
+	bool preempt = (NetworkOwnerService == myKind);
+	if (!mine && !expired && !preempt)
+		return false;
+
+	lease->ownerPid = myPid;
+	lease->ownerKind = myKind;
+	lease->leaseExpiresMs = nowMs + NETWORK_OWNER_LEASE_MS;
+	return true;
+}
+
+void NetworkOwnerLeaseRelease(NetworkOwnerLease *lease, DWORD myPid)
+{
+	if (lease->ownerPid != myPid)
+		return;
+	memzero(lease, sizeof(*lease));
+}
+
+bool NetworkOwnerHeartbeat(ServiceStateData *d, DWORD myPid, NetworkOwnerKind myKind, bool readsEvents, DWORD nowMs)
+{
+	bool owner = NetworkOwnerLeaseTick(&d->owner, myPid, myKind, nowMs);
+	if (readsEvents && !owner)
+		ServiceEventsMarkConsumer(&d->events, nowMs);
+	return owner;
+}
+
+NetworkOwner::NetworkOwner(NetworkOwnerKind kind) :
+	m_kind(kind),
+	m_pid(GetCurrentProcessId()),
+	m_shared(NULL),
+	m_sd(NULL),
+	m_heartbeatThread(NULL),
+	m_stopEvent(NULL),
+	m_ownerChangedEvent(NULL),
+	m_hasLease(0),
+	m_readsEvents(0),
+	m_isOwner(false),
+	m_wasOwner(false),
+	m_lastSeenSeq(0),
+	m_lastOpenTryMs(0)
+{
+	memzero(&m_eventCursor, sizeof(m_eventCursor));
+	// without it the objects get the default dacl, which doesn't let the
+	// ui open them, so it does the network work on its own
+	if ((NetworkOwnerService == m_kind) && !ConvertStringSecurityDescriptorToSecurityDescriptorA(
+			SHARED_STATE_SDDL, SDDL_REVISION_1, &m_sd, NULL)) {
+		slogfmt("NetworkOwner(): ConvertStringSecurityDescriptorToSecurityDescriptor() failed with %d\n", (int)GetLastError());
+		m_sd = NULL;
+	}
+	m_sa.nLength = sizeof(m_sa);
+	m_sa.lpSecurityDescriptor = m_sd;
+	m_sa.bInheritHandle = FALSE;
+	OpenSharedState();
+}
+
+NetworkOwner::~NetworkOwner()
+{
+	if (m_heartbeatThread) {
+		SetEvent(m_stopEvent);
+		WaitForSingleObject(m_heartbeatThread, INFINITE);
+		CloseHandle(m_heartbeatThread);
+	}
+	if (m_stopEvent)
+		CloseHandle(m_stopEvent);
+	if (m_ownerChangedEvent)
+		CloseHandle(m_ownerChangedEvent);
+	if (m_shared) {
+		SharedMemAutoLock lock(m_shared);
+		NetworkOwnerLeaseRelease(&m_shared->GetData()->owner, m_pid);
+	}
+	delete m_shared;
+	if (m_sd)
+		LocalFree(m_sd);
+}
+
+void NetworkOwner::OpenSharedState()
+{
+	m_lastOpenTryMs = GetTickCount();
+	// creating objects in Global\ namespace requires SeCreateGlobalPrivilege,
+	// which only the service has
+	if (NetworkOwnerService == m_kind)
+		m_shared = ServiceStateSharedData::Create(&m_sa);
+	else
+		m_shared = ServiceStateSharedData::Open();
+	if (!m_shared)
+		return;
+	// versions are even, so the first ReadState() reads the state
+	m_lastSeenSeq = (DWORD)-1;
+	ServiceEventCursorInit(&m_eventCursor, &m_shared->GetData()->events);
+
+	m_ownerChangedEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+	m_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!m_ownerChangedEvent || !m_stopEvent)
+		goto Error;
+	RenewLease();
+	m_heartbeatThread = CreateThread(NULL, 0, HeartbeatThread, this, 0, NULL);
+	if (m_heartbeatThread)
+		return;
+Error:
+	// without a heartbeat we'd lose the lease all the time
+	if (m_ownerChangedEvent)
+		CloseHandle(m_ownerChangedEvent);
+	m_ownerChangedEvent = NULL;
+	if (m_stopEvent)
+		CloseHandle(m_stopEvent);
+	m_stopEvent = NULL;
+	delete m_shared;
+	m_shared = NULL;
+}
+
+void NetworkOwner::RenewLease()
+{
+	SharedMemAutoLock lock(m_shared);
+	bool owner = NetworkOwnerHeartbeat(m_shared->GetData(), m_pid, m_kind, 0 != m_readsEvents, GetTickCount());
+	LONG hadLease = InterlockedExchange(&m_hasLease, owner ? 1 : 0);
+	if ((0 != hadLease) != owner)
+		SetEvent(m_ownerChangedEvent);
+}
+
+DWORD WINAPI NetworkOwner::HeartbeatThread(LPVOID param)
+{
+	NetworkOwner *self = (NetworkOwner*)param;
+	for (;;) {
+		DWORD res = WaitForSingleObject(self->m_stopEvent, NETWORK_OWNER_HEARTBEAT_MS);
+		if (WAIT_TIMEOUT != res)
+			break;
+		self->RenewLease();
+	}
+	return 0;
+}
+
+bool NetworkOwner::Tick()
+{
+	m_wasOwner = m_isOwner;
+	if (!m_shared && (GetTickCount() - m_lastOpenTryMs >= NETWORK_OWNER_REOPEN_MS))
+		OpenSharedState();
+
+	if (!m_shared) {
+		// the service isn't running, so there's no-one to share with
+		m_isOwner = true;
+		return true;
+	}
+	m_isOwner = (0 != m_hasLease);
+	return m_isOwner;
+}
+
+void NetworkOwner::PublishIp(IP4_ADDRESS ip)
+{
+	if (!m_shared)
+		return;
+	SharedMemAutoLock lock(m_shared);
+	ServiceStateData *d = m_shared->GetData();
+	if (d->currentIpAddress == ip)
+		return;
+	{
+		SeqLockWriteGuard write(&d->stateSeq);
+		d->currentIpAddress = ip;
+	}
+	PublishEventLocked(ServiceEventIpChanged, ip, 0, NULL);
+}
+
+static void CopyTruncated(char *dst, size_t dstSize, const char *src)
+{
+	size_t len = src ? strlen(src) : 0;
+	if (len >= dstSize)
+		len = dstSize - 1;
+	if (len > 0)
+		memcpy(dst, src, len);
+	dst[len] = 0;
+}
+
+void NetworkOwner::PublishIpUpdateResult(const char *resp, DWORD latencyMs)
+{
+	if (!m_shared)
+		return;
+	SharedMemAutoLock lock(m_shared);
+	ServiceStateData *d = m_shared->GetData();
+	{
+		SeqLockWriteGuard write(&d->stateSeq);
+		// a response is a single short line, truncating is fine
+		CopyTruncated(d->lastIpUpdateResult, dimof(d->lastIpUpdateResult), resp);
+		d->lastIpUpdateTickMs = GetTickCount();
+	}
+	PublishEventLocked(ServiceEventIpUpdate, 0, latencyMs, resp);
+}
+
+// The lease makes the owner the only producer, but during a failover the
+// old and the new owner might briefly overlap. Holding the mutex while
+// publishing keeps them from writing the same slot. Readers don't take it
+void NetworkOwner::PublishEventLocked(ServiceEventType type, IP4_ADDRESS ip, DWORD latencyMs, const char *text)
+{
+	ServiceEvent ev;
+	memzero(&ev, sizeof(ev));
+	ev.type = type;
+	ev.tickMs = GetTickCount();
+	ev.ip = ip;
+	ev.latencyMs = latencyMs;
+	CopyTruncated(ev.text, dimof(ev.text), text);
+	ServiceEventPublish(&m_shared->GetData()->events, &ev);
+	m_shared->SetResponseEvent();
+}
+
+void NetworkOwner::PublishEvent(ServiceEventType type, IP4_ADDRESS ip, DWORD latencyMs, const char *text)
+{
+	if (!m_shared)
+		return;
+	SharedMemAutoLock lock(m_shared);
+	PublishEventLocked(type, ip, latencyMs, text);
+}
+
+void NetworkOwner::PublishNewVersion(const char *url)
+{
+	if (!m_shared)
+		return;
+	// a truncated url is no use to anyone
+	if (strlen(url) >= NEW_VERSION_URL_MAX) {
+		slogfmt("NetworkOwner::PublishNewVersion(): url too long: %s\n", url);
+		return;
+	}
+	SharedMemAutoLock lock(m_shared);
+	ServiceStateData *d = m_shared->GetData();
+	{
+		SeqLockWriteGuard write(&d->stateSeq);
+		CopyTruncated(d->newVersionUrl, dimof(d->newVersionUrl), url);
+	}
+	PublishEventLocked(ServiceEventNewVersion, 0, 0, NULL);
+}
+
+bool NetworkOwner::HasEventConsumer()
+{
+	if (!m_shared)
+		return false;
+	return ServiceEventsHaveConsumer(&m_shared->GetData()->events, GetTickCount());
+}
+
+bool NetworkOwner::TakeIpUpdateRequest()
+{
+	if (!m_shared)
+		return false;
+	return 0 != InterlockedExchange(&m_shared->GetData()->ipUpdateRequested, 0);
+}
+
+HANDLE NetworkOwner::RequestEvent()
+{
+	if (!m_shared)
+		return NULL;
+	return m_shared->m_requestEvent;
+}
+
+bool NetworkOwner::ReadState(NetworkOwnerState *stateOut)
+{
+	if (!m_shared)
+		return false;
+	// doesn't take the mutex, so a slow owner doesn't block us and we
+	// don't slow down the owner
+	ServiceStateData *d = m_shared->GetData();
+	LONG seq;
+	do {
+		if (!SeqLockReadBegin(&d->stateSeq, &seq))
+			return false;
+		if ((DWORD)seq == m_lastSeenSeq)
+			return false;
+		stateOut->currentIpAddress = d->currentIpAddress;
+		stateOut->lastIpUpdateTickMs = d->lastIpUpdateTickMs;
+		memcpy(stateOut->lastIpUpdateResult, d->lastIpUpdateResult, sizeof(stateOut->lastIpUpdateResult));
+	} while (!SeqLockReadValid(&d->stateSeq, seq));
+	m_lastSeenSeq = (DWORD)seq;
+	stateOut->lastIpUpdateResult[dimof(stateOut->lastIpUpdateResult) - 1] = 0;
+	return true;
+}
+
+bool NetworkOwner::ReadNewVersionUrl(char *urlOut, size_t urlOutSize)
+{
+	if (!m_shared || (urlOutSize < NEW_VERSION_URL_MAX))
+		return false;
+	ServiceStateData *d = m_shared->GetData();
+	LONG seq;
+	do {
+		if (!SeqLockReadBegin(&d->stateSeq, &seq))
+			return false;
+		memcpy(urlOut, d->newVersionUrl, NEW_VERSION_URL_MAX);
+	} while (!SeqLockReadValid(&d->stateSeq, seq));
+	urlOut[NEW_VERSION_URL_MAX - 1] = 0;
+	return 0 != *urlOut;
+}
+
+bool NetworkOwner::ReadEvent(ServiceEvent *evOut)
+{
+	if (!m_shared)
+		return false;
+	ServiceEventRing *r = &m_shared->GetData()->events;
+	// the heartbeat thread keeps marking us from now on
+	if (!m_readsEvents) {
+		InterlockedExchange(&m_readsEvents, 1);
+		ServiceEventsMarkConsumer(r, GetTickCount());
+	}
+	return ServiceEventRead(r, &m_eventCursor, evOut);
+}
+
+void NetworkOwner::SkipEvents()
+{
+	if (!m_shared)
+		return;
+	ServiceEventCursorInit(&m_eventCursor, &m_shared->GetData()->events);
+}
+
+bool NetworkOwner::TakeEventsLost()
+{
+	bool lost = (0 != m_eventCursor.lost);
+	m_eventCursor.lost = 0;
+	return lost;
+}
+
+HANDLE NetworkOwner::EventPublishedEvent()
+{
+	if (!m_shared)
+		return NULL;
+	return m_shared->m_responseEvent;
+}
+
+void NetworkOwner::RequestIpUpdate()
+{
+	if (!m_shared)
+		return;
+	InterlockedExchange(&m_shared->GetData()->ipUpdateRequested, 1);
+	m_shared->SetRequestEvent();
+}
@@ -0,0 +1,139 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef NETWORK_OWNER_H__
+#define NETWORK_OWNER_H__
+
+#include "SharedData.h"
+#include "ServiceEvents.h"
+
+/* Only one process on the machine should resolve myip.opendns.com, send
+ip updates and check for new versions. That process is the network owner.
+It holds a lease in ServiceStateData, renews it every
+NETWORK_OWNER_HEARTBEAT_MS from a separate thread (so that a slow http
+request doesn't make it look dead) and publishes its results there. Other
+processes only read published state and events (see ServiceEvents.h).
+
+The service always takes ownership, the ui only does when no-one else
+holds a valid lease, or when the service isn't running at all. If the owner
+dies without releasing the lease, someone else takes over after
+NETWORK_OWNER_LEASE_MS. The heartbeat thread signals OwnerChangedEvent()
+when that happens, so the thread doing the work doesn't have to wake up
+to check.
+*/
+
+enum NetworkOwnerKind {
+	NetworkOwnerNone = 0,
+	NetworkOwnerService = 1,
+	NetworkOwnerUI = 2
+};
+
+#define NETWORK_OWNER_HEARTBEAT_MS	1000
+#define NETWORK_OWNER_LEASE_MS		(5*1000)
+// without shared state (the service isn't running) Tick() tries to open
+// it again no more often than that
+#define NETWORK_OWNER_REOPEN_MS		(60*1000)
+
+// Takes or renews the lease for <myPid> at time <nowMs> (GetTickCount()).
+// Returns true if <myPid> is the owner afterwards
+bool NetworkOwnerLeaseTick(NetworkOwnerLease *lease, DWORD myPid, NetworkOwnerKind myKind, DWORD nowMs);
+void NetworkOwnerLeaseRelease(NetworkOwnerLease *lease, DWORD myPid);
+// What the heartbeat thread does every NETWORK_OWNER_HEARTBEAT_MS: renews
+// the lease and, if <myPid> reads events and isn't the owner, marks it as
+// a consumer. It may read events a lot less often than
+// SERVICE_EVENTS_CONSUMER_TIMEOUT_MS and still counts as listening.
+// Returns true if <myPid> is the owner afterwards
+bool NetworkOwnerHeartbeat(ServiceStateData *d, DWORD myPid, NetworkOwnerKind myKind, bool readsEvents, DWORD nowMs);
+
+// What the owner publishes for others
+typedef struct {
+	IP4_ADDRESS	currentIpAddress;
+	// GetTickCount() time of the last ip update, 0 if none was sent
+	DWORD		lastIpUpdateTickMs;
+	char		lastIpUpdateResult[IP_UPDATE_RESULT_MAX];
+} NetworkOwnerState;
+
+// Not thread-safe, meant to be used from one thread that calls Tick()
+// before doing network work
+class NetworkOwner
+{
+public:
+	explicit NetworkOwner(NetworkOwnerKind kind);
+	// gives up the lease so that failover is immediate
+	~NetworkOwner();
+
+	// returns IsOwner()
+	bool Tick();
+	bool IsOwner() const { return m_isOwner; }
+	// true if we became the owner in the last Tick()
+	bool BecameOwner() const { return m_isOwner && !m_wasOwner; }
+	// false if the service isn't running, we're the owner then and
+	// Tick() has to be called every NETWORK_OWNER_REOPEN_MS to notice
+	// when it starts
+	bool HasSharedState() const { return NULL != m_shared; }
+	// signalled when we get or lose the lease, Tick() tells which. NULL
+	// if there's no shared state
+	HANDLE OwnerChangedEvent() const { return m_ownerChangedEvent; }
+
+	// for the owner
+	void PublishIp(IP4_ADDRESS ip);
+	void PublishIpUpdateResult(const char *resp, DWORD latencyMs=0);
+	void PublishEvent(ServiceEventType type, IP4_ADDRESS ip, DWORD latencyMs, const char *text);
+	// publishes <url> in the state and a ServiceEventNewVersion event
+	void PublishNewVersion(const char *url);
+	// true if another process reads events and its heartbeat is running,
+	// so it will learn about what we publish
+	bool HasEventConsumer();
+	// returns true once for every RequestIpUpdate() from another process
+	bool TakeIpUpdateRequest();
+	// signalled on RequestIpUpdate(), NULL if there's no shared state
+	HANDLE RequestEvent();
+
+	// for others. Returns false if nothing changed since the last call.
+	// Doesn't lock, reads a consistent snapshot with the seqlock
+	bool ReadState(NetworkOwnerState *stateOut);
+	// the url of the new version the owner found, false if it didn't find
+	// one. Doesn't lock
+	bool ReadNewVersionUrl(char *urlOut, size_t urlOutSize);
+	// asks the owner to send an ip update now
+	void RequestIpUpdate();
+	// Returns false if there are no new events. Doesn't lock. From the
+	// first call on, we're a consumer for as long as we exist
+	bool ReadEvent(ServiceEvent *evOut);
+	// forget events published so far, e.g. those we published as the owner
+	void SkipEvents();
+	// true if events were lost (we didn't read them in time) since the
+	// last call. ReadState() has the latest state then
+	bool TakeEventsLost();
+	// signalled when the owner publishes an event, NULL if there's no
+	// shared state. It's auto-reset, so with several consumers only one
+	// wakes up, the others read events on their next timeout
+	HANDLE EventPublishedEvent();
+
+private:
+	void OpenSharedState();
+	void RenewLease();
+	void PublishEventLocked(ServiceEventType type, IP4_ADDRESS ip, DWORD latencyMs, const char *text);
+	static DWORD WINAPI HeartbeatThread(LPVOID param);
+
+	NetworkOwnerKind		m_kind;
+	DWORD					m_pid;
+	ServiceStateSharedData *m_shared;
+	SECURITY_ATTRIBUTES		m_sa;
+	PSECURITY_DESCRIPTOR	m_sd;
+	HANDLE					m_heartbeatThread;
+	HANDLE					m_stopEvent;
+	HANDLE					m_ownerChangedEvent;
+	// set by the heartbeat thread
+	volatile LONG			m_hasLease;
+	// set by ReadEvent(), read by the heartbeat thread
+	volatile LONG			m_readsEvents;
+	bool					m_isOwner;
+	bool					m_wasOwner;
+	DWORD					m_lastSeenSeq;
+	ServiceEventCursor		m_eventCursor;
+	DWORD					m_lastOpenTryMs;
+};
+
+#endif
@@ -0,0 +1,132 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "NetworkOwner.h"
+#include "MiscUtil.h"
+
+#include "UnitTests.h"
+
+static const DWORD SERVICE_PID = 100;
+static const DWORD UI_PID = 200;
+static const DWORD UI2_PID = 300;
+
+static void lease_take_and_renew_ut()
+{
+	NetworkOwnerLease lease;
+	memzero(&lease, sizeof(lease));
+	bool owner;
+
+	// no owner, anyone can take it
+	owner = NetworkOwnerLeaseTick(&lease, UI_PID, NetworkOwnerUI, 1000);
+	utassert(owner);
+	utassert(UI_PID == lease.ownerPid);
+	utassert(NetworkOwnerUI == lease.ownerKind);
+	utassert(1000 + NETWORK_OWNER_LEASE_MS == lease.leaseExpiresMs);
+
+	// renewing extends the lease
+	owner = NetworkOwnerLeaseTick(&lease, UI_PID, NetworkOwnerUI, 2000);
+	utassert(owner);
+	utassert(2000 + NETWORK_OWNER_LEASE_MS == lease.leaseExpiresMs);
+
+	// another ui can't take a valid lease
+	owner = NetworkOwnerLeaseTick(&lease, UI2_PID, NetworkOwnerUI, 3000);
+	utassert(!owner);
+	utassert(UI_PID == lease.ownerPid);
+
+	// but can when the owner stops renewing it
+	owner = NetworkOwnerLeaseTick(&lease, UI2_PID, NetworkOwnerUI, 2000 + NETWORK_OWNER_LEASE_MS);
+	utassert(owner);
+	utassert(UI2_PID == lease.ownerPid);
+}
+
+static void lease_service_preempts_ut()
+{
+	NetworkOwnerLease lease;
+	memzero(&lease, sizeof(lease));
+	bool owner;
+
+	owner = NetworkOwnerLeaseTick(&lease, UI_PID, NetworkOwnerUI, 1000);
+	utassert(owner);
+	owner = NetworkOwnerLeaseTick(&lease, SERVICE_PID, NetworkOwnerService, 1500);
+	utassert(owner);
+	utassert(SERVICE_PID == lease.ownerPid);
+	utassert(NetworkOwnerService == lease.ownerKind);
+
+	// the ui becomes a consumer on its next heartbeat
+	owner = NetworkOwnerLeaseTick(&lease, UI_PID, NetworkOwnerUI, 2000);
+	utassert(!owner);
+	utassert(SERVICE_PID == lease.ownerPid);
+
+	// releasing someone else's lease does nothing
+	NetworkOwnerLeaseRelease(&lease, UI_PID);
+	utassert(SERVICE_PID == lease.ownerPid);
+
+	// the ui takes over right away after the service releases it
+	NetworkOwnerLeaseRelease(&lease, SERVICE_PID);
+	utassert(0 == lease.ownerPid);
+	owner = NetworkOwnerLeaseTick(&lease, UI_PID, NetworkOwnerUI, 2100);
+	utassert(owner);
+}
+
+static void lease_tick_wraparound_ut()
+{
+	NetworkOwnerLease lease;
+	memzero(&lease, sizeof(lease));
+	bool owner;
+
+	// GetTickCount() wraps around while the lease is valid
+	DWORD now = 0xffffffff - 1000;
+	owner = NetworkOwnerLeaseTick(&lease, UI_PID, NetworkOwnerUI, now);
+	utassert(owner);
+	utassert(lease.leaseExpiresMs < now);
+	owner = NetworkOwnerLeaseTick(&lease, UI2_PID, NetworkOwnerUI, now + 2000);
+	utassert(!owner);
+	owner = NetworkOwnerLeaseTick(&lease, UI2_PID, NetworkOwnerUI, now + NETWORK_OWNER_LEASE_MS);
+	utassert(owner);
+}
+
+// The ui reads events when it's woken up, which can be a lot less often
+// than SERVICE_EVENTS_CONSUMER_TIMEOUT_MS, but it's listening as long as
+// its heartbeat runs
+static void heartbeat_marks_consumer_ut()
+{
+	ServiceStateData *d = SAZ(ServiceStateData);
+	if (!d)
+		return;
+	DWORD now = 1000;
+	bool owner = NetworkOwnerHeartbeat(d, SERVICE_PID, NetworkOwnerService, false, now);
+	utassert(owner);
+	// a ui that doesn't read events isn't a consumer
+	owner = NetworkOwnerHeartbeat(d, UI_PID, NetworkOwnerUI, false, now);
+	utassert(!owner);
+	utassert(!ServiceEventsHaveConsumer(&d->events, now));
+
+	// it reads events once and then only heartbeats
+	ServiceEventsMarkConsumer(&d->events, now);
+	bool listening = true;
+	for (DWORD ms = 0; ms < 20 * SERVICE_EVENTS_CONSUMER_TIMEOUT_MS; ms += NETWORK_OWNER_HEARTBEAT_MS) {
+		now += NETWORK_OWNER_HEARTBEAT_MS;
+		NetworkOwnerHeartbeat(d, SERVICE_PID, NetworkOwnerService, false, now);
+		NetworkOwnerHeartbeat(d, UI_PID, NetworkOwnerUI, true, now);
+		if (!ServiceEventsHaveConsumer(&d->events, now))
+			listening = false;
+	}
+	utassert(listening);
+
+	// the ui exits
+	now += SERVICE_EVENTS_CONSUMER_TIMEOUT_MS;
+	NetworkOwnerHeartbeat(d, SERVICE_PID, NetworkOwnerService, false, now);
+	utassert(!ServiceEventsHaveConsumer(&d->events, now));
+	free(d);
+}
+
+void network_owner_ut_all()
+{
+	lease_take_and_renew_ut();
+	lease_service_preempts_ut();
+	lease_tick_wraparound_ut();
+	heartbeat_marks_consumer_ut();
+}
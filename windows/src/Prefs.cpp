@@ -8,10 +8,11 @@
 #include "StrUtil.h"
 #include "MiscUtil.h"
 #include "JsonParser.h"
+#include "MemArena.h"
 #include "yajl_gen.h"
 
 /* every preference can be accessed as g_${name} global */
-#define M(PREF_NAME, PREF_DEFAULT_VALUE, IS_OBSCURED) \
+#define M(PREF_NAME, PREF_DEFAULT_VALUE, IS_OBSCURED, PREF_TYPE) \
 char* g_pref_##PREF_NAME;
 
 PREFS_DEF(M)
@@ -19,10 +20,10 @@ PREFS_DEF(M)
 #undef M
 
 /* define preferences array */
-#define M(PREF_NAME, PREF_DEFAULT_VALUE, IS_OBSCURED) \
-{ #PREF_NAME, &g_pref_##PREF_NAME, PREF_DEFAULT_VALUE, IS_OBSCURED },
+#define M(PREF_NAME, PREF_DEFAULT_VALUE, IS_OBSCURED, PREF_TYPE) \
+{ #PREF_NAME, &g_pref_##PREF_NAME, PREF_DEFAULT_VALUE, IS_OBSCURED, PrefType##PREF_TYPE },
 
-Prefs g_prefs[] = {
+Prefs g_prefs[PREFS_COUNT] = {
 	PREFS_DEF(M)
 };
 
@@ -38,9 +39,43 @@ static char *DupPrefValue(char *value, bool obscured)
 		return strdup(value);
 }
 
+static bool PrefsSorted()
+{
+	for (int i=1; i < dimof(g_prefs); i++) {
+		if (strcmp(g_prefs[i-1].name, g_prefs[i].name) >= 0)
+			return false;
+	}
+	return true;
+}
+
+// returns -1 if <name> isn't a pref
+static int PrefIdByName(const char *name)
+{
+	int lo = 0;
+	int hi = dimof(g_prefs) - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		int cmp = strcmp(name, g_prefs[mid].name);
+		if (0 == cmp)
+			return mid;
+		if (cmp < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+	return -1;
+}
+
+static void PrefUpdateTyped(Prefs *p)
+{
+	if (PrefTypeBool == p->type)
+		p->boolVal = !streq("0", *(p->value));
+}
+
 static bool PrefsLoad(const TCHAR *prefsFileName)
 {
 	ASSERT_RUN_ONCE();
+	assert(PrefsSorted());
 	char *prefsAsJsonTxt = FileReadAll(prefsFileName);
 	// if failed to read, pretend it's an empty hash
 	// so that we go through the loop below that
@@ -48,32 +83,39 @@ static bool PrefsLoad(const TCHAR *prefsFileName)
 	if (!prefsAsJsonTxt)
 		prefsAsJsonTxt = strdup("{}");
 
-	JsonEl *json = ParseJsonToDoc(prefsAsJsonTxt);
+	// the values are copied below, so the document can go all at once
+	MemArena arena;
+	JsonEl *json = ParseJsonToDoc(prefsAsJsonTxt, &arena);
 	assert(json);
 	if (!json) {
 		free(prefsAsJsonTxt);
 		return false;
 	}
 
-	// TODO: linear search is inefficient, but given small amount of data,
-	// we don't care. Could be improved by sorting map values by keys
-	// upon reading and doing a binary search or making it a real
-	// hash table
+	// prefs are top-level keys, so one pass over them puts each value
+	// in its slot. Unknown keys (e.g. of prefs we no longer have) are
+	// ignored
+	char *values[PREFS_COUNT] = { 0 };
+	JsonElMap *map = JsonElAsMap(json);
+	for (JsonElMapData *d = map ? map->firstVal : NULL; d; d = d->next) {
+		int id = PrefIdByName(d->key);
+		if ((-1 != id) && !values[id])
+			values[id] = JsonElAsStringVal(d->val);
+	}
+
 	for (int i=0; i < dimof(g_prefs); i++) {
 		Prefs *p = &(g_prefs[i]);
-		char * name = p->name;
-		char * value = *(p->value);
-		assert(!value);
-		JsonEl *valueEl = GetMapElByName(json, name);
-		value = JsonElAsStringVal(valueEl);
+		assert(!*(p->value));
+		char *value = values[i];
 		if (!value)
 			value = p->defaultValue;
 		value = DupPrefValue(value, p->obscured);
 		*(p->value) = value;
+		StrSetCopy(&p->savedValue, value);
+		PrefUpdateTyped(p);
 	}
 
 	free(prefsAsJsonTxt);
-	JsonElFree(json);
 	return true;
 }
 
@@ -84,6 +126,16 @@ static bool IsPrefValEq(const char *s1, const char *s2)
 	return streq(s1, s2);
 }
 
+bool PreferencesChanged()
+{
+	for (int i=0; i < dimof(g_prefs); i++) {
+		Prefs *p = &(g_prefs[i]);
+		if (!IsPrefValEq(*(p->value), p->savedValue))
+			return true;
+	}
+	return false;
+}
+
 static void PrefsSave(const TCHAR *fileName)
 {
 	const char *buf = NULL;
@@ -135,7 +187,13 @@ static void PrefsSave(const TCHAR *fileName)
 	if (yajl_gen_status_ok != status)
 		goto Error;
 
-	FileWriteAll(fileName, buf, bufLen);
+	// if it fails, prefs stay changed and we'll try again on next save
+	if (FileWriteAllAtomic(fileName, buf, bufLen)) {
+		for (int i=0; i < dimof(g_prefs); i++) {
+			Prefs *p = &(g_prefs[i]);
+			StrSetCopy(&p->savedValue, *(p->value));
+		}
+	}
 Exit:
 	if (h)
 		yajl_gen_free(h);
@@ -153,6 +211,8 @@ void PreferencesFree()
 		Prefs *p = &(g_prefs[i]);
 		char * value = *(p->value);
 		free(value);
+		free(p->savedValue);
+		p->savedValue = NULL;
 		p->value = reinterpret_cast<char**>(-1); /* so that we crash trying to access it */
 	}
 }
@@ -195,9 +255,19 @@ void PreferencesLoadFromDir(const TCHAR *dir)
 
 void PreferencesSave()
 {
+	if (!PreferencesChanged())
+		return;
 	PrefsSave(SettingsFileName());
 }
 
+void SetPrefBool(PrefId id, BOOL val)
+{
+	Prefs *p = &(g_prefs[id]);
+	assert(PrefTypeBool == p->type);
+	SetPrefVal(p->value, val ? "1" : "0");
+	PrefUpdateTyped(p);
+}
+
 // Special handling to make caller's life easier: consider a NULL hostname
 // to be a default hostname and represent it as empty string ("")
 void PrefSetHostname(const char *hostname)
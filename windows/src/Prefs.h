@@ -14,34 +14,66 @@
 #define UNS_NO_DYNAMIC_IP_NETWORKS "unsnodynip" // has networks but none of them is configured for dynamic ips
 #define UNS_NO_NETWORK_SELECTED "unnonetsel"
 
+// Only writes the settings file if a pref changed since it was last
+// loaded or saved
 void PreferencesSave();
+bool PreferencesChanged();
 void PreferencesLoad();
 void PreferencesLoadFromDir(const TCHAR *dir);
 void PreferencesFree();
 
+typedef enum {
+	PrefTypeString = 1,
+	// "0" or "1", also available as BOOL via GetPrefBool()
+	PrefTypeBool
+} PrefType;
+
 typedef struct Prefs {
 	char *name;
 	char **value;
 	char *defaultValue;
 	bool obscured;
+	PrefType type;
+	// parsed value of PrefTypeBool prefs
+	BOOL boolVal;
+	// value as it is in the settings file, to tell if it needs saving
+	char *savedValue;
 } Prefs;
 
+// Must be sorted by name: the order is also the order of g_prefs, which
+// PrefsLoad() binary searches for keys in the settings file
 #define PREFS_DEF(M) \
-	M(user_name, NULL, false) \
-	M(unique_id, NULL, false) \
-	M(token, NULL, true) \
-	M(hostname, NULL, false) \
-	M(network_id, NULL, false) \
-	M(user_networks_state, NULL, false) \
-	M(send_updates, "1", false) \
-	M(run_hidden, "0", false) \
-	M(disable_nagging, "0", false) \
-	M(dns_o_matic, "0", false) \
+	M(disable_nagging, "0", false, Bool) \
+	M(dns_o_matic, "0", false, Bool) \
+	M(hostname, NULL, false, String) \
+	M(hostnames, NULL, false, String) \
+	M(network_id, NULL, false, String) \
+	M(run_hidden, "0", false, Bool) \
+	M(send_updates, "1", false, Bool) \
+	M(token, NULL, true, String) \
+	M(unique_id, NULL, false, String) \
+	M(user_name, NULL, false, String) \
+	M(user_networks_state, NULL, false, String) \
+
+/* every preference has an index into g_prefs named PREF_${name} */
+#define M(PREF_NAME, PREF_DEFAULT_VALUE, IS_OBSCURED, PREF_TYPE) \
+PREF_##PREF_NAME,
+
+typedef enum {
+	PREFS_DEF(M)
+	PREFS_COUNT
+} PrefId;
+
+#undef M
+
+extern Prefs g_prefs[PREFS_COUNT];
 
 // g_pref_hostname - NULL means invalid, empty string means default
+// g_pref_hostnames - comma-separated list of more networks whose ip is
+// updated together with g_pref_hostname, in as few requests as possible
 
 /* every preference can be accessed as g_${name} global */
-#define M(PREF_NAME, PREF_DEFAULT_VALUE, IS_OBSCURED) \
+#define M(PREF_NAME, PREF_DEFAULT_VALUE, IS_OBSCURED, PREF_TYPE) \
 extern char* g_pref_##PREF_NAME;
 
 PREFS_DEF(M)
@@ -55,19 +87,12 @@ static inline void SetPrefVal(char **s, const char *newVal)
 	StrSetCopy(s, newVal);
 }
 
-static inline void SetPrefValBool(char **s, BOOL val)
-{
-	const char *sval = "1";
-	if (FALSE == val)
-		sval = "0";
-	StrSetCopy(s, sval);
-}
+void SetPrefBool(PrefId id, BOOL val);
 
-static inline BOOL GetPrefValBool(char *s)
+static inline BOOL GetPrefBool(PrefId id)
 {
-	if (streq("0", s))
-		return FALSE;
-	return TRUE;
+	assert(PrefTypeBool == g_prefs[id].type);
+	return g_prefs[id].boolVal;
 }
 
 #endif
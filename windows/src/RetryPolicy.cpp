@@ -0,0 +1,257 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "RetryPolicy.h"
+#include "MiscUtil.h"
+#include "SimpleLog.h"
+#include "TimerWheel.h"
+
+// xorshift32, good enough for spreading retries. Never returns 0 as long
+// as it doesn't start with it
+static DWORD NextRand(DWORD *rand)
+{
+	DWORD x = *rand;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*rand = x;
+	return x;
+}
+
+void RetryStateInit(RetryState *s, const RetryPolicy *policy, DWORD seed)
+{
+	memzero(s, sizeof(*s));
+	s->policy = policy;
+	s->stats.state = CircuitClosed;
+	s->rand = seed ? seed : 0x9e3779b9;
+}
+
+DWORD RetryBackoffMs(const RetryPolicy *policy, int failures, DWORD *rand)
+{
+	DWORD capMs = policy->baseDelayMs;
+	for (int i = 1; (i < failures) && (capMs < policy->maxDelayMs); i++) {
+		if (capMs > policy->maxDelayMs / 2)
+			capMs = policy->maxDelayMs;
+		else
+			capMs *= 2;
+	}
+	if (capMs > policy->maxDelayMs)
+		capMs = policy->maxDelayMs;
+	if (0 == capMs)
+		return 0;
+	return NextRand(rand) % (capMs + 1);
+}
+
+bool RetryAllow(RetryState *s, ULONGLONG nowMs)
+{
+	RetryStats *stats = &s->stats;
+	if (CircuitOpen == stats->state) {
+		if (nowMs < stats->retryAtMs) {
+			stats->rejected++;
+			return false;
+		}
+		stats->state = CircuitHalfOpen;
+	}
+	if (CircuitHalfOpen == stats->state) {
+		if (s->trialInFlight) {
+			stats->rejected++;
+			return false;
+		}
+		s->trialInFlight = true;
+	}
+	return true;
+}
+
+void RetrySucceeded(RetryState *s)
+{
+	RetryStats *stats = &s->stats;
+	stats->successes++;
+	stats->consecutiveFailures = 0;
+	stats->state = CircuitClosed;
+	stats->retryAtMs = 0;
+	s->trialInFlight = false;
+}
+
+DWORD RetryFailed(RetryState *s, ULONGLONG nowMs)
+{
+	const RetryPolicy *policy = s->policy;
+	RetryStats *stats = &s->stats;
+	stats->failures++;
+	stats->consecutiveFailures++;
+	s->trialInFlight = false;
+
+	DWORD delayMs = RetryBackoffMs(policy, stats->consecutiveFailures, &s->rand);
+	bool open = (CircuitHalfOpen == stats->state) || (CircuitOpen == stats->state);
+	if ((CircuitClosed == stats->state) && (stats->consecutiveFailures >= policy->failuresToOpen))
+		open = true;
+	if (open) {
+		if (CircuitOpen != stats->state)
+			stats->opened++;
+		stats->state = CircuitOpen;
+		DWORD openMs = policy->openMs / 2 + NextRand(&s->rand) % (policy->openMs / 2 + 1);
+		if (openMs > delayMs)
+			delayMs = openMs;
+	}
+	stats->retryAtMs = nowMs + delayMs;
+	stats->lastDelayMs = delayMs;
+	return delayMs;
+}
+
+DWORD RetryMsLeft(const RetryState *s, ULONGLONG nowMs)
+{
+	if (nowMs >= s->stats.retryAtMs)
+		return 0;
+	return (DWORD)(s->stats.retryAtMs - nowMs);
+}
+
+const char *CircuitStateName(CircuitState state)
+{
+	if (CircuitOpen == state)
+		return "open";
+	if (CircuitHalfOpen == state)
+		return "half-open";
+	return "closed";
+}
+
+// ip updates are sent every 3 hrs anyway, so we try a few times soon
+// and then back off to about once an hour. Upgrade checks can wait a lot
+// longer. Api calls are mostly made by the user, who shouldn't be kept
+// waiting long
+static const RetryPolicy gEndpointPolicies[RetryEndpointsCount] = {
+	// RetryEndpointIpUpdate
+	{ 30*1000, 60*60*1000, 3, 15*60*1000 },
+	// RetryEndpointApi
+	{ 5*1000, 15*60*1000, 5, 2*60*1000 },
+	// RetryEndpointAutoUpdate
+	{ 60*1000, 6*60*60*1000, 3, 60*60*1000 },
+};
+
+static const char *gEndpointNames[RetryEndpointsCount] = {
+	"ip update", "api", "auto update"
+};
+
+static RetryState		gEndpoints[RetryEndpointsCount];
+static bool				gEndpointsInitialized;
+static RetryClockFunc	gClock;
+static void *			gClockCtx;
+static MonotonicClock	gMonotonicClock;
+
+static CRITICAL_SECTION	gEndpointsCs;
+
+// the first request can come from any thread, so the lock must exist
+// before any of them start
+static bool InitEndpointsLock()
+{
+	InitializeCriticalSection(&gEndpointsCs);
+	return true;
+}
+static bool gEndpointsCsInitialized = InitEndpointsLock();
+
+#define LOCK() EnterCriticalSection(&gEndpointsCs)
+#define UNLOCK() LeaveCriticalSection(&gEndpointsCs)
+
+// must be called with the lock held
+static void InitEndpoints(DWORD seed)
+{
+	for (int i = 0; i < RetryEndpointsCount; i++)
+		RetryStateInit(&gEndpoints[i], &gEndpointPolicies[i], seed + i);
+	gEndpointsInitialized = true;
+}
+
+// returns the endpoint's state with the lock held
+static RetryState *LockEndpoint(RetryEndpoint ep)
+{
+	assert((ep >= 0) && (ep < RetryEndpointsCount));
+	LOCK();
+	if (!gEndpointsInitialized) {
+		MonotonicClockInit(&gMonotonicClock);
+		// every client must get different delays
+		InitEndpoints(GetTickCount() ^ (GetCurrentProcessId() << 16));
+	}
+	return &gEndpoints[ep];
+}
+
+static ULONGLONG NowMs()
+{
+	if (gClock)
+		return gClock(gClockCtx);
+	return MonotonicClockMs(&gMonotonicClock);
+}
+
+const char *RetryEndpointName(RetryEndpoint ep)
+{
+	assert((ep >= 0) && (ep < RetryEndpointsCount));
+	return gEndpointNames[ep];
+}
+
+bool RetryEndpointAllow(RetryEndpoint ep)
+{
+	RetryState *s = LockEndpoint(ep);
+	CircuitState prevState = s->stats.state;
+	bool allow = RetryAllow(s, NowMs());
+	if (prevState != s->stats.state)
+		slogfmt("%s: circuit half-open, trying a request\n", gEndpointNames[ep]);
+	UNLOCK();
+	return allow;
+}
+
+void RetryEndpointSucceeded(RetryEndpoint ep)
+{
+	RetryState *s = LockEndpoint(ep);
+	CircuitState prevState = s->stats.state;
+	RetrySucceeded(s);
+	if (prevState != s->stats.state)
+		slogfmt("%s: circuit closed\n", gEndpointNames[ep]);
+	UNLOCK();
+}
+
+DWORD RetryEndpointFailed(RetryEndpoint ep)
+{
+	RetryState *s = LockEndpoint(ep);
+	CircuitState prevState = s->stats.state;
+	DWORD delayMs = RetryFailed(s, NowMs());
+	if (prevState != s->stats.state)
+		slogfmt("%s: circuit open after %d failures, next try in %d s\n", gEndpointNames[ep],
+			s->stats.consecutiveFailures, (int)(delayMs / 1000));
+	UNLOCK();
+	return delayMs;
+}
+
+DWORD RetryEndpointMsLeft(RetryEndpoint ep)
+{
+	RetryState *s = LockEndpoint(ep);
+	DWORD msLeft = RetryMsLeft(s, NowMs());
+	UNLOCK();
+	return msLeft;
+}
+
+void RetryEndpointGetStats(RetryEndpoint ep, RetryStats *statsOut)
+{
+	RetryState *s = LockEndpoint(ep);
+	*statsOut = s->stats;
+	UNLOCK();
+}
+
+void RetryEndpointsLogStats()
+{
+	for (int i = 0; i < RetryEndpointsCount; i++) {
+		RetryStats stats;
+		RetryEndpointGetStats((RetryEndpoint)i, &stats);
+		slogfmt("%s: circuit %s, %d failures in a row, %d ok, %d failed, %d rejected, opened %d times\n",
+			gEndpointNames[i], CircuitStateName(stats.state), stats.consecutiveFailures,
+			stats.successes, stats.failures, stats.rejected, stats.opened);
+	}
+}
+
+void RetryEndpointsReset(RetryClockFunc clock, void *clockCtx, DWORD seed)
+{
+	LOCK();
+	MonotonicClockInit(&gMonotonicClock);
+	gClock = clock;
+	gClockCtx = clockCtx;
+	InitEndpoints(seed);
+	UNLOCK();
+}
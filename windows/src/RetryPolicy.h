@@ -0,0 +1,105 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef RETRY_POLICY_H__
+#define RETRY_POLICY_H__
+
+/* When to try a request again after it failed, and when to stop trying
+for a while because the servers are clearly down.
+
+After a failure, the next try is a random time between 0 and a delay that
+doubles with every failure in a row ("full jitter"), so that after an
+outage all the clients don't come back at the same moment.
+
+Each endpoint has a circuit breaker. It's closed while requests succeed.
+After failuresToOpen failures in a row it opens and requests aren't made
+at all (they fail right away) for about openMs. Then it's half-open: one
+request is let through, and it either closes the circuit or opens it
+again.
+
+RetryState is the bare logic, times are passed in. The RetryEndpoint
+functions keep one RetryState for each of our servers and are what ip
+updates, api calls and upgrade checks use. They're thread-safe.
+*/
+
+typedef struct {
+	// the most the first retry waits, doubled with every failure in a row
+	// up to maxDelayMs
+	DWORD		baseDelayMs;
+	DWORD		maxDelayMs;
+	// failures in a row that open the circuit
+	int			failuresToOpen;
+	// how long an open circuit stays open, randomized between half of it
+	// and all of it
+	DWORD		openMs;
+} RetryPolicy;
+
+enum CircuitState {
+	CircuitClosed,
+	CircuitOpen,
+	CircuitHalfOpen
+};
+
+typedef struct {
+	CircuitState	state;
+	int				consecutiveFailures;
+	// totals since start
+	int				successes;
+	int				failures;
+	// requests not made because the circuit was open
+	int				rejected;
+	// how many times the circuit opened
+	int				opened;
+	// when the next try is due after the last failure, 0 after a success
+	ULONGLONG		retryAtMs;
+	DWORD			lastDelayMs;
+} RetryStats;
+
+typedef struct {
+	const RetryPolicy *	policy;
+	RetryStats			stats;
+	// the one request let through a half-open circuit is being made
+	bool				trialInFlight;
+	DWORD				rand;
+} RetryState;
+
+void		RetryStateInit(RetryState *s, const RetryPolicy *policy, DWORD seed);
+// false if the circuit is open, the caller must not make the request.
+// Otherwise it must call RetrySucceeded() or RetryFailed() when it's done
+bool		RetryAllow(RetryState *s, ULONGLONG nowMs);
+void		RetrySucceeded(RetryState *s);
+// returns how long to wait before trying again
+DWORD		RetryFailed(RetryState *s, ULONGLONG nowMs);
+// how long from <nowMs> until the next try is due, 0 if it is
+DWORD		RetryMsLeft(const RetryState *s, ULONGLONG nowMs);
+// a random delay for the <failures>'th failure in a row, advances <rand>
+DWORD		RetryBackoffMs(const RetryPolicy *policy, int failures, DWORD *rand);
+const char *CircuitStateName(CircuitState state);
+
+enum RetryEndpoint {
+	// GetIpUpdateHost()
+	RetryEndpointIpUpdate,
+	// GetApiHost()
+	RetryEndpointApi,
+	// the upgrade check server, see GetUpdateUrl()
+	RetryEndpointAutoUpdate,
+	RetryEndpointsCount
+};
+
+const char *RetryEndpointName(RetryEndpoint ep);
+bool		RetryEndpointAllow(RetryEndpoint ep);
+void		RetryEndpointSucceeded(RetryEndpoint ep);
+DWORD		RetryEndpointFailed(RetryEndpoint ep);
+DWORD		RetryEndpointMsLeft(RetryEndpoint ep);
+void		RetryEndpointGetStats(RetryEndpoint ep, RetryStats *statsOut);
+// writes the state of all endpoints to the log
+void		RetryEndpointsLogStats();
+
+typedef ULONGLONG (*RetryClockFunc)(void *ctx);
+// Forgets everything about all endpoints. For tests and simulations, which
+// also give their own clock (NULL for the real one) and a <seed> so that
+// runs can be repeated
+void		RetryEndpointsReset(RetryClockFunc clock, void *clockCtx, DWORD seed);
+
+#endif
@@ -0,0 +1,189 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "MiscUtil.h"
+#include "RetryPolicy.h"
+
+#include "UnitTests.h"
+
+#define ONE_MIN_MS		(60*1000)
+
+static const RetryPolicy gTestPolicy = { 1000, 60*1000, 3, 10*60*1000 };
+
+// delays stay under a cap that doubles with every failure, up to the max,
+// and are spread over all of it rather than bunched at the top
+static void retry_backoff_ut()
+{
+	DWORD rand = 7;
+	DWORD capMs = gTestPolicy.baseDelayMs;
+	for (int failures = 1; failures <= 40; failures++) {
+		DWORD maxSeenMs = 0;
+		DWORD minSeenMs = (DWORD)-1;
+		for (int i = 0; i < 1000; i++) {
+			DWORD delayMs = RetryBackoffMs(&gTestPolicy, failures, &rand);
+			if (delayMs > maxSeenMs)
+				maxSeenMs = delayMs;
+			if (delayMs < minSeenMs)
+				minSeenMs = delayMs;
+		}
+		utassert(maxSeenMs <= capMs);
+		utassert(maxSeenMs > capMs / 2);
+		utassert(minSeenMs < capMs / 10);
+		capMs *= 2;
+		if (capMs > gTestPolicy.maxDelayMs)
+			capMs = gTestPolicy.maxDelayMs;
+	}
+}
+
+// closed until failuresToOpen failures in a row, open for between half of
+// openMs and openMs, then one request goes through and decides
+static void retry_circuit_ut()
+{
+	RetryState s;
+	ULONGLONG nowMs = 1000;
+	RetryStateInit(&s, &gTestPolicy, 3);
+
+	bool ok = RetryAllow(&s, nowMs);
+	utassert(ok);
+	RetryFailed(&s, nowMs);
+	ok = RetryAllow(&s, nowMs);
+	utassert(ok);
+	RetrySucceeded(&s);
+	utassert(0 == s.stats.consecutiveFailures);
+
+	for (int i = 0; i < gTestPolicy.failuresToOpen; i++) {
+		utassert(CircuitClosed == s.stats.state);
+		ok = RetryAllow(&s, nowMs);
+		utassert(ok);
+		RetryFailed(&s, nowMs);
+	}
+	utassert(CircuitOpen == s.stats.state);
+	utassert(1 == s.stats.opened);
+	DWORD msLeft = RetryMsLeft(&s, nowMs);
+	utassert(msLeft >= gTestPolicy.openMs / 2);
+	utassert(msLeft <= gTestPolicy.openMs);
+
+	ok = RetryAllow(&s, nowMs + msLeft - 1);
+	utassert(!ok);
+	utassert(1 == s.stats.rejected);
+
+	// a single trial request, which fails and opens the circuit again
+	nowMs += msLeft;
+	ok = RetryAllow(&s, nowMs);
+	utassert(ok);
+	utassert(CircuitHalfOpen == s.stats.state);
+	ok = RetryAllow(&s, nowMs);
+	utassert(!ok);
+	RetryFailed(&s, nowMs);
+	utassert(CircuitOpen == s.stats.state);
+	utassert(2 == s.stats.opened);
+	utassert(RetryMsLeft(&s, nowMs) >= gTestPolicy.openMs / 2);
+
+	nowMs += gTestPolicy.openMs;
+	ok = RetryAllow(&s, nowMs);
+	utassert(ok);
+	RetrySucceeded(&s);
+	utassert(CircuitClosed == s.stats.state);
+	utassert(0 == RetryMsLeft(&s, nowMs));
+	utassert(2 == s.stats.successes);
+	utassert(2 == s.stats.rejected);
+	utassert(gTestPolicy.failuresToOpen + 2 == s.stats.failures);
+}
+
+static ULONGLONG TestNowMs(void *ctx)
+{
+	return *(ULONGLONG*)ctx;
+}
+
+// endpoints are independent and run on the clock they're given
+static void retry_endpoints_ut()
+{
+	ULONGLONG nowMs = 0;
+	RetryEndpointsReset(TestNowMs, &nowMs, 5);
+	for (int i = 0; i < 20; i++) {
+		if (RetryEndpointAllow(RetryEndpointIpUpdate))
+			RetryEndpointFailed(RetryEndpointIpUpdate);
+	}
+	RetryStats stats;
+	RetryEndpointGetStats(RetryEndpointIpUpdate, &stats);
+	utassert(CircuitOpen == stats.state);
+	utassert(stats.rejected > 0);
+	utassert(RetryEndpointMsLeft(RetryEndpointIpUpdate) > 0);
+	bool ok = RetryEndpointAllow(RetryEndpointApi);
+	utassert(ok);
+	RetryEndpointSucceeded(RetryEndpointApi);
+
+	nowMs += stats.retryAtMs;
+	utassert(0 == RetryEndpointMsLeft(RetryEndpointIpUpdate));
+	ok = RetryEndpointAllow(RetryEndpointIpUpdate);
+	utassert(ok);
+	RetryEndpointSucceeded(RetryEndpointIpUpdate);
+	RetryEndpointGetStats(RetryEndpointIpUpdate, &stats);
+	utassert(CircuitClosed == stats.state);
+	RetryEndpointsReset(NULL, NULL, 1);
+}
+
+void retry_policy_ut_all()
+{
+	retry_backoff_ut();
+	retry_circuit_ut();
+	retry_endpoints_ut();
+}
+
+#define HERD_CLIENTS	100000
+#define HERD_MINUTES	120
+
+// The busiest minute for our servers once they come back, when every
+// client started failing at the same moment and retries until it gets
+// through. With a fixed delay all of them come back together
+static int HerdPeakPerMinute(bool jitter)
+{
+	int *perMinute = (int*)malloc(HERD_MINUTES * sizeof(int));
+	if (!perMinute)
+		return 0;
+	memzero(perMinute, HERD_MINUTES * sizeof(int));
+	const RetryPolicy *policy = &gTestPolicy;
+	const ULONGLONG upAtMs = 30 * ONE_MIN_MS;
+	for (int i = 0; i < HERD_CLIENTS; i++) {
+		RetryState s;
+		RetryStateInit(&s, policy, i + 1);
+		ULONGLONG nowMs = 0;
+		while (nowMs < HERD_MINUTES * (ULONGLONG)ONE_MIN_MS) {
+			if (!RetryAllow(&s, nowMs)) {
+				nowMs += RetryMsLeft(&s, nowMs);
+				continue;
+			}
+			perMinute[nowMs / ONE_MIN_MS]++;
+			if (nowMs >= upAtMs)
+				break;
+			DWORD delayMs = RetryFailed(&s, nowMs);
+			if (!jitter) {
+				delayMs = s.stats.lastDelayMs = policy->maxDelayMs;
+				s.stats.retryAtMs = nowMs + delayMs;
+			}
+			nowMs += delayMs ? delayMs : 1;
+		}
+	}
+	int peak = 0;
+	for (int m = upAtMs / ONE_MIN_MS; m < HERD_MINUTES; m++) {
+		if (perMinute[m] > peak)
+			peak = perMinute[m];
+	}
+	free(perMinute);
+	return peak;
+}
+
+void retry_policy_bench_all()
+{
+	double start = benchTimeMs();
+	int peak = HerdPeakPerMinute(false);
+	benchReport("retries of clients without jitter", HERD_CLIENTS, benchTimeMs() - start);
+	fprintf(stderr, "\n  busiest minute after an outage: %d requests", peak);
+	start = benchTimeMs();
+	peak = HerdPeakPerMinute(true);
+	benchReport("retries of clients with backoff, jitter and circuit breaker", HERD_CLIENTS, benchTimeMs() - start);
+	fprintf(stderr, "\n  busiest minute after an outage: %d requests\n", peak);
+}
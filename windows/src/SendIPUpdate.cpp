@@ -4,10 +4,23 @@
 
 #include "MiscUtil.h"
 #include "Http.h"
+#include "HttpAsync.h"
 #include "JsonParser.h"
 #include "Prefs.h"
+#include "RetryPolicy.h"
 #include "StrUtil.h"
 
+// Tells the ip update endpoint's circuit breaker how a request went. An
+// answer other than a server error means the servers are fine, even if
+// they didn't like the update
+static void RecordIpUpdateResult(const char *resp)
+{
+	if (IpUpdateFailedOnServer(resp))
+		RetryEndpointFailed(RetryEndpointIpUpdate);
+	else
+		RetryEndpointSucceeded(RetryEndpointIpUpdate);
+}
+
 char* SendIpUpdate()
 {
 	assert(CanSendIPUpdates());
@@ -26,18 +39,230 @@ char* SendIpUpdate()
 		return NULL;
 	assert(g_pref_hostname);
 
+	// no response while the circuit is open
+	if (!RetryEndpointAllow(RetryEndpointIpUpdate))
+		return NULL;
+
 	const char *urlTxt = GetIpUpdateUrl(TRUE);
 	const char *host = GetIpUpdateHost();
 
-	HttpResult *httpResult = HttpGet(host, urlTxt, INTERNET_DEFAULT_HTTPS_PORT);
+	HttpResult *httpResult = HttpAsyncGetWait(host, urlTxt, INTERNET_DEFAULT_HTTPS_PORT, HTTP_ASYNC_DEFAULT_TIMEOUT_MS);
 	free((void*)urlTxt);
 	if (httpResult && httpResult->IsValid()) {
-		res = (char*)httpResult->data.getData(NULL);
+		res = (char*)httpResult->data.stealData(NULL);
 	}
 	delete httpResult;
+	RecordIpUpdateResult(res);
+	return res;
+}
+
+// g_pref_hostname followed by networks in g_pref_hostnames, without
+// duplicates. The default network (empty g_pref_hostname) can't be named
+// in a batch so it's left out if there are other networks
+char **IpUpdateHostnamesFromPrefs(int *countOut)
+{
+	int count = 0;
+	int maxCount = 1;
+	for (const char *s = g_pref_hostnames; s && *s; s++) {
+		if (',' == *s)
+			maxCount++;
+	}
+	if (!strempty(g_pref_hostnames))
+		maxCount++;
+
+	char **hostnames = (char**)malloc(sizeof(char*) * maxCount);
+	if (!hostnames) {
+		*countOut = 0;
+		return NULL;
+	}
+	if (!strempty(g_pref_hostname))
+		hostnames[count++] = strdup(g_pref_hostname);
+
+	char *next = g_pref_hostnames;
+	char *hostname;
+	while (NULL != (hostname = StrSplitIter(&next, ','))) {
+		StrStripWsBoth(hostname);
+		bool dup = strempty(hostname);
+		for (int i=0; !dup && (i < count); i++) {
+			if (strieq(hostnames[i], hostname))
+				dup = true;
+		}
+		if (dup)
+			free(hostname);
+		else
+			hostnames[count++] = hostname;
+	}
+	*countOut = count;
+	return hostnames;
+}
+
+void IpUpdateHostnamesFree(char **hostnames, int count)
+{
+	for (int i=0; i < count; i++)
+		free(hostnames[i]);
+	free(hostnames);
+}
+
+// how many of <hostnames> (at least one) fit in a single update request
+// whose url without any hostnames is <baseUrlLen> long
+int IpUpdateBatchSize(const char **hostnames, int count, size_t baseUrlLen)
+{
+	size_t urlLen = baseUrlLen;
+	int n;
+	for (n = 0; (n < count) && (n < IP_UPDATE_MAX_HOSTS_PER_REQUEST); n++) {
+		char *encoded = StrUrlEncode(hostnames[n]);
+		// a comma is encoded as %2C
+		size_t len = (encoded ? strlen(encoded) : 0) + (n > 0 ? 3 : 0);
+		free(encoded);
+		if ((n > 0) && (urlLen + len > IP_UPDATE_MAX_URL_LEN))
+			break;
+		urlLen += len;
+	}
+	if (0 == n)
+		n = 1;
+	return n;
+}
+
+static IpUpdateHostResult *NewHostResult(const char *hostname, const char *line)
+{
+	IpUpdateHostResult *res = SAZ(IpUpdateHostResult);
+	if (!res)
+		return NULL;
+	res->hostname = strdup(hostname);
+	res->response = StrDupSafe(line);
+	if (line)
+		res->result = IpUpdateResultParse(line, &res->ip);
+	else
+		res->result = IpUpdateNotAvailable;
+	return res;
+}
+
+// the next line that isn't empty, NULL if there are no more
+static char *NextResponseLine(char **next)
+{
+	char *line = NULL;
+	while (*next && !line) {
+		line = StrSplitIter(next, '\n');
+		StrStripWsBoth(line);
+		if (strempty(line)) {
+			free(line);
+			line = NULL;
+		}
+	}
+	return line;
+}
+
+// The response has a line per hostname, in the order they were sent. An
+// error that applies to the whole request (e.g. "badauth") is only sent
+// once, so when it's all there is it applies to all hostnames. Otherwise
+// hostnames past the end of the response (e.g. it was cut short) get no
+// response, like when the request failed, so that they're sent again.
+// <resp> is NULL if the request failed
+IpUpdateHostResult *ParseIpUpdateBatchResponse(const char *resp, const char **hostnames, int count)
+{
+	IpUpdateHostResult *head = NULL;
+	IpUpdateHostResult **last = &head;
+	char *txt = StrDupSafe(resp);
+	char *next = txt;
+	char *line = NextResponseLine(&next);
+	char *nextLine = NextResponseLine(&next);
+	bool forAll = line && !nextLine && IpUpdateResponseForRequest(line);
+
+	for (int i=0; i < count; i++) {
+		IpUpdateHostResult *res = NewHostResult(hostnames[i], line);
+		if (!res)
+			break;
+		*last = res;
+		last = &res->next;
+		if (forAll)
+			continue;
+		free(line);
+		line = nextLine;
+		nextLine = NextResponseLine(&next);
+	}
+	free(line);
+	free(nextLine);
+	free(txt);
+	return head;
+}
+
+void IpUpdateHostResultFreeList(IpUpdateHostResult *head)
+{
+	while (head) {
+		IpUpdateHostResult *next = head->next;
+		free(head->hostname);
+		free(head->response);
+		free(head);
+		head = next;
+	}
+}
+
+static char *JoinHostnames(const char **hostnames, int count)
+{
+	size_t len = 0;
+	for (int i=0; i < count; i++)
+		len += strlen(hostnames[i]) + 1;
+	char *res = (char*)malloc(len + 1);
+	if (!res)
+		return NULL;
+	char *s = res;
+	for (int i=0; i < count; i++) {
+		if (i > 0)
+			*s++ = ',';
+		len = strlen(hostnames[i]);
+		memcpy(s, hostnames[i], len);
+		s += len;
+	}
+	*s = 0;
 	return res;
 }
 
+// Updates all <hostnames>, as many in a single request as the protocol
+// allows. Returns a result for every hostname, in the same order
+IpUpdateHostResult *SendIpUpdateBatch(const char **hostnames, int count)
+{
+	assert(CanSendIPUpdates());
+	if (!CanSendIPUpdates() || !g_pref_token)
+		return NULL;
+
+	IpUpdateHostResult *head = NULL;
+	IpUpdateHostResult **last = &head;
+	const char *host = GetIpUpdateHost();
+	const char *baseUrl = GetIpUpdateUrlForHostname(TRUE, NULL);
+	size_t baseUrlLen = baseUrl ? strlen(baseUrl) : 0;
+	free((void*)baseUrl);
+
+	int batchSize;
+	for (int start = 0; start < count; start += batchSize) {
+		batchSize = IpUpdateBatchSize(hostnames + start, count - start, baseUrlLen);
+		char *resp = NULL;
+		DWORD startMs = GetTickCount();
+		char *joined = JoinHostnames(hostnames + start, batchSize);
+		const char *urlTxt = joined ? GetIpUpdateUrlForHostname(TRUE, joined) : NULL;
+		// hostnames in batches not allowed by the circuit get no response
+		bool allowed = urlTxt && RetryEndpointAllow(RetryEndpointIpUpdate);
+		HttpResult *httpResult = NULL;
+		if (allowed)
+			httpResult = HttpAsyncGetWait(host, urlTxt, INTERNET_DEFAULT_HTTPS_PORT, HTTP_ASYNC_DEFAULT_TIMEOUT_MS);
+		if (httpResult && httpResult->IsValid())
+			resp = (char*)httpResult->data.stealData(NULL);
+		delete httpResult;
+		free((void*)urlTxt);
+		free(joined);
+		if (allowed)
+			RecordIpUpdateResult(resp);
+
+		DWORD latencyMs = GetTickCount() - startMs;
+		*last = ParseIpUpdateBatchResponse(resp, hostnames + start, batchSize);
+		free(resp);
+		while (*last) {
+			(*last)->latencyMs = latencyMs;
+			last = &(*last)->next;
+		}
+	}
+	return head;
+}
+
 char *SendDnsOmaticUpdate()
 {
 	assert(CanSendIPUpdates());
@@ -55,54 +280,154 @@ char *SendDnsOmaticUpdate()
 	const char *urlTxt = GetIpUpdateUrl(TRUE);
 	const char *host = GetIpUpdateDnsOMaticHost();
 
-	HttpResult *httpResult = HttpGet(host, urlTxt, INTERNET_DEFAULT_HTTPS_PORT);
+	HttpResult *httpResult = HttpAsyncGetWait(host, urlTxt, INTERNET_DEFAULT_HTTPS_PORT, HTTP_ASYNC_DEFAULT_TIMEOUT_MS);
 	free((void*)urlTxt);
 	if (httpResult && httpResult->IsValid()) {
-		res = (char*)httpResult->data.getData(NULL);
+		res = (char*)httpResult->data.stealData(NULL);
 	}
 	delete httpResult;
 	return res;
 }
 
-IpUpdateResult IpUpdateResultFromString(const char *s)
-{
-	if (StrStartsWithI(s, "The service is not available"))
-		return IpUpdateNotAvailable;
-	if (StrStartsWithI(s, "good"))
-		return IpUpdateOk;
-	if (StrStartsWithI(s, "nochg"))
-		return IpUpdateOk;
-	if (StrStartsWithI(s, "!yours"))
-		return IpUpdateNotYours;
-	if (StrStartsWithI(s, "badauth"))
-		return IpUpdateBadAuth;
-	if (StrStartsWithI(s, "nohost"))
-		return IpUpdateNoHost;
-
+typedef struct {
+	const char *	code;
+	IpUpdateResult	result;
+	// sent once for a whole batched request rather than for every hostname
+	bool			forRequest;
+} IpUpdateCode;
+
+// Sorted and lower-case, which FindIpUpdateCode() relies on. No code is
+// a prefix of another one
+static const IpUpdateCode gIpUpdateCodes[] = {
+	{ "!donator", IpUpdateMiscErr, true },
+	{ "!yours", IpUpdateNotYours, false },
 	// not sure if those really happen, they're supported by 1.3 client
-	if (StrStartsWithI(s, "dnserr"))
-		return IpUpdateDnsErr;
-
-	if (StrStartsWithI(s, "911"))
-		return IpUpdateDnsErr;
+	{ "911", IpUpdateDnsErr, true },
+	{ "abuse", IpUpdateMiscErr, true },
+	{ "badagent", IpUpdateMiscErr, true },
+	{ "badauth", IpUpdateBadAuth, true },
+	{ "dnserr", IpUpdateDnsErr, false },
+	{ "good", IpUpdateOk, false },
+	{ "nochg", IpUpdateOk, false },
+	{ "nohost", IpUpdateNoHost, false },
+	{ "notfqdn", IpUpdateMiscErr, false },
+	{ "numhost", IpUpdateMiscErr, false },
+	{ "the service is not available", IpUpdateNotAvailable, true },
+};
+
+// Parses a dotted ip address at the beginning of <s>, 1.2.3.4 is 0x01020304.
+// Returns 0 if it isn't one
+IP4_ADDRESS ParseIp4(const char *s)
+{
+	IP4_ADDRESS ip = 0;
+	for (int part = 0; part < 4; part++) {
+		if (part > 0) {
+			if ('.' != *s)
+				return 0;
+			s++;
+		}
+		if ((*s < '0') || (*s > '9'))
+			return 0;
+		unsigned n = 0;
+		for (int digits = 0; (*s >= '0') && (*s <= '9'); digits++, s++) {
+			if (3 == digits)
+				return 0;
+			n = n * 10 + (*s - '0');
+		}
+		if (n > 255)
+			return 0;
+		ip = (ip << 8) | n;
+	}
+	return ip;
+}
 
-	if (StrStartsWithI(s, "abuse"))
-		return IpUpdateMiscErr;
+// Finds the code <s> starts with in one pass over <s>, like walking a trie:
+// gIpUpdateCodes[lo..hi) are the codes that match the chars seen so far,
+// found with binary search. Once there's only one left, the rest of it is
+// compared directly. Returns NULL for an unknown code
+static const IpUpdateCode *FindIpUpdateCode(const char *s)
+{
+	int lo = 0, hi = dimof(gIpUpdateCodes);
+	int i = 0;
+	while (hi - lo > 1) {
+		char c = s[i];
+		if ((c >= 'A') && (c <= 'Z'))
+			c += 'a' - 'A';
+		// first code with code[i] >= c
+		int l = lo, h = hi;
+		while (l < h) {
+			int mid = (l + h) / 2;
+			if (gIpUpdateCodes[mid].code[i] < c)
+				l = mid + 1;
+			else
+				h = mid;
+		}
+		lo = l;
+		// first code with code[i] > c
+		h = hi;
+		while (l < h) {
+			int mid = (l + h) / 2;
+			if (gIpUpdateCodes[mid].code[i] <= c)
+				l = mid + 1;
+			else
+				h = mid;
+		}
+		hi = l;
+		i++;
+	}
+	if (lo == hi)
+		return NULL;
 
-	if (StrStartsWithI(s, "notfqdn"))
-		return IpUpdateMiscErr;
+	const char *code = gIpUpdateCodes[lo].code;
+	for (; code[i]; i++) {
+		char c = s[i];
+		if ((c >= 'A') && (c <= 'Z'))
+			c += 'a' - 'A';
+		if (c != code[i])
+			return NULL;
+	}
+	return &gIpUpdateCodes[lo];
+}
 
-	if (StrStartsWithI(s, "numhost"))
-		return IpUpdateMiscErr;
+// Unknown codes are IpUpdateUnknown. <ipOut> gets the ip that follows
+// "good", "nochg" and "!yours", 0 if there isn't one
+IpUpdateResult IpUpdateResultParse(const char *s, IP4_ADDRESS *ipOut)
+{
+	if (ipOut)
+		*ipOut = 0;
+	const IpUpdateCode *code = FindIpUpdateCode(s);
+	if (!code)
+		return IpUpdateUnknown;
+	// the code is followed by a space and an ip or by nothing
+	size_t len = strlen(code->code);
+	if (ipOut && (' ' == s[len]))
+		*ipOut = ParseIp4(s + len + 1);
+	return code->result;
+}
 
-	if (StrStartsWithI(s, "badagent"))
-		return IpUpdateMiscErr;
+// true if <resp> is an answer to the whole request, like "badauth", that
+// the server sends only once however many hostnames were in it
+bool IpUpdateResponseForRequest(const char *resp)
+{
+	const IpUpdateCode *code = FindIpUpdateCode(resp);
+	return code && code->forRequest;
+}
 
-	if (StrStartsWithI(s, "!donator"))
-		return IpUpdateMiscErr;
+IpUpdateResult IpUpdateResultFromString(const char *s)
+{
+	return IpUpdateResultParse(s, NULL);
+}
 
-	assert(0);
-	return IpUpdateOk;
+// true if there was no response to an ip update or the servers had a
+// problem with it that's worth trying again soon, as opposed to one
+// with the update itself. An answer we don't understand (e.g. an error
+// page from a proxy) counts as a problem with the servers
+bool IpUpdateFailedOnServer(const char *resp)
+{
+	if (!resp)
+		return true;
+	IpUpdateResult result = IpUpdateResultFromString(resp);
+	return (IpUpdateNotAvailable == result) || (IpUpdateDnsErr == result) || (IpUpdateUnknown == result);
 }
 
 #if 0
@@ -120,7 +445,7 @@ char* SendIpUpdate()
 	HttpResult *httpResult = HttpGetWithBasicAuth("updates.opendns.com", "/nic/update", userName, pwd, true);
 	if (httpResult && httpResult->IsValid()) {
 		DWORD dataLen;
-		char *data = (char*)httpResult->data.getData(&dataLen);
+		char *data = (char*)httpResult->data.stealData(&dataLen);
 		free(data);
 	}
 	delete httpResult;
@@ -147,7 +472,7 @@ TCHAR *DownloadUpdateIfNotDownloaded(const char *url)
 		goto Error;
 
 	DWORD size;
-	void *s = httpResult->data.getData(&size);
+	void *s = httpResult->data.stealData(&size);
 	if (!s)
 		goto Error;
 
@@ -191,10 +516,10 @@ static CString AutoUpdateUrl(const TCHAR *version, const char *type)
 #define TEST_UPDATE_LOCALLY 0
 
 #if TEST_UPDATE_LOCALLY
-#define AUTO_UPDATE_HOST _T("127.0.0.1")
+#define AUTO_UPDATE_HOST "127.0.0.1"
 #define AUTO_UPDATE_PORT 8080
 #else
-#define AUTO_UPDATE_HOST _T("opendnsupdate.appspot.com")
+#define AUTO_UPDATE_HOST "opendnsupdate.appspot.com"
 #define AUTO_UPDATE_PORT 80
 #endif
 
@@ -218,11 +543,22 @@ char *GetUpdateUrl(const TCHAR *version, VersionUpdateCheckType type)
 	else
 		assert(0);
 
+	if (!RetryEndpointAllow(RetryEndpointAutoUpdate))
+		return NULL;
 	CString url = AutoUpdateUrl(version, typeStr);
-	HttpResult *res = HttpGet(AUTO_UPDATE_HOST, url, AUTO_UPDATE_PORT);
-	if (!res || !res->IsValid())
+	char *urlUtf8 = TStrToStr(url);
+	HttpResult *res = NULL;
+	if (urlUtf8)
+		res = HttpAsyncGetWait(AUTO_UPDATE_HOST, urlUtf8, AUTO_UPDATE_PORT, HTTP_ASYNC_DEFAULT_TIMEOUT_MS);
+	free(urlUtf8);
+	if (!res || !res->IsValid()) {
+		RetryEndpointFailed(RetryEndpointAutoUpdate);
+		delete res;
 		return NULL;
-	char *s = (char *)res->data.getData(NULL);
+	}
+	RetryEndpointSucceeded(RetryEndpointAutoUpdate);
+	char *s = (char *)res->data.stealData(NULL);
+	delete res;
 	json = ParseJsonToDoc(s);
 	JsonEl *upgradeAvailable = GetMapElByName(json, "upgrade");
 	JsonElBool *upgradeAvailableBool = JsonElAsBool(upgradeAvailable);
@@ -1,6 +1,8 @@
 #ifndef SEND_IP_UPDATE_H__
 #define SEND_IP_UPDATE_H__
 
+#include <windns.h>
+
 enum VersionUpdateCheckType {
 	UpdateCheckInstall,
 	UpdateCheckUninstall,
@@ -14,12 +16,45 @@ enum IpUpdateResult {
 	IpUpdateNotAvailable,
 	IpUpdateNoHost,
 	IpUpdateDnsErr,
-	IpUpdateMiscErr
+	IpUpdateMiscErr,
+	// not a response we know
+	IpUpdateUnknown
+};
+
+// the dyndns protocol allows up to 20 hostnames in one update request
+#define IP_UPDATE_MAX_HOSTS_PER_REQUEST 20
+// and we keep the url below what proxies reliably accept
+#define IP_UPDATE_MAX_URL_LEN 2000
+
+typedef struct IpUpdateHostResult IpUpdateHostResult;
+
+// a linked list of per-network results of a batched ip update
+struct IpUpdateHostResult {
+	IpUpdateHostResult *next;
+	char *hostname;
+	// the line of the response for this hostname (e.g. "good 1.2.3.4")
+	// or NULL if the request failed
+	char *response;
+	IpUpdateResult result;
+	// ip from the response, 0 if it didn't have one
+	IP4_ADDRESS ip;
+	// how long the request that carried this hostname took
+	DWORD latencyMs;
 };
 
 char* SendIpUpdate();
+char **IpUpdateHostnamesFromPrefs(int *countOut);
+void IpUpdateHostnamesFree(char **hostnames, int count);
+IpUpdateHostResult *SendIpUpdateBatch(const char **hostnames, int count);
+int IpUpdateBatchSize(const char **hostnames, int count, size_t baseUrlLen);
+IpUpdateHostResult *ParseIpUpdateBatchResponse(const char *resp, const char **hostnames, int count);
+void IpUpdateHostResultFreeList(IpUpdateHostResult *head);
 char *SendDnsOmaticUpdate();
 IpUpdateResult IpUpdateResultFromString(const char *s);
+IpUpdateResult IpUpdateResultParse(const char *s, IP4_ADDRESS *ipOut);
+bool IpUpdateFailedOnServer(const char *resp);
+bool IpUpdateResponseForRequest(const char *resp);
+IP4_ADDRESS ParseIp4(const char *s);
 char *GetUpdateUrl(const TCHAR *version, VersionUpdateCheckType type);
 TCHAR *DownloadUpdateIfNotDownloaded(const char *url);
 
@@ -0,0 +1,248 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "SendIPUpdate.h"
+#include "MiscUtil.h"
+#include "Prefs.h"
+#include "StrUtil.h"
+
+#include "UnitTests.h"
+
+static int ListLen(IpUpdateHostResult *head)
+{
+	int n = 0;
+	for (; head; head = head->next)
+		n++;
+	return n;
+}
+
+static void parse_batch_response_ut()
+{
+	const char *hostnames[] = { "home", "office", "cabin" };
+	IpUpdateHostResult *res;
+
+	res = ParseIpUpdateBatchResponse("good 1.2.3.4\r\nnochg 1.2.3.4\r\nnohost\r\n", hostnames, 3);
+	utassert(3 == ListLen(res));
+	utassert(streq("home", res->hostname));
+	utassert(streq("good 1.2.3.4", res->response));
+	utassert(IpUpdateOk == res->result);
+	utassert(0x01020304 == res->ip);
+	utassert(streq("office", res->next->hostname));
+	utassert(IpUpdateOk == res->next->result);
+	utassert(streq("cabin", res->next->next->hostname));
+	utassert(IpUpdateNoHost == res->next->next->result);
+	IpUpdateHostResultFreeList(res);
+
+	// an error for the whole request applies to all hostnames
+	res = ParseIpUpdateBatchResponse("badauth\n", hostnames, 3);
+	utassert(3 == ListLen(res));
+	for (IpUpdateHostResult *r = res; r; r = r->next) {
+		utassert(IpUpdateBadAuth == r->result);
+		utassert(streq("badauth", r->response));
+	}
+	IpUpdateHostResultFreeList(res);
+
+	res = ParseIpUpdateBatchResponse("the service is not available", hostnames, 2);
+	utassert(2 == ListLen(res));
+	utassert(IpUpdateNotAvailable == res->result);
+	utassert(streq("the service is not available", res->next->response));
+	IpUpdateHostResultFreeList(res);
+
+	// hostnames the response has no line for are sent again, they don't
+	// get the last line
+	res = ParseIpUpdateBatchResponse("good 1.2.3.4\nnohost\n", hostnames, 3);
+	utassert(3 == ListLen(res));
+	utassert(IpUpdateOk == res->result);
+	utassert(IpUpdateNoHost == res->next->result);
+	utassert(NULL == res->next->next->response);
+	utassert(IpUpdateNotAvailable == res->next->next->result);
+	IpUpdateHostResultFreeList(res);
+
+	// even if there's only one line, when it's for a single hostname
+	res = ParseIpUpdateBatchResponse("good 1.2.3.4\n", hostnames, 3);
+	utassert(3 == ListLen(res));
+	utassert(IpUpdateOk == res->result);
+	utassert(streq("good 1.2.3.4", res->response));
+	utassert(NULL == res->next->response);
+	utassert(IpUpdateNotAvailable == res->next->result);
+	utassert(NULL == res->next->next->response);
+	IpUpdateHostResultFreeList(res);
+
+	// failed request
+	res = ParseIpUpdateBatchResponse(NULL, hostnames, 2);
+	utassert(2 == ListLen(res));
+	utassert(NULL == res->response);
+	utassert(IpUpdateNotAvailable == res->result);
+	IpUpdateHostResultFreeList(res);
+}
+
+static void result_from_string_ut()
+{
+	IP4_ADDRESS ip;
+
+	utassert(IpUpdateOk == IpUpdateResultParse("good 67.215.65.132", &ip));
+	utassert(0x43d74184 == ip);
+	utassert(IpUpdateOk == IpUpdateResultParse("NOCHG 1.2.3.4\r\n", &ip));
+	utassert(0x01020304 == ip);
+	utassert(IpUpdateNotYours == IpUpdateResultParse("!yours 255.0.0.1", &ip));
+	utassert(0xff000001 == ip);
+	utassert(IpUpdateOk == IpUpdateResultParse("good", &ip));
+	utassert(0 == ip);
+	// not a valid ip
+	utassert(IpUpdateOk == IpUpdateResultParse("good 1.2.3", &ip));
+	utassert(0 == ip);
+	utassert(IpUpdateOk == IpUpdateResultParse("good 1.2.3.256", &ip));
+	utassert(0 == ip);
+	utassert(IpUpdateOk == IpUpdateResultParse("good 1.2.3.0004", &ip));
+	utassert(0 == ip);
+
+	utassert(IpUpdateBadAuth == IpUpdateResultFromString("badauth"));
+	utassert(IpUpdateMiscErr == IpUpdateResultFromString("badagent"));
+	utassert(IpUpdateNoHost == IpUpdateResultFromString("nohost"));
+	utassert(IpUpdateMiscErr == IpUpdateResultFromString("notfqdn"));
+	utassert(IpUpdateMiscErr == IpUpdateResultFromString("numhost"));
+	utassert(IpUpdateDnsErr == IpUpdateResultFromString("dnserr"));
+	utassert(IpUpdateDnsErr == IpUpdateResultFromString("911"));
+	utassert(IpUpdateMiscErr == IpUpdateResultFromString("abuse"));
+	utassert(IpUpdateMiscErr == IpUpdateResultFromString("!donator"));
+	utassert(IpUpdateNotAvailable == IpUpdateResultFromString("The service is not available"));
+
+	// unknown codes and prefixes of known codes
+	utassert(IpUpdateUnknown == IpUpdateResultFromString(""));
+	utassert(IpUpdateUnknown == IpUpdateResultFromString("goo"));
+	utassert(IpUpdateUnknown == IpUpdateResultFromString("no"));
+	utassert(IpUpdateUnknown == IpUpdateResultFromString("badau"));
+	utassert(IpUpdateUnknown == IpUpdateResultFromString("<html>"));
+	utassert(IpUpdateUnknown == IpUpdateResultFromString("~good"));
+
+	// they're retried like server errors, known errors aren't
+	utassert(IpUpdateFailedOnServer("<html>"));
+	utassert(IpUpdateFailedOnServer("dnserr"));
+	utassert(!IpUpdateFailedOnServer("numhost"));
+	utassert(!IpUpdateFailedOnServer("good 1.2.3.4"));
+
+	utassert(IpUpdateResponseForRequest("BadAuth"));
+	utassert(IpUpdateResponseForRequest("!donator"));
+	utassert(IpUpdateResponseForRequest("abuse"));
+	utassert(IpUpdateResponseForRequest("911"));
+	utassert(IpUpdateResponseForRequest("the service is not available"));
+	utassert(!IpUpdateResponseForRequest("good 1.2.3.4"));
+	utassert(!IpUpdateResponseForRequest("nohost"));
+	utassert(!IpUpdateResponseForRequest("<html>"));
+}
+
+static void batch_size_ut()
+{
+	const char *hostnames[IP_UPDATE_MAX_HOSTS_PER_REQUEST + 5];
+	char buf[64];
+	for (int i=0; i < dimof(hostnames); i++)
+		hostnames[i] = "net";
+
+	int n = IpUpdateBatchSize(hostnames, dimof(hostnames), 100);
+	utassert(IP_UPDATE_MAX_HOSTS_PER_REQUEST == n);
+	n = IpUpdateBatchSize(hostnames, 3, 100);
+	utassert(3 == n);
+
+	// "net" + "%2C" is 6 chars, except the first
+	n = IpUpdateBatchSize(hostnames, 10, IP_UPDATE_MAX_URL_LEN - 3 - 6*2);
+	utassert(3 == n);
+
+	// one hostname always goes, even if too long
+	memset(buf, 'a', sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = 0;
+	hostnames[0] = buf;
+	n = IpUpdateBatchSize(hostnames, 10, IP_UPDATE_MAX_URL_LEN);
+	utassert(1 == n);
+}
+
+static void hostnames_from_prefs_ut()
+{
+	char *savedHostname = g_pref_hostname;
+	char *savedHostnames = g_pref_hostnames;
+	char **hostnames;
+	int count;
+
+	g_pref_hostname = "home";
+	g_pref_hostnames = NULL;
+	hostnames = IpUpdateHostnamesFromPrefs(&count);
+	utassert(1 == count);
+	utassert(streq("home", hostnames[0]));
+	IpUpdateHostnamesFree(hostnames, count);
+
+	g_pref_hostnames = " office, HOME,,cabin ";
+	hostnames = IpUpdateHostnamesFromPrefs(&count);
+	utassert(3 == count);
+	utassert(streq("home", hostnames[0]));
+	utassert(streq("office", hostnames[1]));
+	utassert(streq("cabin", hostnames[2]));
+	IpUpdateHostnamesFree(hostnames, count);
+
+	// default network
+	g_pref_hostname = "";
+	hostnames = IpUpdateHostnamesFromPrefs(&count);
+	utassert(3 == count);
+	utassert(streq("office", hostnames[0]));
+	IpUpdateHostnamesFree(hostnames, count);
+
+	g_pref_hostname = savedHostname;
+	g_pref_hostnames = savedHostnames;
+}
+
+void send_ip_update_ut_all()
+{
+	result_from_string_ut();
+	parse_batch_response_ut();
+	batch_size_ut();
+	hostnames_from_prefs_ut();
+}
+
+// how IpUpdateResultFromString() used to match codes, for comparison.
+// Returns the index of the code
+static int MatchCodeLinear(const char *s)
+{
+	static const char *codes[] = { "The service is not available", "good",
+		"nochg", "!yours", "badauth", "nohost", "dnserr", "911", "abuse",
+		"notfqdn", "numhost", "badagent", "!donator" };
+	for (int i=0; i < dimof(codes); i++) {
+		if (StrStartsWithI(s, codes[i]))
+			return i;
+	}
+	return -1;
+}
+
+static void result_from_string_bench()
+{
+	// typical responses of a batched update, and the worst case
+	static const char *lines[] = { "good 67.215.65.132", "nochg 67.215.65.132",
+		"nohost", "!donator" };
+	const int iterations = 1000000;
+	int total = 0;
+	for (int i=0; i < dimof(lines); i++) {
+		fprintf(stderr, "\nresponse '%s'", lines[i]);
+		double start = benchTimeMs();
+		for (int j=0; j < iterations; j++)
+			total += MatchCodeLinear(lines[i]);
+		benchReport("  StrStartsWithI() chain", iterations, benchTimeMs() - start);
+
+		start = benchTimeMs();
+		for (int j=0; j < iterations; j++)
+			total += IpUpdateResultFromString(lines[i]);
+		benchReport("  IpUpdateResultFromString()", iterations, benchTimeMs() - start);
+
+		IP4_ADDRESS ip;
+		start = benchTimeMs();
+		for (int j=0; j < iterations; j++)
+			total += IpUpdateResultParse(lines[i], &ip);
+		benchReport("  IpUpdateResultParse()", iterations, benchTimeMs() - start);
+	}
+	// so that the loops are not optimized out
+	utassert(total != -1);
+}
+
+void send_ip_update_bench_all()
+{
+	result_from_string_bench();
+}
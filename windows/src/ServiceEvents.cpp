@@ -0,0 +1,82 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "ServiceEvents.h"
+#include "MiscUtil.h"
+
+static inline DWORD SlotSeq(DWORD n)
+{
+	return 2 * n + 2;
+}
+
+static inline ServiceEventSlot *SlotFor(ServiceEventRing *r, DWORD n)
+{
+	return &r->slots[n & (SERVICE_EVENTS_COUNT - 1)];
+}
+
+void ServiceEventPublish(ServiceEventRing *r, const ServiceEvent *ev)
+{
+	DWORD n = (DWORD)r->head;
+	ServiceEventSlot *slot = SlotFor(r, n);
+	// Interlocked*() are full barriers, so the event isn't written before
+	// the slot is marked and isn't visible before it's complete
+	InterlockedExchange(&slot->seq, (LONG)(SlotSeq(n) - 1));
+	memcpy((void*)&slot->ev, ev, sizeof(slot->ev));
+	InterlockedExchange(&slot->seq, (LONG)SlotSeq(n));
+	InterlockedExchange(&r->head, (LONG)(n + 1));
+}
+
+void ServiceEventCursorInit(ServiceEventCursor *c, ServiceEventRing *r)
+{
+	c->next = (DWORD)r->head;
+	c->lost = 0;
+}
+
+bool ServiceEventRead(ServiceEventRing *r, ServiceEventCursor *c, ServiceEvent *evOut)
+{
+	for (;;) {
+		DWORD head = (DWORD)r->head;
+		MemoryBarrier();
+		if (c->next == head)
+			return false;
+		// events older than the last SERVICE_EVENTS_COUNT are gone
+		if (head - c->next > SERVICE_EVENTS_COUNT) {
+			c->lost += head - c->next - SERVICE_EVENTS_COUNT;
+			c->next = head - SERVICE_EVENTS_COUNT;
+		}
+
+		ServiceEventSlot *slot = SlotFor(r, c->next);
+		DWORD want = SlotSeq(c->next);
+		if ((DWORD)slot->seq == want) {
+			MemoryBarrier();
+			memcpy(evOut, (const void*)&slot->ev, sizeof(*evOut));
+			MemoryBarrier();
+			if ((DWORD)slot->seq == want) {
+				evOut->text[dimof(evOut->text) - 1] = 0;
+				c->next++;
+				return true;
+			}
+		}
+		// the producer lapped us and is overwriting the slot (or already
+		// has), so the event is lost
+		c->lost++;
+		c->next++;
+	}
+}
+
+void ServiceEventsMarkConsumer(ServiceEventRing *r, DWORD nowMs)
+{
+	InterlockedExchange(&r->consumerTickMs, (LONG)nowMs);
+}
+
+bool ServiceEventsHaveConsumer(ServiceEventRing *r, DWORD nowMs)
+{
+	DWORD lastMs = (DWORD)r->consumerTickMs;
+	if (0 == lastMs)
+		return false;
+	// GetTickCount() wraps around, so compare the difference
+	return nowMs - lastMs < SERVICE_EVENTS_CONSUMER_TIMEOUT_MS;
+}
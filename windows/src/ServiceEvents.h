@@ -0,0 +1,44 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SERVICE_EVENTS_H__
+#define SERVICE_EVENTS_H__
+
+#include "SharedData.h"
+
+/* Events published by the network owner (usually the service) for the ui,
+in a ring in the shared memory. There's one producer (callers of
+ServiceEventPublish() must make sure of that) and any number of consumers,
+each with its own cursor. Consumers don't take any locks and don't slow
+down the producer: a consumer that falls more than SERVICE_EVENTS_COUNT
+events behind loses the oldest ones, which its cursor counts.
+
+A slot's seq tells which event is in it. The producer makes it odd before
+overwriting the slot and sets it to the new event's value after, so a
+consumer that sees the same, expected seq before and after copying an
+event knows the copy is whole.
+*/
+
+// consumers that weren't marked for that long are gone. NetworkOwner marks
+// them on every heartbeat, not only when they read
+#define SERVICE_EVENTS_CONSUMER_TIMEOUT_MS	(5*1000)
+
+typedef struct {
+	// number of the next event to read
+	DWORD	next;
+	// events that were overwritten before we read them
+	DWORD	lost;
+} ServiceEventCursor;
+
+void ServiceEventPublish(ServiceEventRing *r, const ServiceEvent *ev);
+
+// Starts after the most recent event
+void ServiceEventCursorInit(ServiceEventCursor *c, ServiceEventRing *r);
+// Returns false if there are no new events
+bool ServiceEventRead(ServiceEventRing *r, ServiceEventCursor *c, ServiceEvent *evOut);
+
+void ServiceEventsMarkConsumer(ServiceEventRing *r, DWORD nowMs);
+bool ServiceEventsHaveConsumer(ServiceEventRing *r, DWORD nowMs);
+
+#endif
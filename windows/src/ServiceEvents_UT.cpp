@@ -0,0 +1,167 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "ServiceEvents.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+#include "UnitTests.h"
+
+#define STRESS_EVENTS	200000
+#define STRESS_READERS	3
+
+static void MakeEvent(ServiceEvent *ev, DWORD n)
+{
+	memzero(ev, sizeof(*ev));
+	ev->type = ServiceEventIpUpdate;
+	ev->tickMs = n;
+	ev->ip = n * 2654435761U;
+	ev->latencyMs = ~n;
+	sprintf(ev->text, "good %u", n);
+}
+
+// an event that was torn by the producer wouldn't pass this
+static bool EventValid(const ServiceEvent *ev)
+{
+	char buf[32];
+	DWORD n = ev->tickMs;
+	if ((ev->ip != n * 2654435761U) || (ev->latencyMs != ~n))
+		return false;
+	sprintf(buf, "good %u", n);
+	return streq(buf, ev->text);
+}
+
+static void service_events_read_ut()
+{
+	ServiceEventRing *r = SAZ(ServiceEventRing);
+	if (!r)
+		return;
+	ServiceEventCursor c;
+	ServiceEvent ev;
+	bool ok;
+	ServiceEventCursorInit(&c, r);
+	ok = ServiceEventRead(r, &c, &ev);
+	utassert(!ok);
+
+	for (DWORD n = 0; n < 3; n++) {
+		MakeEvent(&ev, n);
+		ServiceEventPublish(r, &ev);
+	}
+	// utassert() evaluates its argument twice
+	for (DWORD n = 0; n < 3; n++) {
+		ok = ServiceEventRead(r, &c, &ev);
+		utassert(ok && EventValid(&ev) && (n == ev.tickMs));
+	}
+	ok = ServiceEventRead(r, &c, &ev);
+	utassert(!ok);
+	utassert(0 == c.lost);
+
+	// a new cursor only sees new events
+	ServiceEventCursor c2;
+	ServiceEventCursorInit(&c2, r);
+	MakeEvent(&ev, 3);
+	ServiceEventPublish(r, &ev);
+	ok = ServiceEventRead(r, &c2, &ev);
+	utassert(ok && (3 == ev.tickMs));
+	ok = ServiceEventRead(r, &c2, &ev);
+	utassert(!ok);
+
+	// falling behind by more than the ring holds loses the oldest
+	for (DWORD n = 4; n < 4 + SERVICE_EVENTS_COUNT + 5; n++) {
+		MakeEvent(&ev, n);
+		ServiceEventPublish(r, &ev);
+	}
+	ok = ServiceEventRead(r, &c, &ev);
+	utassert(ok && (4 + 5 == ev.tickMs));
+	utassert(1 + 5 == c.lost);
+	free(r);
+}
+
+static void service_events_consumer_ut()
+{
+	ServiceEventRing *r = SAZ(ServiceEventRing);
+	if (!r)
+		return;
+	utassert(!ServiceEventsHaveConsumer(r, 1000));
+	ServiceEventsMarkConsumer(r, 1000);
+	utassert(ServiceEventsHaveConsumer(r, 1000 + SERVICE_EVENTS_CONSUMER_TIMEOUT_MS - 1));
+	utassert(!ServiceEventsHaveConsumer(r, 1000 + SERVICE_EVENTS_CONSUMER_TIMEOUT_MS));
+	// GetTickCount() wrap-around
+	ServiceEventsMarkConsumer(r, 0xfffffff0);
+	utassert(ServiceEventsHaveConsumer(r, 0x10));
+	free(r);
+}
+
+typedef struct {
+	ServiceEventCursor	cursor;
+	DWORD				read;
+	bool				ok;
+} StressReader;
+
+static ServiceEventRing *gStressRing;
+
+static DWORD WINAPI ProducerThread(LPVOID /* param */)
+{
+	ServiceEvent ev;
+	for (DWORD n = 0; n < STRESS_EVENTS; n++) {
+		MakeEvent(&ev, n);
+		ServiceEventPublish(gStressRing, &ev);
+	}
+	return 0;
+}
+
+static DWORD WINAPI ReaderThread(LPVOID param)
+{
+	StressReader *reader = (StressReader*)param;
+	ServiceEvent ev;
+	DWORD prev = (DWORD)-1;
+	while (reader->read + reader->cursor.lost < STRESS_EVENTS) {
+		if (!ServiceEventRead(gStressRing, &reader->cursor, &ev))
+			continue;
+		// events are whole and in order, even if some were lost
+		if (!EventValid(&ev) || ((DWORD)-1 != prev && ev.tickMs <= prev))
+			reader->ok = false;
+		prev = ev.tickMs;
+		reader->read++;
+	}
+	return 0;
+}
+
+// readers never block the producer and never see a half-written event
+static void service_events_stress_ut()
+{
+	gStressRing = SAZ(ServiceEventRing);
+	if (!gStressRing)
+		return;
+	StressReader readers[STRESS_READERS];
+	HANDLE threads[STRESS_READERS + 1];
+	for (int i=0; i < STRESS_READERS; i++) {
+		ServiceEventCursorInit(&readers[i].cursor, gStressRing);
+		readers[i].read = 0;
+		readers[i].ok = true;
+		threads[i] = CreateThread(NULL, 0, ReaderThread, &readers[i], 0, NULL);
+	}
+	threads[STRESS_READERS] = CreateThread(NULL, 0, ProducerThread, NULL, 0, NULL);
+	for (int i=0; i < dimof(threads); i++) {
+		if (threads[i]) {
+			WaitForSingleObject(threads[i], INFINITE);
+			CloseHandle(threads[i]);
+		}
+	}
+	for (int i=0; i < STRESS_READERS; i++) {
+		utassert(readers[i].ok);
+		utassert(readers[i].read > 0);
+	}
+	free(gStressRing);
+	gStressRing = NULL;
+}
+
+void service_events_ut_all()
+{
+	service_events_read_ut();
+	service_events_consumer_ut();
+	service_events_stress_ut();
+}
@@ -0,0 +1,333 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "ServiceLoop.h"
+#include "DnsQuery.h"
+#include "EventLog.h"
+#include "MiscUtil.h"
+#include "NetworkOwner.h"
+#include "Prefs.h"
+#include "RetryPolicy.h"
+#include "SimpleLog.h"
+#include "StrUtil.h"
+
+ServiceLoop::ServiceLoop(ServiceEnv *env) :
+	m_env(env),
+	m_timers(NULL),
+	m_prevIp(IP_UNKNOWN),
+	m_prevIpUpdateResult(IpUpdateOk),
+	m_lastIpUpdateMs(0)
+{
+	IpCheckScheduleInit(&m_ipCheckSchedule, false);
+}
+
+ServiceLoop::~ServiceLoop()
+{
+	TimerWheelDelete(m_timers);
+}
+
+bool ServiceLoop::Start(bool haveNotifier)
+{
+	ULONGLONG nowMs = m_env->NowMs();
+	m_timers = TimerWheelNew(nowMs);
+	if (!m_timers)
+		return false;
+	IpCheckScheduleInit(&m_ipCheckSchedule, haveNotifier);
+
+	TimerInit(&m_ownerTimer, OnOwnerTimer, this);
+	TimerWheelSchedule(m_timers, &m_ownerTimer, nowMs, 0);
+	TimerInit(&m_ipCheckTimer, OnIpCheckTimer, this);
+	TimerWheelSchedule(m_timers, &m_ipCheckTimer, nowMs, 0);
+	// the first ip check sends an update, so the periodic one can wait
+	m_lastIpUpdateMs = nowMs;
+	TimerInit(&m_ipUpdateTimer, OnIpUpdateTimer, this);
+	TimerWheelSchedule(m_timers, &m_ipUpdateTimer, nowMs + IP_UPDATE_PERIOD_MS, IP_UPDATE_PERIOD_MS);
+	// the ui doesn't check for upgrades while we're running, it waits for
+	// us to publish what we found
+	TimerInit(&m_upgradeCheckTimer, OnUpgradeCheckTimer, this);
+	TimerWheelSchedule(m_timers, &m_upgradeCheckTimer, nowMs, UPGRADE_CHECK_PERIOD_MS);
+	return true;
+}
+
+void ServiceLoop::RunTimers()
+{
+	TimerWheelAdvance(m_timers, m_env->NowMs());
+}
+
+DWORD ServiceLoop::MsToNextTimer()
+{
+	return TimerWheelMsToNext(m_timers, m_env->NowMs());
+}
+
+void ServiceLoop::NetworkChanged()
+{
+	IpCheckScheduleNetworkChanged(&m_ipCheckSchedule);
+	TimerWheelSchedule(m_timers, &m_ipCheckTimer, m_env->NowMs(), 0);
+}
+
+void ServiceLoop::WokenUp()
+{
+	TimerWheelSchedule(m_timers, &m_ownerTimer, m_env->NowMs(), 0);
+}
+
+// <published> is true if <resp> was published as the result the ui shows
+void ServiceLoop::HandleIpUpdateResponse(const char *resp, bool published)
+{
+	// those get retried, and shouldn't stop us from telling the user about
+	// a later "badauth"
+	if (IpUpdateFailedOnServer(resp))
+		return;
+
+	IpUpdateResult result = IpUpdateResultFromString(resp);
+	if ((IpUpdateNotYours != result) && (IpUpdateBadAuth != result)) {
+		// whatever we told the user about is fixed, tell them about
+		// the next problem
+		m_prevIpUpdateResult = IpUpdateOk;
+		return;
+	}
+
+	if (result == m_prevIpUpdateResult) {
+		// Already told the user about it, silently ignore.
+		// We don't want to flood the user with too many
+		// messages
+		return;
+	}
+	m_prevIpUpdateResult = result;
+
+	if (m_env->GuiIsListening()) {
+		if (!published)
+			m_env->PublishEvent(ServiceEventUpdateError, resp);
+		return;
+	}
+
+	if (IpUpdateNotYours == m_prevIpUpdateResult) {
+		m_env->LaunchGui(CMD_ARG_NOT_YOURS);
+		return;
+	}
+
+	if (IpUpdateBadAuth == m_prevIpUpdateResult) {
+		m_env->LaunchGui(CMD_ARG_BAD_AUTH);
+		return;
+	}
+}
+
+DWORD IpUpdateRetryMs()
+{
+	DWORD delayMs = RetryEndpointMsLeft(RetryEndpointIpUpdate);
+	if (delayMs < IP_UPDATE_MIN_RETRY_MS)
+		delayMs = IP_UPDATE_MIN_RETRY_MS;
+	return delayMs;
+}
+
+// Sends a failed update again when the backoff says so, instead of with
+// the next periodic one. The 3 hrs period starts over after the retry
+void ServiceLoop::ScheduleIpUpdateRetry()
+{
+	DWORD delayMs = IpUpdateRetryMs();
+	slogfmt("ip update failed, trying again in %d s\n", (int)(delayMs / 1000));
+	TimerWheelSchedule(m_timers, &m_ipUpdateTimer, m_env->NowMs() + delayMs, IP_UPDATE_PERIOD_MS);
+}
+
+static void LogIpUpdate(char *resp)
+{
+	assert(g_pref_user_name);
+	const char *urlTxt = GetIpUpdateUrl(FALSE);
+	// a single message, so that it isn't split by messages from other threads
+	slogfmt("sent ip update for user '%s', response: '%s'  url: %s host: %s\n",
+		g_pref_user_name ? g_pref_user_name : "", resp ? resp : "",
+		urlTxt ? urlTxt : "", GetIpUpdateHost());
+	free((void*)urlTxt);
+}
+
+// returns true if any of the networks should be updated again soon
+bool ServiceLoop::SendIpUpdateBatchFromService(const char **hostnames, int count)
+{
+	bool failed = false;
+	IpUpdateHostResult *results = SendIpUpdateBatch(hostnames, count);
+	// the user is told about the first network the update was refused
+	// for, if there is one
+	IpUpdateHostResult *refused = NULL;
+	IpUpdateHostResult *answered = NULL;
+	// the ui only shows the status of the first network
+	if (results)
+		m_env->PublishIpUpdateResult(results->response, results->latencyMs);
+	for (IpUpdateHostResult *r = results; r; r = r->next) {
+		slogfmt("sent batched ip update for network '%s', response: '%s'\n",
+			r->hostname, r->response ? r->response : "");
+		int result = r->response ? r->result : EVENT_RESULT_NO_RESPONSE;
+		EventLogWrite(EventIpUpdate, r->ip, GetIpUpdateHost(), r->hostname, result, r->latencyMs);
+		if (IpUpdateFailedOnServer(r->response)) {
+			failed = true;
+			continue;
+		}
+		if (!answered)
+			answered = r;
+		if (!refused && ((IpUpdateNotYours == r->result) || (IpUpdateBadAuth == r->result)))
+			refused = r;
+	}
+	if (refused)
+		answered = refused;
+	if (answered)
+		HandleIpUpdateResponse(answered->response, answered == results);
+	IpUpdateHostResultFreeList(results);
+	return failed;
+}
+
+void ServiceLoop::SendIpUpdateFromService()
+{
+	// any update, not only the periodic one, restarts the 3 hrs period
+	m_lastIpUpdateMs = m_env->NowMs();
+	TimerWheelSchedule(m_timers, &m_ipUpdateTimer, m_lastIpUpdateMs + IP_UPDATE_PERIOD_MS, IP_UPDATE_PERIOD_MS);
+	if (m_env->IsPaused())
+		return;
+
+	bool failed;
+	int count;
+	char **hostnames = IpUpdateHostnamesFromPrefs(&count);
+	if (count > 1) {
+		failed = SendIpUpdateBatchFromService((const char**)hostnames, count);
+	} else {
+		ULONGLONG startMs = m_env->NowMs();
+		char *resp = SendIpUpdate();
+		DWORD latencyMs = (DWORD)(m_env->NowMs() - startMs);
+		LogIpUpdate(resp);
+		IP4_ADDRESS ip = 0;
+		int result = resp ? IpUpdateResultParse(resp, &ip) : EVENT_RESULT_NO_RESPONSE;
+		EventLogWrite(EventIpUpdate, ip, GetIpUpdateHost(), g_pref_hostname, result, latencyMs);
+		if (resp)
+			m_env->PublishIpUpdateResult(resp, latencyMs);
+		HandleIpUpdateResponse(resp, true);
+		failed = IpUpdateFailedOnServer(resp);
+		free(resp);
+	}
+	IpUpdateHostnamesFree(hostnames, count);
+	if (failed)
+		ScheduleIpUpdateRetry();
+}
+
+void ServiceLoop::CheckForSoftwareUpgrade()
+{
+	TimerWheelSchedule(m_timers, &m_upgradeCheckTimer, m_env->NowMs() + UPGRADE_CHECK_PERIOD_MS, UPGRADE_CHECK_PERIOD_MS);
+	slog("CheckForSoftwareUpgrade()\n");
+	// once a day is often enough to see how our servers have been doing
+	RetryEndpointsLogStats();
+
+	char *url = GetUpdateUrl(PROGRAM_VERSION, UpdateCheckVersionCheck);
+	if (!url)
+		return;
+	// the ui downloads it from there, without checking again
+	m_env->PublishNewVersion(url);
+	free(url);
+
+	// found an update - launch the UI asking it to check for an upgrade
+	// because a service can't show any UI
+
+	// TODO: make it less obnoxious if a user didn't choose to
+	// upgrade
+	if (m_env->GuiIsListening())
+		return;
+	slog("launching ui with /upgradecheck\n");
+	m_env->LaunchGui(CMD_ARG_UPGRADE_CHECK);
+}
+
+void ServiceLoop::MyIpChanged(IP4_ADDRESS myNewIp)
+{
+	if (myNewIp == m_prevIp)
+		return;
+
+	bool wasPrevOk = RealIpAddress(m_prevIp);
+	m_prevIp = myNewIp;
+	if (RealIpAddress(myNewIp))
+		EventLogWrite(EventIpChanged, Ip4NetworkToHostOrder(myNewIp), NULL, NULL, 0, 0);
+	else
+		EventLogWrite(EventIpChanged, 0, NULL, NULL, myNewIp, 0);
+	if (RealIpAddress(myNewIp))
+		SendIpUpdateFromService();
+
+	// notify the user via launching UI if we're not using
+	// OpenDNS servers
+	if (myNewIp != IP_NOT_USING_OPENDNS)
+		return;
+
+	// if it was bad before, don't bother
+	if (!wasPrevOk)
+		return;
+	// a running ui got the new ip from PublishIp()
+	if (m_env->GuiIsListening())
+		return;
+	m_env->LaunchGui(CMD_ARG_NOT_USING_UPENDNS);
+}
+
+void ServiceLoop::PeriodicIpCheck(bool force)
+{
+	if (force)
+		IpCheckScheduleForce(&m_ipCheckSchedule);
+	// IpCheckSchedule only needs differences, which the low 32 bits have
+	DWORD nowMs = (DWORD)m_env->NowMs();
+	if (IpCheckScheduleDue(&m_ipCheckSchedule, nowMs)) {
+		IP4_ADDRESS myIp = m_env->GetMyIp();
+		nowMs = (DWORD)m_env->NowMs();
+		IpCheckScheduleChecked(&m_ipCheckSchedule, nowMs, myIp != m_prevIp);
+		m_env->PublishIp(myIp);
+		MyIpChanged(myIp);
+	}
+	DWORD msLeft = IpCheckScheduleMsLeft(&m_ipCheckSchedule, nowMs);
+	TimerWheelSchedule(m_timers, &m_ipCheckTimer, m_env->NowMs() + msLeft, 0);
+}
+
+// the ui asked for an ip update e.g. because the user changed the network
+void ServiceLoop::HandleIpUpdateRequest()
+{
+	if (!m_env->TakeIpUpdateRequest())
+		return;
+	ULONGLONG timePassedInMs = m_env->NowMs() - m_lastIpUpdateMs;
+	if (timePassedInMs < MIN_FORCED_UPDATE_INTERVAL_MS)
+		return;
+	slog("sending ip update requested by ui\n");
+	SendIpUpdateFromService();
+}
+
+// Runs when we start and when we're woken up. The lease is renewed by
+// NetworkOwner's own thread, so there's nothing to do periodically unless
+// there's no shared state to renew it in
+void ServiceLoop::OnOwnerTimer(void *ctx)
+{
+	ServiceLoop *self = (ServiceLoop*)ctx;
+	bool owner = self->m_env->Tick();
+	if (!self->m_env->HasSharedState())
+		TimerWheelSchedule(self->m_timers, &self->m_ownerTimer, self->m_env->NowMs() + NETWORK_OWNER_REOPEN_MS, 0);
+	if (!owner)
+		return;
+	if (self->m_env->BecameOwner()) {
+		slog("became network owner\n");
+		self->PeriodicIpCheck(true);
+	}
+	self->HandleIpUpdateRequest();
+}
+
+// the other timers keep running when another process owns the network,
+// they just don't do anything. The ip check isn't re-armed until we
+// become the owner
+void ServiceLoop::OnIpCheckTimer(void *ctx)
+{
+	ServiceLoop *self = (ServiceLoop*)ctx;
+	if (self->m_env->IsOwner())
+		self->PeriodicIpCheck(false);
+}
+
+void ServiceLoop::OnIpUpdateTimer(void *ctx)
+{
+	ServiceLoop *self = (ServiceLoop*)ctx;
+	if (self->m_env->IsOwner())
+		self->SendIpUpdateFromService();
+}
+
+void ServiceLoop::OnUpgradeCheckTimer(void *ctx)
+{
+	ServiceLoop *self = (ServiceLoop*)ctx;
+	if (self->m_env->IsOwner())
+		self->CheckForSoftwareUpgrade();
+}
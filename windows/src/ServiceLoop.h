@@ -0,0 +1,116 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SERVICE_LOOP_H__
+#define SERVICE_LOOP_H__
+
+#include "NetworkChange.h"
+#include "SendIPUpdate.h"
+#include "SharedData.h"
+#include "TimerWheel.h"
+
+/* What the service does, regardless of what it waits on in between:
+checks the ip, sends ip updates when it changes and every 3 hrs, and checks
+for new versions daily. All of it is driven by timers on a TimerWheel.
+Updates that fail because of the servers are tried again as RetryPolicy.h
+says, rather than 3 hrs later.
+
+The outside world (the clock, dns, the network owner lease and the ui) is
+reached through ServiceEnv. Http requests go through the current
+HttpTransport (see HttpSetTransport()). Service.cpp gives it the real
+ones, ServiceSim.h fake ones and a virtual clock. Not thread-safe.
+*/
+
+#define IP_UPDATE_PERIOD_MS				(3*60*60*1000)
+#define UPGRADE_CHECK_PERIOD_MS			(24*60*60*1000)
+// several ip update requests from the ui in a row only result in one update
+#define MIN_FORCED_UPDATE_INTERVAL_MS	(5*1000)
+// however short the backoff, so that nothing can make us send updates
+// in a loop
+#define IP_UPDATE_MIN_RETRY_MS			(5*1000)
+
+class ServiceEnv
+{
+public:
+	virtual ~ServiceEnv() {}
+	// ms that never go back, e.g. from a MonotonicClock
+	virtual ULONGLONG NowMs() = 0;
+	// see GetMyIp() in DnsQuery.h
+	virtual IP4_ADDRESS GetMyIp() = 0;
+
+	// the network owner lease, see NetworkOwner.h
+	virtual bool Tick() = 0;
+	virtual bool IsOwner() = 0;
+	virtual bool BecameOwner() = 0;
+	virtual bool HasSharedState() = 0;
+	virtual bool TakeIpUpdateRequest() = 0;
+	virtual void PublishIp(IP4_ADDRESS ip) = 0;
+	virtual void PublishIpUpdateResult(const char *resp, DWORD latencyMs) = 0;
+	virtual void PublishEvent(ServiceEventType type, const char *text) = 0;
+	virtual void PublishNewVersion(const char *url) = 0;
+
+	// true if a running ui learns about what we publish. Otherwise we
+	// launch the ui with <param> (e.g. CMD_ARG_NOT_YOURS) to tell the user
+	virtual bool GuiIsListening() = 0;
+	virtual void LaunchGui(const TCHAR *param) = 0;
+	// no ip updates are sent while paused
+	virtual bool IsPaused() { return false; }
+};
+
+// how long to wait before sending a failed ip update again: what the
+// backoff for the ip update server says, but at least IP_UPDATE_MIN_RETRY_MS.
+// The ui uses it too when it sends the updates itself
+DWORD	IpUpdateRetryMs();
+
+class ServiceLoop
+{
+public:
+	explicit ServiceLoop(ServiceEnv *env);
+	~ServiceLoop();
+
+	// <haveNotifier> is true if NetworkChanged() gets called, so the ip
+	// doesn't have to be checked as often. Returns false if out of memory
+	bool Start(bool haveNotifier);
+	void RunTimers();
+	// how long to wait before calling RunTimers() again
+	DWORD MsToNextTimer();
+	// checks the ip right away
+	void NetworkChanged();
+	// one of the events we wait on (the lease changing hands, a request
+	// from the ui) was signalled: looks at the lease and at requests from
+	// the ui right away. Nothing else checks them
+	void WokenUp();
+
+	IP4_ADDRESS CurrentIp() const { return m_prevIp; }
+	// for adding timers of our own, they're run by RunTimers()
+	TimerWheel *Timers() const { return m_timers; }
+
+private:
+	void HandleIpUpdateResponse(const char *resp, bool published);
+	void ScheduleIpUpdateRetry();
+	bool SendIpUpdateBatchFromService(const char **hostnames, int count);
+	void SendIpUpdateFromService();
+	void CheckForSoftwareUpgrade();
+	void MyIpChanged(IP4_ADDRESS myNewIp);
+	void PeriodicIpCheck(bool force);
+	void HandleIpUpdateRequest();
+
+	static void OnOwnerTimer(void *ctx);
+	static void OnIpCheckTimer(void *ctx);
+	static void OnIpUpdateTimer(void *ctx);
+	static void OnUpgradeCheckTimer(void *ctx);
+
+	ServiceEnv *		m_env;
+	TimerWheel *		m_timers;
+	Timer				m_ownerTimer;
+	Timer				m_ipCheckTimer;
+	Timer				m_ipUpdateTimer;
+	Timer				m_upgradeCheckTimer;
+	IpCheckSchedule		m_ipCheckSchedule;
+	IP4_ADDRESS			m_prevIp;
+	IpUpdateResult		m_prevIpUpdateResult;
+	ULONGLONG			m_lastIpUpdateMs;
+};
+
+#endif
@@ -0,0 +1,227 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "ServiceSim.h"
+#include "DnsQuery.h"
+#include "HttpTransport.h"
+#include "MiscUtil.h"
+#include "Prefs.h"
+#include "StrUtil.h"
+
+void SimOptionsInit(SimOptions *opts)
+{
+	opts->haveNotifier = true;
+	opts->dnsLatencyMs = 30;
+	opts->httpLatencyMs = 200;
+	opts->httpTimeoutMs = 30*1000;
+	opts->seed = 1;
+}
+
+// The machine and the network as the service sees them. Time only moves
+// when ServiceSimRun() says so or while a request is being made
+class SimEnv : public ServiceEnv
+{
+public:
+	ULONGLONG			m_nowMs;
+	const SimOptions *	m_opts;
+	SimStats *			m_stats;
+	IP4_ADDRESS			m_ip;
+	// when m_ip changed, 0 once the servers heard about it
+	ULONGLONG			m_ipChangedMs;
+	bool				m_serversDown;
+	const char *		m_updateResponse;
+	int					m_ticks;
+
+	SimEnv(const SimOptions *opts, SimStats *stats, IP4_ADDRESS ip) :
+		m_nowMs(0), m_opts(opts), m_stats(stats), m_ip(ip), m_ipChangedMs(0),
+		m_serversDown(false), m_updateResponse(NULL), m_ticks(0) {}
+
+	virtual ULONGLONG NowMs() { return m_nowMs; }
+
+	virtual IP4_ADDRESS GetMyIp() {
+		m_stats->dnsQueries++;
+		m_nowMs += m_opts->dnsLatencyMs;
+		return m_ip;
+	}
+
+	// we're the only process, so we always own the network
+	virtual bool Tick() {
+		m_ticks++;
+		return true;
+	}
+	virtual bool IsOwner() { return true; }
+	virtual bool BecameOwner() { return 1 == m_ticks; }
+	virtual bool HasSharedState() { return true; }
+	virtual bool TakeIpUpdateRequest() { return false; }
+	virtual void PublishIp(IP4_ADDRESS ip) {}
+	virtual void PublishIpUpdateResult(const char *resp, DWORD latencyMs) {}
+	virtual void PublishEvent(ServiceEventType type, const char *text) {}
+	virtual void PublishNewVersion(const char *url) {}
+	virtual bool GuiIsListening() { return false; }
+	virtual void LaunchGui(const TCHAR *param) { m_stats->guiLaunches++; }
+};
+
+// Answers ip updates and upgrade checks the way our servers do
+class SimTransport : public HttpTransport
+{
+public:
+	SimEnv *	m_env;
+
+	explicit SimTransport(SimEnv *env) : m_env(env) {}
+	virtual void Send(const HttpRequest *req, HttpResult *res);
+};
+
+static void AppendStr(HttpResult *res, const char *s)
+{
+	res->data.append(s, strlen(s));
+}
+
+void SimTransport::Send(const HttpRequest *req, HttpResult *res)
+{
+	SimEnv *env = m_env;
+	SimStats *stats = env->m_stats;
+	bool ipUpdate = streq(req->host, GetIpUpdateHost());
+	DWORD latencyMs = env->m_serversDown ? env->m_opts->httpTimeoutMs : env->m_opts->httpLatencyMs;
+	env->m_nowMs += latencyMs;
+
+	if (!ipUpdate) {
+		stats->upgradeChecks++;
+		if (env->m_serversDown)
+			res->error = (DWORD)-1;
+		else
+			AppendStr(res, "{\"upgrade\": false}");
+		return;
+	}
+
+	stats->ipUpdates++;
+	stats->ipUpdateLatencyTotalMs += latencyMs;
+	if (latencyMs > stats->ipUpdateLatencyMaxMs)
+		stats->ipUpdateLatencyMaxMs = latencyMs;
+	if (env->m_serversDown) {
+		stats->ipUpdatesFailed++;
+		res->error = (DWORD)-1;
+		return;
+	}
+	if (env->m_updateResponse) {
+		stats->ipUpdatesFailed++;
+		AppendStr(res, env->m_updateResponse);
+		return;
+	}
+
+	// the servers see the ip the update comes from
+	if (0 != env->m_ipChangedMs) {
+		ULONGLONG delayMs = env->m_nowMs - env->m_ipChangedMs;
+		stats->ipChangesDelivered++;
+		stats->ipChangeDelayTotalMs += delayMs;
+		if (delayMs > stats->ipChangeDelayMaxMs)
+			stats->ipChangeDelayMaxMs = delayMs;
+		env->m_ipChangedMs = 0;
+	}
+	char buf[32];
+	BYTE *b = (BYTE*)&env->m_ip;
+	sprintf(buf, "good %d.%d.%d.%d", b[0], b[1], b[2], b[3]);
+	AppendStr(res, buf);
+}
+
+static ULONGLONG SimNowMs(void *ctx)
+{
+	SimEnv *env = (SimEnv*)ctx;
+	return env->m_nowMs;
+}
+
+static void ApplyEvent(const SimEvent *ev, SimEnv *env, ServiceLoop *loop)
+{
+	switch (ev->type) {
+	case SimIpChange:
+		if (ev->ip == env->m_ip)
+			break;
+		env->m_ip = ev->ip;
+		env->m_ipChangedMs = env->m_nowMs;
+		if (env->m_opts->haveNotifier)
+			loop->NetworkChanged();
+		break;
+	case SimServersDown:
+		env->m_serversDown = true;
+		break;
+	case SimServersUp:
+		env->m_serversDown = false;
+		break;
+	case SimUpdateResponse:
+		env->m_updateResponse = ev->response;
+		break;
+	}
+}
+
+bool ServiceSimRun(const SimOptions *opts, IP4_ADDRESS startIp, const SimEvent *events, int eventsCount, ULONGLONG durationMs, SimStats *statsOut)
+{
+	memzero(statsOut, sizeof(*statsOut));
+	SimEnv env(opts, statsOut, startIp);
+	SimTransport transport(&env);
+	ServiceLoop loop(&env);
+	if (!loop.Start(opts->haveNotifier))
+		return false;
+	RetryEndpointsReset(SimNowMs, &env, opts->seed);
+
+	char *savedUserName = g_pref_user_name;
+	char *savedToken = g_pref_token;
+	char *savedState = g_pref_user_networks_state;
+	char *savedHostname = g_pref_hostname;
+	char *savedHostnames = g_pref_hostnames;
+	g_pref_user_name = "sim";
+	g_pref_token = "simtoken";
+	g_pref_user_networks_state = UNS_OK;
+	g_pref_hostname = "home";
+	g_pref_hostnames = NULL;
+	HttpTransport *prevTransport = HttpSetTransport(&transport);
+
+	int next = 0;
+	while (env.m_nowMs < durationMs) {
+		while ((next < eventsCount) && (events[next].atMs <= env.m_nowMs))
+			ApplyEvent(&events[next++], &env, &loop);
+		loop.RunTimers();
+		statsOut->wakeUps++;
+		ULONGLONG wakeMs = env.m_nowMs + loop.MsToNextTimer();
+		if ((next < eventsCount) && (events[next].atMs < wakeMs))
+			wakeMs = events[next].atMs;
+		// timers scheduled for now run in the wheel's next tick, which
+		// real time would get to on its own
+		if (wakeMs <= env.m_nowMs)
+			wakeMs = env.m_nowMs + 1;
+		env.m_nowMs = wakeMs;
+	}
+
+	RetryEndpointGetStats(RetryEndpointIpUpdate, &statsOut->ipUpdateRetry);
+	RetryEndpointsReset(NULL, NULL, GetTickCount());
+	HttpSetTransport(prevTransport);
+	g_pref_user_name = savedUserName;
+	g_pref_token = savedToken;
+	g_pref_user_networks_state = savedState;
+	g_pref_hostname = savedHostname;
+	g_pref_hostnames = savedHostnames;
+	return true;
+}
+
+void SimStatsReport(const char *name, const SimStats *stats, ULONGLONG durationMs)
+{
+	double days = (double)durationMs / (24*60*60*1000);
+	fprintf(stderr, "\n%s, %.1f days:\n", name, days);
+	fprintf(stderr, "  %d wake ups, %d dns queries, %d upgrade checks, %d ui launches\n",
+		stats->wakeUps, stats->dnsQueries, stats->upgradeChecks, stats->guiLaunches);
+	fprintf(stderr, "  %d ip updates (%.1f a day), %d failed", stats->ipUpdates,
+		stats->ipUpdates / days, stats->ipUpdatesFailed);
+	if (stats->ipUpdates > 0)
+		fprintf(stderr, ", latency avg %d ms max %d ms", (int)(stats->ipUpdateLatencyTotalMs / stats->ipUpdates),
+			(int)stats->ipUpdateLatencyMaxMs);
+	fprintf(stderr, "\n");
+	const RetryStats *retry = &stats->ipUpdateRetry;
+	if ((retry->failures > 0) || (retry->rejected > 0))
+		fprintf(stderr, "  circuit opened %d times, %d updates not sent while open\n",
+			retry->opened, retry->rejected);
+	if (stats->ipChangesDelivered > 0)
+		fprintf(stderr, "  %d ip changes reached the servers after avg %d ms, max %d ms\n",
+			stats->ipChangesDelivered, (int)(stats->ipChangeDelayTotalMs / stats->ipChangesDelivered),
+			(int)stats->ipChangeDelayMaxMs);
+}
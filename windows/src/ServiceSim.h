@@ -0,0 +1,80 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SERVICE_SIM_H__
+#define SERVICE_SIM_H__
+
+#include "RetryPolicy.h"
+#include "ServiceLoop.h"
+
+/* Runs the real ServiceLoop against fake dns and http on a virtual clock,
+so that weeks of the service's life take milliseconds. It's for measuring
+how many requests a client policy sends to our servers and how long it
+takes for an ip change to reach them, before it ships.
+
+A scenario is a list of SimEvents in time order: the ip changing, the
+servers failing every request until they come back, or answering ip
+updates with an error. Requests take a fixed amount of virtual time.
+*/
+
+enum SimEventType {
+	// the ip the servers see becomes SimEvent::ip
+	SimIpChange,
+	// http requests time out until SimServersUp
+	SimServersDown,
+	SimServersUp,
+	// ip updates are answered with SimEvent::response, NULL for the
+	// usual "good $ip"
+	SimUpdateResponse
+};
+
+typedef struct {
+	ULONGLONG		atMs;
+	SimEventType	type;
+	IP4_ADDRESS		ip;
+	const char *	response;
+} SimEvent;
+
+typedef struct {
+	// if false, ip changes are only noticed by polling
+	bool		haveNotifier;
+	DWORD		dnsLatencyMs;
+	DWORD		httpLatencyMs;
+	// how long a request takes to fail when the servers are down
+	DWORD		httpTimeoutMs;
+	// for the random retry delays, runs with the same seed are the same
+	DWORD		seed;
+} SimOptions;
+
+typedef struct {
+	// how many times the loop woke up to run timers
+	int			wakeUps;
+	// resolving myip.opendns.com
+	int			dnsQueries;
+	int			ipUpdates;
+	int			ipUpdatesFailed;
+	int			upgradeChecks;
+	int			guiLaunches;
+	// latency of ip update requests, including the failed ones
+	ULONGLONG	ipUpdateLatencyTotalMs;
+	DWORD		ipUpdateLatencyMaxMs;
+	// from an ip change to the servers getting a successful update from
+	// the new ip. Changes the servers never heard about aren't counted
+	int			ipChangesDelivered;
+	ULONGLONG	ipChangeDelayTotalMs;
+	ULONGLONG	ipChangeDelayMaxMs;
+	// the ip update endpoint at the end of the run
+	RetryStats	ipUpdateRetry;
+} SimStats;
+
+void SimOptionsInit(SimOptions *opts);
+// Runs the service for <durationMs> of virtual time, starting with ip
+// <startIp>. Sets up the prefs needed to send ip updates for a single
+// network and the http transport for the duration of the run. Resets
+// the RetryEndpoint state, before and after
+bool ServiceSimRun(const SimOptions *opts, IP4_ADDRESS startIp, const SimEvent *events, int eventsCount, ULONGLONG durationMs, SimStats *statsOut);
+// prints <stats> of a run called <name> to stderr
+void SimStatsReport(const char *name, const SimStats *stats, ULONGLONG durationMs);
+
+#endif
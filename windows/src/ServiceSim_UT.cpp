@@ -0,0 +1,235 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "ServiceSim.h"
+#include "MiscUtil.h"
+
+#include "UnitTests.h"
+
+#define HOUR_MS	((ULONGLONG)60*60*1000)
+#define DAY_MS	(24*HOUR_MS)
+#define WEEK_MS	(7*DAY_MS)
+
+// 1.2.3.4 etc. as GetMyIp() returns them
+#define SIM_IP1	0x04030201
+#define SIM_IP2	0x08070605
+#define SIM_IP3	0x0c0b0a09
+
+static void SimEventInit(SimEvent *ev, ULONGLONG atMs, SimEventType type, IP4_ADDRESS ip)
+{
+	memzero(ev, sizeof(*ev));
+	ev->atMs = atMs;
+	ev->type = type;
+	ev->ip = ip;
+}
+
+// nothing happens for a week: an update on start and every 3 hrs after,
+// an upgrade check a day, and ip checks no more often than the schedule
+// allows
+static void service_sim_quiet_week_ut()
+{
+	SimOptions opts;
+	SimStats stats;
+	SimOptionsInit(&opts);
+	bool ok = ServiceSimRun(&opts, SIM_IP1, NULL, 0, WEEK_MS, &stats);
+	utassert(ok);
+	utassert(1 + 7*8 - 1 == stats.ipUpdates);
+	utassert(0 == stats.ipUpdatesFailed);
+	utassert(7 == stats.upgradeChecks);
+	utassert(0 == stats.guiLaunches);
+	// a few more while the interval grows to the longest one
+	utassert(stats.dnsQueries <= 4 + (int)(WEEK_MS / IP_CHECK_MAX_INTERVAL_MS));
+	// we only wake up for those, and once when we start
+	utassert(stats.wakeUps <= 1 + stats.dnsQueries + stats.ipUpdates + stats.upgradeChecks);
+}
+
+// with a notifier ip changes reach the servers right away, polling takes
+// up to the longest interval between checks
+static void service_sim_ip_changes_ut()
+{
+	SimEvent events[6];
+	SimEventInit(&events[0], 1*HOUR_MS, SimIpChange, SIM_IP2);
+	SimEventInit(&events[1], 5*HOUR_MS, SimIpChange, SIM_IP3);
+	SimEventInit(&events[2], 1*DAY_MS, SimIpChange, SIM_IP1);
+	SimEventInit(&events[3], 1*DAY_MS + 90*1000, SimIpChange, SIM_IP2);
+	SimEventInit(&events[4], 2*DAY_MS, SimIpChange, SIM_IP3);
+	SimEventInit(&events[5], 2*DAY_MS + 10*60*1000, SimIpChange, SIM_IP1);
+
+	SimOptions opts;
+	SimStats stats;
+	SimOptionsInit(&opts);
+	bool ok = ServiceSimRun(&opts, SIM_IP1, events, dimof(events), 3*DAY_MS, &stats);
+	utassert(ok);
+	utassert(dimof(events) == stats.ipChangesDelivered);
+	utassert(stats.ipChangeDelayMaxMs <= 1000);
+
+	opts.haveNotifier = false;
+	ok = ServiceSimRun(&opts, SIM_IP1, events, dimof(events), 3*DAY_MS, &stats);
+	utassert(ok);
+	utassert(dimof(events) == stats.ipChangesDelivered);
+	utassert(stats.ipChangeDelayMaxMs <= IP_CHECK_MAX_INTERVAL_MS + 1000);
+	utassert(stats.ipChangeDelayMaxMs > 1000);
+}
+
+// an ip change during an outage reaches the servers soon after they're
+// back, without a request every few seconds while they're down
+static void service_sim_outage_ut()
+{
+	SimEvent events[3];
+	SimEventInit(&events[0], 2*HOUR_MS, SimServersDown, 0);
+	SimEventInit(&events[1], 4*HOUR_MS, SimIpChange, SIM_IP2);
+	SimEventInit(&events[2], 10*HOUR_MS, SimServersUp, 0);
+
+	SimOptions opts;
+	SimStats stats;
+	SimOptionsInit(&opts);
+	bool ok = ServiceSimRun(&opts, SIM_IP1, events, dimof(events), DAY_MS, &stats);
+	utassert(ok);
+	utassert(stats.ipUpdatesFailed > 0);
+	utassert(stats.ipUpdatesFailed <= 8 * 10);
+	utassert(1 == stats.ipChangesDelivered);
+	utassert(stats.ipChangeDelayMaxMs <= 6*HOUR_MS + HOUR_MS + opts.httpTimeoutMs);
+	utassert(stats.ipUpdateLatencyMaxMs == opts.httpTimeoutMs);
+	utassert(stats.ipUpdateRetry.opened > 0);
+	utassert(CircuitClosed == stats.ipUpdateRetry.state);
+}
+
+// "the service is not available" is retried within the hour, and doesn't
+// stop the user from being told about bad credentials later
+static void service_sim_not_available_ut()
+{
+	SimEvent events[4];
+	SimEventInit(&events[0], HOUR_MS, SimUpdateResponse, 0);
+	events[0].response = "The service is not available";
+	SimEventInit(&events[1], HOUR_MS + HOUR_MS / 2, SimIpChange, SIM_IP2);
+	SimEventInit(&events[2], 2*HOUR_MS, SimUpdateResponse, 0);
+	SimEventInit(&events[3], 8*HOUR_MS, SimUpdateResponse, 0);
+	events[3].response = "badauth";
+
+	SimOptions opts;
+	SimStats stats;
+	SimOptionsInit(&opts);
+	bool ok = ServiceSimRun(&opts, SIM_IP1, events, dimof(events), DAY_MS, &stats);
+	utassert(ok);
+	utassert(1 == stats.ipChangesDelivered);
+	utassert(stats.ipChangeDelayMaxMs <= HOUR_MS + HOUR_MS / 2);
+	utassert(1 == stats.guiLaunches);
+}
+
+// the user is told about bad credentials once, not on every update
+static void service_sim_bad_auth_ut()
+{
+	SimEvent events[1];
+	SimEventInit(&events[0], HOUR_MS, SimUpdateResponse, 0);
+	events[0].response = "badauth";
+
+	SimOptions opts;
+	SimStats stats;
+	SimOptionsInit(&opts);
+	bool ok = ServiceSimRun(&opts, SIM_IP1, events, dimof(events), DAY_MS, &stats);
+	utassert(ok);
+	utassert(1 == stats.guiLaunches);
+	utassert(stats.ipUpdatesFailed >= 7);
+}
+
+// told again about bad credentials after they were fixed and broke again
+static void service_sim_bad_auth_again_ut()
+{
+	SimEvent events[3];
+	SimEventInit(&events[0], HOUR_MS, SimUpdateResponse, 0);
+	events[0].response = "badauth";
+	SimEventInit(&events[1], 8*HOUR_MS, SimUpdateResponse, 0);
+	SimEventInit(&events[2], 16*HOUR_MS, SimUpdateResponse, 0);
+	events[2].response = "badauth";
+
+	SimOptions opts;
+	SimStats stats;
+	SimOptionsInit(&opts);
+	bool ok = ServiceSimRun(&opts, SIM_IP1, events, dimof(events), DAY_MS, &stats);
+	utassert(ok);
+	utassert(2 == stats.guiLaunches);
+}
+
+// an answer we don't understand is retried like a server error and
+// opens the circuit, instead of hiding a later "badauth"
+static void service_sim_unknown_response_ut()
+{
+	SimEvent events[2];
+	SimEventInit(&events[0], HOUR_MS, SimUpdateResponse, 0);
+	events[0].response = "<html>Bad gateway</html>";
+	SimEventInit(&events[1], 12*HOUR_MS, SimUpdateResponse, 0);
+	events[1].response = "badauth";
+
+	SimOptions opts;
+	SimStats stats;
+	SimOptionsInit(&opts);
+	bool ok = ServiceSimRun(&opts, SIM_IP1, events, dimof(events), DAY_MS, &stats);
+	utassert(ok);
+	utassert(stats.ipUpdateRetry.opened > 0);
+	utassert(1 == stats.guiLaunches);
+}
+
+void service_sim_ut_all()
+{
+	service_sim_quiet_week_ut();
+	service_sim_ip_changes_ut();
+	service_sim_outage_ut();
+	service_sim_not_available_ut();
+	service_sim_bad_auth_ut();
+	service_sim_bad_auth_again_ut();
+	service_sim_unknown_response_ut();
+}
+
+// An ip that changes every <changeEveryMs>, e.g. a flapping connection
+// or a provider that hands out a new address every few minutes
+static SimEvent *BuildFlaps(ULONGLONG durationMs, ULONGLONG changeEveryMs, int *countOut)
+{
+	int count = (int)(durationMs / changeEveryMs);
+	SimEvent *events = (SimEvent*)malloc(count * sizeof(SimEvent));
+	if (!events)
+		return NULL;
+	for (int i=0; i < count; i++)
+		SimEventInit(&events[i], (i + 1) * changeEveryMs, SimIpChange, (i % 2) ? SIM_IP1 : SIM_IP2);
+	*countOut = count;
+	return events;
+}
+
+static void RunAndReport(const char *name, const SimOptions *opts, const SimEvent *events, int count, ULONGLONG durationMs)
+{
+	SimStats stats;
+	double start = benchTimeMs();
+	bool ok = ServiceSimRun(opts, SIM_IP1, events, count, durationMs, &stats);
+	double elapsedMs = benchTimeMs() - start;
+	utassert(ok);
+	SimStatsReport(name, &stats, durationMs);
+	fprintf(stderr, "  simulated in %.2f ms", elapsedMs);
+}
+
+// the server load of the current policy in a few typical situations,
+// over 4 weeks
+void service_sim_bench_all()
+{
+	const ULONGLONG durationMs = 4*WEEK_MS;
+	SimOptions opts;
+	SimOptionsInit(&opts);
+	RunAndReport("quiet", &opts, NULL, 0, durationMs);
+	opts.haveNotifier = false;
+	RunAndReport("quiet, no notifier", &opts, NULL, 0, durationMs);
+	opts.haveNotifier = true;
+
+	int count;
+	SimEvent *events = BuildFlaps(durationMs, 10*60*1000, &count);
+	if (events) {
+		RunAndReport("ip changes every 10 min", &opts, events, count, durationMs);
+		free(events);
+	}
+
+	SimEvent outage[2];
+	SimEventInit(&outage[0], DAY_MS, SimServersDown, 0);
+	SimEventInit(&outage[1], DAY_MS + 12*HOUR_MS, SimServersUp, 0);
+	RunAndReport("12 hrs outage", &opts, outage, dimof(outage), durationMs);
+	fprintf(stderr, "\n");
+}
@@ -9,12 +9,82 @@
 
 /* Data shared via shared memory between the service and UI */
 
+// Which process does the network work (resolving myip, sending ip updates,
+// checking for new versions). The owner renews the lease every
+// NETWORK_OWNER_HEARTBEAT_MS. See NetworkOwner.h
+typedef struct {
+	DWORD ownerPid;
+	DWORD ownerKind;
+	// GetTickCount() time, which is the same for all processes
+	DWORD leaseExpiresMs;
+} NetworkOwnerLease;
+
+#define IP_UPDATE_RESULT_MAX 128
+#define NEW_VERSION_URL_MAX 512
+
+enum ServiceEventType {
+	ServiceEventIpChanged = 1,
+	// result of the update of the network shown by the ui
+	ServiceEventIpUpdate = 2,
+	// update of another network failed because of e.g. !yours or badauth
+	ServiceEventUpdateError = 3,
+	// the owner found a new version, its url is in the state
+	ServiceEventNewVersion = 4
+};
+
+typedef struct {
+	DWORD type;
+	// GetTickCount() time
+	DWORD tickMs;
+	// for ServiceEventIpChanged, as returned by GetMyIp()
+	IP4_ADDRESS ip;
+	// how long the ip update took
+	DWORD latencyMs;
+	// response for ServiceEventIpUpdate and ServiceEventUpdateError
+	char text[IP_UPDATE_RESULT_MAX];
+} ServiceEvent;
+
+// must be a power of 2
+#define SERVICE_EVENTS_COUNT 32
+
+typedef struct {
+	// 2*n+2 once event number n is in the slot, odd while it's being
+	// written. See ServiceEvents.h
+	volatile LONG seq;
+	ServiceEvent ev;
+} ServiceEventSlot;
+
+// Written by the network owner, read by everyone else without locking
+typedef struct {
+	// number of events ever published
+	volatile LONG head;
+	// GetTickCount() time a consumer was last marked (see
+	// NetworkOwnerHeartbeat()), so that the owner knows if someone is
+	// listening
+	volatile LONG consumerTickMs;
+	ServiceEventSlot slots[SERVICE_EVENTS_COUNT];
+} ServiceEventRing;
+
 typedef struct {
 	IP4_ADDRESS currentIpAddress;
+	NetworkOwnerLease owner;
+	// seqlock (see SharedMem.h) for the state below, which the owner
+	// changes with the mutex held and others read without it
+	volatile LONG stateSeq;
+	DWORD lastIpUpdateTickMs;
+	char lastIpUpdateResult[IP_UPDATE_RESULT_MAX];
+	// where the new version the owner found is, empty if it didn't find
+	// one. Others download it from there instead of checking themselves
+	char newVersionUrl[NEW_VERSION_URL_MAX];
+	// set by a process that wants the owner to send an ip update now
+	LONG ipUpdateRequested;
+	ServiceEventRing events;
 } ServiceStateData;
 
+// Global\ so that the service (in session 0) and the ui (in user's
+// session) see the same one
 struct ServiceStateDataName {
-	static const char *name() { return "opendns_ipupdater_servicestate"; }
+	static const char *name() { return "Global\\opendns_ipupdater_servicestate"; }
 };
 
 typedef SharedMemT<ServiceStateData, ServiceStateDataName> ServiceStateSharedData;
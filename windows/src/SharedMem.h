@@ -49,6 +49,8 @@ public:
 	HANDLE			m_mutex;
 	HANDLE			m_requestEvent;
 	HANDLE			m_responseEvent;
+	// used when creating objects, NULL for default security
+	SECURITY_ATTRIBUTES *m_sa;
 
 	void SetRequestEvent() {
 		SetEvent(m_requestEvent);
@@ -58,8 +60,9 @@ public:
 		SetEvent(m_responseEvent);
 	}
 
-	static SharedMem *Create(const char* name, int size) {
+	static SharedMem *Create(const char* name, int size, SECURITY_ATTRIBUTES *sa=NULL) {
 		SharedMem *o = new SharedMem();
+		o->m_sa = sa;
 		bool ok = o->CreateHelper(name, size);
 		if (!ok) {
 			delete o;
@@ -100,25 +103,39 @@ private:
 		, m_mutex(NULL)
 		, m_requestEvent(NULL)
 		, m_responseEvent(NULL)
+		, m_sa(NULL)
 	{
 	}
 
-    bool CreateSyncObjects()
+	// When opening, only asks for the rights we use: Create*() on an
+	// existing object asks for all of them, which the dacl the service
+	// gives its objects doesn't allow
+	HANDLE CreateOrOpenEvent(const char *name, bool open)
+	{
+		if (open)
+			return OpenEventA(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, name);
+		return CreateEventA(m_sa, FALSE, FALSE, name);
+	}
+
+    bool CreateSyncObjects(bool open)
 	{
 		char *mutexName = str_cat(m_name, "_mutex");
-		m_mutex = CreateMutexA(NULL, FALSE, mutexName);
+		if (open)
+			m_mutex = OpenMutexA(SYNCHRONIZE | MUTEX_MODIFY_STATE, FALSE, mutexName);
+		else
+			m_mutex = CreateMutexA(m_sa, FALSE, mutexName);
 		free(mutexName);
 		if (NULL == m_mutex)
 			return false;
 
 		char *requestEventName = str_cat(m_name, "_request_event");
-		m_requestEvent = CreateEventA(NULL, FALSE, FALSE, requestEventName);
+		m_requestEvent = CreateOrOpenEvent(requestEventName, open);
 		free(requestEventName);
 		if (NULL == m_requestEvent)
 			return false;
 
 		char *responseEventName = str_cat(m_name, "_response_event");
-		m_responseEvent = CreateEventA(NULL, FALSE, FALSE, responseEventName);
+		m_responseEvent = CreateOrOpenEvent(responseEventName, open);
 		free(responseEventName);
 		if (NULL == m_responseEvent)
 			return false;
@@ -130,26 +147,26 @@ private:
 		m_size = size;
 		m_name = name;
 		m_memHandle = CreateFileMappingA(INVALID_HANDLE_VALUE,
-							NULL, PAGE_READWRITE, 0, size, name);
+							m_sa, PAGE_READWRITE, 0, size, name);
 		if (NULL == m_memHandle)
 			return false;
 
 		m_mem = MapViewOfFile(m_memHandle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
 		if (!m_mem)
 			return false;
-		return CreateSyncObjects();
+		return CreateSyncObjects(false);
 	}
 
 	bool OpenHelper(const char *name) {
 		m_name = name;
-		m_memHandle = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+		m_memHandle = OpenFileMappingA(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, name);
 		if (NULL == m_memHandle)
 			return false;
 
-		m_mem = MapViewOfFile(m_memHandle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+		m_mem = MapViewOfFile(m_memHandle, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, 0);
 		if (!m_mem)
 			return false;
-		return CreateSyncObjects();
+		return CreateSyncObjects(true);
 	}
 };
 
@@ -157,8 +174,8 @@ template<typename T, typename Name>
 class SharedMemT : public SharedMem
 {
 public:
-	static SharedMemT<T,Name> *Create() {
-		SharedMem *o = SharedMem::Create(Name::name(), sizeof(T));
+	static SharedMemT<T,Name> *Create(SECURITY_ATTRIBUTES *sa=NULL) {
+		SharedMem *o = SharedMem::Create(Name::name(), sizeof(T), sa);
 		return static_cast<SharedMemT<T,Name> *>(o);
 	}
 
@@ -176,6 +193,59 @@ public:
 	}
 };
 
+/* Seqlock for data in shared memory that is changed by one writer at a time
+(e.g. the holder of the SharedMem mutex) and read by many. Readers don't
+take the mutex: they copy the data and check that no write started or
+finished meanwhile, otherwise they copy again. <seq> is odd while a write
+is in progress and a version of the data otherwise. */
+
+// Readers give up if a write seems to never finish
+#define SEQLOCK_MAX_READ_SPINS 1000
+
+class SeqLockWriteGuard {
+public:
+	explicit SeqLockWriteGuard(volatile LONG *seq)
+	{
+		m_seq = seq;
+		m_start = *seq;
+		// a writer died in the middle of a write
+		if (m_start & 1)
+			m_start++;
+		InterlockedExchange(m_seq, m_start + 1);
+	}
+
+	~SeqLockWriteGuard()
+	{
+		InterlockedExchange(m_seq, m_start + 2);
+	}
+private:
+	volatile LONG *	m_seq;
+	LONG			m_start;
+};
+
+// Returns false if a write is in progress for too long. Otherwise, after
+// copying the data, SeqLockReadValid() with <startOut> tells if it's whole
+static inline bool SeqLockReadBegin(volatile LONG *seq, LONG *startOut)
+{
+	for (int spins = 0; spins < SEQLOCK_MAX_READ_SPINS; spins++) {
+		LONG start = *seq;
+		if (0 == (start & 1)) {
+			MemoryBarrier();
+			*startOut = start;
+			return true;
+		}
+		// the writer might have been preempted, let it run
+		Sleep(0);
+	}
+	return false;
+}
+
+static inline bool SeqLockReadValid(volatile LONG *seq, LONG start)
+{
+	MemoryBarrier();
+	return *seq == start;
+}
+
 class SharedMemAutoLock {
 public:
 	explicit SharedMemAutoLock(SharedMem *m)
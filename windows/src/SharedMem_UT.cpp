@@ -0,0 +1,164 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "SharedMem.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+#include "UnitTests.h"
+
+#define STRESS_WRITES	200000
+#define STRESS_READERS	4
+
+// every field is derived from <n>, so a torn read shows
+typedef struct {
+	volatile LONG	seq;
+	DWORD			n;
+	DWORD			notN;
+	char			text[32];
+	DWORD			nAgain;
+} SeqLockTestData;
+
+typedef struct {
+	DWORD	reads;
+	bool	ok;
+} SeqLockReader;
+
+static SeqLockTestData *gStressData;
+static volatile LONG gWriterDone;
+
+static void SetTestData(SeqLockTestData *d, DWORD n)
+{
+	d->n = n;
+	d->notN = ~n;
+	sprintf(d->text, "%u", n);
+	d->nAgain = n;
+}
+
+static bool TestDataValid(const SeqLockTestData *d)
+{
+	char text[32];
+	sprintf(text, "%u", d->n);
+	return (d->notN == ~d->n) && (d->nAgain == d->n) && streq(text, d->text);
+}
+
+static void seqlock_basic_ut()
+{
+	SeqLockTestData *d = SAZ(SeqLockTestData);
+	if (!d)
+		return;
+	LONG start;
+	bool ok = SeqLockReadBegin(&d->seq, &start);
+	utassert(ok && (0 == start));
+	{
+		SeqLockWriteGuard write(&d->seq);
+		utassert(1 == d->seq);
+		// a write in progress fails the read started before it
+		utassert(!SeqLockReadValid(&d->seq, start));
+		SetTestData(d, 1);
+	}
+	utassert(2 == d->seq);
+	ok = SeqLockReadBegin(&d->seq, &start);
+	utassert(ok && (2 == start));
+	utassert(SeqLockReadValid(&d->seq, start));
+
+	// a writer died in the middle of a write: readers give up instead
+	// of spinning forever and the next writer makes the version even
+	d->seq = 3;
+	ok = SeqLockReadBegin(&d->seq, &start);
+	utassert(!ok);
+	{
+		SeqLockWriteGuard write(&d->seq);
+		utassert(5 == d->seq);
+		SetTestData(d, 2);
+	}
+	utassert(6 == d->seq);
+	ok = SeqLockReadBegin(&d->seq, &start);
+	utassert(ok && (6 == start));
+	free(d);
+}
+
+static DWORD WINAPI WriterThread(LPVOID /* param */)
+{
+	for (DWORD n = 1; n <= STRESS_WRITES; n++) {
+		SeqLockWriteGuard write(&gStressData->seq);
+		SetTestData(gStressData, n);
+	}
+	InterlockedExchange(&gWriterDone, 1);
+	return 0;
+}
+
+static DWORD WINAPI ReaderThread(LPVOID param)
+{
+	SeqLockReader *reader = (SeqLockReader*)param;
+	SeqLockTestData copy;
+	DWORD prevN = 0;
+	LONG prevSeq = 0;
+	for (;;) {
+		bool done = (0 != gWriterDone);
+		LONG seq;
+		// the writer is alive, so the version is never odd for long
+		if (!SeqLockReadBegin(&gStressData->seq, &seq))
+			continue;
+		copy.n = gStressData->n;
+		copy.notN = gStressData->notN;
+		memcpy(copy.text, gStressData->text, sizeof(copy.text));
+		copy.nAgain = gStressData->nAgain;
+		if (!SeqLockReadValid(&gStressData->seq, seq))
+			continue;
+		copy.text[dimof(copy.text) - 1] = 0;
+		// snapshots are whole and never go back in time
+		if ((0 != copy.n && !TestDataValid(&copy)) || (seq < prevSeq) || (copy.n < prevN))
+			reader->ok = false;
+		// the version tells how many writes there were
+		if ((DWORD)seq != copy.n * 2)
+			reader->ok = false;
+		prevSeq = seq;
+		prevN = copy.n;
+		reader->reads++;
+		if (done)
+			break;
+	}
+	if (prevN != STRESS_WRITES)
+		reader->ok = false;
+	return 0;
+}
+
+// readers never take a lock and never see a half-written state
+static void seqlock_stress_ut()
+{
+	gStressData = SAZ(SeqLockTestData);
+	if (!gStressData)
+		return;
+	gWriterDone = 0;
+	SeqLockReader readers[STRESS_READERS];
+	HANDLE threads[STRESS_READERS + 1];
+	for (int i=0; i < STRESS_READERS; i++) {
+		readers[i].reads = 0;
+		readers[i].ok = true;
+		threads[i] = CreateThread(NULL, 0, ReaderThread, &readers[i], 0, NULL);
+	}
+	threads[STRESS_READERS] = CreateThread(NULL, 0, WriterThread, NULL, 0, NULL);
+	for (int i=0; i < dimof(threads); i++) {
+		if (threads[i]) {
+			WaitForSingleObject(threads[i], INFINITE);
+			CloseHandle(threads[i]);
+		}
+	}
+	for (int i=0; i < STRESS_READERS; i++) {
+		utassert(readers[i].ok);
+		utassert(readers[i].reads > 0);
+	}
+	utassert(STRESS_WRITES * 2 == gStressData->seq);
+	free(gStressData);
+	gStressData = NULL;
+}
+
+void shared_mem_ut_all()
+{
+	seqlock_basic_ut();
+	seqlock_stress_ut();
+}
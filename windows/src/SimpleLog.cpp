@@ -2,29 +2,61 @@
 
 #include "SimpleLog.h"
 
+#include "AsyncLog.h"
+#include "LogRotate.h"
 #include "MiscUtil.h"
 #include "StrUtil.h"
 
 static const TCHAR *	gLogFileName;
 static FILE *			gLogFile;
+// NULL if we couldn't start the writer thread, then we write directly
+static AsyncLog *		gAsyncLog;
+static LogRotate *		gLogRotate;
+static SLogLevel		gFlushLevel = SLogError;
 bool					gLogToDebugger = true;
 static CRITICAL_SECTION gLogCs;
 
 bool SLogInit(const TCHAR *logFileName)
 {
-#ifdef DEBUG
-	static bool wasHere = false;
-	assert(!wasHere);
-	wasHere = true;
-#endif
+	assert(!gLogFileName);
 	InitializeCriticalSection(&gLogCs);
 	gLogFileName = tstrdup(logFileName);
 	gLogFile = _tfopen(logFileName, _T("ab"));
+	// the writer thread opens the log later if it can't be opened now
+	gAsyncLog = AsyncLogNew(gLogFile, ASYNC_LOG_FLUSH_INTERVAL_MS);
+	// without the writer thread we'd have to rotate while logging
+	if (gAsyncLog)
+		SLogSetRotation(LOG_ROTATE_MAX_SIZE, LOG_ROTATE_MAX_AGE_MINUTES, LOG_ROTATE_MAX_ARCHIVES);
 	return true;
 }
 
+// called on the log writer thread
+static FILE *RotateLog(void *ctx, FILE *f)
+{
+	f = LogRotateIfNeeded((LogRotate*)ctx, f);
+	gLogFile = f;
+	return f;
+}
+
+void SLogSetRotation(long maxSize, DWORD maxAgeMinutes, int maxArchives)
+{
+	if (!gAsyncLog || !gLogFileName)
+		return;
+	LogRotate *r = LogRotateNew(gLogFileName, maxSize, maxAgeMinutes, maxArchives);
+	if (!r)
+		return;
+	AsyncLogSetRotateFunc(gAsyncLog, RotateLog, r);
+	LogRotateFree(gLogRotate);
+	gLogRotate = r;
+}
+
 void SLogStop()
 {
+	AsyncLog *asyncLog = gAsyncLog;
+	gAsyncLog = NULL;
+	AsyncLogFree(asyncLog);
+	LogRotateFree(gLogRotate);
+	gLogRotate = NULL;
 	TStrFree(&gLogFileName);
 	if (gLogFile) {
 		fclose(gLogFile);
@@ -33,21 +65,54 @@ void SLogStop()
 	DeleteCriticalSection(&gLogCs);
 }
 
-// TODO: add critical section to protect logging?
-void slog(const char *s)
+const TCHAR *SLogFileName()
+{
+	return gLogFileName;
+}
+
+void SLogDrain()
+{
+	if (gAsyncLog)
+		AsyncLogDrain(gAsyncLog);
+}
+
+void SLogSetFlushInterval(DWORD flushIntervalMs)
+{
+	if (gAsyncLog)
+		AsyncLogSetFlushInterval(gAsyncLog, flushIntervalMs);
+}
+
+void SLogSetFlushLevel(SLogLevel level)
+{
+	gFlushLevel = level;
+}
+
+void slogl(SLogLevel level, const char *s)
 {
 	if (gLogToDebugger)
 		OutputDebugStringA(s);
+
+	size_t slen = strlen(s);
+	// gLogFile is NULL while the writer can't open the log, it keeps
+	// trying
+	if (gAsyncLog) {
+		AsyncLogWrite(gAsyncLog, s, slen, level >= gFlushLevel);
+		return;
+	}
 	if (!gLogFile)
 		return;
 
 	EnterCriticalSection(&gLogCs);
-	size_t slen = strlen(s);
 	fwrite(s, slen, 1, gLogFile);
 	fflush(gLogFile);
 	LeaveCriticalSection(&gLogCs);
 }
 
+void slog(const char *s)
+{
+	slogl(SLogInfo, s);
+}
+
 void slognl(const char *s)
 {
 	slog(s);
@@ -1,10 +1,32 @@
 #ifndef SIMPLE_LOG_H__
 #define SIMPLE_LOG_H__
 
+// Messages are written to the file by a background thread (see AsyncLog.h).
+// Those at or above the flush level (SLogError by default) are flushed
+// right away, others within the flush interval. The writer thread also
+// rotates the log when it gets too big or too old (see LogRotate.h)
+enum SLogLevel {
+	SLogInfo,
+	SLogError
+};
+
+// can be called again after SLogStop()
 bool SLogInit(const TCHAR *logFileName);
+// writes out all pending messages
 void SLogStop();
+// NULL before SLogInit() and after SLogStop()
+const TCHAR *SLogFileName();
+// like SLogStop() but the log can still be used afterwards. For the crash
+// handler
+void SLogDrain();
+void SLogSetFlushInterval(DWORD flushIntervalMs);
+void SLogSetFlushLevel(SLogLevel level);
+// must be called after SLogInit()
+void SLogSetRotation(long maxSize, DWORD maxAgeMinutes, int maxArchives);
+
 void slog(const char *s);
 void slognl(const char *s);
+void slogl(SLogLevel level, const char *s);
 
 #ifdef UNICODE
 void slog(const WCHAR *s);
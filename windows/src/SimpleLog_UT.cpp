@@ -0,0 +1,52 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "SimpleLog.h"
+#include "MiscUtil.h"
+#include "StrUtil.h"
+
+#include "UnitTests.h"
+
+// A log that can't be opened, e.g. because rotating couldn't reopen it,
+// is opened as soon as it can be and slog() writes to it again
+static void slog_reopen_ut()
+{
+	TCHAR dir[MAX_PATH];
+	TCHAR path[MAX_PATH];
+	GetTempPath(dimof(dir), dir);
+	GetTempFileName(dir, _T("slt"), 0, path);
+	DeleteFile(path);
+
+	// the service starts logging before it runs the tests
+	TCHAR *prevFileName = NULL;
+	if (SLogFileName()) {
+		prevFileName = tstrdup(SLogFileName());
+		SLogStop();
+	}
+
+	// a directory can't be opened as the log
+	CreateDirectory(path, NULL);
+	SLogInit(path);
+	slog("lost\n");
+	SLogDrain();
+	RemoveDirectory(path);
+	slog("kept\n");
+	SLogStop();
+
+	char *s = FileReadAll(path, NULL);
+	utassert(s && streq("kept\n", s));
+	free(s);
+	DeleteFile(path);
+
+	if (prevFileName)
+		SLogInit(prevFileName);
+	free(prevFileName);
+}
+
+void simple_log_ut_all()
+{
+	slog_reopen_ut();
+}
@@ -0,0 +1,51 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef SOCKETS_H__
+#define SOCKETS_H__
+
+// The bits of winsock that aren't plain BSD sockets, for DnsClient.
+// Only what's in winsock 1.1, which <windows.h> already brings in.
+
+typedef int socklen_t;
+
+static inline bool SocketsInit()
+{
+	static bool initialized = false;
+	if (initialized)
+		return true;
+	WSADATA wsaData;
+	// never cleaned up, the dll goes away with the process
+	initialized = (0 == WSAStartup(MAKEWORD(1, 1), &wsaData));
+	return initialized;
+}
+
+static inline bool SocketSetNonBlocking(SOCKET s)
+{
+	u_long nonBlocking = 1;
+	return 0 == ioctlsocket(s, FIONBIO, &nonBlocking);
+}
+
+static inline int SocketLastError() { return WSAGetLastError(); }
+static inline bool SocketWouldBlock(int err) { return WSAEWOULDBLOCK == err; }
+static inline bool SocketInProgress(int err) { return WSAEWOULDBLOCK == err; }
+
+// Waits up to <timeoutMs> for <s> to become readable or, with <forWrite>,
+// writable or failed (winsock reports a failed connect() only as an
+// exception). Returns false on timeout or error
+static inline bool SocketWait(SOCKET s, bool forWrite, DWORD timeoutMs)
+{
+	fd_set fds, errFds;
+	FD_ZERO(&fds);
+	FD_SET(s, &fds);
+	FD_ZERO(&errFds);
+	FD_SET(s, &errFds);
+	struct timeval tv;
+	tv.tv_sec = timeoutMs / 1000;
+	tv.tv_usec = (timeoutMs % 1000) * 1000;
+	int n = select((int)s + 1, forWrite ? NULL : &fds, forWrite ? &fds : NULL, forWrite ? &errFds : NULL, &tv);
+	return n > 0;
+}
+
+#endif
@@ -0,0 +1,274 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "MiscUtil.h"
+#include "TimerWheel.h"
+
+#define SLOT_MASK		(TIMER_WHEEL_SLOTS - 1)
+// ticks from now that the last level reaches
+#define MAX_DELTA		((1ULL << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+struct TimerWheel {
+	// the next tick to run the timers of. All timers due before it ran
+	ULONGLONG	currTick;
+	int			counts[TIMER_WHEEL_LEVELS];
+	// each slot is a circular list with a dummy timer as its head
+	Timer		slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+static inline void ListInit(Timer *head)
+{
+	head->next = head;
+	head->prev = head;
+}
+
+static inline bool ListEmpty(const Timer *head)
+{
+	return head->next == head;
+}
+
+static inline void ListAppend(Timer *head, Timer *t)
+{
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+}
+
+static inline void ListRemove(Timer *t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = NULL;
+	t->prev = NULL;
+}
+
+static inline int SlotIndex(ULONGLONG tick, int level)
+{
+	return (int)(tick >> (TIMER_WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+}
+
+// ticks are rounded up, so that timers are never early
+static inline ULONGLONG DeadlineTick(ULONGLONG deadlineMs)
+{
+	return (deadlineMs + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+}
+
+static void Add(TimerWheel *w, Timer *t)
+{
+	ULONGLONG expires = DeadlineTick(t->deadlineMs);
+	if (expires < w->currTick)
+		expires = w->currTick;
+	ULONGLONG delta = expires - w->currTick;
+	if (delta > MAX_DELTA)
+		expires = w->currTick + MAX_DELTA;
+	int level = 0;
+	while ((level < TIMER_WHEEL_LEVELS - 1) && (delta >> (TIMER_WHEEL_SLOT_BITS * (level + 1))))
+		level++;
+	t->level = level;
+	w->counts[level]++;
+	ListAppend(&w->slots[level][SlotIndex(expires, level)], t);
+}
+
+// level is -1 while TimerWheelAdvance() has the timer in its list of those
+// about to run, which aren't counted any more
+static void Remove(TimerWheel *w, Timer *t)
+{
+	if (t->level >= 0)
+		w->counts[t->level]--;
+	ListRemove(t);
+}
+
+// moves the timers of a slot that's coming up a level (or more) down
+static void Cascade(TimerWheel *w, int level, int idx)
+{
+	Timer *head = &w->slots[level][idx];
+	while (!ListEmpty(head)) {
+		Timer *t = head->next;
+		Remove(w, t);
+		Add(w, t);
+	}
+}
+
+TimerWheel *TimerWheelNew(ULONGLONG nowMs)
+{
+	TimerWheel *w = SAZ(TimerWheel);
+	if (!w)
+		return NULL;
+	w->currTick = nowMs / TIMER_WHEEL_TICK_MS;
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for (int i = 0; i < TIMER_WHEEL_SLOTS; i++)
+			ListInit(&w->slots[level][i]);
+	}
+	return w;
+}
+
+void TimerWheelDelete(TimerWheel *w)
+{
+	if (!w)
+		return;
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+			Timer *head = &w->slots[level][i];
+			while (!ListEmpty(head))
+				ListRemove(head->next);
+		}
+	}
+	free(w);
+}
+
+void TimerInit(Timer *t, TimerFunc func, void *ctx)
+{
+	memzero(t, sizeof(*t));
+	t->func = func;
+	t->ctx = ctx;
+}
+
+bool TimerScheduled(const Timer *t)
+{
+	return NULL != t->next;
+}
+
+void TimerWheelSchedule(TimerWheel *w, Timer *t, ULONGLONG deadlineMs, DWORD periodMs)
+{
+	if (TimerScheduled(t))
+		Remove(w, t);
+	t->deadlineMs = deadlineMs;
+	t->periodMs = periodMs;
+	Add(w, t);
+}
+
+void TimerWheelCancel(TimerWheel *w, Timer *t)
+{
+	if (TimerScheduled(t))
+		Remove(w, t);
+}
+
+static int TotalCount(TimerWheel *w)
+{
+	int count = 0;
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+		count += w->counts[level];
+	return count;
+}
+
+// nothing runs before the next cascade of the lowest level that has timers,
+// so there's no point in going through the ticks before it one by one
+static ULONGLONG NextBusyTick(TimerWheel *w, ULONGLONG lastTick)
+{
+	if (0 != w->counts[0])
+		return w->currTick;
+	for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		if (0 == w->counts[level])
+			continue;
+		ULONGLONG levelTicks = 1ULL << (TIMER_WHEEL_SLOT_BITS * level);
+		ULONGLONG next = (w->currTick + levelTicks - 1) & ~(levelTicks - 1);
+		return (next < lastTick) ? next : lastTick;
+	}
+	return lastTick;
+}
+
+int TimerWheelAdvance(TimerWheel *w, ULONGLONG nowMs)
+{
+	ULONGLONG nowTick = nowMs / TIMER_WHEEL_TICK_MS;
+	int ran = 0;
+	Timer due;
+	while (w->currTick <= nowTick) {
+		w->currTick = NextBusyTick(w, nowTick + 1);
+		if (w->currTick > nowTick)
+			break;
+		int idx = SlotIndex(w->currTick, 0);
+		if (0 == idx) {
+			for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+				int levelIdx = SlotIndex(w->currTick, level);
+				Cascade(w, level, levelIdx);
+				if (0 != levelIdx)
+					break;
+			}
+		}
+
+		// take the due timers out first, so that those they schedule for
+		// now go in the next tick
+		ListInit(&due);
+		Timer *head = &w->slots[0][idx];
+		while (!ListEmpty(head)) {
+			Timer *t = head->next;
+			Remove(w, t);
+			t->level = -1;
+			ListAppend(&due, t);
+		}
+		w->currTick++;
+		while (!ListEmpty(&due)) {
+			Timer *t = due.next;
+			ListRemove(t);
+			if (t->periodMs) {
+				// if we were late (e.g. the computer was asleep), the
+				// periods we missed are skipped
+				ULONGLONG missed = (nowMs - t->deadlineMs) / t->periodMs;
+				t->deadlineMs += (missed + 1) * t->periodMs;
+				Add(w, t);
+			}
+			t->func(t->ctx);
+			ran++;
+		}
+	}
+	return ran;
+}
+
+static bool EarliestInSlot(const Timer *head, ULONGLONG *earliestInOut)
+{
+	if (ListEmpty(head))
+		return false;
+	// when TimerWheelAdvance() will run it, rounded up to the tick
+	for (const Timer *t = head->next; t != head; t = t->next) {
+		ULONGLONG dueMs = DeadlineTick(t->deadlineMs) * TIMER_WHEEL_TICK_MS;
+		if (dueMs < *earliestInOut)
+			*earliestInOut = dueMs;
+	}
+	return true;
+}
+
+DWORD TimerWheelMsToNext(TimerWheel *w, ULONGLONG nowMs)
+{
+	if (0 == TotalCount(w))
+		return TIMER_WHEEL_MAX_WAIT_MS;
+	ULONGLONG earliest = (ULONGLONG)-1;
+	// slots come in the order of their deadlines starting with the current
+	// one, the first slot with timers has the earliest timer of its level.
+	// On the levels above the first, the current slot only has timers from
+	// a full turn later, unless it's about to be cascaded
+	for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		if (0 == w->counts[level])
+			continue;
+		ULONGLONG lowerTicks = 1ULL << (TIMER_WHEEL_SLOT_BITS * level);
+		bool cascaded = (0 != (w->currTick & (lowerTicks - 1)));
+		int start = SlotIndex(w->currTick, level) + (cascaded ? 1 : 0);
+		for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+			if (EarliestInSlot(&w->slots[level][(start + i) & SLOT_MASK], &earliest))
+				break;
+		}
+	}
+	if (earliest <= nowMs)
+		return 0;
+	if (earliest - nowMs > TIMER_WHEEL_MAX_WAIT_MS)
+		return TIMER_WHEEL_MAX_WAIT_MS;
+	return (DWORD)(earliest - nowMs);
+}
+
+void MonotonicClockInit(MonotonicClock *c)
+{
+	c->lastTicks = GetTickCount();
+	c->wraps = 0;
+}
+
+ULONGLONG MonotonicClockMs(MonotonicClock *c)
+{
+	DWORD ticks = GetTickCount();
+	if (ticks < c->lastTicks)
+		c->wraps++;
+	c->lastTicks = ticks;
+	return (c->wraps << 32) | ticks;
+}
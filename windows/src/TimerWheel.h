@@ -0,0 +1,85 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef TIMER_WHEEL_H__
+#define TIMER_WHEEL_H__
+
+/* Runs periodic and one-shot tasks at their deadlines, so that a thread can
+sleep until the next deadline (TimerWheelMsToNext()) instead of waking up
+to check every task on its own.
+
+It's a hierarchical timer wheel: TIMER_WHEEL_LEVELS levels of
+TIMER_WHEEL_SLOTS slots, each level TIMER_WHEEL_SLOTS times coarser than
+the one below. A timer goes in the slot for its deadline on the finest
+level that reaches that far and moves down a level as its deadline gets
+close. Adding and removing a timer is O(1).
+
+Times are ms of a MonotonicClock (or any other clock that doesn't go back
+and doesn't wrap around), which callers pass in, so that tests and
+simulations can drive the wheel with a clock of their own. Not
+thread-safe: a wheel is used by the thread that waits on it.
+*/
+
+#define TIMER_WHEEL_TICK_MS		10
+#define TIMER_WHEEL_SLOT_BITS	6
+#define TIMER_WHEEL_SLOTS		(1 << TIMER_WHEEL_SLOT_BITS)
+// 64^4 ticks of 10 ms is over 46 hours. Timers further out than that wait
+// in the last level until they're within reach
+#define TIMER_WHEEL_LEVELS		4
+
+// TimerWheelMsToNext() never returns more than that, so that a
+// MonotonicClock gets read often enough to notice GetTickCount() wrapping
+#define TIMER_WHEEL_MAX_WAIT_MS	(24*60*60*1000)
+
+typedef void (*TimerFunc)(void *ctx);
+
+// Owned by the caller, who must TimerWheelCancel() it before freeing it
+typedef struct Timer {
+	struct Timer *	next;
+	struct Timer *	prev;
+	ULONGLONG		deadlineMs;
+	// 0 for one-shot timers
+	DWORD			periodMs;
+	TimerFunc		func;
+	void *			ctx;
+	// the level of the wheel it's in, for TimerWheelCancel()
+	int				level;
+} Timer;
+
+typedef struct TimerWheel TimerWheel;
+
+TimerWheel *	TimerWheelNew(ULONGLONG nowMs);
+// the timers that are still scheduled are just forgotten
+void			TimerWheelDelete(TimerWheel *w);
+
+void			TimerInit(Timer *t, TimerFunc func, void *ctx);
+bool			TimerScheduled(const Timer *t);
+
+// Schedules <t> for <deadlineMs> and then every <periodMs>, if it isn't 0.
+// Re-schedules it if it's already scheduled. Periodic timers are due
+// <periodMs> after they were last due, not after they ran, so they don't
+// drift
+void			TimerWheelSchedule(TimerWheel *w, Timer *t, ULONGLONG deadlineMs, DWORD periodMs);
+void			TimerWheelCancel(TimerWheel *w, Timer *t);
+
+// Runs the timers that are due at <nowMs>, in the order of their deadlines
+// (to within TIMER_WHEEL_TICK_MS). They can schedule and cancel any
+// timers, including themselves. Returns how many ran
+int				TimerWheelAdvance(TimerWheel *w, ULONGLONG nowMs);
+// how long from <nowMs> until the next timer is due: 0 if one is due
+// already, at most TIMER_WHEEL_MAX_WAIT_MS
+DWORD			TimerWheelMsToNext(TimerWheel *w, ULONGLONG nowMs);
+
+// GetTickCount() extended to 64 bits, so that it doesn't wrap around
+// every 49.7 days. Must be read at least once in that time. Not
+// thread-safe, each thread should have its own
+typedef struct {
+	DWORD		lastTicks;
+	ULONGLONG	wraps;
+} MonotonicClock;
+
+void			MonotonicClockInit(MonotonicClock *c);
+ULONGLONG		MonotonicClockMs(MonotonicClock *c);
+
+#endif
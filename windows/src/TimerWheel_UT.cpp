@@ -0,0 +1,268 @@
+// Copyright (c) 2009 OpenDNS Inc. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "stdafx.h"
+
+#include "MiscUtil.h"
+#include "TimerWheel.h"
+
+#include "UnitTests.h"
+
+#define ONE_HOUR_MS		(60*60*1000ULL)
+#define ONE_DAY_MS		(24*ONE_HOUR_MS)
+
+#define RANDOM_TIMERS	2000
+#define BENCH_TIMERS	100000
+
+typedef struct {
+	Timer		timer;
+	ULONGLONG *	nowMs;
+	int			runs;
+	// when it ran last and what its deadline was then
+	ULONGLONG	ranAtMs;
+	ULONGLONG	ranDeadlineMs;
+	bool		early;
+} TestTimer;
+
+static DWORD gRandom = 1;
+
+static DWORD NextRandom()
+{
+	gRandom = gRandom * 1103515245 + 12345;
+	return gRandom >> 8;
+}
+
+static void TestTimerFunc(void *ctx)
+{
+	TestTimer *tt = (TestTimer*)ctx;
+	tt->runs++;
+	tt->ranAtMs = *tt->nowMs;
+	// periodic timers already have their next deadline
+	tt->ranDeadlineMs = tt->timer.deadlineMs - tt->timer.periodMs;
+	if (tt->ranAtMs < tt->ranDeadlineMs)
+		tt->early = true;
+}
+
+static void TestTimerInit(TestTimer *tt, ULONGLONG *nowMs)
+{
+	memzero(tt, sizeof(*tt));
+	TimerInit(&tt->timer, TestTimerFunc, tt);
+	tt->nowMs = nowMs;
+}
+
+// timers from 0 to 3 days out (so some are out of the wheel's reach at
+// first) run once, never early and on time if we wake up when told to
+static void timer_wheel_random_ut()
+{
+	ULONGLONG nowMs = 5 * ONE_DAY_MS + 7;
+	TimerWheel *w = TimerWheelNew(nowMs);
+	TestTimer *timers = (TestTimer*)malloc(RANDOM_TIMERS * sizeof(TestTimer));
+	if (!w || !timers) {
+		free(timers);
+		TimerWheelDelete(w);
+		return;
+	}
+	ULONGLONG earliest = (ULONGLONG)-1;
+	for (int i=0; i < RANDOM_TIMERS; i++) {
+		TestTimerInit(&timers[i], &nowMs);
+		ULONGLONG deadline = nowMs + (NextRandom() % (3 * ONE_DAY_MS / 1000)) * 1000 + (NextRandom() % 1000);
+		if (deadline < earliest)
+			earliest = deadline;
+		TimerWheelSchedule(w, &timers[i].timer, deadline, 0);
+	}
+	// rounded up to the tick
+	earliest = (earliest + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS * TIMER_WHEEL_TICK_MS;
+	utassert(earliest - nowMs == TimerWheelMsToNext(w, nowMs));
+
+	int ran = 0;
+	int bad = 0;
+	for (int steps = 0; ran < RANDOM_TIMERS && steps < 100000; steps++) {
+		nowMs += TimerWheelMsToNext(w, nowMs);
+		ran += TimerWheelAdvance(w, nowMs);
+	}
+	utassert(RANDOM_TIMERS == ran);
+	for (int i=0; i < RANDOM_TIMERS; i++) {
+		TestTimer *tt = &timers[i];
+		if ((1 != tt->runs) || tt->early || TimerScheduled(&tt->timer))
+			bad++;
+		// we woke up when told to, so they ran on time
+		if (tt->ranAtMs - tt->timer.deadlineMs >= TIMER_WHEEL_TICK_MS)
+			bad++;
+	}
+	utassert(0 == bad);
+	utassert(TIMER_WHEEL_MAX_WAIT_MS == TimerWheelMsToNext(w, nowMs));
+	free(timers);
+	TimerWheelDelete(w);
+}
+
+// Sleeping for a long time, as when the computer is asleep, runs all the
+// timers that got due in the order of their deadlines
+static void timer_wheel_order_ut()
+{
+	ULONGLONG nowMs = 0;
+	TimerWheel *w = TimerWheelNew(nowMs);
+	TestTimer timers[50];
+	if (!w)
+		return;
+	for (int i=0; i < dimof(timers); i++) {
+		TestTimerInit(&timers[i], &nowMs);
+		// in reverse order, across all levels
+		TimerWheelSchedule(w, &timers[i].timer, (dimof(timers) - i) * ONE_HOUR_MS + i, 0);
+	}
+	nowMs = 3 * ONE_DAY_MS;
+	int ran = TimerWheelAdvance(w, nowMs);
+	utassert(dimof(timers) == ran);
+	for (int i=0; i < dimof(timers); i++) {
+		utassert(1 == timers[i].runs);
+	}
+	TimerWheelDelete(w);
+}
+
+// periodic timers don't drift and skip the periods they missed
+static void timer_wheel_periodic_ut()
+{
+	ULONGLONG nowMs = 1000;
+	TimerWheel *w = TimerWheelNew(nowMs);
+	if (!w)
+		return;
+	TestTimer tt;
+	TestTimerInit(&tt, &nowMs);
+	TimerWheelSchedule(w, &tt.timer, nowMs + 3 * ONE_HOUR_MS, 3 * ONE_HOUR_MS);
+	ULONGLONG endMs = nowMs + 7 * ONE_DAY_MS;
+	while (nowMs < endMs) {
+		// wake up a bit late every time
+		nowMs += TimerWheelMsToNext(w, nowMs) + 5;
+		TimerWheelAdvance(w, nowMs);
+	}
+	utassert(7 * 8 == tt.runs);
+	utassert(1000 + 7 * 8 * 3 * ONE_HOUR_MS == tt.ranDeadlineMs);
+	utassert(!tt.early);
+
+	// asleep for a day: it runs once, not 8 times
+	nowMs = tt.timer.deadlineMs + ONE_DAY_MS;
+	int ran = TimerWheelAdvance(w, nowMs);
+	utassert(1 == ran);
+	utassert(tt.timer.deadlineMs > nowMs);
+	utassert((tt.timer.deadlineMs - 1000) % (3 * ONE_HOUR_MS) == 0);
+	TimerWheelCancel(w, &tt.timer);
+	utassert(!TimerScheduled(&tt.timer));
+	TimerWheelDelete(w);
+}
+
+typedef struct {
+	TimerWheel *	w;
+	Timer			self;
+	Timer *			other;
+	ULONGLONG *		nowMs;
+	int				runs;
+} ReschedulingTimer;
+
+static void ReschedulingTimerFunc(void *ctx)
+{
+	ReschedulingTimer *rt = (ReschedulingTimer*)ctx;
+	rt->runs++;
+	if (rt->other)
+		TimerWheelCancel(rt->w, rt->other);
+	// again right away, which is the next tick
+	if (rt->runs < 3)
+		TimerWheelSchedule(rt->w, &rt->self, *rt->nowMs, 0);
+}
+
+static void timer_wheel_reschedule_ut()
+{
+	ULONGLONG nowMs = 0;
+	TimerWheel *w = TimerWheelNew(nowMs);
+	if (!w)
+		return;
+	ReschedulingTimer rt;
+	TestTimer victim;
+	TestTimerInit(&victim, &nowMs);
+	rt.w = w;
+	rt.nowMs = &nowMs;
+	rt.runs = 0;
+	rt.other = &victim.timer;
+	TimerInit(&rt.self, ReschedulingTimerFunc, &rt);
+	TimerWheelSchedule(w, &rt.self, 100, 0);
+	// due at the same time, but cancelled by the first one
+	TimerWheelSchedule(w, &victim.timer, 100, 0);
+	// re-scheduling moves it
+	TimerWheelSchedule(w, &rt.self, 50, 0);
+	utassert(50 == TimerWheelMsToNext(w, nowMs));
+
+	nowMs = 50;
+	int ran = TimerWheelAdvance(w, nowMs);
+	utassert((1 == ran) && (1 == rt.runs));
+	utassert(0 == victim.runs && !TimerScheduled(&victim.timer));
+	utassert(0 == TimerWheelMsToNext(w, nowMs));
+	nowMs = 200;
+	ran = TimerWheelAdvance(w, nowMs);
+	utassert((2 == ran) && (3 == rt.runs));
+	utassert(!TimerScheduled(&rt.self));
+
+	// cancelling a timer that's due in the same tick, after us
+	rt.runs = 2;
+	TimerWheelSchedule(w, &rt.self, 300, 0);
+	TimerWheelSchedule(w, &victim.timer, 300, 0);
+	nowMs = 300;
+	ran = TimerWheelAdvance(w, nowMs);
+	utassert((1 == ran) && (3 == rt.runs));
+	utassert(0 == victim.runs && !TimerScheduled(&victim.timer));
+	utassert(TIMER_WHEEL_MAX_WAIT_MS == TimerWheelMsToNext(w, nowMs));
+	TimerWheelDelete(w);
+}
+
+static void monotonic_clock_ut()
+{
+	MonotonicClock c;
+	MonotonicClockInit(&c);
+	ULONGLONG t1 = MonotonicClockMs(&c);
+	ULONGLONG t2 = MonotonicClockMs(&c);
+	utassert(t2 >= t1);
+	// as if GetTickCount() was about to wrap around last time we looked
+	c.lastTicks = 0xffffffff;
+	ULONGLONG t3 = MonotonicClockMs(&c);
+	utassert(t3 > 0xffffffffULL);
+	utassert(MonotonicClockMs(&c) >= t3);
+}
+
+void timer_wheel_ut_all()
+{
+	timer_wheel_random_ut();
+	timer_wheel_order_ut();
+	timer_wheel_periodic_ut();
+	timer_wheel_reschedule_ut();
+	monotonic_clock_ut();
+}
+
+static void NopTimerFunc(void * /* ctx */)
+{
+}
+
+void timer_wheel_bench_all()
+{
+	ULONGLONG nowMs = 0;
+	TimerWheel *w = TimerWheelNew(nowMs);
+	Timer *timers = (Timer*)malloc(BENCH_TIMERS * sizeof(Timer));
+	if (!w || !timers) {
+		free(timers);
+		TimerWheelDelete(w);
+		return;
+	}
+	double start = benchTimeMs();
+	for (int i=0; i < BENCH_TIMERS; i++) {
+		TimerInit(&timers[i], NopTimerFunc, NULL);
+		TimerWheelSchedule(w, &timers[i], NextRandom() % ONE_DAY_MS, 0);
+	}
+	benchReport("TimerWheelSchedule()", BENCH_TIMERS, benchTimeMs() - start);
+
+	// a wakeup a second for a day
+	int ran = 0;
+	start = benchTimeMs();
+	for (nowMs = 0; nowMs <= ONE_DAY_MS; nowMs += 1000)
+		ran += TimerWheelAdvance(w, nowMs);
+	benchReport("TimerWheelAdvance() a second for a day", BENCH_TIMERS, benchTimeMs() - start);
+	utassert(BENCH_TIMERS == ran);
+	free(timers);
+	TimerWheelDelete(w);
+}
@@ -7,8 +7,10 @@
 #include "StrUtil.h"
 #include "MiscUtil.h"
 #include "Http.h"
+#include "HttpAsync.h"
 #include "JsonParser.h"
 #include "Prefs.h"
+#include "RetryPolicy.h"
 #include "JsonApiResponses.h"
 #include "SimpleLog.h"
 
@@ -214,6 +216,24 @@ static char *GetNamesAsCommaSeparatedString(StringTimeNode *head)
 	return res;
 }
 
+// Typo exceptions are sent in the background, so they stay away from the
+// api servers while its circuit is open. Returns NULL then
+static HttpResult *ApiPost(const char *paramsTxt)
+{
+	if (!RetryEndpointAllow(RetryEndpointApi))
+		return NULL;
+	const char *apiHost = GetApiHost();
+	INTERNET_PORT port = INTERNET_DEFAULT_HTTP_PORT;
+	if (IsApiHostHttps())
+		port = INTERNET_DEFAULT_HTTPS_PORT;
+	HttpResult *httpRes = HttpAsyncPostWait(apiHost, API_URL, paramsTxt, port, HTTP_ASYNC_DEFAULT_TIMEOUT_MS);
+	if (httpRes && httpRes->IsValid())
+		RetryEndpointSucceeded(RetryEndpointApi);
+	else
+		RetryEndpointFailed(RetryEndpointApi);
+	return httpRes;
+}
+
 static char *GetNetworkIdApi()
 {
 	HttpResult *httpRes = NULL;
@@ -223,15 +243,13 @@ static char *GetNetworkIdApi()
 
 	CString params = ApiParamsNetworkGet(g_pref_token);
 	const char *paramsTxt = TStrToStr(params);
-	const char *apiHost = GetApiHost();
-	bool apiHostIsHttps = IsApiHostHttps();
-	httpRes = HttpPost(apiHost, API_URL, paramsTxt, apiHostIsHttps);
+	httpRes = ApiPost(paramsTxt);
 	free((void*)paramsTxt);
 	if (!httpRes || !httpRes->IsValid())
 		goto Exit;
 
 	DWORD dataSize;
-	jsonTxt = (char *)httpRes->data.getData(&dataSize);
+	jsonTxt = (char *)httpRes->data.stealData(&dataSize);
 	if (!jsonTxt)
 		goto Exit;
 
@@ -247,11 +265,7 @@ static char *GetNetworkIdApi()
 		goto Exit;
 	}
 
-	JsonEl *resp = GetMapElByName(json, "response");
-	if (!resp)
-		goto Exit;
-
-	JsonEl *networkIdEl = GetMapElByName(resp, "network_id");
+	JsonEl *networkIdEl = GetElByPath(json, "response/network_id");
 	if (!networkIdEl)
 		goto Exit;
 
@@ -300,15 +314,13 @@ static BOOL SubmitAddedTypoExceptions(StringTimeNode *added)
 	slogfmt("Adding typo exceptions: %s\n", toAdd);
 	CString params = ApiParamsNetworkTypoExceptionsAdd(g_pref_token, networkId, toAdd);
 	const char *paramsTxt = TStrToStr(params);
-	const char *apiHost = GetApiHost();
-	bool apiHostIsHttps = IsApiHostHttps();
-	httpRes = HttpPost(apiHost, API_URL, paramsTxt, apiHostIsHttps);
+	httpRes = ApiPost(paramsTxt);
 	free((void*)paramsTxt);
 	if (!httpRes || !httpRes->IsValid())
 		goto Error;
 
 	DWORD dataSize;
-	jsonTxt = (char *)httpRes->data.getData(&dataSize);
+	jsonTxt = (char *)httpRes->data.stealData(&dataSize);
 	if (!jsonTxt)
 		goto Error;
 
@@ -352,15 +364,13 @@ static BOOL SubmitExpiredTypoExceptions(StringTimeNode *expired)
 	slogfmt("Removing expired typo exceptions: %s\n", toDelete);
 	CString params = ApiParamsNetworkTypoExceptionsRemove(g_pref_token, networkId, toDelete);
 	const char *paramsTxt = TStrToStr(params);
-	const char *apiHost = GetApiHost();
-	bool apiHostIsHttps = IsApiHostHttps();
-	httpRes = HttpPost(apiHost, API_URL, paramsTxt, apiHostIsHttps);
+	httpRes = ApiPost(paramsTxt);
 	free((void*)paramsTxt);
 	if (!httpRes || !httpRes->IsValid())
 		goto Error;
 
 	DWORD dataSize;
-	jsonTxt = (char *)httpRes->data.getData(&dataSize);
+	jsonTxt = (char *)httpRes->data.stealData(&dataSize);
 	if (!jsonTxt)
 		goto Error;
 
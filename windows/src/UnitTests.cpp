@@ -31,3 +31,23 @@ int unitTestsFailed()
 {
 	return g_unitTestsFailed;
 }
+
+// current time in milliseconds, with high resolution. Only useful
+// for measuring time differences
+double benchTimeMs()
+{
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	if (0 == freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (double)now.QuadPart * 1000.0 / (double)freq.QuadPart;
+}
+
+void benchReport(const char *name, int iterations, double timeMs)
+{
+	double perIteration = 0;
+	if (iterations > 0)
+		perIteration = timeMs / (double)iterations;
+	fprintf(stderr, "\n%s: %d iterations in %.2f ms, %.3f ms per iteration", name, iterations, timeMs, perIteration);
+}
@@ -10,6 +10,9 @@ void recordUnitTestFailed();
 int unitTestsTotal();
 int unitTestsFailed();
 
+double benchTimeMs();
+void benchReport(const char *name, int iterations, double timeMs);
+
 #define utassert(ok) \
 	assert(ok); \
 	if (ok) \
@@ -4,12 +4,71 @@
 
 void json_parser_ut_all();
 void strutil_ut_all();
+void json_parser_bench_all();
+void growable_buf_ut_all();
+void growable_buf_bench_all();
+void http_conn_pool_ut_all();
+void http_async_ut_all();
+void send_ip_update_ut_all();
+void send_ip_update_bench_all();
+void dns_client_ut_all();
+void network_change_ut_all();
+void timer_wheel_ut_all();
+void timer_wheel_bench_all();
+void retry_policy_ut_all();
+void retry_policy_bench_all();
+void network_owner_ut_all();
+void service_events_ut_all();
+void service_sim_ut_all();
+void service_sim_bench_all();
+void shared_mem_ut_all();
+void async_log_ut_all();
+void log_rotate_ut_all();
+void simple_log_ut_all();
+void event_log_ut_all();
+void event_log_bench_all();
+void ip_updates_store_ut_all();
+void ip_updates_log_parser_ut_all();
+void ip_updates_log_parser_bench_all();
 
 int run_unit_tests()
 {
 	json_parser_ut_all();
 	strutil_ut_all();
+	growable_buf_ut_all();
+	http_conn_pool_ut_all();
+	http_async_ut_all();
+	send_ip_update_ut_all();
+	dns_client_ut_all();
+	network_change_ut_all();
+	timer_wheel_ut_all();
+	retry_policy_ut_all();
+	network_owner_ut_all();
+	service_events_ut_all();
+	service_sim_ut_all();
+	shared_mem_ut_all();
+	async_log_ut_all();
+	log_rotate_ut_all();
+	simple_log_ut_all();
+	event_log_ut_all();
+	ip_updates_store_ut_all();
+	ip_updates_log_parser_ut_all();
 	assert(0 == unitTestsFailed());
 	return unitTestsFailed();
 }
 
+// benchmarks take a while so unlike unit tests they're only run
+// on demand (OpenDNSDynamicIpService.exe bench)
+int run_benchmarks()
+{
+	json_parser_bench_all();
+	growable_buf_bench_all();
+	send_ip_update_bench_all();
+	timer_wheel_bench_all();
+	retry_policy_bench_all();
+	service_sim_bench_all();
+	event_log_bench_all();
+	ip_updates_log_parser_bench_all();
+	fprintf(stderr, "\n");
+	return unitTestsFailed();
+}
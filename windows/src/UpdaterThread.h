@@ -5,22 +5,38 @@
 #ifndef UPDATER_THREAD_H__
 #define UPDATER_THREAD_H__
 
-/* This thread does 2 things, at 1 min intervals:
+/* This thread does 2 things, at 1 min intervals (less often while nothing
+changes, see IpCheckSchedule) and right away when the network changes:
  - resolves myip.opendns.com to get current ip address of this computer
  - detects if we're using OpenDNS dns servers: if myip.opendns.com returns
    NX record, we're *not* using OpenDNS dns servers
+It also sends periodic ip updates, checks for new versions and submits typo
+exceptions. Everything it does periodically is a timer on a TimerWheel, and
+in between it sleeps until the next one is due or it's woken up.
+
+All that is only done when we're the network owner (see NetworkOwner.h),
+which we're not when the service is running. Then we just report the
+events the service publishes.
 */
 #include "WTLThread.h"
 #include "DnsQuery.h"
 #include "MiscUtil.h"
+#include "NetworkChange.h"
+#include "NetworkOwner.h"
 #include "SimpleLog.h"
 #include "SendIPUpdate.h"
 #include "Prefs.h"
+#include "ServiceLoop.h"
+#include "TimerWheel.h"
+#include "TypoExceptions.h"
 
 extern bool g_simulate_upgrade;
 
-static const ULONGLONG THREE_HRS_IN_MS =  3*60*60*1000;
-static const ULONGLONG ONE_DAY_IN_MS   = 24*60*60*1000;
+// the ip update and upgrade check periods are the service's, see ServiceLoop.h
+static const DWORD TYPO_EXCEPTIONS_PERIOD_MS = 10*60*1000;
+// EventPublishedEvent() only wakes up one of the uis (there's one for every
+// logged in user), the others catch up on events that often
+static const DWORD CONSUMER_CATCH_UP_MS = 60*1000;
 
 class UpdaterThreadObserver
 {
@@ -30,44 +46,46 @@ public:
 	virtual void OnNewVersionAvailable(TCHAR *setupFilePath) = 0;
 };
 
-// special values for IP4_ADDRESS
-enum {
-	// we haven't had a chance to dns resolve "myip.opends.com"
-	IP_UNKNOWN  = 0,
-	// we resolved "myip.opendns.com" but got NX record. That means
-	// we're not using OpenDNS dns server
-	IP_NOT_USING_OPENDNS = 1,
-	// we try to resolve "myip.opendns.com" but got generic dns error
-	// this usually indicates network connection problems
-	IP_DNS_RESOLVE_ERROR = 2
-};
-
-static inline bool RealIpAddress(IP4_ADDRESS ipAddr)
-{
-	if (ipAddr > IP_DNS_RESOLVE_ERROR)
-		return true;
-	return false;
-}
-
 class UpdaterThread : public CThread
 {
 public:
 	UpdaterThreadObserver *	m_updaterObserver;
 	HANDLE				m_event;
 	bool				m_stop;
-	ULONGLONG			m_lastIpUpdateTimeInMs;
-	ULONGLONG			m_lastSoftwareUpgradeTimeInMs;
+	// GetTickCount() of the last update, ours or the service's
+	DWORD				m_lastIpUpdateTimeInMs;
+	IpCheckSchedule		m_ipCheckSchedule;
+	IP4_ADDRESS			m_lastCheckedIp;
 	bool				m_forceNextIpUpdate;
 	bool				m_forceNextSoftwareUpdate;
+	bool				m_forceNextIpCheck;
+	// only used by the thread itself
+	NetworkOwner *		m_networkOwner;
+	NetworkChangeNotifier *	m_networkChange;
+	MonotonicClock		m_clock;
+	TimerWheel *		m_timers;
+	Timer				m_ownerTimer;
+	Timer				m_ipCheckTimer;
+	Timer				m_ipUpdateTimer;
+	Timer				m_upgradeCheckTimer;
+	Timer				m_typoExceptionsTimer;
+	// false until we read the owner's state after becoming a consumer
+	bool				m_consumerStarted;
 
 	UpdaterThread(UpdaterThreadObserver *updaterObserver) :
 		m_updaterObserver(updaterObserver),
 		m_stop(false)
 	{
 		m_lastIpUpdateTimeInMs = 0;
-		m_lastSoftwareUpgradeTimeInMs = 0;
+		m_lastCheckedIp = IP_UNKNOWN;
+		IpCheckScheduleInit(&m_ipCheckSchedule, false);
 		m_forceNextIpUpdate = false;
 		m_forceNextSoftwareUpdate = false;
+		m_forceNextIpCheck = true;
+		m_networkOwner = NULL;
+		m_networkChange = NULL;
+		m_timers = NULL;
+		m_consumerStarted = false;
 
 		// we shouldn't need more stack than 64k
 		// TODO: this doesn't seem to change stack size from default 1MB
@@ -77,18 +95,6 @@ public:
 			this, 0, &m_dwThreadId);
 	}
 
-	IP4_ADDRESS GetMyIp()
-	{
-		IP4_ADDRESS myIp;
-		int res = dns_query("myip.opendns.com", &myIp);
-		if (DNS_QUERY_OK == res)
-			return myIp;
-		if (DNS_QUERY_NO_A_RECORD == res)
-			return IP_NOT_USING_OPENDNS;
-		assert(DNS_QUERY_ERROR == res);
-		return IP_DNS_RESOLVE_ERROR;
-	}
-
 	void UpdateCurrentIp(IP4_ADDRESS myIp)
 	{
 		m_updaterObserver->OnIpCheckResult(myIp);
@@ -98,86 +104,61 @@ public:
 		if (!CanSendIPUpdates())
 			return -1;
 
-		ULONGLONG currTimeInMs = GetTickCount();
-
-		// the time wraps-around every 49.7 days.
-		if (currTimeInMs < m_lastIpUpdateTimeInMs) {
-			// going backwards in time - it must be wrap around
-			m_lastIpUpdateTimeInMs = currTimeInMs;
-			slognl("Detected GetTickCount() wrap-around");
-		}
-
-		ULONGLONG timePassedInMs =  currTimeInMs - m_lastIpUpdateTimeInMs;
-		ULONGLONG timePassedInMin = timePassedInMs / (60 * 1000);
-		return (int)timePassedInMin;
+		// unsigned math handles GetTickCount() wrap-around
+		DWORD timePassedInMs = GetTickCount() - m_lastIpUpdateTimeInMs;
+		return (int)(timePassedInMs / (60 * 1000));
 	}
 
-	bool ShouldSendPeriodicUpdate()
+	ULONGLONG NowMs()
 	{
-		if (!CanSendIPUpdates())
-			return false;
-
-		if (m_forceNextIpUpdate) {
-			m_forceNextIpUpdate = false;
-			return true;
-		}
-
-		ULONGLONG currTimeInMs = GetTickCount();
-
-		// the time wraps-around every 49.7 days.
-		if (currTimeInMs < m_lastIpUpdateTimeInMs) {
-			// going backwards in time - it must be wrap around
-			m_lastIpUpdateTimeInMs = GetTickCount();
-			slognl("Detected GetTickCount() wrap-around");
-		}
-
-		ULONGLONG nextUpdateTimeInMs = m_lastIpUpdateTimeInMs + THREE_HRS_IN_MS;
-		if (currTimeInMs > nextUpdateTimeInMs)
-			return true;
-		return false;
+		return MonotonicClockMs(&m_clock);
 	}
 
 	void SendPeriodicUpdate()
 	{
 		char *resp = NULL;
+		bool failed = false;
 		m_lastIpUpdateTimeInMs = GetTickCount();
-		BOOL sendDnsOmatic = GetPrefValBool(g_pref_dns_o_matic);
+		// any update, not only the periodic one, restarts the 3 hrs period
+		TimerWheelSchedule(m_timers, &m_ipUpdateTimer, NowMs() + IP_UPDATE_PERIOD_MS, IP_UPDATE_PERIOD_MS);
+		BOOL sendDnsOmatic = GetPrefBool(PREF_dns_o_matic);
+		int count = 0;
+		char **hostnames = NULL;
+		if (!sendDnsOmatic)
+			hostnames = ::IpUpdateHostnamesFromPrefs(&count);
 		if (sendDnsOmatic) {
 			resp = ::SendDnsOmaticUpdate();
+		} else if (count > 1) {
+			// the ui only shows the status of one network. The selected
+			// one comes first
+			IpUpdateHostResult *results = ::SendIpUpdateBatch((const char**)hostnames, count);
+			if (results)
+				resp = StrDupSafe(results->response);
+			for (IpUpdateHostResult *r = results; r; r = r->next) {
+				if (::IpUpdateFailedOnServer(r->response))
+					failed = true;
+			}
+			::IpUpdateHostResultFreeList(results);
 		} else {
 			resp = ::SendIpUpdate();
+			failed = ::IpUpdateFailedOnServer(resp);
 		}
+		::IpUpdateHostnamesFree(hostnames, count);
+		// a failed update is sent again when the backoff says so, like the
+		// service does, instead of with the next periodic one. dns-o-matic
+		// updates aren't retried, it's not our server
+		if (failed)
+			TimerWheelSchedule(m_timers, &m_ipUpdateTimer, NowMs() + IpUpdateRetryMs(), IP_UPDATE_PERIOD_MS);
 		if (NULL == resp)
 			return;
+		m_networkOwner->PublishIpUpdateResult(resp);
 		m_updaterObserver->OnIpUpdateResult(resp);
 		free(resp);
 	}
 
-	bool ShouldCheckForSoftwareUpgrade()
-	{
-		ULONGLONG currTimeInMs = GetTickCount();
-
-		if (m_forceNextSoftwareUpdate) {
-			m_forceNextSoftwareUpdate = false;
-			return true;
-		}
-
-		// the time wraps-around every 49.7 days.
-		if (currTimeInMs < m_lastSoftwareUpgradeTimeInMs) {
-			// going backwards in time - it must be wrap around
-			m_lastSoftwareUpgradeTimeInMs = GetTickCount();
-			slognl("Detected GetTickCount() wrap-around");
-		}
-
-		ULONGLONG nextUpdateTimeInMs = m_lastSoftwareUpgradeTimeInMs + ONE_DAY_IN_MS;
-		if (currTimeInMs > nextUpdateTimeInMs)
-			return true;
-		return false;
-	}
-
 	void CheckForSoftwareUpgrade(bool simulateUpgrade=false)
 	{
-		m_lastSoftwareUpgradeTimeInMs = GetTickCount();
+		TimerWheelSchedule(m_timers, &m_upgradeCheckTimer, NowMs() + UPGRADE_CHECK_PERIOD_MS, UPGRADE_CHECK_PERIOD_MS);
 		slognl("CheckForSoftwareUpgrade()");
 
 		const TCHAR *version = PROGRAM_VERSION;
@@ -189,12 +170,27 @@ public:
 			return;
 		}
 
+		// for the uis of other users
+		m_networkOwner->PublishNewVersion(url);
 		TCHAR *filePath = DownloadUpdateIfNotDownloaded(url);
 		free(url);
 		if (filePath)
 			m_updaterObserver->OnNewVersionAvailable(filePath);
 	}
 
+	// as a consumer we don't check for new versions, we download the one
+	// the owner found, if any
+	void DownloadPublishedNewVersion()
+	{
+		char url[NEW_VERSION_URL_MAX];
+		if (!m_networkOwner->ReadNewVersionUrl(url, dimof(url)))
+			return;
+		slogfmt("downloading new version published by the network owner: %s\n", url);
+		TCHAR *filePath = DownloadUpdateIfNotDownloaded(url);
+		if (filePath)
+			m_updaterObserver->OnNewVersionAvailable(filePath);
+	}
+
 #if 0
 	// a function that uses lots of stack space, to test
 	// if our stack limits take place. Calculates a value
@@ -230,6 +226,7 @@ public:
 
 	void ForceIpCheck()
 	{
+		m_forceNextIpCheck = true;
 		SetEvent(m_event);
 	}
 
@@ -241,28 +238,224 @@ public:
 			Join();
 	}
 
-	DWORD Run()
+	// checks the ip if it's due and re-arms m_ipCheckTimer for when
+	// the next check is
+	void CheckIp()
+	{
+		DWORD nowMs = GetTickCount();
+		if (IpCheckScheduleDue(&m_ipCheckSchedule, nowMs)) {
+			IP4_ADDRESS myIp = GetMyIp();
+			nowMs = GetTickCount();
+			IpCheckScheduleChecked(&m_ipCheckSchedule, nowMs, myIp != m_lastCheckedIp);
+			m_lastCheckedIp = myIp;
+			m_networkOwner->PublishIp(myIp);
+			UpdateCurrentIp(myIp);
+		}
+		DWORD msLeft = IpCheckScheduleMsLeft(&m_ipCheckSchedule, nowMs);
+		TimerWheelSchedule(m_timers, &m_ipCheckTimer, NowMs() + msLeft, 0);
+	}
+
+	// the periodic work is done by the timers, here we only do what
+	// we were asked to
+	void RunAsOwner()
+	{
+		m_consumerStarted = false;
+		if (m_networkOwner->TakeIpUpdateRequest())
+			m_forceNextIpUpdate = true;
+
+		if (m_forceNextIpCheck || m_networkOwner->BecameOwner()) {
+			m_forceNextIpCheck = false;
+			IpCheckScheduleForce(&m_ipCheckSchedule);
+			CheckIp();
+		}
+
+		if (m_forceNextIpUpdate && CanSendIPUpdates()) {
+			m_forceNextIpUpdate = false;
+			SendPeriodicUpdate();
+		}
+
+		if (m_forceNextSoftwareUpdate) {
+			m_forceNextSoftwareUpdate = false;
+			CheckForSoftwareUpgrade(g_simulate_upgrade);
+		}
+	}
+
+	void RunAsConsumer()
+	{
+		// the owner does the work, we only pass on explicit user requests
+		if (m_forceNextIpUpdate) {
+			m_forceNextIpUpdate = false;
+			m_networkOwner->RequestIpUpdate();
+		}
+		if (m_forceNextSoftwareUpdate) {
+			m_forceNextSoftwareUpdate = false;
+			DownloadPublishedNewVersion();
+		}
+		// we'll check right away if we become the owner
+		m_forceNextIpCheck = false;
+
+		// events tell us what changed, but when we start or if we missed
+		// some, we catch up from the state
+		if (!m_consumerStarted) {
+			m_consumerStarted = true;
+			m_networkOwner->SkipEvents();
+			ReadOwnerState();
+		} else if (m_networkOwner->TakeEventsLost()) {
+			ReadOwnerState();
+		}
+
+		ServiceEvent ev;
+		while (m_networkOwner->ReadEvent(&ev))
+			OnOwnerEvent(&ev);
+	}
+
+	void ReadOwnerState()
+	{
+		NetworkOwnerState state;
+		if (!m_networkOwner->ReadState(&state))
+			return;
+		UpdateCurrentIp(state.currentIpAddress);
+		if (0 == state.lastIpUpdateTickMs)
+			return;
+		if (state.lastIpUpdateTickMs == m_lastIpUpdateTimeInMs)
+			return;
+		m_lastIpUpdateTimeInMs = state.lastIpUpdateTickMs;
+		m_updaterObserver->OnIpUpdateResult(state.lastIpUpdateResult);
+	}
+
+	void OnOwnerEvent(ServiceEvent *ev)
+	{
+		switch (ev->type) {
+		case ServiceEventIpChanged:
+			UpdateCurrentIp(ev->ip);
+			break;
+		case ServiceEventIpUpdate:
+			m_lastIpUpdateTimeInMs = ev->tickMs;
+			m_updaterObserver->OnIpUpdateResult(ev->text);
+			break;
+		case ServiceEventUpdateError:
+			m_updaterObserver->OnIpUpdateResult(ev->text);
+			break;
+		case ServiceEventNewVersion:
+			DownloadPublishedNewVersion();
+			break;
+		}
+	}
+
+	// runs right away when we're woken up. The lease is renewed by
+	// NetworkOwner's own thread, which wakes us up when it changes hands
+	static void OnOwnerTimer(void *ctx)
+	{
+		UpdaterThread *self = (UpdaterThread*)ctx;
+		NetworkOwner *owner = self->m_networkOwner;
+		bool isOwner = owner->Tick();
+		if (!owner->HasSharedState())
+			TimerWheelSchedule(self->m_timers, &self->m_ownerTimer, self->NowMs() + NETWORK_OWNER_REOPEN_MS, 0);
+		else if (!isOwner)
+			TimerWheelSchedule(self->m_timers, &self->m_ownerTimer, self->NowMs() + CONSUMER_CATCH_UP_MS, 0);
+		if (isOwner)
+			self->RunAsOwner();
+		else
+			self->RunAsConsumer();
+	}
+
+	// unless we're the owner, these don't do anything. The ip check
+	// isn't re-armed until we become the owner
+	static void OnIpCheckTimer(void *ctx)
+	{
+		UpdaterThread *self = (UpdaterThread*)ctx;
+		if (self->m_networkOwner->IsOwner())
+			self->CheckIp();
+	}
+
+	static void OnIpUpdateTimer(void *ctx)
+	{
+		UpdaterThread *self = (UpdaterThread*)ctx;
+		if (self->m_networkOwner->IsOwner() && CanSendIPUpdates())
+			self->SendPeriodicUpdate();
+	}
+
+	static void OnUpgradeCheckTimer(void *ctx)
+	{
+		UpdaterThread *self = (UpdaterThread*)ctx;
+		if (self->m_networkOwner->IsOwner())
+			self->CheckForSoftwareUpgrade(g_simulate_upgrade);
+	}
+
+	static void OnTypoExceptionsTimer(void * /* ctx */)
+	{
+		SubmitTypoExceptionsAsync();
+	}
+
+	void StartTimers()
 	{
-		const DWORD ONE_MINUTE_IN_MS = 1000*60;
+		ULONGLONG nowMs = NowMs();
+		TimerInit(&m_ownerTimer, OnOwnerTimer, this);
+		TimerWheelSchedule(m_timers, &m_ownerTimer, nowMs, 0);
+		TimerInit(&m_ipCheckTimer, OnIpCheckTimer, this);
+		// the ui asks for an ip update and an upgrade check when it
+		// starts, so the periodic ones can wait
+		TimerInit(&m_ipUpdateTimer, OnIpUpdateTimer, this);
+		TimerWheelSchedule(m_timers, &m_ipUpdateTimer, nowMs + IP_UPDATE_PERIOD_MS, IP_UPDATE_PERIOD_MS);
+		TimerInit(&m_upgradeCheckTimer, OnUpgradeCheckTimer, this);
+		TimerWheelSchedule(m_timers, &m_upgradeCheckTimer, nowMs + UPGRADE_CHECK_PERIOD_MS, UPGRADE_CHECK_PERIOD_MS);
+		TimerInit(&m_typoExceptionsTimer, OnTypoExceptionsTimer, this);
+		TimerWheelSchedule(m_timers, &m_typoExceptionsTimer, nowMs, TYPO_EXCEPTIONS_PERIOD_MS);
+	}
+
+	void WaitForWork()
+	{
+		HANDLE handles[4];
+		DWORD count = 0;
+		handles[count++] = m_event;
+		if (m_networkOwner->OwnerChangedEvent())
+			handles[count++] = m_networkOwner->OwnerChangedEvent();
+		if (m_networkOwner->EventPublishedEvent())
+			handles[count++] = m_networkOwner->EventPublishedEvent();
+		if (m_networkChange->ChangedEvent())
+			handles[count++] = m_networkChange->ChangedEvent();
+		DWORD waitMs = TimerWheelMsToNext(m_timers, NowMs());
+		DWORD res = WaitForMultipleObjects(count, handles, FALSE, waitMs);
+		if (WAIT_TIMEOUT != res)
+			TimerWheelSchedule(m_timers, &m_ownerTimer, NowMs(), 0);
+	}
 
+	DWORD Run()
+	{
 		m_event = CreateEvent(NULL, FALSE, FALSE, NULL);
 		if (NULL == m_event)
 			return 1;
 
+		MonotonicClockInit(&m_clock);
+		m_timers = TimerWheelNew(NowMs());
+		if (!m_timers) {
+			CloseHandle(m_event);
+			return 1;
+		}
+
+		m_networkOwner = new NetworkOwner(NetworkOwnerUI);
+		m_networkChange = NewNetworkChangeNotifier();
+		IpCheckScheduleInit(&m_ipCheckSchedule, m_networkChange->IsWorking());
+		StartTimers();
 		while (!m_stop)
 		{
-			IP4_ADDRESS myIp = GetMyIp();
-			UpdateCurrentIp(myIp);
-
-			if (ShouldSendPeriodicUpdate())
-				SendPeriodicUpdate();
-
-			if (ShouldCheckForSoftwareUpgrade())
-				CheckForSoftwareUpgrade(g_simulate_upgrade);
+			// taken even when we're not the owner so that the event
+			// doesn't stay signalled
+			if (m_networkChange->TakeChange()) {
+				IpCheckScheduleNetworkChanged(&m_ipCheckSchedule);
+				TimerWheelSchedule(m_timers, &m_ipCheckTimer, NowMs(), 0);
+			}
+			TimerWheelAdvance(m_timers, NowMs());
 
 			// int k = StackHungry();
-			WaitForSingleObject(m_event, ONE_MINUTE_IN_MS);
+			WaitForWork();
 		}
+		delete m_networkOwner;
+		m_networkOwner = NULL;
+		delete m_networkChange;
+		m_networkChange = NULL;
+		TimerWheelDelete(m_timers);
+		m_timers = NULL;
 		CloseHandle(m_event);
 		return 0;
 	}